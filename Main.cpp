@@ -5,11 +5,19 @@
 | Description: Main module in program.
 |
 | Functions:  Program_Get_User_Preferences
+|               Run_Server
 |             Program_Init
-|							 Init_Graphics
-|								Set_Mouse_Cursor
+|               Init_Graphics
+|               Set_Mouse_Cursor
 |             Program_Run
-|							 Init_Render_State
+|               Init_Render_State
+|               Run_Tool_Mode
+|               Wait_For_Event
+|               Spawn_World
+|               Build_World
+|               Get_World_Shapes
+|               Light_World
+|               Light_Trees
 |             Program_Free
 |             Program_Immediate_Key_Handler
 |
@@ -31,6 +39,31 @@
 
 #include "main.h"
 #include "position.h"
+#include "pacer.h"
+#include "dynres.h"
+#include "lightmgr.h"
+#include "collide.h"
+#include "bvh.h"
+#include "audioprop.h"
+#include "arena.h"
+#include "ecs.h"
+#include "hotload.h"
+#include "snapshot.h"
+#include "terrain.h"
+#include "renderq.h"
+#include "bench.h"
+#include "texmgr.h"
+#include "bmp.h"
+#include "atlas.h"
+#include "meshopt.h"
+#include "bake.h"
+#include "adpcm.h"
+#include "world.h"
+#include "simlod.h"
+#include "server.h"
+#include "sprite.h"
+#include "stress.h"
+#include "pipeline.h"
 
 /*___________________
 |
@@ -42,14 +75,30 @@ typedef struct {
 	unsigned bitdepth;
 } UserPreferences;
 
+// Game state saved with the entities in a snapshot
+typedef struct {
+	int        hp;
+	int        num_paper_touched;
+	gx3dVector position;
+	gx3dVector heading;
+} GameState;
+
 /*___________________
 |
 | Function Prototypes
 |__________________*/
 
+static int Run_Server();
 static int Init_Graphics(unsigned resolution, unsigned bitdepth, unsigned stencildepth, int* generate_keypress_events);
 static void Set_Mouse_Cursor();
 static void Init_Render_State();
+static int Run_Tool_Mode(int* exit_code);
+static int Wait_For_Event(evEvent* event, unsigned timeout);
+static Bvh Spawn_World(Arena level_arena, unsigned seed, gx3dObject* obj_tree, gx3dObject* obj_paper, gx3dObject* obj_slender);
+static Bvh Build_World(Arena level_arena, gx3dObject* obj_tree, gx3dObject* obj_paper, gx3dObject* obj_slender);
+static void Get_World_Shapes(gx3dObject* obj_tree, gx3dObject* obj_paper, gx3dObject* obj_slender, WorldShapes* shapes);
+static int Light_World(gx3dObject* obj_tree);
+static void Light_Trees();
 
 /*___________________
 |
@@ -57,7 +106,8 @@ static void Init_Render_State();
 |__________________*/
 
 #define MAX_VRAM_PAGES  2
-/*#define GRAPHICS_RESOLUTION  \
+// The 3D scene is rendered at a dynamic internal resolution, so every mode can be offered
+#define GRAPHICS_RESOLUTION  \
 (                          \
 gxRESOLUTION_640x480   | \
 gxRESOLUTION_800x600   | \
@@ -76,13 +126,60 @@ gxRESOLUTION_2048x1280 | \
 gxRESOLUTION_1280x720  | \
 gxRESOLUTION_1600x900  | \
 gxRESOLUTION_1920x1080   \
-)*/
-#define GRAPHICS_RESOLUTION gxRESOLUTION_640x480
+)
 #define GRAPHICS_STENCILDEPTH 0
 #define GRAPHICS_BITDEPTH (gxBITDEPTH_24 | gxBITDEPTH_32)
 
 #define SCREENSHOT_FILENAME "screenshots\\screen"
 
+// Quicksave file (F5 to save, F6 to load)
+#define SNAPSHOT_FILENAME "quicksave.snp"
+// Gameplay is captured every SNAPSHOT_INTERVAL ms, keeping SNAPSHOT_RING snapshots to rewind through (F7)
+#define SNAPSHOT_INTERVAL  1000
+#define SNAPSHOT_RING      10
+
+// Max time (ms) a static screen sleeps before polling its audio again
+#define SCREEN_IDLE_TIMEOUT 50
+// Sleep granularity (ms) while waiting for input on a static screen
+#define SCREEN_IDLE_SLEEP   10
+
+// Gameplay frame rate cap (0 = uncapped)
+#define TARGET_FRAME_RATE 60
+// Frame work time (ms) the dynamic resolution controller aims for
+#define FRAME_TIME_BUDGET (1000.0f / TARGET_FRAME_RATE * 0.9f)
+
+// Static lighting is baked over the area the world spawns in (world units, texels per side)
+#define LIGHTMAP_FILENAME    "Objects\\Images\\Lightmap"
+#define LIGHTMAP_MIN         -80.0f
+#define LIGHTMAP_SIZE        160.0f
+#define LIGHTMAP_RESOLUTION  256
+#define LIGHTMAP_AO_RADIUS   8.0f
+
+// Level arena holds the world state of a round, frame arena transient data of a frame
+#define LEVEL_ARENA_SIZE  (1024 * 1024)
+#define FRAME_ARENA_SIZE  (256 * 1024)
+
+// Most 3D draws queued in a frame
+#define MAX_DRAWS  1024
+
+// Estimated texture memory to keep loaded (the world textures and two screens)
+#define TEXTURE_BUDGET  (8 * 1024 * 1024)
+
+// Distance from the player at which the wolves howl
+#define WOLVES_DISTANCE 60.0f
+
+// Scale at which the screen billboard covers the whole screen
+#define SCREEN_QUAD_SCALE 0.085f
+
+// Page icons at the top left of the HUD, as fractions of the screen height
+#define HUD_ICON_SIZE    0.04f
+#define HUD_ICON_SPACING 0.055f
+#define HUD_ICON_MARGIN  0.03f
+
+// Frame rate readout at the bottom left, refreshed this often (ms) so its text rarely changes
+#define FRAME_RATE_GLYPH_SIZE 16.0f
+#define FRAME_RATE_INTERVAL   500
+
 #define AUTO_TRACKING    1
 #define NO_AUTO_TRACKING 0
 
@@ -103,6 +200,10 @@ int Program_Get_User_Preferences(void** preferences)
 {
 	static UserPreferences user_preferences;
 
+	// Started with -server?  Host a game before graphics mode is started and exit with its result, nonzero on failure
+	if (strstr(GetCommandLineA(), "-server"))
+		ExitProcess(Run_Server() ? 0 : 1);
+
 	if (gxGetUserFormat(GRAPHICS_DRIVER, GRAPHICS_RESOLUTION, GRAPHICS_BITDEPTH, &user_preferences.resolution, &user_preferences.bitdepth)) {
 		*preferences = (void*)&user_preferences;
 		return (1);
@@ -111,6 +212,31 @@ int Program_Get_User_Preferences(void** preferences)
 		return (0);
 }
 
+/*____________________________________________________________________
+|
+| Function: Run_Server
+|
+| Input: Called from Program_Get_User_Preferences()
+| Output: Hosts a multiplayer game in place of playing (stats go to the
+|   debug file).  The server needs only the terrain's heights, so it
+|   runs without graphics, sound or input.  Returns true if the server
+|   ran.
+|___________________________________________________________________*/
+
+static int Run_Server()
+{
+	int ok;
+
+	if (NOT Terrain_Init_Heights(TERRAIN_SIZE, TERRAIN_RESOLUTION, TERRAIN_MAX_HEIGHT, TERRAIN_SEED)) {
+		debug_WriteFile("Run_Server(): can't generate the terrain");
+		return (FALSE);
+	}
+	ok = Server_Run(GetCommandLineA());
+	Terrain_Free();
+
+	return (ok);
+}
+
 /*____________________________________________________________________
 |
 | Function: Program_Init
@@ -213,36 +339,6 @@ static void Set_Mouse_Cursor()
 	msSetCursor(msCURSOR_MEDIUM_ARROW, fc, bc);
 }
 
-/*____________________________________________________________________
-|
-| Function: Draw_Screen
-|
-| Input: Called from Program_Run()
-| Output: Displays various game screens
-|___________________________________________________________________*/
-
-gx3dObject* obj_screen;
-static void Draw_Screen(gx3dTexture screen) {
-	gx3dMatrix view_save, m, m1, m2;
-	gx3d_GetViewMatrix(&view_save);
-	gx3dVector tfrom = { 0,0,-1 }, tto = { 0,0,0 }, twup = { 0,1,0 };
-	gx3d_CameraSetPosition(&tfrom, &tto, &twup, gx3d_CAMERA_ORIENTATION_LOOKTO_FIXED);
-	gx3d_CameraSetViewMatrix();
-	gx3d_DisableZBuffer();
-	gx3d_EnableAlphaBlending();
-	gx3d_GetTranslateMatrix(&m, 0, 0, .5);
-	gx3d_GetRotateYMatrix(&m1, 0);
-	gx3d_GetScaleMatrix(&m2, 0.085f, 0.085f, 0.085f);
-	gx3d_MultiplyMatrix(&m, &m1, &m);
-	gx3d_MultiplyMatrix(&m, &m2, &m);
-	gx3d_SetObjectMatrix(obj_screen, &m);
-	gx3d_SetTexture(0, screen);
-	gx3d_DrawObject(obj_screen);
-	gx3d_DisableAlphaBlending();
-	gx3d_EnableZBuffer();
-	gx3d_SetViewMatrix(&view_save);
-}
-
 /*____________________________________________________________________
 |
 | Function: Program_Run
@@ -264,7 +360,7 @@ void Program_Run()
 	static bool running = false;
 	static bool walking = false;
 
-	gx3dObject* obj_tree, * obj_skydome, * obj_ground, * obj_paper, * obj_slender, * obj_camera;
+	gx3dObject* obj_tree, * obj_skydome, * obj_paper, * obj_slender, * obj_camera, * obj_screen;
 
 	gx3dMatrix m, m1, m2, m3, m4, m5;
 	gx3dColor color3d_white = { 1, 1, 1, 0 };
@@ -281,6 +377,8 @@ void Program_Run()
 	};
 
 	int startTime = time(NULL);
+	// Seed once, the wolves' chance is drawn every frame
+	srand((unsigned)startTime);
 
 	// // How to use C++ print outupt 
 	// string mystr;
@@ -320,19 +418,22 @@ void Program_Run()
 	snd_Init(22, 16, 2, 1, 1);
 	snd_SetListenerDistanceFactorToFeet(snd_3D_APPLY_NOW);
 
-	Sound s_forest, s_footsteps, s_running, s_paper, s_ouch, s_gameover, s_title, s_story1, s_wolves, s_survived, s_fire;
-
-	s_forest = snd_LoadSound("wav\\forest.wav", snd_CONTROL_VOLUME, 0);
-	s_footsteps = snd_LoadSound("wav\\walking.wav", snd_CONTROL_VOLUME, 0);
-	s_running = snd_LoadSound("wav\\running.wav", snd_CONTROL_VOLUME, 0);
-	s_paper = snd_LoadSound("wav\\paper.wav", snd_CONTROL_VOLUME, 0);
-	s_ouch = snd_LoadSound("wav\\ouch.wav", snd_CONTROL_VOLUME, 0);
-	s_gameover = snd_LoadSound("wav\\gameover.wav", snd_CONTROL_VOLUME, 0);
-	s_title = snd_LoadSound("wav\\title.wav", snd_CONTROL_VOLUME, 0);
-	s_story1 = snd_LoadSound("wav\\story1.wav", snd_CONTROL_VOLUME, 0);
-	s_wolves = snd_LoadSound("wav\\wolves.wav", snd_CONTROL_VOLUME, 0);
-	s_survived = snd_LoadSound("wav\\survived.wav", snd_CONTROL_VOLUME, 0);
-	s_fire = snd_LoadSound("wav\\fire.wav", snd_CONTROL_3D, 0);
+	// Each sound is streamed from its compressed .adp file if it has one
+	if (NOT Adpcm_Stream_Init())
+		debug_WriteFile("Program_Run(): can't start streaming sounds, loading them as WAV files");
+	AdpcmSource s_forest, s_footsteps, s_running, s_paper, s_ouch, s_gameover, s_title, s_story1, s_wolves, s_survived, s_fire;
+
+	s_forest = Adpcm_Open("wav\\forest.wav", snd_CONTROL_VOLUME);
+	s_footsteps = Adpcm_Open("wav\\walking.wav", snd_CONTROL_VOLUME);
+	s_running = Adpcm_Open("wav\\running.wav", snd_CONTROL_VOLUME);
+	s_paper = Adpcm_Open("wav\\paper.wav", snd_CONTROL_VOLUME);
+	s_ouch = Adpcm_Open("wav\\ouch.wav", snd_CONTROL_VOLUME);
+	s_gameover = Adpcm_Open("wav\\gameover.wav", snd_CONTROL_VOLUME);
+	s_title = Adpcm_Open("wav\\title.wav", snd_CONTROL_VOLUME);
+	s_story1 = Adpcm_Open("wav\\story1.wav", snd_CONTROL_VOLUME);
+	s_wolves = Adpcm_Open("wav\\wolves.wav", snd_CONTROL_VOLUME);
+	s_survived = Adpcm_Open("wav\\survived.wav", snd_CONTROL_VOLUME);
+	s_fire = Adpcm_Open("wav\\fire.wav", snd_CONTROL_VOLUME);
 
 	/*____________________________________________________________________
 	|
@@ -359,14 +460,10 @@ void Program_Run()
 	|___________________________________________________________________*/
 
 	gx3dVector heading, position;
-	// Set starting camera position
-	position.x = 0;
-	position.y = 5;
-	position.z = -100;
-	// Set starting camera view direction (heading)
-	heading.x = 0;  // {0,0,1} for cubic environment mapping to work correctly
-	heading.y = 0;
-	heading.z = 1;
+	// Starting camera position and view direction (heading), {0,0,1} for cubic environment mapping to work correctly
+	const gx3dVector start_position = { 0, 5, -100 }, start_heading = { 0, 0, 1 };
+	position = start_position;
+	heading = start_heading;
 
 	Position_Init(&position, &heading, RUN_SPEED);
 
@@ -381,6 +478,10 @@ void Program_Run()
 	float far_plane = 1000;
 	gx3d_SetProjectionMatrix(fov, near_plane, far_plane);
 
+	// Set up point light clustering for the same projection
+	LightMgr_Init(dinfo.max_active_lights);
+	LightMgr_Set_Projection(fov, (float)gxGetScreenWidth() / gxGetScreenHeight(), near_plane, far_plane);
+
 	gx3d_SetFillMode(gx3d_FILL_MODE_GOURAUD_SHADED);
 
 	// Clear the 3D viewport to all black
@@ -399,74 +500,143 @@ void Program_Run()
 	// Load a 3D model																								
 	gx3d_ReadLWO2File("Objects\\ptree6.lwo", &obj_tree, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
 	gx3d_ReadLWO2File("Objects\\skydome.lwo", &obj_skydome, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
-	gx3d_ReadLWO2File("Objects\\ground.lwo", &obj_ground, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
 	gx3d_ReadLWO2File("Objects\\billboard_paper.lwo", &obj_paper, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
 	gx3d_ReadLWO2File("Objects\\billboard_slender.lwo", &obj_slender, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
 	gx3d_ReadLWO2File("Objects\\billboard_screen.lwo", &obj_screen, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
 
-	gx3dTexture tex_title_screen = gx3d_InitTexture_File("Objects\\Images\\Title.bmp", 0, 0);
-	gx3dTexture tex_pause_screen = gx3d_InitTexture_File("Objects\\Images\\Pause.bmp", 0, 0);
-	gx3dTexture tex_survive_screen = gx3d_InitTexture_File("Objects\\Images\\Won.bmp", 0, 0);
-	gx3dTexture tex_gameover_screen = gx3d_InitTexture_File("Objects\\Images\\GameOver.bmp", 0, 0);
-	gx3dTexture tex_firstpage_screen = gx3d_InitTexture_File("Objects\\Images\\Page1.bmp", 0, 0);
-	gx3dTexture tex_story1_screen = gx3d_InitTexture_File("Objects\\Images\\story1.bmp", 0, 0);
-	gx3dTexture tex_story2_screen = gx3d_InitTexture_File("Objects\\Images\\story2.bmp", 0, 0);
-	gx3dTexture tex_tree = gx3d_InitTexture_File("Objects\\Images\\ptree_d512.bmp", "Objects\\Images\\ptree_d512_fa.bmp", 0);
-	gx3dTexture tex_skydome = gx3d_InitTexture_File("Objects\\Images\\Night.bmp", 0, 0);
-	gx3dTexture tex_ground = gx3d_InitTexture_File("Objects\\Images\\Ground.bmp", 0, 0);
-	gx3dTexture tex_paper = gx3d_InitTexture_File("Objects\\Images\\Paper.bmp", "Objects\\Images\\Paper_FA.bmp", 0);
-	gx3dTexture tex_slender = gx3d_InitTexture_File("Objects\\Images\\Slender.bmp", "Objects\\Images\\Slender_FA.bmp", 0);
+	// Reorder their triangles for the vertex cache and overdraw
+	MeshOpt_Optimize_Object(obj_tree);
+	MeshOpt_Optimize_Object(obj_skydome);
+	MeshOpt_Optimize_Object(obj_paper);
+	MeshOpt_Optimize_Object(obj_slender);
+	MeshOpt_Optimize_Object(obj_screen);
+
+	if (NOT DynRes_Init(FRAME_TIME_BUDGET, SCREEN_QUAD_SCALE, obj_screen))
+		debug_WriteFile("Dynamic resolution unavailable, rendering at native resolution");
+	if (NOT Sprite_Init(obj_screen, SCREEN_QUAD_SCALE))
+		debug_WriteFile("Sprites unavailable, no HUD or screens");
+
+	// Generate the ground
+	Terrain_Set_Lightmap_Area(LIGHTMAP_MIN, LIGHTMAP_MIN, LIGHTMAP_SIZE);
+	if (NOT Terrain_Init(TERRAIN_SIZE, TERRAIN_RESOLUTION, TERRAIN_MAX_HEIGHT, TERRAIN_SEED))
+		debug_WriteFile("Terrain unavailable");
+
+	// Textures are loaded on demand within the budget, the trees fall back to a low resolution mip
+	if (NOT TexMgr_Init(TEXTURE_BUDGET))
+		debug_WriteFile("Texture streaming unavailable, reading textures on the main thread");
+	TexId tex_title_screen = TexMgr_Add("Objects\\Images\\Title.bmp", 0, 0, 0);
+	TexId tex_pause_screen = TexMgr_Add("Objects\\Images\\Pause.bmp", 0, 0, 0);
+	TexId tex_survive_screen = TexMgr_Add("Objects\\Images\\Won.bmp", 0, 0, 0);
+	TexId tex_gameover_screen = TexMgr_Add("Objects\\Images\\GameOver.bmp", 0, 0, 0);
+	TexId tex_firstpage_screen = TexMgr_Add("Objects\\Images\\Page1.bmp", 0, 0, 0);
+	TexId tex_story1_screen = TexMgr_Add("Objects\\Images\\story1.bmp", 0, 0, 0);
+	TexId tex_story2_screen = TexMgr_Add("Objects\\Images\\story2.bmp", 0, 0, 0);
+	TexId tex_tree = TexMgr_Add("Objects\\Images\\ptree_d512.bmp", "Objects\\Images\\ptree_d512_fa.bmp", "Objects\\Images\\ptree_d32.bmp", "Objects\\Images\\ptree_d32_fa.bmp");
+	TexId tex_skydome = TexMgr_Add("Objects\\Images\\Night.bmp", 0, 0, 0);
+	TexId tex_ground = TexMgr_Add("Objects\\Images\\Ground.bmp", 0, 0, 0);
+
+	// Pack the billboard and HUD images into one texture, else fall back to a texture each
+	Atlas_Init("Objects\\Images\\Atlas");
+	AtlasId atlas_paper = Atlas_Add("Objects\\Images\\Paper.bmp", "Objects\\Images\\Paper_FA.bmp");
+	AtlasId atlas_slender = Atlas_Add("Objects\\Images\\Slender.bmp", "Objects\\Images\\Slender_FA.bmp");
+	int glyphs_written = Sprite_Write_Glyphs("Objects\\Images\\Glyphs.bmp", "Objects\\Images\\Glyphs_FA.bmp");
+	AtlasId atlas_glyphs = glyphs_written ? Atlas_Add("Objects\\Images\\Glyphs.bmp", "Objects\\Images\\Glyphs_FA.bmp") : ATLAS_INVALID;
+	int atlas_built = Atlas_Build();
+	TexId tex_paper, tex_slender;
+	AtlasRect paper_rect, glyph_rect;
+	if (atlas_built) {
+		Atlas_Map_Object(atlas_paper, obj_paper);
+		Atlas_Map_Object(atlas_slender, obj_slender);
+		tex_paper = Atlas_Get_Texture(atlas_paper);
+		tex_slender = Atlas_Get_Texture(atlas_slender);
+		if (glyphs_written) {
+			Atlas_Get_Rect(atlas_glyphs, &glyph_rect);
+			Sprite_Set_Glyphs(Atlas_Get_Texture(atlas_glyphs), &glyph_rect);
+		}
+	}
+	else {
+		debug_WriteFile("Atlas unavailable, using a texture per billboard");
+		tex_paper = TexMgr_Add("Objects\\Images\\Paper.bmp", "Objects\\Images\\Paper_FA.bmp", 0, 0);
+		tex_slender = TexMgr_Add("Objects\\Images\\Slender.bmp", "Objects\\Images\\Slender_FA.bmp", 0, 0);
+		if (glyphs_written)
+			Sprite_Set_Glyphs(TexMgr_Add("Objects\\Images\\Glyphs.bmp", "Objects\\Images\\Glyphs_FA.bmp", 0, 0), NULL);
+	}
+
+	// Reload assets when their files change (not obj_screen, dynamic resolution keeps its pointer)
+	if (NOT HotLoad_Init())
+		debug_WriteFile("Asset hot reload unavailable");
+	HotLoad_Watch_Particles(&psys_fire, "fire.gxps");
+	HotLoad_Watch_Object(&obj_tree, "Objects\\ptree6.lwo");
+	HotLoad_Watch_Object(&obj_skydome, "Objects\\skydome.lwo");
+	HotLoad_Watch_Atlas_Object(&obj_paper, "Objects\\billboard_paper.lwo", atlas_built ? atlas_paper : ATLAS_INVALID);
+	HotLoad_Watch_Atlas_Object(&obj_slender, "Objects\\billboard_slender.lwo", atlas_built ? atlas_slender : ATLAS_INVALID);
+	HotLoad_Watch_Managed_Texture(tex_title_screen, "Objects\\Images\\Title.bmp", 0);
+	HotLoad_Watch_Managed_Texture(tex_pause_screen, "Objects\\Images\\Pause.bmp", 0);
+	HotLoad_Watch_Managed_Texture(tex_survive_screen, "Objects\\Images\\Won.bmp", 0);
+	HotLoad_Watch_Managed_Texture(tex_gameover_screen, "Objects\\Images\\GameOver.bmp", 0);
+	HotLoad_Watch_Managed_Texture(tex_firstpage_screen, "Objects\\Images\\Page1.bmp", 0);
+	HotLoad_Watch_Managed_Texture(tex_story1_screen, "Objects\\Images\\story1.bmp", 0);
+	HotLoad_Watch_Managed_Texture(tex_story2_screen, "Objects\\Images\\story2.bmp", 0);
+	HotLoad_Watch_Managed_Texture(tex_tree, "Objects\\Images\\ptree_d512.bmp", "Objects\\Images\\ptree_d512_fa.bmp");
+	HotLoad_Watch_Managed_Texture(tex_skydome, "Objects\\Images\\Night.bmp", 0);
+	HotLoad_Watch_Managed_Texture(tex_ground, "Objects\\Images\\Ground.bmp", 0);
+	if (atlas_built) {
+		HotLoad_Watch_Atlas("Objects\\Images\\Paper.bmp", "Objects\\Images\\Paper_FA.bmp");
+		HotLoad_Watch_Atlas("Objects\\Images\\Slender.bmp", "Objects\\Images\\Slender_FA.bmp");
+	}
+	else {
+		HotLoad_Watch_Managed_Texture(tex_paper, "Objects\\Images\\Paper.bmp", "Objects\\Images\\Paper_FA.bmp");
+		HotLoad_Watch_Managed_Texture(tex_slender, "Objects\\Images\\Slender.bmp", "Objects\\Images\\Slender_FA.bmp");
+	}
 
 	bool screen_change = true, screen_title = true, screen_story1 = true, screen_story2 = false, screen_survive = false, screen_gameover = false, screen_firstpage = false;
-	const int NUM_TREES = 100, NUM_PAPER = 8, Slender = 1;
 	int hp = 3, num_paper_touched = 0, take_screenshot;
-	gx3dVector treePosition[NUM_TREES], paperPosition[NUM_PAPER], SlenderPosition[Slender];
-	gx3dSphere paperSphere[NUM_PAPER], treeSphere[NUM_TREES], cameraSphere;
-	gxRelation relation;
-	boolean paperOnScreen[NUM_PAPER], paperDraw[NUM_PAPER];
-
-	srand(time(0));
-	for (int i = 0; i < Slender; i++)
-	{
-		SlenderPosition[i].x = (rand() % 151) - 75;
-		SlenderPosition[i].y = 0;
-		SlenderPosition[i].z = (rand() % 151) - 75;
-		if (SlenderPosition[i].x == 0)
-			SlenderPosition[i].x += 2;
-		else if (SlenderPosition[i].z == 0)
-			SlenderPosition[i].z += 2;
-	}
-	srand(time(0));
-	for (int i = 0; i < NUM_PAPER; i++)
-	{
-		paperPosition[i].x = (rand() % 151) - 75;
-		paperPosition[i].y = 1;
-		paperPosition[i].z = (rand() % 151) - 75;
-
-		if (paperPosition[i].x == 0 || paperPosition[i].x == SlenderPosition[i].x)
-			paperPosition[i].x += 2;
-		else if (paperPosition[i].z == 0 || paperPosition[i].z == SlenderPosition[i].z)
-			paperPosition[i].z += 2;
-
-		paperDraw[i] = true;
+
+	// Started with -bench, -meshopt, -adpcm or -stress?  Run it instead of the game and exit with its result, nonzero on failure
+	int exit_code;
+	if (Run_Tool_Mode(&exit_code)) {
+		HotLoad_Free();
+		Atlas_Free();
+		Sprite_Free();
+		Terrain_Free();
+		TexMgr_Free();
+		DynRes_Free();
+		LightMgr_Free();
+		gx3d_FreeParticleSystem(psys_fire);
+		gx3d_FreeAllObjects();
+		gx3d_FreeAllTextures();
+		Adpcm_Stream_Free();
+		snd_Free();
+		Program_Free();
+		ExitProcess(exit_code);
 	}
-	srand(time(0));
-	for (int i = 0; i < NUM_TREES; i++) {
-
-		treePosition[i].x = (rand() % 151) - 75;
-		treePosition[i].y = 0;
-		treePosition[i].z = (rand() % 151) - 75;
-		if (treePosition[i].x == 0 || treePosition[i].x == paperPosition[i].x || treePosition[i].x == SlenderPosition[i].x)
-			treePosition[i].x += 2;
-		else if (treePosition[i].z == 0 || treePosition[i].z == paperPosition[i].z || treePosition[i].z == SlenderPosition[i].z)
-			treePosition[i].z += 2;
-
-		treeSphere[i] = obj_tree->bound_sphere;
-		treeSphere[i].center.x = treePosition[i].x;
-		treeSphere[i].center.y = treePosition[i].y;
-		treeSphere[i].center.z = treePosition[i].z;
-		treeSphere[i].radius *= 6.0f;  // adjust as needed
+
+	// Generate the world
+	Arena level_arena = Arena_Create(LEVEL_ARENA_SIZE);
+	Arena frame_arena = Arena_Create(FRAME_ARENA_SIZE);
+	Bvh scene_bvh = Spawn_World(level_arena, (unsigned)time(0), obj_tree, obj_paper, obj_slender);
+
+	// Occlude the fire and the wolves by the tree trunks
+	AudioProp_Init();
+	AudioProp_Set_Occluders(scene_bvh, BVH_MASK(ENTITY_TREE));
+	gx3dVector fire_position = { 0, 0, 0 }, wolves_position = { WOLVES_DISTANCE, 0, 0 };
+	AudioProp_Add_Emitter(s_fire, &fire_position, 100, FALSE, 10, 100);
+	AudioEmitter wolves_emitter = AudioProp_Add_Emitter(s_wolves, &wolves_position, 75, FALSE, 10, WOLVES_DISTANCE * 2);
+
+	RenderQ_Init();
+
+	// Simulate each frame while the last one is drawn, unless started with -serial
+	quit = FALSE;
+	if (NOT Pipeline_Init(strstr(GetCommandLineA(), "-serial") == NULL, MAX_DRAWS)) {
+		debug_WriteFile("Program_Run(): can't allocate the frame pipeline, quitting");
+		quit = TRUE;
 	}
+	Pipeline_Set_Projection(fov, (float)gxGetScreenWidth() / gxGetScreenHeight(), near_plane, far_plane);
+
+	// Keep recent gameplay for rewinding, in buffers sized for this world
+	if (NOT Snapshot_Init(SNAPSHOT_RING, sizeof(GameState)))
+		debug_WriteFile("Program_Run(): can't allocate the snapshot ring, rewinding is off");
+	unsigned snapshot_time = 0, gameplay_frames = 0;
 
 	/*____________________________________________________________________
 	|
@@ -474,8 +644,8 @@ void Program_Run()
 	|___________________________________________________________________*/
 
 	gx3dLight dir_light;
-	gx3dLight lantern_light;
-	gx3dLight fire_light;
+	LightId lantern_light;
+	LightId fire_light;
 	//gx3dLight light_flashlight;
 	gx3dLightData light_data;
 	gx3dLightData light_data2;
@@ -518,7 +688,7 @@ void Program_Run()
 	light_data.point.src.x = 0;
 	light_data.point.src.y = 0;
 	light_data.point.src.z = 0;
-	fire_light = gx3d_InitLight(&light_data);
+	fire_light = LightMgr_Add_Point_Light(&light_data);
 
 	light_data2.light_type = gx3d_LIGHT_TYPE_POINT;
 	light_data2.point.diffuse_color.r = 1;
@@ -540,7 +710,25 @@ void Program_Run()
 	light_data2.point.src.x = position.x;
 	light_data2.point.src.y = position.y + CHARACTER_HEIGHT - 1.5; // lantern held next to chest
 	light_data2.point.src.z = position.z;
-	lantern_light = gx3d_InitLight(&light_data2);
+	lantern_light = LightMgr_Add_Point_Light(&light_data2);
+	LightMgr_Enable_Light(lantern_light, FALSE);
+
+	// Bake the fire into the ground and trees, leaving the lantern lit at run time (the directional light is a debug toggle)
+	bool can_bake = false, baking = false;
+	BakeSettings bake_settings = { LIGHTMAP_MIN, LIGHTMAP_MIN, LIGHTMAP_SIZE, LIGHTMAP_RESOLUTION, color3d_dim, LIGHTMAP_AO_RADIUS, 0 };
+	if (Bake_Init(LIGHTMAP_FILENAME, &bake_settings)) {
+		// The fire sits at ground level, bake it from just above the ground so the ground doesn't shadow it
+		gx3dLightData fire_bake = light_data;
+		float ground = Terrain_Get_Height(fire_bake.point.src.x, fire_bake.point.src.z);
+		if (fire_bake.point.src.y < ground + 0.5f)
+			fire_bake.point.src.y = ground + 0.5f;
+		Bake_Add_Point_Light(&fire_bake);
+		LightMgr_Set_Baked(fire_light, TRUE);
+		can_bake = true;
+		baking = Light_World(obj_tree);
+	}
+	else
+		debug_WriteFile("Light baking unavailable, lighting everything at run time");
 
 	//flashlight - needs work...
 	/*gx3dVector direction, normalized_direction;
@@ -596,35 +784,45 @@ void Program_Run()
 	|___________________________________________________________________*/
 
 	// Variables
-	unsigned elapsed_time, last_time, new_time;
+	unsigned elapsed_time;
 	bool force_update;
 	unsigned cmd_move;
 
 	// Init loop variables
 	cmd_move = 0;
-	last_time = 0;
 	force_update = false;
 
+	Pacer_Init(TARGET_FRAME_RATE);
+
+	TexId presented_screen = TEXMGR_INVALID;	// static screen currently on the visual page
+
 	lantern_light_on = 0, dir_light_on = 0;
 	bool draw_wireframe = false, fastMovement = false;
 
-	snd_SetSoundVolume(s_forest, 90);
-	snd_SetSoundVolume(s_ouch, 90);
-	snd_SetSoundVolume(s_footsteps, 90);
-	snd_SetSoundVolume(s_running, 90);
-	snd_SetSoundVolume(s_gameover, 75);
-	snd_SetSoundVolume(s_paper, 75);
-	snd_SetSoundVolume(s_wolves, 75);
-	snd_SetSoundVolume(s_survived, 90);
-	snd_SetSoundVolume(s_fire, 100);
-	snd_SetSoundMode(s_fire, snd_3D_MODE_ORIGIN_RELATIVE, snd_3D_APPLY_NOW);
-	snd_SetSoundPosition(s_fire, 0, 0, 0, snd_3D_APPLY_NOW);
-	snd_SetSoundMinDistance(s_fire, 10, snd_3D_APPLY_NOW);
-	snd_SetSoundMaxDistance(s_fire, 100, snd_3D_APPLY_NOW);
-	snd_PlaySound(s_title, 1);
+	int show_frame_rate = 0;
+	unsigned frame_rate_frames = 0, frame_rate_time = 0;
+	char frame_rate_text[64] = "";
+
+	Adpcm_Set_Volume(s_forest, 90);
+	Adpcm_Set_Volume(s_ouch, 90);
+	Adpcm_Set_Volume(s_footsteps, 90);
+	Adpcm_Set_Volume(s_running, 90);
+	Adpcm_Set_Volume(s_gameover, 75);
+	Adpcm_Set_Volume(s_paper, 75);
+	Adpcm_Set_Volume(s_wolves, 75);
+	Adpcm_Set_Volume(s_survived, 90);
+	Adpcm_Set_Volume(s_fire, 100);
+	Adpcm_Play(s_title, 1);
+
+	// The fire is updated less often the further away it is
+	SimLodClock effects_clock;
+	SimLod fire_lod;
+	SimLod_Init(&effects_clock);
+	SimLod_Add(&effects_clock, &fire_lod);
+	unsigned lod_elapsed_time;
 
 	// Game loop
-	for (quit = FALSE; NOT quit; ) {
+	while (NOT quit) {
 
 		take_screenshot = FALSE;
 
@@ -633,194 +831,236 @@ void Program_Run()
 		| Update clock
 		|___________________________________________________________________*/
 
-		// Get the current time (# milliseconds since the program started)
-		new_time = timeGetTime();
-		// Compute the elapsed time (in milliseconds) since the last time through this loop
-		if (last_time == 0)
-			elapsed_time = 0;
-		else
-			elapsed_time = new_time - last_time;
-		last_time = new_time;
+		// Wait until the next frame is due and get the elapsed time (in milliseconds) to simulate
+		elapsed_time = Pacer_Begin_Frame();
+
+		// Swap in assets whose files have changed
+		HotLoad_Update();
+		// Create the textures that have been read and evict any over budget
+		TexMgr_Update();
 
 		if (screen_change) {
 
-			gx3d_ClearViewport(gx3d_CLEAR_SURFACE | gx3d_CLEAR_ZBUFFER, color, gx3d_MAX_ZBUFFER_VALUE, 0);
-			// Start rendering in 3D           
-			if (gx3d_BeginRender()) {
-				// Set the default material
-				gx3d_SetMaterial(&material_default);
+			/*____________________________________________________________________
+			|
+			| Select the static screen to show
+			|___________________________________________________________________*/
 
-				// Set  amount of ambient light
-				gx3d_SetAmbientLight(color3d_white);
+			TexId screen;
+			if (screen_title)
+				screen = tex_title_screen;
+			else if (screen_story2)
+				screen = tex_story2_screen;
+			else if (screen_survive)
+				screen = tex_survive_screen;
+			else if (screen_gameover)
+				screen = tex_gameover_screen;
+			else if (screen_firstpage)
+				screen = tex_firstpage_screen;
+			else if (screen_story1)
+				screen = tex_story1_screen;
+			else
+				screen = tex_pause_screen;
+
+			// Load the world textures in the background while on a screen
+			TexMgr_Prefetch(tex_tree);
+			TexMgr_Prefetch(tex_skydome);
+			TexMgr_Prefetch(tex_ground);
+			TexMgr_Prefetch(tex_paper);
+			TexMgr_Prefetch(tex_slender);
+
+			// Only render and flip when the screen being shown has changed, keeping the old one up until the new one has loaded
+			TexMgr_Prefetch(screen);
+			if (screen != presented_screen && TexMgr_Is_Resident(screen)) {
+				gx3d_ClearViewport(gx3d_CLEAR_SURFACE | gx3d_CLEAR_ZBUFFER, color, gx3d_MAX_ZBUFFER_VALUE, 0);
+				// Start rendering in 3D           
+				if (gx3d_BeginRender()) {
+					// Set the default material
+					gx3d_SetMaterial(&material_default);
+
+					// Set  amount of ambient light
+					gx3d_SetAmbientLight(color3d_white);
+
+					Sprite_Add(screen, NULL, 0, 0, (float)gxGetScreenWidth(), (float)gxGetScreenHeight());
+					Sprite_Flush();
+
+					// Stop rendering
+					gx3d_EndRender();
+
+					// Page flip (so user can see it)
+					gxFlipVisualActivePages(FALSE);
+
+					presented_screen = screen;
+				}
+			}
 
-				if (screen_title) {
+			/*____________________________________________________________________
+			|
+			| Update screen audio
+			|___________________________________________________________________*/
 
-					Draw_Screen(tex_title_screen);
+			if (screen_title) {
+				// Title music is already looping
+			}
+			else if (screen_story2) {
+
+				cmd_move = 0;
+
+				if (!Adpcm_Is_Playing(s_survived))
+					Adpcm_Play(s_survived, 0);
+				else if (Adpcm_Is_Playing(s_forest))
+					Adpcm_Stop(s_forest);
+				else if (Adpcm_Is_Playing(s_fire))
+					Adpcm_Stop(s_fire);
+				else if (Adpcm_Is_Playing(s_footsteps))
+					Adpcm_Stop(s_footsteps);
+				else if (Adpcm_Is_Playing(s_running))
+					Adpcm_Stop(s_running);
+				else if (Adpcm_Is_Playing(s_wolves))
+					Adpcm_Stop(s_wolves);
+				else if (Adpcm_Is_Playing(s_paper))
+					Adpcm_Stop(s_paper);
+			}
+			else if (screen_survive) {
+				// You Survived!
 
-					if (evGetEvent(&event)) {
-						if (event.type == evTYPE_RAW_KEY_PRESS) {
-							if (event.keycode == evKY_ESC)
-								quit = TRUE;
-							else if (event.keycode == evKY_ENTER) {
-								screen_title = false;
-								screen_change = true;
-							}
-						}
-					}
-				}
-				else if (screen_story2) {
-
-					cmd_move = 0;
-
-					if (!snd_IsPlaying(s_survived))
-						snd_PlaySound(s_survived, 0);
-					else if (snd_IsPlaying(s_forest))
-						snd_StopSound(s_forest);
-					else if (snd_IsPlaying(s_fire))
-						snd_StopSound(s_fire);
-					else if (snd_IsPlaying(s_footsteps))
-						snd_StopSound(s_footsteps);
-					else if (snd_IsPlaying(s_running))
-						snd_StopSound(s_running);
-					else if (snd_IsPlaying(s_wolves))
-						snd_StopSound(s_wolves);
-					else if (snd_IsPlaying(s_paper))
-						snd_StopSound(s_paper);
-
-					Draw_Screen(tex_story2_screen);
-
-					if (evGetEvent(&event)) {
-						if (event.type == evTYPE_RAW_KEY_PRESS) {
-							if (event.keycode == evKY_ESC)
-								quit = TRUE;
-							else if (event.keycode == evKY_ENTER) {
-								screen_story2 = false;
-								screen_survive = true;
-							}
-						}
-					}
-				}
-				else if (screen_survive) {
-					// You Survived!
+				cmd_move = 0;
+			}
+			else if (screen_gameover) {
+				// Game Over!
+
+				cmd_move = 0;
+
+				if (!Adpcm_Is_Playing(s_gameover))
+					Adpcm_Play(s_gameover, 0);
+				else if (Adpcm_Is_Playing(s_forest))
+					Adpcm_Stop(s_forest);
+				else if (Adpcm_Is_Playing(s_fire))
+					Adpcm_Stop(s_fire);
+				else if (Adpcm_Is_Playing(s_footsteps))
+					Adpcm_Stop(s_footsteps);
+				else if (Adpcm_Is_Playing(s_running))
+					Adpcm_Stop(s_running);
+				else if (Adpcm_Is_Playing(s_wolves))
+					Adpcm_Stop(s_wolves);
+			}
+			else if (screen_firstpage) {
+
+				cmd_move = 0;
+
+				if (Adpcm_Is_Playing(s_forest))
+					Adpcm_Stop(s_forest);
+				else if (Adpcm_Is_Playing(s_fire))
+					Adpcm_Stop(s_fire);
+				else if (Adpcm_Is_Playing(s_footsteps))
+					Adpcm_Stop(s_footsteps);
+				else if (Adpcm_Is_Playing(s_running))
+					Adpcm_Stop(s_running);
+				else if (Adpcm_Is_Playing(s_wolves))
+					Adpcm_Stop(s_wolves);
+			}
+			else if (screen_story1) {
 
-					cmd_move = 0;
+				if (Adpcm_Is_Playing(s_title))
+					Adpcm_Stop(s_title);
+				else if (!Adpcm_Is_Playing(s_story1))
+					Adpcm_Play(s_story1, 1);
+			}
+			else {
+
+				cmd_move = 0;
 
-					Draw_Screen(tex_survive_screen);
+				if (Adpcm_Is_Playing(s_story1))
+					Adpcm_Stop(s_story1);
+			}
+
+			/*____________________________________________________________________
+			|
+			| Sleep until input arrives or it is time to poll audio again
+			|___________________________________________________________________*/
 
-					if (evGetEvent(&event)) {
-						if (event.type == evTYPE_RAW_KEY_PRESS) {
-							if (event.keycode == evKY_ESC)
-								quit = TRUE;
+			if (Wait_For_Event(&event, SCREEN_IDLE_TIMEOUT)) {
+				if (event.type == evTYPE_RAW_KEY_PRESS) {
+					if (event.keycode == evKY_ESC)
+						quit = TRUE;
+					else if (event.keycode == evKY_ENTER) {
+						if (screen_title) {
+							screen_title = false;
+							screen_change = true;
 						}
-					}
-				}
-				else if (screen_gameover) {
-					// Game Over!
-
-					cmd_move = 0;
-
-					Draw_Screen(tex_gameover_screen);
-
-					if (!snd_IsPlaying(s_gameover))
-						snd_PlaySound(s_gameover, 0);
-					else if (snd_IsPlaying(s_forest))
-						snd_StopSound(s_forest);
-					else if (snd_IsPlaying(s_fire))
-						snd_StopSound(s_fire);
-					else if (snd_IsPlaying(s_footsteps))
-						snd_StopSound(s_footsteps);
-					else if (snd_IsPlaying(s_running))
-						snd_StopSound(s_running);
-					else if (snd_IsPlaying(s_wolves))
-						snd_StopSound(s_wolves);
-
-					if (evGetEvent(&event)) {
-						if (event.type == evTYPE_RAW_KEY_PRESS) {
-							if (event.keycode == evKY_ESC)
-								quit = TRUE;
+						else if (screen_story2) {
+							screen_story2 = false;
+							screen_survive = true;
 						}
-					}
-				}
-				else if (screen_firstpage) {
-
-					cmd_move = 0;
-
-					if (snd_IsPlaying(s_forest))
-						snd_StopSound(s_forest);
-					else if (snd_IsPlaying(s_fire))
-						snd_StopSound(s_fire);
-					else if (snd_IsPlaying(s_footsteps))
-						snd_StopSound(s_footsteps);
-					else if (snd_IsPlaying(s_running))
-						snd_StopSound(s_running);
-					else if (snd_IsPlaying(s_wolves))
-						snd_StopSound(s_wolves);
-
-					// Show page screen
-					Draw_Screen(tex_firstpage_screen);
-
-					if (evGetEvent(&event)) {
-						if (event.type == evTYPE_RAW_KEY_PRESS) {
-							if (event.keycode == evKY_ESC)
-								quit = TRUE;
-							else if (event.keycode == evKY_ENTER) {
-								screen_firstpage = false;
-								screen_change = false;
-							}
+						else if (screen_survive || screen_gameover) {
+							// Start a new round, keeping the loaded assets
+							Bvh_Free(scene_bvh);
+							scene_bvh = Spawn_World(level_arena, (unsigned)time(0), obj_tree, obj_paper, obj_slender);
+							Pipeline_Reset();
+							// Nothing to rewind to from the last round, and the new world may need more room
+							Snapshot_Clear();
+							Snapshot_Reserve(sizeof(GameState));
+							snapshot_time = 0;
+							gameplay_frames = 0;
+							AudioProp_Set_Occluders(scene_bvh, BVH_MASK(ENTITY_TREE));
+							if (can_bake)
+								baking = Light_World(obj_tree);
+							hp = 3;
+							num_paper_touched = 0;
+							position = start_position;
+							heading = start_heading;
+							Position_Init(&position, &heading, RUN_SPEED);
+							fastMovement = false;
+							if (Adpcm_Is_Playing(s_gameover))
+								Adpcm_Stop(s_gameover);
+							if (Adpcm_Is_Playing(s_survived))
+								Adpcm_Stop(s_survived);
+							screen_survive = false;
+							screen_gameover = false;
+							screen_change = false;
 						}
-					}
-				}
-				else if (screen_story1) {
-					// Show page screen
-					Draw_Screen(tex_story1_screen);
-
-					if (snd_IsPlaying(s_title))
-						snd_StopSound(s_title);
-					else if (!snd_IsPlaying(s_story1))
-						snd_PlaySound(s_story1, 1);
-
-					if (evGetEvent(&event)) {
-						if (event.type == evTYPE_RAW_KEY_PRESS) {
-							if (event.keycode == evKY_ESC)
-								quit = TRUE;
-							else if (event.keycode == evKY_ENTER) {
-								screen_story1 = false;
-								screen_change = true;
-							}
+						else if (screen_firstpage) {
+							screen_firstpage = false;
+							screen_change = false;
+						}
+						else if (screen_story1) {
+							screen_story1 = false;
+							screen_change = true;
 						}
+						else
+							screen_change = false;
 					}
 				}
-				else {
+			}
 
-					cmd_move = 0;
+			// Don't let time spent on a screen count as gameplay time
+			Pacer_Reset();
+		}
+		else {
 
-					// Pause/Help Screen
-					Draw_Screen(tex_pause_screen);
+			// Force the next static screen to be presented
+			presented_screen = TEXMGR_INVALID;
 
-					if (snd_IsPlaying(s_story1))
-						snd_StopSound(s_story1);
+			// Adjust the internal resolution to the cost of the last frame
+			if (elapsed_time)
+				DynRes_Update(Pacer_Get_Work_Time());
 
-					// Enter to continue
-					if (evGetEvent(&event)) {
-						if (event.type == evTYPE_RAW_KEY_PRESS) {
-							if (event.keycode == evKY_ESC)
-								quit = TRUE;
-							else if (event.keycode == evKY_ENTER)
-							{
-								screen_change = false;
-							}
-						}
-					}
-				}
-
-				// Stop rendering
-				gx3d_EndRender();
+			// Light the trees once the round's bake, traced in the background, is done
+			if (baking && NOT Bake_Is_Running()) {
+				baking = false;
+				if (NOT Bake_Finish())
+					debug_WriteFile("Program_Run(): bake failed, lighting everything at run time");
+				Light_Trees();
+			}
 
-				// Page flip (so user can see it)
-				gxFlipVisualActivePages(FALSE);
+			// Capture the world for rewinding
+			gameplay_frames++;
+			snapshot_time += elapsed_time;
+			if (snapshot_time >= SNAPSHOT_INTERVAL) {
+				GameState state = { hp, num_paper_touched, position, heading };
+				Snapshot_Capture(&state, sizeof(state), gameplay_frames);
+				snapshot_time = 0;
 			}
-		}
-		else {
 
 			/*____________________________________________________________________
 			|
@@ -852,10 +1092,46 @@ void Program_Run()
 					}
 					else if (event.keycode == evKY_F1)
 						take_screenshot = TRUE;
+					else if (event.keycode == evKY_F2)
+						show_frame_rate ^= 1;
 					else if (event.keycode == evKY_F3)
 						lantern_light_on ^= 1;
 					else if (event.keycode == evKY_F4)
 						dir_light_on ^= 1;
+					else if (event.keycode == evKY_F5) {
+						GameState state = { hp, num_paper_touched, position, heading };
+						Snapshot_Save(SNAPSHOT_FILENAME, &state, sizeof(state));
+					}
+					else if (event.keycode == evKY_F6 || event.keycode == evKY_F7) {
+						// Quickload, or step back to the last snapshot in the ring
+						GameState* state;
+						unsigned state_size, frame;
+						int restored;
+						if (event.keycode == evKY_F6)
+							restored = Snapshot_Load(SNAPSHOT_FILENAME, (void**)&state, &state_size);
+						else
+							restored = Snapshot_Rewind(1, (void**)&state, &state_size, &frame);
+						if (restored) {
+							// The entities now live in the snapshot, rebuild what is derived from them
+							Bvh_Free(scene_bvh);
+							scene_bvh = Build_World(level_arena, obj_tree, obj_paper, obj_slender);
+							Pipeline_Reset();
+							AudioProp_Set_Occluders(scene_bvh, BVH_MASK(ENTITY_TREE));
+							// The trees' baked light came back with them, unless it was captured before the bake finished
+							if (event.keycode == evKY_F7 && NOT baking)
+								Light_Trees();
+							// A save from a bigger world needs more room to capture
+							Snapshot_Reserve(sizeof(GameState));
+							if (state_size == sizeof(GameState)) {
+								hp = state->hp;
+								num_paper_touched = state->num_paper_touched;
+								position = state->position;
+								heading = state->heading;
+								Position_Init(&position, &heading, fastMovement ? RUN_SPEED * 2.5f : RUN_SPEED);
+							}
+							snapshot_time = 0;
+						}
+					}
 					else if (event.keycode == evKY_SHIFT) {
 						Position_Set_Speed(RUN_SPEED * (float)2.5);
 						fastMovement = true;
@@ -882,52 +1158,38 @@ void Program_Run()
 				else if (event.type == evTYPE_MOUSE_LEFT_PRESS) {
 					// Play sound effect for the press
 					// ADD CODE HERE
-					// Perform a ray test on all visible targets
-					gx3dRay viewVector;
-					viewVector.origin = position;
-					viewVector.direction = heading;
-					bool paper_hit = false;
-					int i;
-					for (i = 0; i < NUM_PAPER && !paper_hit; i++) {
-						if (paperOnScreen[i]) {
-							gxRelation rel = gx3d_Relation_Ray_Sphere(&viewVector, 2.5, &paperSphere[i]);
-							if (rel != gxRELATION_OUTSIDE) {
-
-								if (!snd_IsPlaying(s_paper))
-									snd_PlaySound(s_paper, 0);
-
-								// Remove this paper from the game
-								paperDraw[i] = false;
-								num_paper_touched++;
-								if (num_paper_touched >= 5) {// pickup at least 5/8 pages to win
-									num_paper_touched = 5;
-									screen_change = true;
-									screen_story2 = true;
-								}
-								else if (num_paper_touched == 1)
-									screen_change = true;
-								screen_firstpage = true;
-
-								paper_hit = true;
-							}
+					// Cast a ray from the camera, so trees in the way block the pickup
+					BvhHit hit;
+					if (World_Pick_Page(scene_bvh, &position, &heading, &hit) && *(bool*)Ecs_Get_Component(hit.user, COMP_ON_SCREEN)) {
+						if (!Adpcm_Is_Playing(s_paper))
+							Adpcm_Play(s_paper, 0);
+
+						// Remove this paper from the game, enough of them win
+						int taken = World_Take_Page(scene_bvh, &hit, &num_paper_touched);
+						if (taken == WORLD_PAGE_WON) {
+							screen_change = true;
+							screen_story2 = true;
 						}
+						else if (taken == WORLD_PAGE_FIRST)
+							screen_change = true;
+						screen_firstpage = true;
 					}
 				}
 				switch (cmd_move) {
 				case 0:
-					snd_StopSound(s_footsteps);
-					snd_StopSound(s_running);
+					Adpcm_Stop(s_footsteps);
+					Adpcm_Stop(s_running);
 					break;
 				default:
 					if (fastMovement) {
-						snd_StopSound(s_footsteps);
-						if (!snd_IsPlaying(s_running))
-							snd_PlaySound(s_running, 1);
+						Adpcm_Stop(s_footsteps);
+						if (!Adpcm_Is_Playing(s_running))
+							Adpcm_Play(s_running, 1);
 					}
 					else {
-						snd_StopSound(s_running);
-						if (!snd_IsPlaying(s_footsteps))
-							snd_PlaySound(s_footsteps, 1);
+						Adpcm_Stop(s_running);
+						if (!Adpcm_Is_Playing(s_footsteps))
+							Adpcm_Play(s_footsteps, 1);
 					}
 					break;
 				}
@@ -940,230 +1202,149 @@ void Program_Run()
 			| Update camera view
 			|___________________________________________________________________*/
 
-			if (light_data2.point.src.x != position.x)
-				light_data2.point.src.x = position.x;
-			else if (light_data2.point.src.z != position.z)
-				light_data2.point.src.z = position.z;
-			gx3d_UpdateLight(lantern_light, &light_data2);
-
-			// COLLISION DETECTION - MORE RESEARCH REQUIRED
-			//gx3dTrajectory cameraTrajectory;
-
-			//// Set camera's collision sphere properties 
-			//cameraSphere.center = position;
-			//cameraSphere.radius = 6.0f;	// adjust as needed	
-
-			//// Set camera's trajectory (initially, it's unchanged) 
-			//cameraTrajectory.direction = heading;
-			//cameraTrajectory.velocity = RUN_SPEED;
-
-			//// Check for collisions with trees 
-			//int collisionDetected = 0;
-			//float dtime = 1;
-			//float distance = RUN_SPEED * dtime;
-			//for (int i = 0; i < NUM_TREES && !collisionDetected; i++) {
-			//	float pTime;
-			//	if (gx3d_Collide_Sphere_StaticSphere(&cameraSphere, &cameraTrajectory, dtime, &treeSphere[i], &pTime) == gxRELATION_INTERSECT) {
-			//		position.x -= cameraTrajectory.direction.x * distance * (1.0f - pTime);
-			//		position.y -= cameraTrajectory.direction.y * distance * (1.0f - pTime);
-			//		position.z -= cameraTrajectory.direction.z * distance * (1.0f - pTime);
-
-			//		// Update the camera's collision sphere center 
-			//		cameraSphere.center = position;
-
-			//		// Update the camera's trajectory 
-			//		cameraTrajectory.direction = heading;
-			//		cameraTrajectory.velocity = RUN_SPEED;
-
-			//		collisionDetected = 1;
-			//		break;
-			//	}
-			//}
-
-			//// Update camera position and trajectory if no collision 
-
-			//if (!collisionDetected) {
-			//	// Update the camera's position 
-			//	position.x += heading.x * distance;
-			//	position.y += heading.y * distance;
-			//	position.z += heading.z * distance;
-
-			//	// Update the camera's collision sphere center 
-			//	cameraSphere.center = position;
-
-			//	// Update the camera's trajectory 
-			//	cameraTrajectory.direction = heading;
-			//	cameraTrajectory.velocity = RUN_SPEED;
-			//}
-
 			bool position_changed, camera_changed, collision;
+			gx3dVector old_position = position;
 			Position_Update(elapsed_time, cmd_move, move_y, move_x, force_update,
 				&position_changed, &camera_changed, &collision, &position, &heading);
 
+			// Keep the player out of the tree trunks, sliding along any it walks into
+			if (position_changed) {
+				gx3dSphere player = { old_position, PLAYER_RADIUS };
+				gx3dVector move, resolved;
+				gx3d_SubtractVector(&position, &old_position, &move);
+				if (Collide_Move_Sphere(&player, &move, &resolved)) {
+					position = resolved;
+					// Hand the corrected position back to the position module and update the camera from it
+					Position_Init(&position, &heading, fastMovement ? RUN_SPEED * 2.5f : RUN_SPEED);
+					Position_Update(0, 0, 0, 0, true, &position_changed, &camera_changed, &collision, &position, &heading);
+				}
+			}
+
 			snd_SetListenerPosition(position.x, position.y, position.z, snd_3D_APPLY_NOW);
 			snd_SetListenerOrientation(heading.x, heading.y, heading.z, 0, 1, 0, snd_3D_APPLY_NOW);
+			AudioProp_Update(&position, &heading, elapsed_time);
+
+			/*____________________________________________________________________
+			|
+			| Simulate the next frame
+			|___________________________________________________________________*/
+
+			// Hand this frame's input to the simulation, getting back last frame's to draw
+			PipelineInput input;
+			input.bvh = scene_bvh;
+			input.position = position;
+			input.heading = heading;
+			input.elapsed_time = elapsed_time;
+			input.lantern_position.x = position.x;
+			input.lantern_position.y = light_data2.point.src.y;
+			input.lantern_position.z = position.z;
+			input.lantern_on = lantern_light_on;
+			PipelineSnapshot* snapshot = Pipeline_Begin_Frame(&input);
+			SimLod_Tick(&effects_clock, snapshot->input.elapsed_time);
 
 			/*____________________________________________________________________
 			|
 			| Draw 3D graphics
 			|___________________________________________________________________*/
 
+			// View from where the frame was simulated
+			gx3dVector view_to, view_up = { 0, 1, 0 };
+			view_to.x = snapshot->input.position.x + snapshot->input.heading.x;
+			view_to.y = snapshot->input.position.y + snapshot->input.heading.y;
+			view_to.z = snapshot->input.position.z + snapshot->input.heading.z;
+			gx3d_CameraSetPosition(&snapshot->input.position, &view_to, &view_up, gx3d_CAMERA_ORIENTATION_LOOKTO_FIXED);
+			gx3d_CameraSetViewMatrix();
+
+			// The lantern is only uploaded again if it moved
+			LightMgr_Move_Light(lantern_light, &snapshot->input.lantern_position);
+			LightMgr_Enable_Light(lantern_light, snapshot->input.lantern_on);
+
+			// Pick the ground chunks for this view
+			Terrain_Update(&snapshot->input.position);
+
 			gx3d_SetFogColor(0, 0, 0);
 			gx3d_SetLinearPixelFog(15, 150);
 
-			// Render the screen
-			gx3d_ClearViewport(gx3d_CLEAR_SURFACE | gx3d_CLEAR_ZBUFFER, color, gx3d_MAX_ZBUFFER_VALUE, 0);
 			// Start rendering in 3D
 			if (gx3d_BeginRender()) {
+				// Render the scene at the internal resolution
+				DynRes_Begin_Scene(color);
 				// Set the default material
 				gx3d_SetMaterial(&material_default);
 				gx3d_SetAmbientLight(color3d_dim);
+				// Assign point lights to clusters for this view
+				LightMgr_Reserve_Lights(dir_light_on);
+				LightMgr_Begin_Frame();
 				//Enable Fog
 				gx3d_EnableFog();
 
 				// Play Forest Audio
-				if (!snd_IsPlaying(s_forest))
-					snd_PlaySound(s_forest, 1);
-				else if (!snd_IsPlaying(s_fire))
-					snd_PlaySound(s_fire, 1);
-
-				const int SOUND_CHANCE = 10; // % chance of sound playing
-
-				// generate a random number between 0 and 99
-				srand(time(0));
-				int random_num = rand() % 100;
-
-				// check if the number is less than or equal to SOUND_CHANCE
-				if (random_num <= SOUND_CHANCE) {
-					if (!snd_IsPlaying(s_wolves))
-						snd_PlaySound(s_wolves, 0); // wolves howling
+				if (!Adpcm_Is_Playing(s_forest))
+					Adpcm_Play(s_forest, 1);
+				else if (!Adpcm_Is_Playing(s_fire))
+					Adpcm_Play(s_fire, 1);
+
+				const int SOUND_CHANCE = 10; // % chance of sound playing, per frame at TARGET_FRAME_RATE
+
+				// the chance over the frames this one stood for, as if checked on each
+				float sound_frames = elapsed_time * TARGET_FRAME_RATE / 1000.0f;
+				float sound_chance = 1 - powf(1 - SOUND_CHANCE / 100.0f, sound_frames);
+
+				// draw against the chance
+				if (rand() / (float)RAND_MAX < sound_chance) {
+					if (!Adpcm_Is_Playing(s_wolves)) {
+						// Howl from a random direction somewhere out in the forest
+						float angle = (rand() % 360) * 3.14159265f / 180;
+						wolves_position.x = position.x + cosf(angle) * WOLVES_DISTANCE;
+						wolves_position.y = position.y;
+						wolves_position.z = position.z + sinf(angle) * WOLVES_DISTANCE;
+						AudioProp_Move_Emitter(wolves_emitter, &wolves_position);
+						Adpcm_Play(s_wolves, 0); // wolves howling
+					}
 				}
 
-				// Draw ground
-				gx3d_GetTranslateMatrix(&m, 0, 0, 0);
-				gx3d_SetObjectMatrix(obj_ground, &m);
-				gx3d_SetTexture(0, tex_ground);
-				gx3d_DrawObject(obj_ground, 0);
+				// Queue the scene, drawn sorted by pass, depth and texture
+				RenderQ_Begin(frame_arena, MAX_DRAWS, &snapshot->input.position, color3d_dim);
 
-				// Draw skydome
-				gx3d_SetAmbientLight(color3d_white);
+				// Queue ground, with its static lights from the lightmap once baked
+				TexId tex_lightmap = Bake_Get_Texture();
+				Terrain_Queue(TexMgr_Use(tex_ground), tex_lightmap == TEXMGR_INVALID ? NULL : TexMgr_Use(tex_lightmap));
+
+				// Queue skydome, drawn after everything opaque
 				gx3d_GetScaleMatrix(&m1, 200, 100, 200);
 				gx3d_GetTranslateMatrix(&m2, 0, 0, 0);
 				gx3d_MultiplyMatrix(&m1, &m2, &m);
-				gx3d_SetObjectMatrix(obj_skydome, &m);
-				gx3d_SetTexture(0, tex_skydome);
-				gx3d_DrawObject(obj_skydome, 0);
-
-				// Enable alpha blending and testing
-				gx3d_EnableAlphaBlending();
-				gx3d_EnableAlphaTesting(128);
-				// Enable a fire light
-				gx3d_EnableLight(fire_light);
-				gx3d_SetAmbientLight(color3d_dim);
-
-				// Draw a tree
-				for (int i = 0; i < NUM_TREES; i++) {
-					gx3d_GetTranslateMatrix(&m, treePosition[i].x, 0, treePosition[i].z);
-					gx3d_SetObjectMatrix(obj_tree, &m);
-					gx3d_SetTexture(0, tex_tree);
-					gx3d_DrawObject(obj_tree, 0);
-				}
-
-				// Draw a paper
-				static gx3dVector billboard_normal = { 0, 0, 1 };
-				for (int i = 0; i < NUM_PAPER; i++) {
-					paperOnScreen[i] = false;
-					gxRelation relation;
-					relation = gx3d_Relation_Sphere_Frustum(&treeSphere[i]);
-					if (relation != gxRELATION_OUTSIDE) {
-
-						if (paperDraw[i]) {
-							// check the bounding volume of the paper with the view frustum
-							if (true) {
-								gx3d_GetScaleMatrix(&m1, 1, 1, 1);
-								gx3d_GetBillboardRotateYMatrix(&m2, &billboard_normal, &heading);
-								gx3d_GetTranslateMatrix(&m3, paperPosition[i].x, paperPosition[i].y, paperPosition[i].z);
-								gx3d_MultiplyMatrix(&m1, &m2, &m);
-								gx3d_MultiplyMatrix(&m, &m3, &m);
-								gx3d_SetObjectMatrix(obj_paper, &m);
-								gx3d_SetTexture(0, tex_paper);
-								gx3d_DrawObject(obj_paper, 0);
-								paperOnScreen[i] = true;
-							}
-							// Update bounding spheres of each paper
-							paperSphere[i] = obj_paper->bound_sphere;
-							paperSphere[i].center.x *= 6;
-							paperSphere[i].center.y *= 6;
-							paperSphere[i].center.z *= 6;
-							paperSphere[i].center.x = paperPosition[i].x;
-							paperSphere[i].center.y = paperPosition[i].y;
-							paperSphere[i].center.z = paperPosition[i].z;
-							paperSphere[i].radius *= 6;
-						}
+				gx3dSphere sky_bounds = { { 0, 0, 0 }, 200 };
+				RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_SKY, obj_skydome, &m, TexMgr_Use(tex_skydome), &sky_bounds, FALSE);
+
+				// Queue the trees, papers and SlenderMan in view, as simulated
+				gx3dTexture tree_texture = TexMgr_Use(tex_tree);
+				gx3dTexture paper_texture = TexMgr_Use(tex_paper);
+				gx3dTexture slender_texture = TexMgr_Use(tex_slender);
+				for (int i = 0; i < snapshot->num_draws; i++) {
+					PipelineDraw* d = &snapshot->draws[i];
+					switch (d->type) {
+					case ENTITY_TREE:
+						if (tex_lightmap != TEXMGR_INVALID)
+							RenderQ_Add_Baked(RENDERQ_LAYER_SCENE, RENDERQ_PASS_CUTOUT, obj_tree, &d->matrix, tree_texture, NULL, &d->bounds, &d->light);
+						else
+							RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_CUTOUT, obj_tree, &d->matrix, tree_texture, &d->bounds, TRUE);
+						break;
+					case ENTITY_PAPER:
+						RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_BLEND, obj_paper, &d->matrix, paper_texture, &d->bounds, TRUE);
+						break;
+					case ENTITY_SLENDER:
+						RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_BLEND, obj_slender, &d->matrix, slender_texture, &d->bounds, TRUE);
+						break;
 					}
 				}
 
-				// Move position of slender
-				srand(time(0));
-				for (int i = 0; i < Slender; i++) {
-					// Get direction vector from Slender to camera with random variation
-					gx3dVector dir = {
-						position.x - SlenderPosition[i].x + (float(rand()) / RAND_MAX - 0.5f) * 0.1f,
-						position.y - 0,
-						position.z - SlenderPosition[i].z + (float(rand()) / RAND_MAX - 0.5f) * 0.1f
-					};
-					gx3dVector normalizedVector;
-					// Normalize direction vector
-					gx3d_NormalizeVector(&dir, &normalizedVector);
-					// Calculate movement speed
-					float speed = 0.005f; // adjust as needed
-					// Move Slender towards camera
-					SlenderPosition[i].x += dir.x * speed;
-					SlenderPosition[i].y += 0;
-					SlenderPosition[i].z += dir.z * speed;
-
-					if (SlenderPosition[i].x > 150)
-						SlenderPosition[i].x *= -1;
-					else if (SlenderPosition[i].x < -150)
-						SlenderPosition[i].x *= -1;
-					else if (SlenderPosition[i].z > 150)
-						SlenderPosition[i].z *= -1;
-					else if (SlenderPosition[i].z < -150)
-						SlenderPosition[i].z *= -1;
-
-					gx3dVector diff;
-
-					// calculate distance between Slenderman and camera
-					gx3d_SubtractVector(&position, &SlenderPosition[i], &diff);
-					float distance = gx3d_VectorMagnitude(&diff);
-
-					// check if Slenderman is within a certain distance from the camera, will trigger Game Over!
-					if (distance <= 10) {
-						screen_change = true;
-						screen_gameover = true;
-					}
-				}
-
-				// Draw SlenderMan
-				static gx3dVector billboard_normal2 = { 0, 0, 1 };
-				for (int i = 0; i < Slender; i++) {
-					gx3d_GetScaleMatrix(&m1, 6, 6, 6);
-					gx3d_GetBillboardRotateYMatrix(&m2, &billboard_normal2, &heading);
-					gx3d_GetTranslateMatrix(&m3, SlenderPosition[i].x, SlenderPosition[i].y, SlenderPosition[i].z);
-					gx3d_MultiplyMatrix(&m1, &m2, &m);
-					gx3d_MultiplyMatrix(&m, &m3, &m);
-					gx3d_SetObjectMatrix(obj_slender, &m);
-					gx3d_SetTexture(0, tex_slender);
-					gx3d_DrawObject(obj_slender, 0);
-				}
+				// Draw the queue
+				RenderQ_Submit();
 
 				// Disable Fog
 				gx3d_DisableFog();
 
-				// Disable alpha blending
-				gx3d_DisableAlphaBlending();
-				gx3d_DisableAlphaTesting();
-
 				/*____________________________________________________________________
 				|
 				| Take Screenshot
@@ -1180,18 +1361,6 @@ void Program_Run()
 					gxWriteBMPFile(str);
 				}
 
-				/*____________________________________________________________________
-				|
-				| Update Lantern
-				|___________________________________________________________________*/
-
-				if (NOT lantern_light_on) {
-					gx3d_DisableLight(lantern_light);
-				}
-				else {
-					gx3d_EnableLight(lantern_light);
-				}
-
 				/*____________________________________________________________________
 				|
 				| Update Directional Light
@@ -1213,44 +1382,46 @@ void Program_Run()
 				gx3d_EnableAlphaBlending();
 				gx3d_GetTranslateMatrix(&m, 0, -0.5, 0);
 				gx3d_SetParticleSystemMatrix(psys_fire, &m);
-				gx3d_UpdateParticleSystem(psys_fire, elapsed_time);
-				gx3d_DrawParticleSystem(psys_fire, &heading, draw_wireframe);
-				gx3d_DisableLight(fire_light);
+				gx3dSphere fire_bounds = { { 0, -0.5f, 0 }, 1 };
+				LightMgr_Select_For_Sphere(&fire_bounds);
+				if (SimLod_Due(&effects_clock, &fire_lod, SimLod_Tier(&fire_position, &snapshot->input.position, 1), &lod_elapsed_time))
+					gx3d_UpdateParticleSystem(psys_fire, lod_elapsed_time);
+				gx3d_DrawParticleSystem(psys_fire, &snapshot->input.heading, draw_wireframe);
+				LightMgr_Select_None();
 				gx3d_DisableAlphaBlending();
 
+				// Scale the scene up to the screen
+				DynRes_End_Scene();
+
 				/*____________________________________________________________________
 				|
 				| Draw 2D graphics on top of 3D and Process Paper Markers
 				|___________________________________________________________________*/
 
-				// Save current view matrix
-				gx3dMatrix view_save;
-				gx3d_GetViewMatrix(&view_save);
-
-				// Set new view matrix
-				gx3dVector tfrom = { 0,0,-1 }, tto = { 0,0,0 }, twup = { 0,1,0 };
-				gx3d_CameraSetPosition(&tfrom, &tto, &twup, gx3d_CAMERA_ORIENTATION_LOOKTO_FIXED);
-				gx3d_CameraSetViewMatrix();
-
-				// Draw 2D icons at top of screen
-				if (num_paper_touched) {
-					gx3d_DisableZBuffer();
-					gx3d_EnableAlphaBlending();
-					for (int i = 0; i < num_paper_touched; i++) {
-						gx3d_GetScaleMatrix(&m1, 0.025f, 0.025f, 0.025f);
-						gx3d_GetRotateYMatrix(&m2, 180);
-						gx3d_GetTranslateMatrix(&m3, -0.55 + (0.033 * i), 0.38, 0);
-						gx3d_MultiplyMatrix(&m1, &m2, &m);
-						gx3d_MultiplyMatrix(&m, &m3, &m);
-						gx3d_SetObjectMatrix(obj_paper, &m);
-						gx3d_SetTexture(0, tex_paper);
-						gx3d_DrawObject(obj_paper, 0);
-					}
-					gx3d_DisableAlphaBlending();
-					gx3d_EnableZBuffer();
+				// Queue the 2D icons at top of screen, one per page collected
+				float screen_height = (float)gxGetScreenHeight();
+				if (atlas_built)
+					Atlas_Get_Rect(atlas_paper, &paper_rect);
+				for (int i = 0; i < num_paper_touched; i++)
+					Sprite_Add(tex_paper, atlas_built ? &paper_rect : NULL,
+						(HUD_ICON_MARGIN + HUD_ICON_SPACING * i) * screen_height, HUD_ICON_MARGIN * screen_height,
+						HUD_ICON_SIZE * screen_height, HUD_ICON_SIZE * screen_height);
+
+				// Frame rate readout
+				frame_rate_frames++;
+				frame_rate_time += elapsed_time;
+				if (frame_rate_time >= FRAME_RATE_INTERVAL) {
+					PipelineStats pipeline_stats;
+					Pipeline_Get_Stats(&pipeline_stats);
+					sprintf(frame_rate_text, "%.0f fps  %.1f ms  %.1f ms latency", frame_rate_frames * 1000.0f / frame_rate_time, (float)frame_rate_time / frame_rate_frames, pipeline_stats.last_latency);
+					frame_rate_frames = 0;
+					frame_rate_time = 0;
 				}
-				// Restore view matrix
-				gx3d_SetViewMatrix(&view_save);
+				if (show_frame_rate)
+					Sprite_Text(FRAME_RATE_GLYPH_SIZE, screen_height - FRAME_RATE_GLYPH_SIZE * 2, FRAME_RATE_GLYPH_SIZE, frame_rate_text);
+
+				// Draw them, one draw per texture
+				Sprite_Flush();
 
 				// Stop rendering
 				gx3d_EndRender();
@@ -1258,19 +1429,262 @@ void Program_Run()
 				// Page flip (so user can see it)
 				gxFlipVisualActivePages(FALSE);
 			}
+
+			// Wait for the next frame's simulation, the world is the main thread's again
+			PipelineSnapshot* simulated = Pipeline_End_Frame();
+			if (simulated && simulated->caught) {
+				// Caught, Game Over!
+				screen_change = true;
+				screen_gameover = true;
+			}
 		}
+
+		// Release this frame's transient data
+		Arena_Reset(frame_arena);
 	}
 	/*____________________________________________________________________
 	|
 	| Free stuff and exit
 	|___________________________________________________________________*/
 
+	/*____________________________________________________________________
+	|
+	| Print frame pacing info to debug file
+	|___________________________________________________________________*/
+
+	PacerStats pacer_stats;
+	Pacer_Get_Stats(&pacer_stats);
+	debug_WriteFile("_______________ Frame Pacing _____________");
+	sprintf(str, "target frame time: %.2f ms", pacer_stats.target_frame_time);
+	debug_WriteFile(str);
+	sprintf(str, "frames: %u", pacer_stats.frames);
+	debug_WriteFile(str);
+	sprintf(str, "frame time mean/min/max: %.2f/%.2f/%.2f ms", pacer_stats.mean_frame_time, pacer_stats.min_frame_time, pacer_stats.max_frame_time);
+	debug_WriteFile(str);
+	sprintf(str, "frame time variance: %.3f ms^2 (std dev %.3f ms)", pacer_stats.frame_time_variance, pacer_stats.frame_time_std_dev);
+	debug_WriteFile(str);
+	sprintf(str, "schedule error mean/max: %.3f/%.3f ms", pacer_stats.mean_schedule_error, pacer_stats.max_schedule_error);
+	debug_WriteFile(str);
+	sprintf(str, "spin margin: %.2f ms", pacer_stats.spin_margin);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	Pacer_Free();
+
+	DynResStats dynres_stats;
+	DynRes_Get_Stats(&dynres_stats);
+	debug_WriteFile("____________ Dynamic Resolution __________");
+	sprintf(str, "frame time budget: %.2f ms (mean work time %.2f ms)", dynres_stats.budget, dynres_stats.mean_work_time);
+	debug_WriteFile(str);
+	sprintf(str, "scale current/mean/min: %.3f/%.3f/%.3f", dynres_stats.scale, dynres_stats.mean_scale, dynres_stats.min_scale);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	DynRes_Free();
+
+	LightMgrStats light_stats;
+	LightMgr_Get_Stats(&light_stats);
+	debug_WriteFile("_______________ Light Manager ____________");
+	sprintf(str, "frames: %u, lights: %u, max lights per draw: %u", light_stats.frames, light_stats.lights, light_stats.max_lights_per_draw);
+	debug_WriteFile(str);
+	sprintf(str, "last frame visible lights: %u, cluster refs: %u", light_stats.visible_lights, light_stats.cluster_refs);
+	debug_WriteFile(str);
+	sprintf(str, "selections: %u, uploads: %u, enable changes: %u", light_stats.selections, light_stats.uploads, light_stats.enable_changes);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	LightMgr_Free();
+
+	CollideStats collide_stats;
+	Collide_Get_Stats(&collide_stats);
+	debug_WriteFile("_______________ Collision ________________");
+	sprintf(str, "capsules: %u, grid: %dx%d cells of %.1f", collide_stats.capsules, collide_stats.grid_dx, collide_stats.grid_dz, collide_stats.cell_size);
+	debug_WriteFile(str);
+	sprintf(str, "moves: %u, contacts: %u, candidates tested: %u", collide_stats.moves, collide_stats.contacts, collide_stats.candidates);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	Collide_Free();
+
+	BvhStats bvh_stats;
+	Bvh_Get_Stats(scene_bvh, &bvh_stats);
+	debug_WriteFile("_______________ Scene BVH ________________");
+	sprintf(str, "entries: %u, nodes: %u, depth: %u, builds: %u, refits: %u", bvh_stats.entries, bvh_stats.nodes, bvh_stats.depth, bvh_stats.builds, bvh_stats.refits);
+	debug_WriteFile(str);
+	sprintf(str, "rays: %u, nodes visited: %u, shapes tested: %u", bvh_stats.rays, bvh_stats.nodes_visited, bvh_stats.shapes_tested);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	AudioPropStats audio_stats;
+	AudioProp_Get_Stats(&audio_stats);
+	debug_WriteFile("_____________ Audio Propagation __________");
+	sprintf(str, "frames: %u, emitters: %u, emitter samples: %u", audio_stats.frames, audio_stats.emitters, audio_stats.emitter_updates);
+	debug_WriteFile(str);
+	sprintf(str, "rays: %u (max %u per frame), volume changes: %u", audio_stats.rays, audio_stats.max_rays_per_frame, audio_stats.volume_changes);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	AudioProp_Free();
+	Bvh_Free(scene_bvh);
+
+	EcsStats ecs_stats;
+	Ecs_Get_Stats(&ecs_stats);
+	debug_WriteFile("_______________ Entities _________________");
+	sprintf(str, "entities: %u, archetypes: %u, chunks: %u", ecs_stats.entities, ecs_stats.archetypes, ecs_stats.chunks);
+	debug_WriteFile(str);
+	sprintf(str, "created: %u, destroyed: %u, moved: %u", ecs_stats.creates, ecs_stats.destroys, ecs_stats.moves);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	Ecs_Free();
+
+	RenderQStats renderq_stats;
+	RenderQ_Get_Stats(&renderq_stats);
+	unsigned renderq_frames = renderq_stats.frames ? renderq_stats.frames : 1;
+	debug_WriteFile("_______________ Render Queue _____________");
+	sprintf(str, "frames: %u, draws per frame: %.1f (max %u), dropped: %u", renderq_stats.frames, (float)renderq_stats.draws / renderq_frames, renderq_stats.max_draws, renderq_stats.dropped);
+	debug_WriteFile(str);
+	sprintf(str, "state changes per frame sorted/queue order: %.1f/%.1f", (float)renderq_stats.state_changes / renderq_frames, (float)renderq_stats.unsorted_state_changes / renderq_frames);
+	debug_WriteFile(str);
+	sprintf(str, "opaque depth inversions per frame sorted/queue order: %.1f/%.1f", (float)renderq_stats.depth_inversions / renderq_frames, (float)renderq_stats.unsorted_depth_inversions / renderq_frames);
+	debug_WriteFile(str);
+	sprintf(str, "opaque draws over the sky per frame sorted/queue order: %.1f/%.1f", (float)renderq_stats.sky_overdraws / renderq_frames, (float)renderq_stats.unsorted_sky_overdraws / renderq_frames);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	RenderQ_Free();
+
+	TerrainStats terrain_stats;
+	Terrain_Get_Stats(&terrain_stats);
+	debug_WriteFile("_______________ Terrain __________________");
+	sprintf(str, "chunks: %u in %u levels, resident: %u, builds: %u, uploads: %u, evictions: %u", terrain_stats.nodes, terrain_stats.levels, terrain_stats.resident, terrain_stats.builds, terrain_stats.uploads, terrain_stats.evictions);
+	debug_WriteFile(str);
+	sprintf(str, "last frame drawn: %u, culled: %u, triangles: %u (max %u)", terrain_stats.drawn, terrain_stats.culled, terrain_stats.triangles, terrain_stats.max_triangles);
+	debug_WriteFile(str);
+	sprintf(str, "chunk ACMR: %.3f (%.3f as generated)", terrain_stats.acmr, terrain_stats.acmr_unoptimized);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	Terrain_Free();
+
+	SnapshotStats snapshot_stats;
+	Snapshot_Get_Stats(&snapshot_stats);
+	debug_WriteFile("_______________ Snapshots ________________");
+	sprintf(str, "captures: %u, rewinds: %u, saves: %u, loads: %u, failed: %u", snapshot_stats.captures, snapshot_stats.rewinds, snapshot_stats.saves, snapshot_stats.loads, snapshot_stats.failures);
+	debug_WriteFile(str);
+	sprintf(str, "last snapshot: %u bytes, capture %.3f ms, restore %.3f ms, save %.3f ms", snapshot_stats.size, snapshot_stats.last_capture_time, snapshot_stats.last_restore_time, snapshot_stats.last_save_time);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	Snapshot_Free();
+
+	ArenaStats level_stats, frame_stats;
+	Arena_Get_Stats(level_arena, &level_stats);
+	Arena_Get_Stats(frame_arena, &frame_stats);
+	debug_WriteFile("_______________ Memory Arenas ____________");
+	sprintf(str, "level arena: %u/%u bytes peak, %u rounds, %u failed allocations", level_stats.peak, level_stats.capacity, level_stats.resets, level_stats.failures);
+	debug_WriteFile(str);
+	sprintf(str, "frame arena: %u/%u bytes peak, %u frames, %u failed allocations", frame_stats.peak, frame_stats.capacity, frame_stats.resets, frame_stats.failures);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	Arena_Free(frame_arena);
+	Arena_Free(level_arena);
+
+	HotLoadStats hotload_stats;
+	HotLoad_Get_Stats(&hotload_stats);
+	debug_WriteFile("_______________ Hot Reload _______________");
+	sprintf(str, "assets watched: %u, changes: %u, reloads: %u, failed: %u", hotload_stats.assets, hotload_stats.changes, hotload_stats.reloads, hotload_stats.failures);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	HotLoad_Free();
+
+	AtlasStats atlas_stats;
+	Atlas_Get_Stats(&atlas_stats);
+	debug_WriteFile("_______________ Atlas ____________________");
+	sprintf(str, "entries: %u, pages: %u of %ux%u, %u%% filled", atlas_stats.entries, atlas_stats.pages, atlas_stats.page_size, atlas_stats.page_size, atlas_stats.fill);
+	debug_WriteFile(str);
+	sprintf(str, "builds: %u, failed: %u, last build %.2f ms", atlas_stats.builds, atlas_stats.failures, atlas_stats.last_build_time);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	Atlas_Free();
+
+	SpriteStats sprite_stats;
+	Sprite_Get_Stats(&sprite_stats);
+	debug_WriteFile("_______________ Sprites __________________");
+	sprintf(str, "frames: %u, quads: %u (%u dropped), max per frame: %u", sprite_stats.frames, sprite_stats.quads, sprite_stats.dropped, sprite_stats.max_quads);
+	debug_WriteFile(str);
+	sprintf(str, "draws: %u, batch rebuilds: %u, max batches: %u", sprite_stats.draws, sprite_stats.builds, sprite_stats.max_batches);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	Sprite_Free();
+
+	PipelineStats pipeline_stats;
+	Pipeline_Get_Stats(&pipeline_stats);
+	debug_WriteFile("_______________ Pipeline _________________");
+	sprintf(str, "frames: %u, %s, draws dropped: %u", pipeline_stats.frames, pipeline_stats.threaded ? "threaded" : "serial", pipeline_stats.dropped);
+	debug_WriteFile(str);
+	if (pipeline_stats.frames) {
+		sprintf(str, "mean simulate: %.2f ms, mean wait: %.2f ms", pipeline_stats.sim_time / pipeline_stats.frames, pipeline_stats.wait_time / pipeline_stats.frames);
+		debug_WriteFile(str);
+		sprintf(str, "latency: %.2f ms mean, %.2f ms max", pipeline_stats.latency / pipeline_stats.frames, pipeline_stats.max_latency);
+		debug_WriteFile(str);
+	}
+	debug_WriteFile("__________________________________________");
+	Pipeline_Free();
+
+	SimLodClock slender_clock;
+	World_Get_Sim_Stats(&slender_clock);
+	debug_WriteFile("_______________ Simulation LOD ___________");
+	sprintf(str, "Slender steps near/mid/far: %u/%u/%u, skipped: %u/%u/%u", slender_clock.updates[SIMLOD_NEAR], slender_clock.updates[SIMLOD_MID], slender_clock.updates[SIMLOD_FAR],
+		slender_clock.skipped[SIMLOD_NEAR], slender_clock.skipped[SIMLOD_MID], slender_clock.skipped[SIMLOD_FAR]);
+	debug_WriteFile(str);
+	sprintf(str, "fire updates near/mid/far: %u/%u/%u, skipped: %u/%u/%u", effects_clock.updates[SIMLOD_NEAR], effects_clock.updates[SIMLOD_MID], effects_clock.updates[SIMLOD_FAR],
+		effects_clock.skipped[SIMLOD_NEAR], effects_clock.skipped[SIMLOD_MID], effects_clock.skipped[SIMLOD_FAR]);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+
+	MeshOptStats meshopt_stats;
+	MeshOpt_Get_Stats(&meshopt_stats);
+	debug_WriteFile("_______________ Meshes ___________________");
+	sprintf(str, "objects optimised: %u, triangles: %u, ACMR: %.3f (%.3f as authored)", meshopt_stats.objects, meshopt_stats.triangles, meshopt_stats.acmr_after, meshopt_stats.acmr_before);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+
+	BakeStats bake_stats;
+	Bake_Get_Stats(&bake_stats);
+	debug_WriteFile("_______________ Light Baker ______________");
+	sprintf(str, "bakes: %u, loaded from file: %u, failed: %u, %u trees, %u lights", bake_stats.bakes, bake_stats.cache_hits, bake_stats.failures, bake_stats.trees, bake_stats.lights);
+	debug_WriteFile(str);
+	sprintf(str, "last bake %.2f ms, %llu rays on %u threads, saved in %u bytes", bake_stats.last_bake_time, bake_stats.rays, bake_stats.threads, bake_stats.file_size);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	Bake_Free();
+
+	BmpStats bmp_stats;
+	Bmp_Get_Stats(&bmp_stats);
+	debug_WriteFile("_______________ BMP Decoder ______________");
+	sprintf(str, "loads: %u, failed: %u, %llu texels from %llu bytes (%s)", bmp_stats.loads, bmp_stats.failures, bmp_stats.texels, bmp_stats.bytes, bmp_stats.simd ? "SSSE3" : "scalar");
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+
+	AdpcmStats adpcm_stats;
+	Adpcm_Get_Stats(&adpcm_stats);
+	debug_WriteFile("_______________ Sounds ___________________");
+	sprintf(str, "streamed from ADPCM: %u, %u bytes (%u as PCM), from WAV: %u, failed: %u", adpcm_stats.loads, adpcm_stats.compressed_bytes, adpcm_stats.pcm_bytes, adpcm_stats.wav_loads, adpcm_stats.failures);
+	debug_WriteFile(str);
+	sprintf(str, "resident: %u bytes with the stream buffers (%.2fx smaller than PCM)", adpcm_stats.resident_bytes, adpcm_stats.resident_bytes ? (float)adpcm_stats.pcm_bytes / adpcm_stats.resident_bytes : 0.0f);
+	debug_WriteFile(str);
+	sprintf(str, "channel blocks decoded: %llu (voices %s)", adpcm_stats.blocks_decoded, adpcm_stats.simd ? "SSE2" : "scalar");
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+
+	TexMgrStats texmgr_stats;
+	TexMgr_Get_Stats(&texmgr_stats);
+	debug_WriteFile("_______________ Textures _________________");
+	sprintf(str, "textures: %u, resident: %u, %u/%u bytes (peak %u)", texmgr_stats.textures, texmgr_stats.resident, texmgr_stats.resident_bytes, texmgr_stats.budget, texmgr_stats.peak_bytes);
+	debug_WriteFile(str);
+	sprintf(str, "loads: %u, evictions: %u (%u to a low resolution mip), failed: %u", texmgr_stats.loads, texmgr_stats.evictions, texmgr_stats.mip_drops, texmgr_stats.failures);
+	debug_WriteFile(str);
+	sprintf(str, "uses while loading: %u, last load %.2f ms", texmgr_stats.placeholder_uses, texmgr_stats.last_load_time);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+	TexMgr_Free();
+
 	gx3d_FreeLight(dir_light);
-	gx3d_FreeLight(lantern_light);
-	gx3d_FreeLight(fire_light);
 	gx3d_FreeParticleSystem(psys_fire);
 	gx3d_FreeAllObjects();
 	gx3d_FreeAllTextures();
+	Adpcm_Stream_Free();
 	snd_Free();
 }
 
@@ -1312,6 +1726,192 @@ static void Init_Render_State()
 	gx3d_SetTextureFiltering(1, gx3d_TEXTURE_FILTERTYPE_TRILINEAR, 0);
 }
 
+/*____________________________________________________________________
+|
+| Function: Run_Tool_Mode
+|
+| Input: Called from Program_Run()
+| Output: Runs the tool the game was started as, if any, in place of
+|   the game: -bench, -meshopt, -adpcm or -stress.  Returns true if
+|   one ran, with the exit code: 0 if it succeeded, 1 if it failed (a
+|   benchmark regressed, nothing to report or encode, a stress step
+|   couldn't run).  -server runs before graphics mode, see
+|   Run_Server().
+|___________________________________________________________________*/
+
+static int Run_Tool_Mode(int* exit_code)
+{
+	char* command_line = GetCommandLineA();
+	int ok;
+
+	// Benchmark suite (results go to bench.json and the debug file)
+	if (strstr(command_line, "-bench"))
+		ok = Bench_Run(command_line);
+	// Report what optimising each model saves (to the debug file)
+	else if (strstr(command_line, "-meshopt"))
+		ok = MeshOpt_Report_Models("Objects") > 0;
+	// Encode each sound in wav to a compressed .adp file (reported to the debug file)
+	else if (strstr(command_line, "-adpcm"))
+		ok = Adpcm_Encode_Directory("wav") > 0;
+	// Sweep the size of the forest and report how the frame time scales (to stress.csv, stress.json and the debug file)
+	else if (strstr(command_line, "-stress"))
+		ok = Stress_Run(command_line);
+	else
+		return (FALSE);
+
+	*exit_code = ok ? 0 : 1;
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Wait_For_Event
+|
+| Input: Called from Program_Run()
+| Output: Sleeps until an input event is available or timeout ms have
+|   passed, without spinning the cpu.  Returns true if an event was
+|   read into event, else false.
+|___________________________________________________________________*/
+
+static int Wait_For_Event(evEvent* event, unsigned timeout)
+{
+	unsigned start_time = timeGetTime();
+
+	for (;;) {
+		if (evGetEvent(event))
+			return (TRUE);
+		if (timeGetTime() - start_time >= timeout)
+			return (FALSE);
+		Sleep(SCREEN_IDLE_SLEEP);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Spawn_World
+|
+| Input: Called from Program_Run()
+| Output: Releases the previous world and generates a new one from seed
+|   in the level arena: the entities, trunk colliders and scene BVH.
+|   Loaded assets are kept.  Returns the scene BVH.
+|___________________________________________________________________*/
+
+static Bvh Spawn_World(Arena level_arena, unsigned seed, gx3dObject* obj_tree, gx3dObject* obj_paper, gx3dObject* obj_slender)
+{
+	WorldShapes shapes;
+
+	// Release the previous world
+	Arena_Reset(level_arena);
+
+	// The world's components and the ones the game draws with
+	Ecs_Init(level_arena);
+	World_Define_Components();
+	Ecs_Define_Component(COMP_ON_SCREEN, sizeof(bool));
+	Ecs_Define_Component(COMP_BAKED_LIGHT, sizeof(gx3dColor));
+
+	Get_World_Shapes(obj_tree, obj_paper, obj_slender, &shapes);
+
+	return (World_Spawn(level_arena, seed, &shapes, ECS_MASK(COMP_BAKED_LIGHT), ECS_MASK(COMP_ON_SCREEN)));
+}
+
+/*____________________________________________________________________
+|
+| Function: Build_World
+|
+| Input: Called from Program_Run()
+| Output: Releases the previous world's colliders and BVH and builds
+|   them again in the level arena for the entities restored into the
+|   entity store.  Returns the scene BVH.
+|___________________________________________________________________*/
+
+static Bvh Build_World(Arena level_arena, gx3dObject* obj_tree, gx3dObject* obj_paper, gx3dObject* obj_slender)
+{
+	WorldShapes shapes;
+
+	// Release the previous world, the entities live in the restored snapshot
+	Arena_Reset(level_arena);
+
+	Get_World_Shapes(obj_tree, obj_paper, obj_slender, &shapes);
+
+	return (World_Build(level_arena, &shapes));
+}
+
+/*____________________________________________________________________
+|
+| Function: Get_World_Shapes
+|
+| Input: Called from Spawn_World(), Build_World()
+| Output: Gets the sizes the world is built with from the models.
+|___________________________________________________________________*/
+
+static void Get_World_Shapes(gx3dObject* obj_tree, gx3dObject* obj_paper, gx3dObject* obj_slender, WorldShapes* shapes)
+{
+	shapes->tree_height = obj_tree->bound_box.max.y;
+	shapes->tree_radius = obj_tree->bound_sphere.radius;
+	shapes->paper_radius = obj_paper->bound_sphere.radius;
+	shapes->slender_radius = obj_slender->bound_sphere.radius;
+}
+
+/*____________________________________________________________________
+|
+| Function: Light_World
+|
+| Input: Called from Program_Run()
+| Output: Starts baking the static lights into the ground's lightmap
+|   and each tree's light in the background, or loads the bake if
+|   nothing changed since it was saved.  The trees have the ambient
+|   light until Program_Run() finishes the bake and calls
+|   Light_Trees().  Returns true if the bake was started.
+|___________________________________________________________________*/
+
+static int Light_World(gx3dObject* obj_tree)
+{
+	EcsQuery query;
+
+	// The trunk is the trees' collision capsule, the canopy a sphere over the top of the model
+	float width = obj_tree->bound_box.max.x - obj_tree->bound_box.min.x;
+	float depth = obj_tree->bound_box.max.z - obj_tree->bound_box.min.z;
+	float canopy_radius = (width > depth ? width : depth) / 2;
+	float canopy_y = obj_tree->bound_box.max.y - canopy_radius;
+
+	Bake_Clear_Trees();
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_TREE) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BAKED_LIGHT));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		for (int i = 0; i < query.count; i++)
+			Bake_Add_Tree(&pos[i], obj_tree->bound_box.max.y, TREE_TRUNK_RADIUS, canopy_y, canopy_radius);
+	}
+	int started = Bake_Start(TRUE);
+	if (NOT started)
+		debug_WriteFile("Light_World(): bake failed, lighting everything at run time");
+	Light_Trees();
+
+	return (started);
+}
+
+/*____________________________________________________________________
+|
+| Function: Light_Trees
+|
+| Input: Called from Program_Run(), Light_World()
+| Output: Gives each tree its baked light, or the ambient light if the
+|   bake isn't done.  Trees take their own light as they're drawn.
+|___________________________________________________________________*/
+
+static void Light_Trees()
+{
+	EcsQuery query;
+	int tree = 0;
+
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_TREE) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BAKED_LIGHT));
+	while (Ecs_Query_Next(&query)) {
+		gx3dColor* baked_light = ECS_COLUMN(&query, gx3dColor, COMP_BAKED_LIGHT);
+		for (int i = 0; i < query.count; i++)
+			Bake_Get_Tree_Light(tree++, &baked_light[i]);
+	}
+}
+
 /*____________________________________________________________________
 |
 | Function: Program_Free
@@ -0,0 +1,1386 @@
+/*____________________________________________________________________
+|
+| File: adpcm.cpp
+|
+| Description: IMA-ADPCM sounds - a 4-bit compressed sound format with
+|   an offline encoder, an SSE2 block decoder and sample accurate
+|   seeking and looping.
+|
+|   A sound is split into blocks of ADPCM_BLOCK_SAMPLES samples per
+|   channel.  Each channel's part of a block is ADPCM_BLOCK_BYTES: its
+|   first sample and step index, then a 4-bit code for each of the
+|   rest (low nibble first).  Blocks decode on their own, so seeking
+|   to any sample decodes at most one block per channel.  Blocks are a
+|   quarter the size of 16-bit PCM, less their 4 byte headers.
+|
+|   The encoder reads 16-bit mono or stereo WAV files, taking the loop
+|   points from the file's sampler chunk if it has one (else the whole
+|   sound loops), and writes .adp files: a header then the blocks.
+|   "-adpcm" encodes every sound in wav and reports the savings.
+|
+|   Decoding a channel block is a serial chain, each sample predicted
+|   from the last, so the SSE2 decoder runs 8 chains at once, one per
+|   16-bit lane: a voice decodes the next 8 channel blocks it will
+|   play (4 blocks of a stereo sound) in one pass.  Saturating adds do
+|   the clamping.
+|
+|   The toolkit only plays sounds it loads from WAV files, into its
+|   own PCM buffers, so a sound with an .adp file is streamed instead:
+|   a thread reads and decodes it a block at a time from the file, a
+|   few short buffers ahead of a waveOut device of its own, which
+|   Windows mixes with the toolkit's.  Each sound keeps the block it is
+|   playing, compressed and decoded, so sounds playing together don't
+|   decode each other's blocks over again, and with its buffers that is
+|   all that is resident.  Its device is stereo so a mono sound can be
+|   panned.  A sound without an .adp file is loaded into the toolkit.
+|   A voice (Adpcm_Voice_Init(), Adpcm_Read()) decodes a sound loaded
+|   whole (Adpcm_Load()) as it plays, for a mixer to call.
+|
+| Functions:  Adpcm_Encode
+|							 Encode_Block
+|							 Encode_Sample
+|             Adpcm_Encode_Wav
+|             Adpcm_Encode_Directory
+|							 Measure_SNR
+|             Adpcm_Save
+|             Adpcm_Load
+|							 Read_Header
+|             Adpcm_Free
+|             Adpcm_Voice_Init
+|             Adpcm_Seek
+|             Adpcm_Read
+|							 Read_Frames
+|							 Voice_Block
+|							 Decode_Blocks
+|							 Decode_Lanes
+|							 Decode_Lane
+|							 Decode_Sample
+|             Adpcm_Stream_Init
+|             Adpcm_Stream_Free
+|             Adpcm_Open
+|             Adpcm_Play
+|             Adpcm_Stop
+|             Adpcm_Is_Playing
+|             Adpcm_Set_Volume
+|             Adpcm_Set_Pan
+|							 Stream_Thread
+|							 Feed_Source
+|							 Fill_Buffer
+|							 Source_Block
+|							 Read_File
+|							 Parse_Wav
+|             Adpcm_Use_SIMD
+|             Adpcm_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include <emmintrin.h>
+
+#include "adpcm.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define ADPCM_MAGIC       "ADPC"
+#define ADPCM_VERSION     1
+#define ADPCM_CODES       (ADPCM_BLOCK_SAMPLES - 1)  // per channel block, 8 to a 32-bit word
+#define ADPCM_MAX_INDEX   88
+
+#define ADPCM_MAX_SOURCES     16
+#define ADPCM_STREAM_BUFFERS  4
+#define ADPCM_STREAM_FRAMES   512   // per buffer, 23 ms at 22 kHz
+#define ADPCM_NO_BLOCK        0xFFFFFFFF
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	char     magic[4];
+	unsigned version;
+	unsigned channels;
+	unsigned sample_rate;
+	unsigned num_samples;
+	unsigned loop_start, loop_end;
+	unsigned num_blocks;
+} FileHeader;
+
+typedef struct {
+	int          channels;
+	int          sample_rate;
+	const short* pcm;          // interleaved
+	unsigned     num_samples;
+	unsigned     loop_start, loop_end;
+} Wav;
+
+// Returns a block's decoded samples, each channel's in turn, or NULL if it can't be read
+typedef const short* (*BlockReader)(void* reader, unsigned block);
+
+typedef struct {
+	Sound          sound;      // loaded into the toolkit, else 0 and streamed
+	AdpcmSound     adpcm;      // the .adp file's header, its blocks are read as they play
+	HANDLE         file;       // INVALID_HANDLE_VALUE if not streamed
+	unsigned char* block;      // the last block read, each channel's in turn
+	short*         pcm;        // ...decoded
+	unsigned       decoded;    // its index, or ADPCM_NO_BLOCK
+	unsigned       position;   // next sample to decode
+	int            loop;
+	int            volume;     // 0-100
+	int            pan;        // -100 (left) to 100 (right)
+	bool           playing;    // until its last buffer has played
+	HWAVEOUT       device;     // stereo
+	WAVEHDR    headers[ADPCM_STREAM_BUFFERS];
+	bool           queued[ADPCM_STREAM_BUFFERS];  // written to the device and not yet refilled
+	short*         buffers;
+} Source;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Encode_Block(const short* pcm, int channels, unsigned count, int* index, unsigned char* out);
+static int Encode_Sample(int sample, int* predictor, int* index);
+static double Measure_SNR(AdpcmSound* sound, const short* pcm);
+static bool Read_Header(HANDLE file, AdpcmSound* sound);
+static unsigned Read_Frames(AdpcmSound* sound, unsigned* position, int loop, short* out, unsigned frames, BlockReader read_block, void* reader);
+static const short* Voice_Block(void* reader, unsigned block);
+static void Decode_Blocks(AdpcmVoice* voice, unsigned block);
+static void Decode_Lanes(const unsigned char** in, short** out);
+static void Decode_Lane(const unsigned char* in, short* out);
+static void Decode_Sample(int code, int* predictor, int* index);
+static DWORD WINAPI Stream_Thread(LPVOID param);
+static void Feed_Source(Source* s);
+static bool Fill_Buffer(Source* s, int b);
+static const short* Source_Block(void* reader, unsigned block);
+static bool Read_File(const char* filename, unsigned char** data, DWORD* size);
+static bool Parse_Wav(unsigned char* data, DWORD size, Wav* wav);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static const short step_table[ADPCM_MAX_INDEX + 1] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+	253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+	1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+	3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+	11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+	32767
+};
+static const int index_table[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+static int              use_simd = TRUE;
+static AdpcmStats       stats;
+
+static Source           sources[ADPCM_MAX_SOURCES];
+static int              num_sources;
+static CRITICAL_SECTION lock;              // guards the sources' play state
+static HANDLE           stream_thread, stop_event, buffer_event;
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Encode
+|
+| Input: Called from Adpcm_Encode_Wav(), Adpcm_Encode_Directory()
+| Output: Encodes 16-bit samples (channels interleaved) into a sound,
+|   looping from loop_start to loop_end (the whole sound if they're
+|   out of order).  Returns true on success.  Call Adpcm_Free() when
+|   done with the sound.
+|___________________________________________________________________*/
+
+int Adpcm_Encode(const short* pcm, int channels, int sample_rate, unsigned num_samples, unsigned loop_start, unsigned loop_end, AdpcmSound* sound)
+{
+	unsigned b, count;
+	int c, index[ADPCM_MAX_CHANNELS];
+	unsigned char* out;
+
+	memset(sound, 0, sizeof(AdpcmSound));
+	if (channels < 1 || channels > ADPCM_MAX_CHANNELS || num_samples == 0)
+		return (FALSE);
+
+	sound->num_blocks = (num_samples + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES;
+	sound->data = (unsigned char*)malloc(sound->num_blocks * channels * ADPCM_BLOCK_BYTES);
+	if (sound->data == NULL)
+		return (FALSE);
+	sound->channels = channels;
+	sound->sample_rate = sample_rate;
+	sound->num_samples = num_samples;
+	if (loop_end > num_samples)
+		loop_end = num_samples;
+	if (loop_start >= loop_end) {
+		loop_start = 0;
+		loop_end = num_samples;
+	}
+	sound->loop_start = loop_start;
+	sound->loop_end = loop_end;
+
+	// The step index carries on from block to block, the predictor starts over
+	for (c = 0; c < channels; c++)
+		index[c] = 0;
+	out = sound->data;
+	for (b = 0; b < sound->num_blocks; b++) {
+		count = num_samples - b * ADPCM_BLOCK_SAMPLES;
+		if (count > ADPCM_BLOCK_SAMPLES)
+			count = ADPCM_BLOCK_SAMPLES;
+		for (c = 0; c < channels; c++, out += ADPCM_BLOCK_BYTES)
+			Encode_Block(pcm + b * ADPCM_BLOCK_SAMPLES * channels + c, channels, count, &index[c], out);
+	}
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Encode_Block
+|
+| Input: Called from Adpcm_Encode()
+| Output: Encodes count samples (1 to ADPCM_BLOCK_SAMPLES) of a
+|   channel into a channel block, holding the last sample to fill it.
+|___________________________________________________________________*/
+
+static void Encode_Block(const short* pcm, int channels, unsigned count, int* index, unsigned char* out)
+{
+	unsigned i;
+	int predictor, sample, code;
+
+	predictor = pcm[0];
+	*(short*)out = (short)predictor;
+	out[2] = (unsigned char)*index;
+	out[3] = 0;
+	memset(out + 4, 0, ADPCM_BLOCK_BYTES - 4);
+	for (i = 0; i < ADPCM_CODES; i++) {
+		sample = pcm[(i + 1 < count ? i + 1 : count - 1) * channels];
+		code = Encode_Sample(sample, &predictor, index);
+		out[4 + i / 2] |= (i & 1) ? code << 4 : code;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Encode_Sample
+|
+| Input: Called from Encode_Block()
+| Output: Returns the code that best predicts a sample, updating the
+|   predictor and step index as the decoder will.
+|___________________________________________________________________*/
+
+static int Encode_Sample(int sample, int* predictor, int* index)
+{
+	int step, diff, code;
+
+	step = step_table[*index];
+	diff = sample - *predictor;
+	code = 0;
+	if (diff < 0) {
+		code = 8;
+		diff = -diff;
+	}
+	if (diff >= step) {
+		code |= 4;
+		diff -= step;
+	}
+	if (diff >= step >> 1) {
+		code |= 2;
+		diff -= step >> 1;
+	}
+	if (diff >= step >> 2)
+		code |= 1;
+	Decode_Sample(code, predictor, index);
+
+	return (code);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Encode_Wav
+|
+| Input: Called from Find_Sounds()
+| Output: Encodes a 16-bit WAV file into a sound.  Returns true on
+|   success.
+|___________________________________________________________________*/
+
+int Adpcm_Encode_Wav(const char* filename, AdpcmSound* sound)
+{
+	unsigned char* data;
+	DWORD size;
+	Wav wav;
+	bool ok;
+
+	memset(sound, 0, sizeof(AdpcmSound));
+	if (NOT Read_File(filename, &data, &size))
+		return (FALSE);
+	ok = Parse_Wav(data, size, &wav) &&
+	     Adpcm_Encode(wav.pcm, wav.channels, wav.sample_rate, wav.num_samples, wav.loop_start, wav.loop_end, sound);
+	free(data);
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Encode_Directory
+|
+| Input: Called from Program_Run()
+| Output: Encodes each WAV file in a directory to an .adp file beside
+|   it and writes their sizes and signal to noise ratios to the debug
+|   file.  Returns the # of files encoded.
+|___________________________________________________________________*/
+
+int Adpcm_Encode_Directory(const char* directory)
+{
+	int count;
+	char filename[MAX_PATH], str[512];
+	unsigned char* data;
+	unsigned adp_bytes, total_wav, total_adp;
+	DWORD size;
+	HANDLE find;
+	WIN32_FIND_DATAA find_data;
+	Wav wav;
+	AdpcmSound sound;
+
+	count = 0;
+	total_wav = total_adp = 0;
+	sprintf(filename, "%s\\*.wav", directory);
+	find = FindFirstFileA(filename, &find_data);
+	if (find == INVALID_HANDLE_VALUE)
+		return (0);
+
+	debug_WriteFile("_______________ ADPCM Encoder ____________");
+	do {
+		sprintf(filename, "%s\\%s", directory, find_data.cFileName);
+		if (NOT Read_File(filename, &data, &size))
+			continue;
+		if (NOT Parse_Wav(data, size, &wav)) {
+			sprintf(str, "%s: not a 16-bit mono or stereo WAV file", find_data.cFileName);
+			debug_WriteFile(str);
+			free(data);
+			continue;
+		}
+		if (Adpcm_Encode(wav.pcm, wav.channels, wav.sample_rate, wav.num_samples, wav.loop_start, wav.loop_end, &sound)) {
+			strcpy(strrchr(filename, '.'), ".adp");
+			if (Adpcm_Save(filename, &sound)) {
+				adp_bytes = sizeof(FileHeader) + sound.num_blocks * sound.channels * ADPCM_BLOCK_BYTES;
+				sprintf(str, "%s: %.1f s, %d channel(s), loop %u-%u, %u -> %u bytes (%.2fx), SNR %.1f dB",
+					find_data.cFileName, (float)wav.num_samples / wav.sample_rate, wav.channels, sound.loop_start, sound.loop_end,
+					(unsigned)size, adp_bytes, (float)size / adp_bytes, Measure_SNR(&sound, wav.pcm));
+				total_wav += size;
+				total_adp += adp_bytes;
+				count++;
+			}
+			else
+				sprintf(str, "%s: can't write %s", find_data.cFileName, filename);
+			Adpcm_Free(&sound);
+		}
+		else
+			sprintf(str, "%s: out of memory", find_data.cFileName);
+		debug_WriteFile(str);
+		free(data);
+	} while (FindNextFileA(find, &find_data));
+	FindClose(find);
+
+	if (total_adp) {
+		sprintf(str, "total: %u -> %u bytes (%.2fx)", total_wav, total_adp, (float)total_wav / total_adp);
+		debug_WriteFile(str);
+	}
+	debug_WriteFile("__________________________________________");
+
+	return (count);
+}
+
+/*____________________________________________________________________
+|
+| Function: Measure_SNR
+|
+| Input: Called from Adpcm_Encode_Directory()
+| Output: Returns the signal to noise ratio (dB) of a sound decoded,
+|   against the samples it was encoded from.
+|___________________________________________________________________*/
+
+static double Measure_SNR(AdpcmSound* sound, const short* pcm)
+{
+	unsigned i, n, total;
+	double signal, noise, d;
+	short out[1024];
+	AdpcmVoice* voice;
+
+	voice = (AdpcmVoice*)malloc(sizeof(AdpcmVoice));
+	if (voice == NULL)
+		return (0);
+
+	signal = noise = 0;
+	total = sound->num_samples * sound->channels;
+	Adpcm_Voice_Init(voice, sound, FALSE);
+	while ((n = Adpcm_Read(voice, out, 1024 / sound->channels)) > 0) {
+		n *= sound->channels;
+		for (i = 0; i < n && total; i++, total--, pcm++) {
+			d = out[i] - *pcm;
+			signal += (double)*pcm * *pcm;
+			noise += d * d;
+		}
+	}
+	free(voice);
+
+	if (noise == 0)
+		return (99);
+	return (10 * log10(signal / noise));
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Save
+|
+| Input: Called from Adpcm_Encode_Directory()
+| Output: Writes a sound to an .adp file.  Returns true on success.
+|___________________________________________________________________*/
+
+int Adpcm_Save(const char* filename, AdpcmSound* sound)
+{
+	HANDLE file;
+	DWORD written, bytes;
+	FileHeader header;
+	bool ok;
+
+	memcpy(header.magic, ADPCM_MAGIC, 4);
+	header.version = ADPCM_VERSION;
+	header.channels = sound->channels;
+	header.sample_rate = sound->sample_rate;
+	header.num_samples = sound->num_samples;
+	header.loop_start = sound->loop_start;
+	header.loop_end = sound->loop_end;
+	header.num_blocks = sound->num_blocks;
+	bytes = sound->num_blocks * sound->channels * ADPCM_BLOCK_BYTES;
+
+	file = CreateFileA(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return (FALSE);
+	ok = WriteFile(file, &header, sizeof(header), &written, NULL) && written == sizeof(header) &&
+	     WriteFile(file, sound->data, bytes, &written, NULL) && written == bytes;
+	CloseHandle(file);
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Load
+|
+| Input: Called to play a sound through a voice
+| Output: Reads a sound from an .adp file, kept compressed.  Returns
+|   true on success.  Call Adpcm_Free() when done with the sound.
+|___________________________________________________________________*/
+
+int Adpcm_Load(const char* filename, AdpcmSound* sound)
+{
+	HANDLE file;
+	DWORD read, bytes;
+	bool ok;
+
+	memset(sound, 0, sizeof(AdpcmSound));
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return (FALSE);
+
+	ok = Read_Header(file, sound);
+	if (ok) {
+		bytes = sound->num_blocks * sound->channels * ADPCM_BLOCK_BYTES;
+		sound->data = (unsigned char*)malloc(bytes);
+		ok = sound->data && ReadFile(file, sound->data, bytes, &read, NULL) && read == bytes;
+	}
+	CloseHandle(file);
+	if (NOT ok) {
+		Adpcm_Free(sound);
+		return (FALSE);
+	}
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Read_Header
+|
+| Input: Called from Adpcm_Load(), Adpcm_Open()
+| Output: Reads and checks the header of an .adp file, leaving the file
+|   at its first block, and sets the sound's format from it (not its
+|   data).  Returns true on success.
+|___________________________________________________________________*/
+
+static bool Read_Header(HANDLE file, AdpcmSound* sound)
+{
+	DWORD read;
+	FileHeader header;
+
+	if (NOT (ReadFile(file, &header, sizeof(header), &read, NULL) && read == sizeof(header) &&
+	         memcmp(header.magic, ADPCM_MAGIC, 4) == 0 && header.version == ADPCM_VERSION &&
+	         header.channels >= 1 && header.channels <= ADPCM_MAX_CHANNELS &&
+	         header.num_samples > 0 && header.num_blocks == (header.num_samples + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES &&
+	         header.loop_start < header.loop_end && header.loop_end <= header.num_samples))
+		return (false);
+
+	sound->channels = header.channels;
+	sound->sample_rate = header.sample_rate;
+	sound->num_samples = header.num_samples;
+	sound->loop_start = header.loop_start;
+	sound->loop_end = header.loop_end;
+	sound->num_blocks = header.num_blocks;
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Free
+|
+| Input: Called from Adpcm_Encode_Directory(), Adpcm_Load(),
+|   Bench_Run()
+| Output: Frees a sound's blocks.
+|___________________________________________________________________*/
+
+void Adpcm_Free(AdpcmSound* sound)
+{
+	free(sound->data);
+	sound->data = NULL;
+	sound->num_blocks = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Voice_Init
+|
+| Input: Called from Measure_SNR(), Run_Decode_ADPCM()
+| Output: Starts a voice playing a sound from its first sample.
+|___________________________________________________________________*/
+
+void Adpcm_Voice_Init(AdpcmVoice* voice, AdpcmSound* sound, int loop)
+{
+	voice->sound = sound;
+	voice->loop = loop;
+	voice->position = 0;
+	voice->first_block = 0;
+	voice->num_decoded = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Seek
+|
+| Input: Called from Run_Decode_ADPCM()
+| Output: Moves a voice to a sample (from the start of the sound).
+|___________________________________________________________________*/
+
+void Adpcm_Seek(AdpcmVoice* voice, unsigned sample)
+{
+	voice->position = sample < voice->sound->num_samples ? sample : voice->sound->num_samples;
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Read
+|
+| Input: Called from Measure_SNR(), Run_Decode_ADPCM()
+| Output: Reads up to frames samples per channel (interleaved) from a
+|   voice, decoding blocks as it reaches them and wrapping at the loop
+|   end if it loops.  Returns the # of frames read, fewer only at the
+|   end of a sound that doesn't loop.
+|___________________________________________________________________*/
+
+unsigned Adpcm_Read(AdpcmVoice* voice, short* out, unsigned frames)
+{
+	return (Read_Frames(voice->sound, &voice->position, voice->loop, out, frames, Voice_Block, voice));
+}
+
+/*____________________________________________________________________
+|
+| Function: Read_Frames
+|
+| Input: Called from Adpcm_Read(), Fill_Buffer()
+| Output: Reads up to frames samples per channel (interleaved) of a
+|   sound from position on, getting each block from read_block and
+|   wrapping at the loop end if loop is true.  Returns the # of frames
+|   read, fewer at the end of a sound that doesn't loop or if a block
+|   can't be read.
+|___________________________________________________________________*/
+
+static unsigned Read_Frames(AdpcmSound* sound, unsigned* position, int loop, short* out, unsigned frames, BlockReader read_block, void* reader)
+{
+	unsigned done, end, offset, n, i;
+	const short *left, *right;
+
+	end = loop ? sound->loop_end : sound->num_samples;
+	for (done = 0; done < frames; done += n) {
+		if (*position >= end) {
+			if (NOT loop)
+				break;
+			*position = sound->loop_start;
+		}
+		offset = *position % ADPCM_BLOCK_SAMPLES;
+		left = read_block(reader, *position / ADPCM_BLOCK_SAMPLES);
+		if (left == NULL)
+			break;
+		left += offset;
+
+		n = ADPCM_BLOCK_SAMPLES - offset;
+		if (n > end - *position)
+			n = end - *position;
+		if (n > frames - done)
+			n = frames - done;
+		if (sound->channels == 1)
+			memcpy(out + done, left, n * sizeof(short));
+		else {
+			// Interleave the channels
+			right = left + ADPCM_BLOCK_SAMPLES;
+			i = 0;
+			if (use_simd)
+				for (; i + 8 <= n; i += 8) {
+					__m128i l = _mm_loadu_si128((__m128i*)(left + i));
+					__m128i r = _mm_loadu_si128((__m128i*)(right + i));
+					_mm_storeu_si128((__m128i*)(out + (done + i) * 2), _mm_unpacklo_epi16(l, r));
+					_mm_storeu_si128((__m128i*)(out + (done + i) * 2 + 8), _mm_unpackhi_epi16(l, r));
+				}
+			for (; i < n; i++) {
+				out[(done + i) * 2] = left[i];
+				out[(done + i) * 2 + 1] = right[i];
+			}
+		}
+		*position += n;
+	}
+
+	return (done);
+}
+
+/*____________________________________________________________________
+|
+| Function: Voice_Block
+|
+| Input: Called from Read_Frames()
+| Output: Returns a block of a voice's sound, decoding it and the
+|   blocks after it if the voice doesn't hold it.
+|___________________________________________________________________*/
+
+static const short* Voice_Block(void* reader, unsigned block)
+{
+	AdpcmVoice* voice = (AdpcmVoice*)reader;
+
+	if (block < voice->first_block || block >= voice->first_block + voice->num_decoded)
+		Decode_Blocks(voice, block);
+
+	return (voice->pcm + (block - voice->first_block) * voice->sound->channels * ADPCM_BLOCK_SAMPLES);
+}
+
+/*____________________________________________________________________
+|
+| Function: Decode_Blocks
+|
+| Input: Called from Voice_Block()
+| Output: Decodes as many blocks from block on as the voice has lanes
+|   for.
+|___________________________________________________________________*/
+
+static void Decode_Blocks(AdpcmVoice* voice, unsigned block)
+{
+	int lane, lanes;
+	unsigned blocks;
+	const unsigned char* in[ADPCM_VOICE_LANES];
+	short* out[ADPCM_VOICE_LANES];
+	AdpcmSound* sound = voice->sound;
+
+	blocks = ADPCM_VOICE_LANES / sound->channels;
+	if (blocks > sound->num_blocks - block)
+		blocks = sound->num_blocks - block;
+	lanes = blocks * sound->channels;
+
+	// A block's channels are in turn, so the lanes' channel blocks are too
+	for (lane = 0; lane < ADPCM_VOICE_LANES; lane++) {
+		in[lane] = sound->data + (block * sound->channels + (lane < lanes ? lane : 0)) * ADPCM_BLOCK_BYTES;
+		out[lane] = voice->pcm + lane * ADPCM_BLOCK_SAMPLES;
+	}
+	if (use_simd)
+		Decode_Lanes(in, out);
+	else
+		for (lane = 0; lane < lanes; lane++)
+			Decode_Lane(in[lane], out[lane]);
+
+	voice->first_block = block;
+	voice->num_decoded = blocks;
+	stats.blocks_decoded += lanes;
+}
+
+/*____________________________________________________________________
+|
+| Function: Decode_Lanes
+|
+| Input: Called from Decode_Blocks()
+| Output: Decodes ADPCM_VOICE_LANES channel blocks at once with SSE2,
+|   exactly as Decode_Lane() does each.
+|___________________________________________________________________*/
+
+static void Decode_Lanes(const unsigned char** in, short** out)
+{
+	int i, k, lane;
+	short index_lanes[8];
+	__m128i predictor, index, word_lo, word_hi, code, step, low, high, sign, grows, sample[8];
+	__m128i a0, a1, a2, a3, a4, a5, a6, a7, b0, b1, b2, b3, b4, b5, b6, b7;
+	const __m128i nibble = _mm_set1_epi32(15), one = _mm_set1_epi16(1), two = _mm_set1_epi16(2),
+	              four = _mm_set1_epi16(4), seven = _mm_set1_epi16(7), eight = _mm_set1_epi16(8),
+	              three = _mm_set1_epi16(3), minus_one = _mm_set1_epi16(-1), zero = _mm_setzero_si128(),
+	              max_index = _mm_set1_epi16(ADPCM_MAX_INDEX);
+
+	for (lane = 0; lane < 8; lane++) {
+		out[lane][0] = *(const short*)in[lane];
+		index_lanes[lane] = in[lane][2] > ADPCM_MAX_INDEX ? ADPCM_MAX_INDEX : in[lane][2];
+	}
+	predictor = _mm_setr_epi16(out[0][0], out[1][0], out[2][0], out[3][0], out[4][0], out[5][0], out[6][0], out[7][0]);
+	index = _mm_loadu_si128((__m128i*)index_lanes);
+
+	for (i = 0; i < ADPCM_CODES / 8; i++) {
+		// Each lane's next 8 codes
+		word_lo = _mm_setr_epi32(*(const int*)(in[0] + 4 + i * 4), *(const int*)(in[1] + 4 + i * 4),
+		                         *(const int*)(in[2] + 4 + i * 4), *(const int*)(in[3] + 4 + i * 4));
+		word_hi = _mm_setr_epi32(*(const int*)(in[4] + 4 + i * 4), *(const int*)(in[5] + 4 + i * 4),
+		                         *(const int*)(in[6] + 4 + i * 4), *(const int*)(in[7] + 4 + i * 4));
+		for (k = 0; k < 8; k++) {
+			code = _mm_packs_epi32(_mm_and_si128(word_lo, nibble), _mm_and_si128(word_hi, nibble));
+			word_lo = _mm_srli_epi32(word_lo, 4);
+			word_hi = _mm_srli_epi32(word_hi, 4);
+
+			_mm_storeu_si128((__m128i*)index_lanes, index);
+			step = _mm_setr_epi16(step_table[index_lanes[0]], step_table[index_lanes[1]], step_table[index_lanes[2]], step_table[index_lanes[3]],
+			                      step_table[index_lanes[4]], step_table[index_lanes[5]], step_table[index_lanes[6]], step_table[index_lanes[7]]);
+
+			// The difference in two parts that each fit a signed short: both have the code's sign, so
+			// saturating after each clamps the same as after the sum
+			low = _mm_add_epi16(_mm_srli_epi16(step, 3),
+			      _mm_add_epi16(_mm_and_si128(_mm_srli_epi16(step, 1), _mm_cmpeq_epi16(_mm_and_si128(code, two), two)),
+			                    _mm_and_si128(_mm_srli_epi16(step, 2), _mm_cmpeq_epi16(_mm_and_si128(code, one), one))));
+			high = _mm_and_si128(step, _mm_cmpeq_epi16(_mm_and_si128(code, four), four));
+			sign = _mm_cmpeq_epi16(_mm_and_si128(code, eight), eight);
+			predictor = _mm_subs_epi16(_mm_adds_epi16(predictor, _mm_andnot_si128(sign, low)), _mm_and_si128(sign, low));
+			predictor = _mm_subs_epi16(_mm_adds_epi16(predictor, _mm_andnot_si128(sign, high)), _mm_and_si128(sign, high));
+			sample[k] = predictor;
+
+			// index += -1 for codes 0-3, else 2, 4, 6, 8
+			code = _mm_and_si128(code, seven);
+			grows = _mm_cmpgt_epi16(code, three);
+			index = _mm_add_epi16(index, _mm_or_si128(_mm_and_si128(grows, _mm_slli_epi16(_mm_sub_epi16(code, three), 1)), _mm_andnot_si128(grows, minus_one)));
+			index = _mm_min_epi16(_mm_max_epi16(index, zero), max_index);
+		}
+
+		// Transpose the 8 samples of 8 lanes into 8 samples of each lane
+		a0 = _mm_unpacklo_epi16(sample[0], sample[1]);
+		a1 = _mm_unpackhi_epi16(sample[0], sample[1]);
+		a2 = _mm_unpacklo_epi16(sample[2], sample[3]);
+		a3 = _mm_unpackhi_epi16(sample[2], sample[3]);
+		a4 = _mm_unpacklo_epi16(sample[4], sample[5]);
+		a5 = _mm_unpackhi_epi16(sample[4], sample[5]);
+		a6 = _mm_unpacklo_epi16(sample[6], sample[7]);
+		a7 = _mm_unpackhi_epi16(sample[6], sample[7]);
+		b0 = _mm_unpacklo_epi32(a0, a2);
+		b1 = _mm_unpackhi_epi32(a0, a2);
+		b2 = _mm_unpacklo_epi32(a1, a3);
+		b3 = _mm_unpackhi_epi32(a1, a3);
+		b4 = _mm_unpacklo_epi32(a4, a6);
+		b5 = _mm_unpackhi_epi32(a4, a6);
+		b6 = _mm_unpacklo_epi32(a5, a7);
+		b7 = _mm_unpackhi_epi32(a5, a7);
+		_mm_storeu_si128((__m128i*)(out[0] + 1 + i * 8), _mm_unpacklo_epi64(b0, b4));
+		_mm_storeu_si128((__m128i*)(out[1] + 1 + i * 8), _mm_unpackhi_epi64(b0, b4));
+		_mm_storeu_si128((__m128i*)(out[2] + 1 + i * 8), _mm_unpacklo_epi64(b1, b5));
+		_mm_storeu_si128((__m128i*)(out[3] + 1 + i * 8), _mm_unpackhi_epi64(b1, b5));
+		_mm_storeu_si128((__m128i*)(out[4] + 1 + i * 8), _mm_unpacklo_epi64(b2, b6));
+		_mm_storeu_si128((__m128i*)(out[5] + 1 + i * 8), _mm_unpackhi_epi64(b2, b6));
+		_mm_storeu_si128((__m128i*)(out[6] + 1 + i * 8), _mm_unpacklo_epi64(b3, b7));
+		_mm_storeu_si128((__m128i*)(out[7] + 1 + i * 8), _mm_unpackhi_epi64(b3, b7));
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Decode_Lane
+|
+| Input: Called from Decode_Blocks(), Source_Block()
+| Output: Decodes a channel block.
+|___________________________________________________________________*/
+
+static void Decode_Lane(const unsigned char* in, short* out)
+{
+	int i, predictor, index;
+
+	predictor = *(const short*)in;
+	index = in[2] > ADPCM_MAX_INDEX ? ADPCM_MAX_INDEX : in[2];
+	out[0] = (short)predictor;
+	for (i = 0; i < ADPCM_CODES; i++) {
+		Decode_Sample((in[4 + i / 2] >> ((i & 1) * 4)) & 15, &predictor, &index);
+		out[i + 1] = (short)predictor;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Decode_Sample
+|
+| Input: Called from Encode_Sample(), Decode_Lane()
+| Output: Updates the predictor (the decoded sample) and step index
+|   from a code.
+|___________________________________________________________________*/
+
+static void Decode_Sample(int code, int* predictor, int* index)
+{
+	int step, diff;
+
+	step = step_table[*index];
+	diff = step >> 3;
+	if (code & 4)
+		diff += step;
+	if (code & 2)
+		diff += step >> 1;
+	if (code & 1)
+		diff += step >> 2;
+	*predictor += (code & 8) ? -diff : diff;
+	if (*predictor > 32767)
+		*predictor = 32767;
+	else if (*predictor < -32768)
+		*predictor = -32768;
+	*index += index_table[code];
+	if (*index < 0)
+		*index = 0;
+	else if (*index > ADPCM_MAX_INDEX)
+		*index = ADPCM_MAX_INDEX;
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Stream_Init
+|
+| Input: Called from Program_Run()
+| Output: Starts the thread that feeds streamed sounds to their
+|   devices.  Returns true on success.
+|___________________________________________________________________*/
+
+int Adpcm_Stream_Init()
+{
+	num_sources = 0;
+	InitializeCriticalSection(&lock);
+
+	stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	buffer_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (stop_event && buffer_event)
+		stream_thread = CreateThread(NULL, 0, Stream_Thread, NULL, 0, NULL);
+
+	return (stream_thread != NULL);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Stream_Free
+|
+| Input: Called from Program_Run()
+| Output: Stops the streamed sounds and frees them.  Sounds loaded into
+|   the toolkit are freed by snd_Free().
+|___________________________________________________________________*/
+
+void Adpcm_Stream_Free()
+{
+	int i, b;
+	Source* s;
+
+	if (stream_thread) {
+		SetEvent(stop_event);
+		WaitForSingleObject(stream_thread, INFINITE);
+		CloseHandle(stream_thread);
+		stream_thread = NULL;
+	}
+	for (i = 0; i < num_sources; i++) {
+		s = &sources[i];
+		if (s->device) {
+			waveOutReset(s->device);
+			for (b = 0; b < ADPCM_STREAM_BUFFERS; b++)
+				waveOutUnprepareHeader(s->device, &s->headers[b], sizeof(WAVEHDR));
+			waveOutClose(s->device);
+		}
+		if (s->file != INVALID_HANDLE_VALUE)
+			CloseHandle(s->file);
+		free(s->block);
+		free(s->pcm);
+		free(s->buffers);
+	}
+	num_sources = 0;
+	if (stop_event) {
+		CloseHandle(stop_event);
+		stop_event = NULL;
+	}
+	if (buffer_event) {
+		CloseHandle(buffer_event);
+		buffer_event = NULL;
+	}
+	DeleteCriticalSection(&lock);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Open
+|
+| Input: Called from Program_Run()
+| Output: Opens a sound to stream from its .adp file (the WAV
+|   filename's extension changed), else loads it into the toolkit from
+|   the WAV file.  Returns the sound or ADPCM_INVALID_SOURCE.
+|___________________________________________________________________*/
+
+AdpcmSource Adpcm_Open(const char* filename, int flags)
+{
+	int b;
+	unsigned block_bytes, pcm_bytes, buffer_bytes;
+	char adp_filename[MAX_PATH];
+	char* extension;
+	WAVEFORMATEX format;
+	Source* s;
+
+	if (num_sources == ADPCM_MAX_SOURCES) {
+		stats.failures++;
+		return (ADPCM_INVALID_SOURCE);
+	}
+	s = &sources[num_sources];
+	memset(s, 0, sizeof(Source));
+	s->volume = 100;
+
+	sprintf(adp_filename, "%.*s", MAX_PATH - 5, filename);
+	extension = strrchr(adp_filename, '.');
+	if (extension && strchr(extension, '\\') == NULL)
+		strcpy(extension, ".adp");
+	else
+		strcat(adp_filename, ".adp");
+
+	s->file = stream_thread ? CreateFileA(adp_filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL) : INVALID_HANDLE_VALUE;
+	if (s->file != INVALID_HANDLE_VALUE && Read_Header(s->file, &s->adpcm)) {
+		// Always a stereo device, so a mono sound can be panned
+		format.wFormatTag = WAVE_FORMAT_PCM;
+		format.nChannels = 2;
+		format.nSamplesPerSec = s->adpcm.sample_rate;
+		format.wBitsPerSample = 16;
+		format.nBlockAlign = (WORD)(2 * sizeof(short));
+		format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+		format.cbSize = 0;
+		block_bytes = s->adpcm.channels * ADPCM_BLOCK_BYTES;
+		pcm_bytes = s->adpcm.channels * ADPCM_BLOCK_SAMPLES * sizeof(short);
+		buffer_bytes = ADPCM_STREAM_FRAMES * format.nBlockAlign;
+		s->block = (unsigned char*)malloc(block_bytes);
+		s->pcm = (short*)malloc(pcm_bytes);
+		s->buffers = (short*)malloc(ADPCM_STREAM_BUFFERS * buffer_bytes);
+		s->decoded = ADPCM_NO_BLOCK;
+		if (s->block && s->pcm && s->buffers && waveOutOpen(&s->device, WAVE_MAPPER, &format, (DWORD_PTR)buffer_event, 0, CALLBACK_EVENT) == MMSYSERR_NOERROR) {
+			for (b = 0; b < ADPCM_STREAM_BUFFERS; b++) {
+				s->headers[b].lpData = (LPSTR)s->buffers + b * buffer_bytes;
+				s->headers[b].dwBufferLength = buffer_bytes;
+				waveOutPrepareHeader(s->device, &s->headers[b], sizeof(WAVEHDR));
+			}
+			stats.loads++;
+			stats.compressed_bytes += sizeof(FileHeader) + s->adpcm.num_blocks * s->adpcm.channels * ADPCM_BLOCK_BYTES;
+			stats.pcm_bytes += s->adpcm.num_samples * s->adpcm.channels * sizeof(short);
+			stats.resident_bytes += block_bytes + pcm_bytes + ADPCM_STREAM_BUFFERS * buffer_bytes;
+			return (num_sources++);
+		}
+		s->device = NULL;
+		free(s->block);
+		free(s->pcm);
+		free(s->buffers);
+		s->block = NULL;
+		s->pcm = NULL;
+		s->buffers = NULL;
+		stats.failures++;
+	}
+	else
+		stats.wav_loads++;
+	if (s->file != INVALID_HANDLE_VALUE)
+		CloseHandle(s->file);
+	s->file = INVALID_HANDLE_VALUE;
+
+	s->sound = snd_LoadSound(filename, flags, 0);
+	if (s->sound == 0) {
+		stats.failures++;
+		return (ADPCM_INVALID_SOURCE);
+	}
+
+	return (num_sources++);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Play
+|
+| Input: Called from Program_Run()
+| Output: Plays a sound from its start, looping it if loop is true.
+|___________________________________________________________________*/
+
+void Adpcm_Play(AdpcmSource source, int loop)
+{
+	int b;
+	Source* s;
+
+	if (source == ADPCM_INVALID_SOURCE)
+		return;
+	s = &sources[source];
+	if (s->sound) {
+		snd_PlaySound(s->sound, loop);
+		return;
+	}
+
+	EnterCriticalSection(&lock);
+	waveOutReset(s->device);
+	s->position = 0;
+	s->loop = loop;
+	s->playing = true;
+	for (b = 0; b < ADPCM_STREAM_BUFFERS; b++)
+		s->queued[b] = Fill_Buffer(s, b);
+	LeaveCriticalSection(&lock);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Stop
+|
+| Input: Called from Program_Run()
+| Output: Stops a sound.
+|___________________________________________________________________*/
+
+void Adpcm_Stop(AdpcmSource source)
+{
+	int b;
+	Source* s;
+
+	if (source == ADPCM_INVALID_SOURCE)
+		return;
+	s = &sources[source];
+	if (s->sound) {
+		snd_StopSound(s->sound);
+		return;
+	}
+
+	EnterCriticalSection(&lock);
+	s->playing = false;
+	waveOutReset(s->device);
+	for (b = 0; b < ADPCM_STREAM_BUFFERS; b++)
+		s->queued[b] = false;
+	LeaveCriticalSection(&lock);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Is_Playing
+|
+| Input: Called from Program_Run()
+| Output: Returns true if a sound is playing.
+|___________________________________________________________________*/
+
+int Adpcm_Is_Playing(AdpcmSource source)
+{
+	int playing;
+	Source* s;
+
+	if (source == ADPCM_INVALID_SOURCE)
+		return (FALSE);
+	s = &sources[source];
+	if (s->sound)
+		return (snd_IsPlaying(s->sound));
+
+	EnterCriticalSection(&lock);
+	playing = s->playing;
+	LeaveCriticalSection(&lock);
+
+	return (playing);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Set_Volume
+|
+| Input: Called from Program_Run(), Apply_Emitter()
+| Output: Sets the volume (0-100) of a sound.  A streamed sound's
+|   samples are scaled by it as they're decoded, so a change is heard
+|   once the buffers already queued have played.
+|___________________________________________________________________*/
+
+void Adpcm_Set_Volume(AdpcmSource source, int volume)
+{
+	Source* s;
+
+	if (source == ADPCM_INVALID_SOURCE)
+		return;
+	s = &sources[source];
+	if (s->sound)
+		snd_SetSoundVolume(s->sound, volume);
+	else
+		s->volume = volume < 0 ? 0 : volume > 100 ? 100 : volume;
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Set_Pan
+|
+| Input: Called from Apply_Emitter()
+| Output: Sets the pan of a streamed sound, from -100 (left) to 100
+|   (right), heard once the buffers already queued have played.  A
+|   sound loaded into the toolkit isn't panned (3D control positions
+|   it instead).
+|___________________________________________________________________*/
+
+void Adpcm_Set_Pan(AdpcmSource source, int pan)
+{
+	Source* s;
+
+	if (source == ADPCM_INVALID_SOURCE)
+		return;
+	s = &sources[source];
+	if (s->sound == 0)
+		s->pan = pan < -100 ? -100 : pan > 100 ? 100 : pan;
+}
+
+/*____________________________________________________________________
+|
+| Function: Stream_Thread
+|
+| Input: Called from Adpcm_Stream_Init()
+| Output: Refills the buffers the devices have played, until stopped.
+|___________________________________________________________________*/
+
+static DWORD WINAPI Stream_Thread(LPVOID param)
+{
+	int i;
+	HANDLE events[2] = { stop_event, buffer_event };
+
+	while (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+		EnterCriticalSection(&lock);
+		for (i = 0; i < num_sources; i++)
+			if (sources[i].playing)
+				Feed_Source(&sources[i]);
+		LeaveCriticalSection(&lock);
+	}
+
+	return (0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Feed_Source
+|
+| Input: Called from Stream_Thread()
+| Output: Refills a playing sound's buffers that have been played, and
+|   marks it stopped once the last one of a sound that doesn't loop
+|   has.
+|___________________________________________________________________*/
+
+static void Feed_Source(Source* s)
+{
+	int b;
+	bool queued = false;
+
+	for (b = 0; b < ADPCM_STREAM_BUFFERS; b++) {
+		if (s->queued[b] && (s->headers[b].dwFlags & WHDR_DONE))
+			s->queued[b] = Fill_Buffer(s, b);
+		queued = queued || s->queued[b];
+	}
+	if (NOT queued)
+		s->playing = false;
+}
+
+/*____________________________________________________________________
+|
+| Function: Fill_Buffer
+|
+| Input: Called from Adpcm_Play(), Feed_Source()
+| Output: Decodes the next ADPCM_STREAM_FRAMES (at most) of a sound
+|   into one of its buffers, at its volume and pan, and queues it on
+|   the device.  Returns false if the sound had nothing left to play.
+|___________________________________________________________________*/
+
+static bool Fill_Buffer(Source* s, int b)
+{
+	int i, left, right;
+	unsigned frames;
+	short* out;
+
+	out = (short*)s->headers[b].lpData;
+	frames = Read_Frames(&s->adpcm, &s->position, s->loop, out, ADPCM_STREAM_FRAMES, Source_Block, s);
+	if (frames == 0)
+		return (false);
+
+	// Pan by turning the other channel down, and scale both by the volume (in 1/10000ths)
+	left = s->volume * (s->pan > 0 ? 100 - s->pan : 100);
+	right = s->volume * (s->pan < 0 ? 100 + s->pan : 100);
+	if (s->adpcm.channels == 1)
+		// Spread over both channels, from the end back so it can be done in place
+		for (i = (int)frames - 1; i >= 0; i--) {
+			out[i * 2 + 1] = (short)(out[i] * right / 10000);
+			out[i * 2] = (short)(out[i] * left / 10000);
+		}
+	else if (left < 10000 || right < 10000)
+		for (i = 0; i < (int)frames; i++) {
+			out[i * 2] = (short)(out[i * 2] * left / 10000);
+			out[i * 2 + 1] = (short)(out[i * 2 + 1] * right / 10000);
+		}
+	// The end of a sound that doesn't loop is padded with silence
+	memset(out + frames * 2, 0, (ADPCM_STREAM_FRAMES - frames) * 2 * sizeof(short));
+	waveOutWrite(s->device, &s->headers[b], sizeof(WAVEHDR));
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: Source_Block
+|
+| Input: Called from Read_Frames()
+| Output: Returns a block of a streamed sound, reading it from the file
+|   and decoding it unless it's the block the sound last decoded.
+|   Returns NULL if it can't be read.  A single block is too few
+|   channel blocks for the SSE2 decoder's lanes, so it decodes one
+|   channel at a time.
+|___________________________________________________________________*/
+
+static const short* Source_Block(void* reader, unsigned block)
+{
+	int c;
+	DWORD read, bytes;
+	LARGE_INTEGER offset;
+	Source* s = (Source*)reader;
+
+	if (block != s->decoded) {
+		bytes = s->adpcm.channels * ADPCM_BLOCK_BYTES;
+		offset.QuadPart = sizeof(FileHeader) + (LONGLONG)block * bytes;
+		if (NOT (SetFilePointerEx(s->file, offset, NULL, FILE_BEGIN) && ReadFile(s->file, s->block, bytes, &read, NULL) && read == bytes))
+			return (NULL);
+		for (c = 0; c < s->adpcm.channels; c++)
+			Decode_Lane(s->block + c * ADPCM_BLOCK_BYTES, s->pcm + c * ADPCM_BLOCK_SAMPLES);
+		s->decoded = block;
+		stats.blocks_decoded += s->adpcm.channels;
+	}
+
+	return (s->pcm);
+}
+
+/*____________________________________________________________________
+|
+| Function: Read_File
+|
+| Input: Called from Adpcm_Encode_Wav(), Adpcm_Encode_Directory()
+| Output: Reads a whole file into a malloc'd buffer.  Returns true on
+|   success.
+|___________________________________________________________________*/
+
+static bool Read_File(const char* filename, unsigned char** data, DWORD* size)
+{
+	HANDLE file;
+	DWORD read;
+	bool ok;
+
+	*data = NULL;
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return (false);
+
+	*size = GetFileSize(file, NULL);
+	ok = (*size != INVALID_FILE_SIZE);
+	if (ok) {
+		*data = (unsigned char*)malloc(*size ? *size : 1);
+		ok = *data && ReadFile(file, *data, *size, &read, NULL) && read == *size;
+	}
+	CloseHandle(file);
+	if (NOT ok) {
+		free(*data);
+		*data = NULL;
+	}
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Parse_Wav
+|
+| Input: Called from Adpcm_Encode_Wav(), Adpcm_Encode_Directory()
+| Output: Finds the samples of a 16-bit mono or stereo WAV file, and
+|   its first loop if it has a sampler chunk.  Returns true if the
+|   file is one.
+|___________________________________________________________________*/
+
+static bool Parse_Wav(unsigned char* data, DWORD size, Wav* wav)
+{
+	unsigned pos, chunk_size, data_size;
+	int bits;
+
+	memset(wav, 0, sizeof(Wav));
+	if (size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4))
+		return (false);
+
+	bits = 0;
+	data_size = 0;
+	for (pos = 12; pos + 8 <= size; pos += 8 + chunk_size + (chunk_size & 1)) {
+		chunk_size = *(unsigned*)(data + pos + 4);
+		if (chunk_size > size - pos - 8)
+			chunk_size = size - pos - 8;
+		if (memcmp(data + pos, "fmt ", 4) == 0 && chunk_size >= 16) {
+			if (*(unsigned short*)(data + pos + 8) != 1)  // PCM
+				return (false);
+			wav->channels = *(unsigned short*)(data + pos + 10);
+			wav->sample_rate = *(int*)(data + pos + 12);
+			bits = *(unsigned short*)(data + pos + 22);
+		}
+		else if (memcmp(data + pos, "data", 4) == 0) {
+			wav->pcm = (const short*)(data + pos + 8);
+			data_size = chunk_size;
+		}
+		else if (memcmp(data + pos, "smpl", 4) == 0 && chunk_size >= 36 + 24 && *(unsigned*)(data + pos + 8 + 28) > 0) {
+			wav->loop_start = *(unsigned*)(data + pos + 8 + 36 + 8);
+			wav->loop_end = *(unsigned*)(data + pos + 8 + 36 + 12) + 1;  // stored as the last looped
+		}
+	}
+	if (bits != 16 || wav->channels < 1 || wav->channels > ADPCM_MAX_CHANNELS || wav->pcm == NULL)
+		return (false);
+	wav->num_samples = data_size / (wav->channels * 2);
+	if (wav->loop_end == 0)
+		wav->loop_end = wav->num_samples;
+
+	return (wav->num_samples > 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Use_SIMD
+|
+| Input: Called from Bench_Run()
+| Output: Turns the SSE2 decoder on or off.  Returns whether it was on.
+|___________________________________________________________________*/
+
+int Adpcm_Use_SIMD(int use)
+{
+	int was = use_simd;
+
+	use_simd = use ? TRUE : FALSE;
+
+	return (was);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adpcm_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns sound statistics.
+|___________________________________________________________________*/
+
+void Adpcm_Get_Stats(AdpcmStats* out)
+{
+	*out = stats;
+	out->simd = use_simd;
+}
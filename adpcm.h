@@ -0,0 +1,87 @@
+/*____________________________________________________________________
+|
+| File: adpcm.h
+|
+| Description: IMA-ADPCM sounds - a 4-bit compressed sound format with
+|   an offline encoder, an SSE2 block decoder and sample accurate
+|   seeking and looping.
+|___________________________________________________________________*/
+
+#ifndef _ADPCM_H_
+#define _ADPCM_H_
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define ADPCM_BLOCK_SAMPLES  2041  // per channel: the header's sample and 2040 4-bit codes
+#define ADPCM_BLOCK_BYTES    1024  // per channel
+#define ADPCM_MAX_CHANNELS   2
+#define ADPCM_VOICE_LANES    8     // channel blocks a voice decodes at once
+
+#define ADPCM_INVALID_SOURCE (-1)
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	int            channels;
+	int            sample_rate;
+	unsigned       num_samples;             // per channel
+	unsigned       loop_start, loop_end;    // samples, loop_end is one past the last looped
+	unsigned       num_blocks;
+	unsigned char* data;                    // each block has each channel's ADPCM_BLOCK_BYTES in turn
+} AdpcmSound;
+
+// Plays a sound, decoding blocks as they're read
+typedef struct {
+	AdpcmSound* sound;
+	unsigned    position;                   // next sample read
+	int         loop;                       // wrap from loop_end to loop_start, else stop at the end
+	unsigned    first_block, num_decoded;   // blocks in pcm
+	short       pcm[ADPCM_VOICE_LANES * ADPCM_BLOCK_SAMPLES];  // a channel block per lane, each block's channels in turn
+} AdpcmVoice;
+
+// A sound the game plays, streamed from its .adp file or loaded into the toolkit
+typedef int AdpcmSource;
+
+typedef struct {
+	unsigned           loads;               // sounds streamed from .adp files
+	unsigned           wav_loads;           // sounds with no .adp file
+	unsigned           failures;
+	unsigned           compressed_bytes;    // of the .adp files loaded
+	unsigned           pcm_bytes;           // the same sounds as 16-bit PCM
+	unsigned           resident_bytes;      // the block each is playing, compressed and decoded, and its stream buffers
+	unsigned long long blocks_decoded;      // channel blocks
+	int                simd;                // true if voices use the SSE2 decoder
+} AdpcmStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int         Adpcm_Encode (const short *pcm, int channels, int sample_rate, unsigned num_samples, unsigned loop_start, unsigned loop_end, AdpcmSound *sound);
+int         Adpcm_Encode_Wav (const char *filename, AdpcmSound *sound);
+int         Adpcm_Encode_Directory (const char *directory);
+int         Adpcm_Save (const char *filename, AdpcmSound *sound);
+int         Adpcm_Load (const char *filename, AdpcmSound *sound);
+void        Adpcm_Free (AdpcmSound *sound);
+void        Adpcm_Voice_Init (AdpcmVoice *voice, AdpcmSound *sound, int loop);
+void        Adpcm_Seek (AdpcmVoice *voice, unsigned sample);
+unsigned    Adpcm_Read (AdpcmVoice *voice, short *out, unsigned frames);
+int         Adpcm_Stream_Init ();
+void        Adpcm_Stream_Free ();
+AdpcmSource Adpcm_Open (const char *filename, int flags);
+void        Adpcm_Play (AdpcmSource source, int loop);
+void        Adpcm_Stop (AdpcmSource source);
+int         Adpcm_Is_Playing (AdpcmSource source);
+void        Adpcm_Set_Volume (AdpcmSource source, int volume);
+void        Adpcm_Set_Pan (AdpcmSource source, int pan);
+int         Adpcm_Use_SIMD (int use);
+void        Adpcm_Get_Stats (AdpcmStats *stats);
+
+#endif
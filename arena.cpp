@@ -0,0 +1,204 @@
+/*____________________________________________________________________
+|
+| File: arena.cpp
+|
+| Description: Linear (bump) memory arenas.
+|
+|   An arena is one block of memory reserved up front.  Allocating
+|   bumps an offset; nothing is freed individually, instead the whole
+|   arena is reset at once.  Growing the most recent allocation extends
+|   it in place.
+|
+|   Passing a NULL arena to the allocation functions uses the heap, so
+|   modules can take an optional arena and keep a single code path.
+|
+| Functions:  Arena_Create
+|             Arena_Free
+|             Arena_Alloc
+|             Arena_Realloc
+|             Arena_Dealloc
+|             Arena_Reset
+|             Arena_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "arena.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define ARENA_ALIGN  16
+
+#define ARENA_ROUND_UP(_n_)  (((_n_) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct ArenaData {
+	char*      base;      // aligned start of the memory
+	char*      memory;    // as allocated
+	unsigned   offset;    // next free byte
+	unsigned   last;      // offset of the most recent allocation
+	ArenaStats stats;
+};
+
+/*____________________________________________________________________
+|
+| Function: Arena_Create
+|
+| Input: Called from Program_Run()
+| Output: Returns a new arena of size bytes, or NULL on error.
+|___________________________________________________________________*/
+
+Arena Arena_Create(unsigned size)
+{
+	Arena arena;
+
+	arena = (Arena)calloc(1, sizeof(struct ArenaData));
+	if (arena) {
+		arena->memory = (char*)malloc(size + ARENA_ALIGN);
+		if (arena->memory == NULL) {
+			free(arena);
+			return (NULL);
+		}
+		arena->base = (char*)ARENA_ROUND_UP((size_t)arena->memory);
+		arena->stats.capacity = size;
+	}
+
+	return (arena);
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_Free
+|
+| Input: Called from Program_Run()
+| Output: Frees an arena and everything allocated from it.
+|___________________________________________________________________*/
+
+void Arena_Free(Arena arena)
+{
+	if (arena) {
+		free(arena->memory);
+		free(arena);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_Alloc
+|
+| Input: Called from Program_Run(), other modules
+| Output: Returns size bytes aligned to ARENA_ALIGN, or NULL if the
+|   arena is full.
+|___________________________________________________________________*/
+
+void* Arena_Alloc(Arena arena, unsigned size)
+{
+	unsigned offset;
+
+	if (arena == NULL)
+		return (malloc(size));
+
+	offset = ARENA_ROUND_UP(arena->offset);
+	if (size > arena->stats.capacity - offset || offset > arena->stats.capacity) {
+		arena->stats.failures++;
+		return (NULL);
+	}
+	arena->last = offset;
+	arena->offset = offset + size;
+
+	arena->stats.allocations++;
+	arena->stats.used = arena->offset;
+	if (arena->stats.used > arena->stats.peak)
+		arena->stats.peak = arena->stats.used;
+
+	return (arena->base + offset);
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_Realloc
+|
+| Input: Called from other modules
+| Output: Resizes a block (NULL to allocate), keeping its contents.
+|   The most recent allocation grows in place, others are copied.
+|   Returns NULL on error, leaving the block unchanged.
+|___________________________________________________________________*/
+
+void* Arena_Realloc(Arena arena, void* block, unsigned old_size, unsigned new_size)
+{
+	void* new_block;
+
+	if (arena == NULL)
+		return (realloc(block, new_size));
+
+	if (block && (char*)block == arena->base + arena->last && arena->last + new_size <= arena->stats.capacity) {
+		arena->offset = arena->last + new_size;
+		arena->stats.used = arena->offset;
+		if (arena->stats.used > arena->stats.peak)
+			arena->stats.peak = arena->stats.used;
+		return (block);
+	}
+
+	new_block = Arena_Alloc(arena, new_size);
+	if (new_block && block)
+		memcpy(new_block, block, old_size < new_size ? old_size : new_size);
+
+	return (new_block);
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_Dealloc
+|
+| Input: Called from other modules
+| Output: Frees a heap block.  Arena blocks are only released by
+|   Arena_Reset().
+|___________________________________________________________________*/
+
+void Arena_Dealloc(Arena arena, void* block)
+{
+	if (arena == NULL)
+		free(block);
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_Reset
+|
+| Input: Called from Program_Run()
+| Output: Releases everything allocated from an arena.
+|___________________________________________________________________*/
+
+void Arena_Reset(Arena arena)
+{
+	arena->offset = 0;
+	arena->last = 0;
+	arena->stats.used = 0;
+	arena->stats.resets++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Arena_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns arena statistics.
+|___________________________________________________________________*/
+
+void Arena_Get_Stats(Arena arena, ArenaStats* out)
+{
+	*out = arena->stats;
+}
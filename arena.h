@@ -0,0 +1,40 @@
+/*____________________________________________________________________
+|
+| File: arena.h
+|
+| Description: Linear (bump) memory arenas.
+|___________________________________________________________________*/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct ArenaData* Arena;
+
+typedef struct {
+	unsigned capacity;     // bytes
+	unsigned used;         // bytes in use now
+	unsigned peak;         // most bytes ever in use
+	unsigned allocations;
+	unsigned resets;
+	unsigned failures;     // allocations that didn't fit
+} ArenaStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+Arena Arena_Create (unsigned size);
+void  Arena_Free (Arena arena);
+void *Arena_Alloc (Arena arena, unsigned size);
+void *Arena_Realloc (Arena arena, void *block, unsigned old_size, unsigned new_size);
+void  Arena_Dealloc (Arena arena, void *block);
+void  Arena_Reset (Arena arena);
+void  Arena_Get_Stats (Arena arena, ArenaStats *stats);
+
+#endif
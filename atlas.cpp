@@ -0,0 +1,432 @@
+/*____________________________________________________________________
+|
+| File: atlas.cpp
+|
+| Description: Texture atlas - packs small textures into shared pages
+|   so sprites drawn with different images share a texture, and the
+|   render queue can draw them all with one texture bind.
+|
+|   Entries are registered by file and packed by Atlas_Build() into
+|   square power of 2 pages, the smallest that holds them all, else as
+|   many ATLAS_MAX_PAGE_SIZE pages as needed.  Packing is by shelves
+|   (rows) in order of decreasing height.  The toolkit only creates
+|   textures from files, so each page is written out as an image and
+|   alpha file pair and handed to the texture manager.
+|
+|   Each entry sits in a cell ATLAS_GUTTER texels wider on every side,
+|   filled by repeating the entry's edge texels, so filtering at the
+|   entry's edge doesn't pick up its neighbours.  Cells are aligned to
+|   ATLAS_ALIGN texels, so mip levels down to ATLAS_ALIGN times smaller
+|   never average texels from two entries.
+|
+|   Atlas_Map_Object() rewrites an object's texture coordinates into an
+|   entry's rect, so existing models draw with the page unchanged.
+|
+| Functions:  Atlas_Init
+|             Atlas_Free
+|             Atlas_Add
+|             Atlas_Build
+|							 Pack
+|             Atlas_Get_Texture
+|             Atlas_Get_Rect
+|             Atlas_Map_Object
+|             Atlas_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "bmp.h"
+#include "texmgr.h"
+#include "atlas.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define ATLAS_MAX_ENTRIES    32
+#define ATLAS_MAX_PAGES      4
+#define ATLAS_MIN_PAGE_SIZE  256
+#define ATLAS_MAX_PAGE_SIZE  2048
+#define ATLAS_GUTTER         8   // texels of repeated edge around each entry
+#define ATLAS_ALIGN          16  // texels, cells start and end on a multiple of this
+
+#define ATLAS_CELL(_n_)  (((_n_) + 2 * ATLAS_GUTTER + ATLAS_ALIGN - 1) & ~(ATLAS_ALIGN - 1))
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	char      filename[MAX_PATH];
+	char      alpha_filename[MAX_PATH];  // empty if none (opaque)
+	int       width, height;
+	int       page;
+	int       x, y;                      // top left texel in its page
+	AtlasRect rect;
+} Entry;
+
+typedef struct {
+	int page, x, y;
+} Place;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static int Pack(BmpImage* images, int page_size, int max_pages, Place* places);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static char       page_name[MAX_PATH];  // page files are page_name#.bmp, page_name#_FA.bmp
+static Entry      entries[ATLAS_MAX_ENTRIES];
+static int        num_entries;
+static TexId      pages[ATLAS_MAX_PAGES];
+static int        num_pages;
+static int        page_size;
+static AtlasStats stats;
+
+/*____________________________________________________________________
+|
+| Function: Atlas_Init
+|
+| Input: Called from Program_Run()
+| Output: Starts an empty atlas whose pages are written to files
+|   starting with page_filename.
+|___________________________________________________________________*/
+
+void Atlas_Init(const char* page_filename)
+{
+	memset(&stats, 0, sizeof(stats));
+	strncpy(page_name, page_filename, MAX_PATH - 16);
+	page_name[MAX_PATH - 16] = 0;
+	num_entries = 0;
+	num_pages = 0;
+	page_size = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Atlas_Free
+|
+| Input: Called from Program_Run()
+| Output: Forgets all entries.  The page textures belong to the
+|   texture manager and are freed with it.
+|___________________________________________________________________*/
+
+void Atlas_Free()
+{
+	num_entries = 0;
+	num_pages = 0;
+	page_size = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Atlas_Add
+|
+| Input: Called from Program_Run()
+| Output: Registers an image file, with an optional alpha file, to be
+|   packed by Atlas_Build().  Entries can't be added once the atlas is
+|   built.  Returns its id, or ATLAS_INVALID if there is no room.
+|___________________________________________________________________*/
+
+AtlasId Atlas_Add(const char* filename, const char* alpha_filename)
+{
+	Entry* e;
+
+	if (num_entries == ATLAS_MAX_ENTRIES || num_pages)
+		return (ATLAS_INVALID);
+
+	e = &entries[num_entries];
+	memset(e, 0, sizeof(Entry));
+	strncpy(e->filename, filename, MAX_PATH - 1);
+	if (alpha_filename)
+		strncpy(e->alpha_filename, alpha_filename, MAX_PATH - 1);
+	e->page = -1;
+	stats.entries++;
+
+	return (num_entries++);
+}
+
+/*____________________________________________________________________
+|
+| Function: Atlas_Build
+|
+| Input: Called from Program_Run(), Reload_Asset()
+| Output: Reads the entries' images, packs them and writes the pages.
+|   The first build adds the pages to the texture manager, later ones
+|   (after an entry's file changed) have it load them again.  A later
+|   build must give the same layout, since objects have been mapped to
+|   it.  Returns true on success, else keeps the last good pages.
+|___________________________________________________________________*/
+
+int Atlas_Build()
+{
+	int i, p, x, y, sx, sy, size, count;
+	BmpImage images[ATLAS_MAX_ENTRIES];
+	Place places[ATLAS_MAX_ENTRIES];
+	unsigned char *page, *alpha, *src, *dst;
+	char filename[MAX_PATH], alpha_filename[MAX_PATH], str[MAX_PATH + 64];
+	unsigned long long used;
+	bool ok;
+	LARGE_INTEGER freq, t0, t1;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+
+	memset(images, 0, sizeof(images));
+	ok = (num_entries > 0);
+	for (i = 0; i < num_entries && ok; i++) {
+		ok = Bmp_Load(entries[i].filename, entries[i].alpha_filename[0] ? entries[i].alpha_filename : 0, &images[i], NULL, 0);
+		if (NOT ok) {
+			sprintf(str, "Atlas can't read %s", entries[i].filename);
+			debug_WriteFile(str);
+		}
+	}
+
+	// The smallest single page that holds everything, else several of the largest
+	count = 0;
+	size = ATLAS_MIN_PAGE_SIZE;
+	if (ok) {
+		for (; size <= ATLAS_MAX_PAGE_SIZE && count == 0; size *= 2)
+			count = Pack(images, size, 1, places);
+		size /= 2;
+		if (count == 0)
+			count = Pack(images, size, ATLAS_MAX_PAGES, places);
+		if (count == 0)
+			debug_WriteFile("Atlas entries don't fit in the pages");
+		ok = (count > 0);
+	}
+
+	// Objects have been mapped to the current layout
+	if (ok && num_pages) {
+		ok = (count == num_pages && size == page_size);
+		for (i = 0; i < num_entries && ok; i++)
+			ok = (places[i].page == entries[i].page && places[i].x == entries[i].x && places[i].y == entries[i].y &&
+			      images[i].width == entries[i].width && images[i].height == entries[i].height);
+		if (NOT ok)
+			debug_WriteFile("Atlas layout changed, restart to repack");
+	}
+
+	page = NULL;
+	alpha = NULL;
+	if (ok) {
+		page = (unsigned char*)malloc(size * size * 4);
+		alpha = (unsigned char*)malloc(size * size * 4);
+		ok = (page && alpha);
+	}
+
+	for (p = 0; p < count && ok; p++) {
+		memset(page, 0, size * size * 4);
+		for (i = 0; i < num_entries; i++) {
+			if (places[i].page != p)
+				continue;
+			// Copy the entry into its cell, repeating its edge texels into the gutter
+			for (y = -ATLAS_GUTTER; y < images[i].height + ATLAS_GUTTER; y++) {
+				sy = y < 0 ? 0 : (y >= images[i].height ? images[i].height - 1 : y);
+				dst = page + ((places[i].y + y) * size + places[i].x - ATLAS_GUTTER) * 4;
+				for (x = -ATLAS_GUTTER; x < images[i].width + ATLAS_GUTTER; x++, dst += 4) {
+					sx = x < 0 ? 0 : (x >= images[i].width ? images[i].width - 1 : x);
+					src = images[i].texels + (sy * images[i].width + sx) * 4;
+					*(unsigned*)dst = *(unsigned*)src;
+				}
+			}
+		}
+		for (i = 0; i < size * size; i++)
+			alpha[i * 4] = alpha[i * 4 + 1] = alpha[i * 4 + 2] = page[i * 4 + 3];
+
+		sprintf(filename, "%s%d.bmp", page_name, p);
+		sprintf(alpha_filename, "%s%d_FA.bmp", page_name, p);
+		BmpImage page_image = { size, size, page, FALSE };
+		BmpImage alpha_image = { size, size, alpha, FALSE };
+		ok = Bmp_Save(filename, &page_image) && Bmp_Save(alpha_filename, &alpha_image);
+		if (NOT ok) {
+			sprintf(str, "Atlas can't write %s", filename);
+			debug_WriteFile(str);
+		}
+		else if (num_pages == 0)
+			pages[p] = TexMgr_Add(filename, alpha_filename, 0, 0);
+		else
+			TexMgr_Invalidate(pages[p]);
+	}
+
+	if (page)
+		free(page);
+	if (alpha)
+		free(alpha);
+	for (i = 0; i < num_entries; i++)
+		Bmp_Free(&images[i]);
+
+	if (NOT ok) {
+		stats.failures++;
+		return (FALSE);
+	}
+
+	used = 0;
+	for (i = 0; i < num_entries; i++) {
+		Entry* e = &entries[i];
+		e->width = images[i].width;
+		e->height = images[i].height;
+		e->page = places[i].page;
+		e->x = places[i].x;
+		e->y = places[i].y;
+		e->rect.u0 = (float)e->x / size;
+		e->rect.v0 = (float)e->y / size;
+		e->rect.u1 = (float)(e->x + e->width) / size;
+		e->rect.v1 = (float)(e->y + e->height) / size;
+		used += (unsigned long long)e->width * e->height;
+	}
+	num_pages = count;
+	page_size = size;
+
+	QueryPerformanceCounter(&t1);
+	stats.pages = count;
+	stats.page_size = size;
+	stats.fill = (unsigned)(used * 100 / ((unsigned long long)count * size * size));
+	stats.builds++;
+	stats.last_build_time = (float)((t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart);
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Pack
+|
+| Input: Called from Atlas_Build()
+| Output: Places the entries' cells on shelves in pages of a size.
+|   Returns the # of pages used, or 0 if they need more than max_pages.
+|___________________________________________________________________*/
+
+static int Pack(BmpImage* images, int size, int max_pages, Place* places)
+{
+	int i, j, n, w, h, page, x, y, shelf;
+	int order[ATLAS_MAX_ENTRIES];
+
+	// Tallest cells first, then widest
+	for (i = 0; i < num_entries; i++) {
+		n = i;
+		for (j = i; j > 0; j--) {
+			h = ATLAS_CELL(images[order[j - 1]].height) - ATLAS_CELL(images[n].height);
+			w = ATLAS_CELL(images[order[j - 1]].width) - ATLAS_CELL(images[n].width);
+			if (h > 0 || (h == 0 && w >= 0))
+				break;
+			order[j] = order[j - 1];
+		}
+		order[j] = n;
+	}
+
+	page = 0;
+	x = y = shelf = 0;
+	for (i = 0; i < num_entries; i++) {
+		n = order[i];
+		w = ATLAS_CELL(images[n].width);
+		h = ATLAS_CELL(images[n].height);
+		if (w > size || h > size)
+			return (0);
+		if (x + w > size) {
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		if (y + h > size) {
+			if (++page == max_pages)
+				return (0);
+			x = y = shelf = 0;
+		}
+		places[n].page = page;
+		places[n].x = x + ATLAS_GUTTER;
+		places[n].y = y + ATLAS_GUTTER;
+		x += w;
+		if (h > shelf)
+			shelf = h;
+	}
+
+	return (page + 1);
+}
+
+/*____________________________________________________________________
+|
+| Function: Atlas_Get_Texture
+|
+| Input: Called from Program_Run()
+| Output: Returns the texture manager id of an entry's page, or
+|   TEXMGR_INVALID if the atlas isn't built.
+|___________________________________________________________________*/
+
+TexId Atlas_Get_Texture(AtlasId id)
+{
+	if (id < 0 || id >= num_entries || num_pages == 0)
+		return (TEXMGR_INVALID);
+
+	return (pages[entries[id].page]);
+}
+
+/*____________________________________________________________________
+|
+| Function: Atlas_Get_Rect
+|
+| Input: Called from Program_Run(), Atlas_Map_Object()
+| Output: Returns the texture coordinates of an entry in its page, or
+|   the whole texture if the atlas isn't built.
+|___________________________________________________________________*/
+
+void Atlas_Get_Rect(AtlasId id, AtlasRect* rect)
+{
+	if (id < 0 || id >= num_entries || num_pages == 0) {
+		rect->u0 = rect->v0 = 0;
+		rect->u1 = rect->v1 = 1;
+	}
+	else
+		*rect = entries[id].rect;
+}
+
+/*____________________________________________________________________
+|
+| Function: Atlas_Map_Object
+|
+| Input: Called from Program_Run(), Reload_Asset() before the object is
+|   first drawn
+| Output: Maps an object's texture coordinates (0 to 1 over its image)
+|   into an entry's rect, so it draws with the entry's page.
+|___________________________________________________________________*/
+
+void Atlas_Map_Object(AtlasId id, gx3dObject* object)
+{
+	int i;
+	AtlasRect r;
+	gx3dObjectLayer* layer;
+
+	Atlas_Get_Rect(id, &r);
+	for (layer = object->layer; layer; layer = layer->next)
+		if (layer->num_tex_coords > 0 && layer->tex_coords[0])
+			for (i = 0; i < layer->num_vertices; i++) {
+				layer->tex_coords[0][i].u = r.u0 + layer->tex_coords[0][i].u * (r.u1 - r.u0);
+				layer->tex_coords[0][i].v = r.v0 + layer->tex_coords[0][i].v * (r.v1 - r.v0);
+			}
+}
+
+/*____________________________________________________________________
+|
+| Function: Atlas_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns atlas statistics.
+|___________________________________________________________________*/
+
+void Atlas_Get_Stats(AtlasStats* out)
+{
+	*out = stats;
+}
@@ -0,0 +1,57 @@
+/*____________________________________________________________________
+|
+| File: atlas.h
+|
+| Description: Texture atlas - packs small textures into shared pages
+|   so sprites drawn with different images share a texture.
+|___________________________________________________________________*/
+
+#ifndef _ATLAS_H_
+#define _ATLAS_H_
+
+#include "texmgr.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define ATLAS_INVALID  (-1)
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef int AtlasId;
+
+typedef struct {
+	float u0, v0;  // top left
+	float u1, v1;  // bottom right
+} AtlasRect;
+
+typedef struct {
+	unsigned entries;
+	unsigned pages;
+	unsigned page_size;      // texels on a side
+	unsigned fill;           // % of the page texels used by entries
+	unsigned builds;
+	unsigned failures;       // builds that failed (last good pages kept)
+	float    last_build_time;  // ms
+} AtlasStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+void        Atlas_Init (const char *page_filename);
+void        Atlas_Free ();
+AtlasId     Atlas_Add (const char *filename, const char *alpha_filename);
+int         Atlas_Build ();
+TexId       Atlas_Get_Texture (AtlasId id);
+void        Atlas_Get_Rect (AtlasId id, AtlasRect *rect);
+void        Atlas_Map_Object (AtlasId id, gx3dObject *object);
+void        Atlas_Get_Stats (AtlasStats *stats);
+
+#endif
@@ -0,0 +1,372 @@
+/*____________________________________________________________________
+|
+| File: audioprop.cpp
+|
+| Description: Occlusion of sound emitters by scene geometry.
+|
+|   Each emitter is sampled with a few rays from the listener to points
+|   spread around the emitter, counting the occluders (tree trunks)
+|   crossed.  The average count drives an attenuation in dB and a
+|   low-pass cutoff, both smoothed over time so an emitter fades behind
+|   a trunk rather than switching.  Only AUDIOPROP_RAY_BUDGET rays are
+|   cast per frame; emitters are sampled round robin, so with many
+|   emitters each one is refreshed less often instead of the frame
+|   costing more.
+|
+|   Sounds created with 3D control are distance attenuated by the sound
+|   library and only get the occlusion gain.  Other sounds also get a
+|   linear distance rolloff between min and max distance, and are
+|   panned toward the side of the listener the emitter is on.
+|
+| Functions:  AudioProp_Init
+|             AudioProp_Set_Occluders
+|             AudioProp_Free
+|             AudioProp_Add_Emitter
+|             AudioProp_Move_Emitter
+|             AudioProp_Update
+|							 Sample_Emitter
+|							 Apply_Emitter
+|             AudioProp_Get_Emitter_State
+|             AudioProp_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "audioprop.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define AUDIOPROP_MAX_EMITTERS     64
+#define AUDIOPROP_RAY_BUDGET       16      // rays per frame
+#define AUDIOPROP_RAYS_PER_SAMPLE  4       // rays per emitter sample
+#define AUDIOPROP_MAX_HITS         8       // occluders counted per ray
+#define AUDIOPROP_SPREAD           0.75f   // ray target offset around an emitter
+#define AUDIOPROP_SMOOTH_TIME      250.0f  // ms, time constant of the smoothing
+#define AUDIOPROP_DB_PER_HIT       3.0f    // attenuation per occluder
+#define AUDIOPROP_MAX_DB           18.0f
+#define AUDIOPROP_LOWPASS_OPEN     22050.0f  // Hz, cutoff with no occluders
+#define AUDIOPROP_LOWPASS_MIN      800.0f
+#define AUDIOPROP_LOWPASS_PER_HIT  0.6f    // cutoff scale per occluder
+#define AUDIOPROP_MAX_PAN          80      // pan of an emitter straight to the side, short of 100 so the far ear still hears it
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	AdpcmSource sound;
+	gx3dVector  position;
+	int         volume;          // unattenuated volume
+	bool        sound_is_3d;     // sound library handles distance
+	float       min_distance, max_distance;
+	float       target;          // occluders from the last sample
+	float       occlusion;       // smoothed
+	float       gain;
+	float       lowpass;
+	int         applied_volume;
+	int         applied_pan;
+} Emitter;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Sample_Emitter(Emitter* e, gx3dVector* listener);
+static void Apply_Emitter(Emitter* e, gx3dVector* listener, gx3dVector* heading);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static Bvh            occluder_bvh;
+static unsigned       occluder_mask;
+static Emitter        emitters[AUDIOPROP_MAX_EMITTERS];
+static int            num_emitters;
+static int            next_emitter;  // next emitter to sample
+static AudioPropStats stats;
+
+/*____________________________________________________________________
+|
+| Function: AudioProp_Init
+|
+| Input: Called from Program_Run()
+| Output: Initializes audio propagation.
+|___________________________________________________________________*/
+
+void AudioProp_Init()
+{
+	occluder_bvh = NULL;
+	num_emitters = 0;
+	next_emitter = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+/*____________________________________________________________________
+|
+| Function: AudioProp_Set_Occluders
+|
+| Input: Called from Program_Run()
+| Output: Sets the occluders to the entries of bvh with a type in mask.
+|___________________________________________________________________*/
+
+void AudioProp_Set_Occluders(Bvh bvh, unsigned mask)
+{
+	occluder_bvh = bvh;
+	occluder_mask = mask;
+}
+
+/*____________________________________________________________________
+|
+| Function: AudioProp_Free
+|
+| Input: Called from Program_Run()
+| Output: Frees audio propagation.
+|___________________________________________________________________*/
+
+void AudioProp_Free()
+{
+	occluder_bvh = NULL;
+	num_emitters = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: AudioProp_Add_Emitter
+|
+| Input: Called from Program_Run()
+| Output: Adds an emitter for a sound.  Returns the emitter or
+|   AUDIOPROP_INVALID_EMITTER.
+|___________________________________________________________________*/
+
+AudioEmitter AudioProp_Add_Emitter(AdpcmSource sound, gx3dVector* position, int volume, int sound_is_3d, float min_distance, float max_distance)
+{
+	Emitter* e;
+
+	if (num_emitters == AUDIOPROP_MAX_EMITTERS)
+		return (AUDIOPROP_INVALID_EMITTER);
+
+	e = &emitters[num_emitters];
+	e->sound = sound;
+	e->position = *position;
+	e->volume = volume;
+	e->sound_is_3d = sound_is_3d ? true : false;
+	e->min_distance = min_distance;
+	e->max_distance = max_distance;
+	e->target = 0;
+	e->occlusion = 0;
+	e->gain = 1;
+	e->lowpass = AUDIOPROP_LOWPASS_OPEN;
+	e->applied_volume = -1;  // force the first update
+	e->applied_pan = AUDIOPROP_MAX_PAN + 1;
+	stats.emitters++;
+
+	return (num_emitters++);
+}
+
+/*____________________________________________________________________
+|
+| Function: AudioProp_Move_Emitter
+|
+| Input: Called from Program_Run()
+| Output: Moves an emitter.  Its occlusion is resampled on its next
+|   turn.
+|___________________________________________________________________*/
+
+void AudioProp_Move_Emitter(AudioEmitter emitter, gx3dVector* position)
+{
+	emitters[emitter].position = *position;
+}
+
+/*____________________________________________________________________
+|
+| Function: AudioProp_Update
+|
+| Input: Called from Program_Run()
+| Output: Samples occlusion for as many emitters as the ray budget
+|   allows, then smooths and applies every emitter's parameters.
+|   heading is the direction the listener faces.
+|___________________________________________________________________*/
+
+void AudioProp_Update(gx3dVector* listener, gx3dVector* heading, unsigned elapsed_time)
+{
+	int i, samples;
+	unsigned frame_rays;
+	float k;
+	gx3dVector v;
+
+	if (occluder_bvh == NULL || num_emitters == 0)
+		return;
+
+	// Sample emitters round robin within the ray budget, each at most once per frame
+	frame_rays = 0;
+	samples = 0;
+	while (frame_rays + AUDIOPROP_RAYS_PER_SAMPLE <= AUDIOPROP_RAY_BUDGET && samples < num_emitters) {
+		Emitter* e = &emitters[next_emitter];
+		next_emitter = (next_emitter + 1) % num_emitters;
+		samples++;
+		// Emitters out of range are silent anyway
+		gx3d_SubtractVector(&e->position, listener, &v);
+		if (gx3d_VectorMagnitude(&v) >= e->max_distance)
+			continue;
+		Sample_Emitter(e, listener);
+		frame_rays += AUDIOPROP_RAYS_PER_SAMPLE;
+	}
+
+	// Exponential smoothing toward the last sample
+	k = 1 - expf(-(float)elapsed_time / AUDIOPROP_SMOOTH_TIME);
+	for (i = 0; i < num_emitters; i++) {
+		emitters[i].occlusion += (emitters[i].target - emitters[i].occlusion) * k;
+		Apply_Emitter(&emitters[i], listener, heading);
+	}
+
+	stats.frames++;
+	stats.rays += frame_rays;
+	if (frame_rays > stats.max_rays_per_frame)
+		stats.max_rays_per_frame = frame_rays;
+}
+
+/*____________________________________________________________________
+|
+| Function: Sample_Emitter
+|
+| Input: Called from AudioProp_Update()
+| Output: Sets the target occlusion of an emitter to the average # of
+|   occluders between the listener and points spread around it: the
+|   center, left, right and above, relative to the listener.
+|___________________________________________________________________*/
+
+static void Sample_Emitter(Emitter* e, gx3dVector* listener)
+{
+	static const float offsets[AUDIOPROP_RAYS_PER_SAMPLE][2] = {
+		{ 0, 0 }, { -1, 0 }, { 1, 0 }, { 0, 1 }  // side, up
+	};
+	int i, hits;
+	float dx, dz, len, dist;
+	gx3dVector side, target;
+	gx3dRay ray;
+
+	// Horizontal direction perpendicular to the listener-emitter line
+	dx = e->position.x - listener->x;
+	dz = e->position.z - listener->z;
+	len = sqrtf(dx * dx + dz * dz);
+	if (len > 0) {
+		side.x = -dz / len;
+		side.z = dx / len;
+	}
+	else {
+		side.x = 1;
+		side.z = 0;
+	}
+	side.y = 0;
+
+	hits = 0;
+	for (i = 0; i < AUDIOPROP_RAYS_PER_SAMPLE; i++) {
+		target.x = e->position.x + side.x * offsets[i][0] * AUDIOPROP_SPREAD;
+		target.y = e->position.y + offsets[i][1] * AUDIOPROP_SPREAD;
+		target.z = e->position.z + side.z * offsets[i][0] * AUDIOPROP_SPREAD;
+		ray.origin = *listener;
+		gx3d_SubtractVector(&target, listener, &ray.direction);
+		dist = gx3d_VectorMagnitude(&ray.direction);
+		if (dist > 0)
+			hits += Bvh_Count_Hits(occluder_bvh, &ray, dist, occluder_mask, AUDIOPROP_MAX_HITS);
+	}
+
+	e->target = (float)hits / AUDIOPROP_RAYS_PER_SAMPLE;
+	stats.emitter_updates++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Apply_Emitter
+|
+| Input: Called from AudioProp_Update()
+| Output: Computes the gain and low-pass cutoff of an emitter from its
+|   occlusion and sets the sound volume if it changed, and the pan of
+|   a sound without 3D control.
+|___________________________________________________________________*/
+
+static void Apply_Emitter(Emitter* e, gx3dVector* listener, gx3dVector* heading)
+{
+	int volume, pan;
+	float db, dist, range, across;
+	gx3dVector v;
+
+	db = e->occlusion * AUDIOPROP_DB_PER_HIT;
+	if (db > AUDIOPROP_MAX_DB)
+		db = AUDIOPROP_MAX_DB;
+	e->gain = powf(10.0f, -db / 20);
+
+	e->lowpass = AUDIOPROP_LOWPASS_OPEN * powf(AUDIOPROP_LOWPASS_PER_HIT, e->occlusion);
+	if (e->lowpass < AUDIOPROP_LOWPASS_MIN)
+		e->lowpass = AUDIOPROP_LOWPASS_MIN;
+
+	// Linear distance rolloff and panning for sounds without 3D control
+	if (NOT e->sound_is_3d) {
+		gx3d_SubtractVector(&e->position, listener, &v);
+		dist = gx3d_VectorMagnitude(&v);
+		range = e->max_distance - e->min_distance;
+		if (dist >= e->max_distance)
+			e->gain = 0;
+		else if (dist > e->min_distance && range > 0)
+			e->gain *= 1 - (dist - e->min_distance) / range;
+
+		// Along the listener's right, (heading.z, -heading.x) on the ground
+		across = sqrtf((v.x * v.x + v.z * v.z) * (heading->x * heading->x + heading->z * heading->z));
+		pan = across > 0 ? (int)(AUDIOPROP_MAX_PAN * (v.x * heading->z - v.z * heading->x) / across) : 0;
+		if (pan != e->applied_pan) {
+			Adpcm_Set_Pan(e->sound, pan);
+			e->applied_pan = pan;
+		}
+	}
+
+	volume = (int)(e->volume * e->gain + 0.5f);
+	if (volume != e->applied_volume) {
+		Adpcm_Set_Volume(e->sound, volume);
+		e->applied_volume = volume;
+		stats.volume_changes++;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: AudioProp_Get_Emitter_State
+|
+| Input: Called from Program_Run()
+| Output: Returns the current parameters of an emitter.
+|___________________________________________________________________*/
+
+void AudioProp_Get_Emitter_State(AudioEmitter emitter, AudioEmitterState* state)
+{
+	Emitter* e = &emitters[emitter];
+
+	state->occlusion = e->occlusion;
+	state->gain = e->gain;
+	state->lowpass = e->lowpass;
+	state->volume = e->applied_volume;
+	state->pan = e->sound_is_3d ? 0 : e->applied_pan;
+}
+
+/*____________________________________________________________________
+|
+| Function: AudioProp_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns audio propagation statistics.
+|___________________________________________________________________*/
+
+void AudioProp_Get_Stats(AudioPropStats* out)
+{
+	*out = stats;
+}
@@ -0,0 +1,59 @@
+/*____________________________________________________________________
+|
+| File: audioprop.h
+|
+| Description: Occlusion of sound emitters by scene geometry.
+|___________________________________________________________________*/
+
+#ifndef _AUDIOPROP_H_
+#define _AUDIOPROP_H_
+
+#include "bvh.h"
+#include "adpcm.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define AUDIOPROP_INVALID_EMITTER  (-1)
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef int AudioEmitter;
+
+typedef struct {
+	float occlusion;  // smoothed # of occluders between the listener and the emitter
+	float gain;       // 0-1, applied to the emitter volume
+	float lowpass;    // low-pass cutoff frequency in Hz
+	int   volume;     // volume last set on the sound
+	int   pan;        // pan last set on the sound, 0 for a sound with 3D control
+} AudioEmitterState;
+
+typedef struct {
+	unsigned frames;
+	unsigned emitters;
+	unsigned rays;              // total rays cast
+	unsigned max_rays_per_frame;
+	unsigned emitter_updates;   // # of times an emitter's occlusion was sampled
+	unsigned volume_changes;    // # of calls to Adpcm_Set_Volume()
+} AudioPropStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+void         AudioProp_Init ();
+void         AudioProp_Set_Occluders (Bvh bvh, unsigned mask);
+void         AudioProp_Free ();
+AudioEmitter AudioProp_Add_Emitter (AdpcmSource sound, gx3dVector *position, int volume, int sound_is_3d, float min_distance, float max_distance);
+void         AudioProp_Move_Emitter (AudioEmitter emitter, gx3dVector *position);
+void         AudioProp_Update (gx3dVector *listener, gx3dVector *heading, unsigned elapsed_time);
+void         AudioProp_Get_Emitter_State (AudioEmitter emitter, AudioEmitterState *state);
+void         AudioProp_Get_Stats (AudioPropStats *stats);
+
+#endif
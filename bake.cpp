@@ -0,0 +1,1156 @@
+/*____________________________________________________________________
+|
+| File: bake.cpp
+|
+| Description: Light baker - precomputes the static lights and ambient
+|   occlusion of the forest into a lightmap for the ground and a light
+|   color for each tree.
+|
+|   Each lightmap texel is a point on the ground.  Its light is the sky
+|   (the ambient color) scaled by how much of the sky BAKE_AO_RAYS
+|   cosine distributed rays within ao_radius see, plus each point
+|   light as Direct3D's vertex lighting would give it (diffuse with
+|   distance attenuation, and the light's ambient), shadowed by rays
+|   to the light.  Trees block rays with their trunk (a vertical
+|   cylinder) and let BAKE_CANOPY_TRANSMIT of it through their canopy
+|   (a sphere); the ground blocks rays to lights.  The ground is too
+|   gentle to occlude itself within ao_radius, so AO rays only test
+|   the trees.  A tree gets one color, from its canopy's center: the
+|   toolkit's objects share one vertex buffer per model, so there are
+|   no per-instance vertex colors to bake into.
+|
+|   Rays are traced 4 at a time with SSE: a texel's AO rays, or the 4
+|   rays from 4 neighbouring texels to a light.  Trees are binned in a
+|   BAKE_GRID_SIZE grid over the area so a packet only tests trees
+|   near it.  Rows of texels (and groups of trees) are handed out to a
+|   thread per processor.
+|
+|   A bake is saved in a compact file: a header with a hash of
+|   everything that went into it, 16-bit (5:6:5) texels and 24-bit
+|   tree colors.  Bake_Start() loads it instead of tracing when the
+|   hash matches, and does nothing at all when the hash is the one
+|   already shown.  Bake_Finish() writes the lightmap as a bitmap, the
+|   only way the toolkit creates textures.
+|
+|   Bake_Start() can trace in the background, so a new round needn't
+|   stall the game: the lightmap and tree colors aren't given out until
+|   Bake_Finish() has been called once Bake_Is_Running() is false.
+|   Changing the scene while a bake runs cancels it.  Bake_Run() does
+|   both in one call.
+|
+| Functions:  Bake_Init
+|             Bake_Free
+|             Bake_Add_Point_Light
+|             Bake_Clear_Trees
+|             Bake_Add_Tree
+|             Bake_Run
+|             Bake_Start
+|             Bake_Is_Running
+|             Bake_Finish
+|							 Stop_Trace
+|							 Trace_Thread
+|							 Trace_Scene
+|							 Hash_Scene
+|							 Build_Grid
+|							 Bake_Thread
+|							 Bake_Row
+|							 Bake_Trees
+|							 Gather_Trees
+|							 Trace_Packet
+|							 Ground_Blocks
+|							 Light_Packet
+|							 Save_Bake
+|							 Load_Bake
+|             Bake_Get_Texture
+|             Bake_Get_Tree_Light
+|             Bake_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include <emmintrin.h>
+
+#include "terrain.h"
+#include "bmp.h"
+#include "bake.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define BAKE_AO_RAYS          32          // per texel or tree, a multiple of 4
+#define BAKE_GRID_SIZE        32          // cells per side of the tree grid
+#define BAKE_MAX_LIGHTS       8
+#define BAKE_MAX_THREADS      32
+#define BAKE_TREES_PER_JOB    16
+#define BAKE_BIAS             0.05f       // rays start this far above the surface
+#define BAKE_CANOPY_TRANSMIT  0.4f        // light let through a canopy
+#define BAKE_TREE_DIFFUSE     0.5f        // how much of a canopy faces a light, on average
+#define BAKE_GROUND_STEP      1.0f        // world units between ground samples along a ray to a light
+#define BAKE_NORMAL_DELTA     0.5f        // world units either side for the ground normal
+
+#define BAKE_FILE_MAGIC       0x50414D4C  // "LMAP"
+#define BAKE_FILE_VERSION     1
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	float x, z;              // trunk axis
+	float y0, y1;            // trunk bottom and top
+	float trunk_radius;
+	float canopy_y, canopy_radius;
+} Tree;
+
+typedef struct {
+	gx3dVector src;
+	gx3dColor  diffuse, ambient;
+	float      range;
+	float      attenuation[3];  // constant, linear, quadratic
+} Light;
+
+typedef struct {
+	unsigned magic;
+	unsigned version;
+	unsigned hash;
+	int      resolution;
+	unsigned num_trees;
+} FileHeader;
+
+typedef struct {
+	int*               candidates;  // trees near the packet being traced
+	unsigned long long rays;
+} Worker;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Stop_Trace();
+static DWORD WINAPI Trace_Thread(LPVOID param);
+static bool Trace_Scene();
+static unsigned Hash_Scene();
+static bool Build_Grid();
+static DWORD WINAPI Bake_Thread(LPVOID param);
+static void Bake_Row(Worker* w, int row);
+static void Bake_Trees(Worker* w, int first, int last);
+static int Gather_Trees(Worker* w, float x0, float z0, float x1, float z1);
+static __m128 Trace_Packet(Worker* w, int num_candidates, int skip, __m128 ox, __m128 oy, __m128 oz, __m128 dx, __m128 dy, __m128 dz, __m128 max_t);
+static bool Ground_Blocks(gx3dVector* origin, gx3dVector* dir, float distance);
+static void Light_Packet(Worker* w, int skip, gx3dVector* origin, gx3dVector* normal, int num_rays, gx3dColor* color);
+static bool Save_Bake(unsigned hash);
+static bool Load_Bake(unsigned hash);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static char            bmp_filename[MAX_PATH];   // empty if the bake isn't saved
+static char            bake_filename[MAX_PATH];
+static BakeSettings    settings;
+static float           texel_size;
+static Light           lights[BAKE_MAX_LIGHTS];
+static int             num_lights;
+static Tree*           trees;
+static gx3dColor*      tree_light;
+static int             num_trees, max_trees;
+static float           max_tree_radius;
+static int             cell_start[BAKE_GRID_SIZE * BAKE_GRID_SIZE + 1];  // trees of cell c are cell_trees[cell_start[c]..cell_start[c+1]-1]
+static int*            cell_trees;
+static unsigned char*  texels;                   // B, G, R, A, top row (min_z) first
+static unsigned short* packed;                   // 5:6:5, as saved
+static float           ao_x[BAKE_AO_RAYS], ao_y[BAKE_AO_RAYS], ao_z[BAKE_AO_RAYS];  // around +y
+static volatile LONG   next_job;
+static int             num_jobs;
+static Worker          workers[BAKE_MAX_THREADS];
+static TexId           texture;
+static bool            baked;                    // texels and tree_light are for the current scene
+static unsigned        bake_hash;                // scene texels and tree_light are (being) baked for
+static bool            shown;                    // ...and the texture shows it
+static bool            unfinished;               // Bake_Finish() has yet to save and show it
+static bool            traced;                   // ...and it was traced, not loaded
+static HANDLE          trace_thread;             // tracing in the background
+static bool            trace_ok;
+static volatile LONG   cancel;                   // stops the workers taking jobs
+static LARGE_INTEGER   bake_start;
+static BakeStats       stats;
+
+/*____________________________________________________________________
+|
+| Function: Bake_Init
+|
+| Input: Called from Program_Run(), Run_Bake()
+| Output: Sets up a bake of the given area.  The bake is saved to
+|   filename.bin and filename.bmp, or not at all if filename is NULL.
+|   Returns true on success.
+|___________________________________________________________________*/
+
+int Bake_Init(const char* filename, BakeSettings* bake_settings)
+{
+	int i;
+	float r;
+
+	Bake_Free();
+	memset(&stats, 0, sizeof(stats));
+	settings = *bake_settings;
+	if (settings.resolution <= 0 || settings.resolution % 4 || settings.size <= 0)
+		return (FALSE);
+	texel_size = settings.size / settings.resolution;
+	if (filename) {
+		sprintf(bmp_filename, "%.*s.bmp", MAX_PATH - 5, filename);
+		sprintf(bake_filename, "%.*s.bin", MAX_PATH - 5, filename);
+	}
+
+	texels = (unsigned char*)malloc(settings.resolution * settings.resolution * 4);
+	packed = (unsigned short*)malloc(settings.resolution * settings.resolution * sizeof(unsigned short));
+	if (texels == NULL || packed == NULL) {
+		Bake_Free();
+		return (FALSE);
+	}
+
+	// Cosine distributed directions, spiralling out from straight up
+	for (i = 0; i < BAKE_AO_RAYS; i++) {
+		r = sqrtf((i + 0.5f) / BAKE_AO_RAYS);
+		ao_x[i] = r * cosf(i * 2.39996323f);
+		ao_y[i] = sqrtf(1 - r * r);
+		ao_z[i] = r * sinf(i * 2.39996323f);
+	}
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Free
+|
+| Input: Called from Program_Run(), Run_Bake(), Bake_Init()
+| Output: Frees the baker.  The lightmap texture stays registered.
+|___________________________________________________________________*/
+
+void Bake_Free()
+{
+	Stop_Trace();
+	free(trees);
+	free(tree_light);
+	free(cell_trees);
+	free(texels);
+	free(packed);
+	trees = NULL;
+	tree_light = NULL;
+	cell_trees = NULL;
+	texels = NULL;
+	packed = NULL;
+	num_trees = max_trees = 0;
+	num_lights = 0;
+	bmp_filename[0] = 0;
+	bake_filename[0] = 0;
+	texture = TEXMGR_INVALID;
+	baked = false;
+	shown = false;
+	unfinished = false;
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Add_Point_Light
+|
+| Input: Called from Program_Run(), Run_Bake()
+| Output: Adds a static point light to the bake.
+|___________________________________________________________________*/
+
+void Bake_Add_Point_Light(gx3dLightData* data)
+{
+	Light* l;
+
+	Stop_Trace();
+	if (num_lights == BAKE_MAX_LIGHTS || data->light_type != gx3d_LIGHT_TYPE_POINT)
+		return;
+	l = &lights[num_lights++];
+	memset(l, 0, sizeof(Light));
+	l->src = data->point.src;
+	l->diffuse = data->point.diffuse_color;
+	l->ambient = data->point.ambient_color;
+	l->range = data->point.range;
+	l->attenuation[0] = data->point.constant_attenuation;
+	l->attenuation[1] = data->point.linear_attenuation;
+	l->attenuation[2] = data->point.quadratic_attenuation;
+	stats.lights = num_lights;
+	baked = false;
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Clear_Trees
+|
+| Input: Called from Light_World()
+| Output: Removes every tree, before adding a new world's.
+|___________________________________________________________________*/
+
+void Bake_Clear_Trees()
+{
+	Stop_Trace();
+	num_trees = 0;
+	stats.trees = 0;
+	baked = false;
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Add_Tree
+|
+| Input: Called from Light_World(), Run_Bake()
+| Output: Adds a tree standing at base, with a trunk of the given
+|   height and radius and a canopy centered canopy_y above the base.
+|   Returns its index for Bake_Get_Tree_Light(), or -1 if out of
+|   memory.
+|___________________________________________________________________*/
+
+int Bake_Add_Tree(gx3dVector* base, float height, float trunk_radius, float canopy_y, float canopy_radius)
+{
+	int n;
+	Tree* t;
+	gx3dColor* c;
+
+	Stop_Trace();
+	if (num_trees == max_trees) {
+		n = max_trees ? max_trees * 2 : 128;
+		t = (Tree*)realloc(trees, n * sizeof(Tree));
+		if (t)
+			trees = t;
+		c = (gx3dColor*)realloc(tree_light, n * sizeof(gx3dColor));
+		if (c)
+			tree_light = c;
+		if (t == NULL || c == NULL)
+			return (-1);
+		max_trees = n;
+	}
+
+	t = &trees[num_trees];
+	t->x = base->x;
+	t->z = base->z;
+	t->y0 = base->y;
+	t->y1 = base->y + height;
+	t->trunk_radius = trunk_radius;
+	t->canopy_y = base->y + canopy_y;
+	t->canopy_radius = canopy_radius;
+	stats.trees = num_trees + 1;
+	baked = false;
+
+	return (num_trees++);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Run
+|
+| Input: Called from Run_Bake()
+| Output: Bakes the scene, or loads its saved bake, and saves the
+|   lightmap, before returning.  Returns true on success.
+|___________________________________________________________________*/
+
+int Bake_Run()
+{
+	return (Bake_Start(FALSE) && Bake_Finish());
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Start
+|
+| Input: Called from Light_World(), Bake_Run()
+| Output: Starts a bake of the scene: nothing to do if its bake is the
+|   one already shown, loads the saved bake if the hash matches, or
+|   traces it, on a thread of its own if background is true.  Call
+|   Bake_Finish() to show it.  Returns true on success.
+|___________________________________________________________________*/
+
+int Bake_Start(int background)
+{
+	unsigned hash;
+
+	Stop_Trace();
+	QueryPerformanceCounter(&bake_start);
+	baked = false;
+	unfinished = false;
+	if (texels == NULL)
+		return (FALSE);
+
+	hash = Hash_Scene();
+	if (shown && hash == bake_hash) {
+		// The same scene again (a restore, or nothing changed), its bake is still loaded and shown
+		stats.cache_hits++;
+		baked = true;
+		return (TRUE);
+	}
+
+	shown = false;
+	bake_hash = hash;
+	unfinished = true;
+	if (bake_filename[0] && Load_Bake(hash)) {
+		stats.cache_hits++;
+		traced = false;
+		return (TRUE);
+	}
+
+	traced = true;
+	cancel = 0;
+	if (background) {
+		trace_thread = CreateThread(NULL, 0, Trace_Thread, NULL, 0, NULL);
+		if (trace_thread)
+			return (TRUE);
+	}
+	if (NOT Trace_Scene()) {
+		unfinished = false;
+		stats.failures++;
+		return (FALSE);
+	}
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Is_Running
+|
+| Input: Called from Program_Run()
+| Output: Returns true while a bake is tracing in the background.
+|___________________________________________________________________*/
+
+int Bake_Is_Running()
+{
+	return (trace_thread && WaitForSingleObject(trace_thread, 0) == WAIT_TIMEOUT);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Finish
+|
+| Input: Called from Program_Run(), Bake_Run()
+| Output: Waits for the bake Bake_Start() started, saves it if it was
+|   traced and writes the lightmap for the toolkit.  Returns true if
+|   the scene's bake is ready to use.
+|___________________________________________________________________*/
+
+int Bake_Finish()
+{
+	LARGE_INTEGER freq, t1;
+	BmpImage image;
+
+	if (trace_thread) {
+		WaitForSingleObject(trace_thread, INFINITE);
+		CloseHandle(trace_thread);
+		trace_thread = NULL;
+		if (NOT trace_ok) {
+			unfinished = false;
+			stats.failures++;
+			return (FALSE);
+		}
+	}
+	if (NOT unfinished)
+		return (baked);
+	unfinished = false;
+
+	if (traced && bake_filename[0])
+		Save_Bake(bake_hash);
+	baked = true;
+
+	// The toolkit only creates textures from files
+	if (bmp_filename[0]) {
+		image.width = image.height = settings.resolution;
+		image.texels = texels;
+		image.owned = FALSE;
+		if (Bmp_Save(bmp_filename, &image)) {
+			if (texture == TEXMGR_INVALID)
+				texture = TexMgr_Add(bmp_filename, 0, 0, 0);
+			else
+				TexMgr_Invalidate(texture);
+			shown = true;
+		}
+		else
+			stats.failures++;
+	}
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t1);
+	stats.last_bake_time = (float)((t1.QuadPart - bake_start.QuadPart) * 1000.0 / freq.QuadPart);
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Stop_Trace
+|
+| Input: Called from Bake_Free(), Bake_Add_Point_Light(),
+|   Bake_Clear_Trees(), Bake_Add_Tree(), Bake_Start()
+| Output: Cancels a bake tracing in the background and waits for it,
+|   before the scene it's tracing changes.  Its texels are left half
+|   done, so it isn't shown.
+|___________________________________________________________________*/
+
+static void Stop_Trace()
+{
+	if (trace_thread) {
+		InterlockedExchange(&cancel, 1);
+		WaitForSingleObject(trace_thread, INFINITE);
+		CloseHandle(trace_thread);
+		trace_thread = NULL;
+		unfinished = false;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Trace_Thread
+|
+| Input: Called from CreateThread()
+| Output: Traces the scene in the background.
+|___________________________________________________________________*/
+
+static DWORD WINAPI Trace_Thread(LPVOID param)
+{
+	trace_ok = Trace_Scene();
+
+	return (0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Trace_Scene
+|
+| Input: Called from Bake_Start(), Trace_Thread()
+| Output: Traces the lightmap and tree colors on a thread per
+|   processor, this one included.  Returns false if out of memory or
+|   cancelled.
+|___________________________________________________________________*/
+
+static bool Trace_Scene()
+{
+	int i, num_threads;
+	HANDLE threads[BAKE_MAX_THREADS];
+	SYSTEM_INFO info;
+
+	if (NOT Build_Grid())
+		return (false);
+
+	num_threads = settings.threads;
+	if (num_threads <= 0) {
+		GetSystemInfo(&info);
+		num_threads = info.dwNumberOfProcessors;
+	}
+	num_threads = num_threads < 1 ? 1 : num_threads > BAKE_MAX_THREADS ? BAKE_MAX_THREADS : num_threads;
+	for (i = 0; i < num_threads; i++) {
+		workers[i].candidates = (int*)malloc((num_trees + 1) * sizeof(int));
+		workers[i].rays = 0;
+		if (workers[i].candidates == NULL)
+			break;
+	}
+	if (i < num_threads) {
+		while (i-- > 0)
+			free(workers[i].candidates);
+		return (false);
+	}
+
+	// A job per row of texels, then per group of trees; this thread works too
+	next_job = 0;
+	num_jobs = settings.resolution + (num_trees + BAKE_TREES_PER_JOB - 1) / BAKE_TREES_PER_JOB;
+	for (i = 1; i < num_threads; i++)
+		threads[i] = CreateThread(NULL, 0, Bake_Thread, &workers[i], 0, NULL);
+	Bake_Thread(&workers[0]);
+	stats.rays = workers[0].rays;
+	for (i = 1; i < num_threads; i++) {
+		// A thread that couldn't start left its share to the others
+		if (threads[i]) {
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+		}
+		stats.rays += workers[i].rays;
+	}
+	for (i = 0; i < num_threads; i++)
+		free(workers[i].candidates);
+	stats.threads = num_threads;
+	if (cancel)
+		return (false);
+	stats.bakes++;
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: Hash_Scene
+|
+| Input: Called from Bake_Start()
+| Output: Returns a hash of everything a bake depends on: settings,
+|   lights, trees and the ground's height across the area.
+|___________________________________________________________________*/
+
+static unsigned Hash_Scene()
+{
+	unsigned h;
+	int x, z;
+	float y;
+
+#define HASH(_data_,_size_)  for (unsigned _i_ = 0; _i_ < (_size_); _i_++) h = (h ^ ((unsigned char*)(_data_))[_i_]) * 16777619u
+	h = 2166136261u;
+	HASH(&settings.min_x, sizeof(float));
+	HASH(&settings.min_z, sizeof(float));
+	HASH(&settings.size, sizeof(float));
+	HASH(&settings.resolution, sizeof(int));
+	HASH(&settings.ambient, sizeof(gx3dColor));
+	HASH(&settings.ao_radius, sizeof(float));
+	HASH(lights, num_lights * sizeof(Light));
+	HASH(trees, num_trees * sizeof(Tree));
+	for (z = 0; z <= 16; z++)
+		for (x = 0; x <= 16; x++) {
+			y = Terrain_Get_Height(settings.min_x + x * settings.size / 16, settings.min_z + z * settings.size / 16);
+			HASH(&y, sizeof(float));
+		}
+#undef HASH
+
+	return (h);
+}
+
+/*____________________________________________________________________
+|
+| Function: Build_Grid
+|
+| Input: Called from Trace_Scene()
+| Output: Bins the trees by the grid cell of their axis.  Trees outside
+|   the area go in the nearest edge cell.  Returns false if out of
+|   memory.
+|___________________________________________________________________*/
+
+static bool Build_Grid()
+{
+	int i, c, cx, cz;
+	float r;
+
+	free(cell_trees);
+	cell_trees = (int*)malloc((num_trees + 1) * sizeof(int));
+	if (cell_trees == NULL)
+		return (false);
+
+#define CELL(_v_,_min_)  ((int)fminf(fmaxf(((_v_) - (_min_)) * BAKE_GRID_SIZE / settings.size, 0), BAKE_GRID_SIZE - 1))
+	memset(cell_start, 0, sizeof(cell_start));
+	max_tree_radius = 0;
+	for (i = 0; i < num_trees; i++) {
+		cell_start[CELL(trees[i].z, settings.min_z) * BAKE_GRID_SIZE + CELL(trees[i].x, settings.min_x) + 1]++;
+		r = fmaxf(trees[i].trunk_radius, trees[i].canopy_radius);
+		if (r > max_tree_radius)
+			max_tree_radius = r;
+	}
+	for (c = 0; c < BAKE_GRID_SIZE * BAKE_GRID_SIZE; c++)
+		cell_start[c + 1] += cell_start[c];
+	for (i = 0; i < num_trees; i++) {
+		cx = CELL(trees[i].x, settings.min_x);
+		cz = CELL(trees[i].z, settings.min_z);
+		cell_trees[cell_start[cz * BAKE_GRID_SIZE + cx]++] = i;
+	}
+	// Filling moved each start to the next cell's, put them back
+	for (c = BAKE_GRID_SIZE * BAKE_GRID_SIZE; c > 0; c--)
+		cell_start[c] = cell_start[c - 1];
+	cell_start[0] = 0;
+#undef CELL
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Thread
+|
+| Input: Called from Trace_Scene(), CreateThread()
+| Output: Takes jobs until there are none left or the bake is
+|   cancelled.
+|___________________________________________________________________*/
+
+static DWORD WINAPI Bake_Thread(LPVOID param)
+{
+	Worker* w = (Worker*)param;
+	int job, first;
+
+	while (NOT cancel && (job = InterlockedIncrement(&next_job) - 1) < num_jobs) {
+		if (job < settings.resolution)
+			Bake_Row(w, job);
+		else {
+			first = (job - settings.resolution) * BAKE_TREES_PER_JOB;
+			Bake_Trees(w, first, first + BAKE_TREES_PER_JOB < num_trees ? first + BAKE_TREES_PER_JOB : num_trees);
+		}
+	}
+
+	return (0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Row
+|
+| Input: Called from Bake_Thread()
+| Output: Lights a row of texels, 4 at a time.
+|___________________________________________________________________*/
+
+static void Bake_Row(Worker* w, int row)
+{
+	int i, k, n, col;
+	float x, z, angle, ao;
+	gx3dVector origin[4], normal[4], n1;
+	gx3dColor color[4];
+	__m128 ox, oy, oz, dx, dy, dz, vis, max_t, c, s;
+	unsigned char* texel;
+	unsigned short* p;
+	float v[4];
+
+	z = settings.min_z + (row + 0.5f) * texel_size;
+	for (col = 0; col < settings.resolution; col += 4) {
+		for (k = 0; k < 4; k++) {
+			x = settings.min_x + (col + k + 0.5f) * texel_size;
+			origin[k].x = x;
+			origin[k].y = Terrain_Get_Height(x, z) + BAKE_BIAS;
+			origin[k].z = z;
+			n1.x = Terrain_Get_Height(x - BAKE_NORMAL_DELTA, z) - Terrain_Get_Height(x + BAKE_NORMAL_DELTA, z);
+			n1.y = 2 * BAKE_NORMAL_DELTA;
+			n1.z = Terrain_Get_Height(x, z - BAKE_NORMAL_DELTA) - Terrain_Get_Height(x, z + BAKE_NORMAL_DELTA);
+			gx3d_NormalizeVector(&n1, &normal[k]);
+		}
+
+		// Occlusion of the sky, with the rays turned a different way at each texel so the pattern doesn't show
+		n = Gather_Trees(w, origin[0].x - settings.ao_radius, z - settings.ao_radius, origin[3].x + settings.ao_radius, z + settings.ao_radius);
+		max_t = _mm_set1_ps(settings.ao_radius);
+		for (k = 0; k < 4; k++) {
+			ao = 0;
+			if (n) {
+				angle = (((unsigned)(row * 73856093) ^ (unsigned)((col + k) * 19349663)) & 1023) * (6.2831853f / 1024);
+				c = _mm_set1_ps(cosf(angle));
+				s = _mm_set1_ps(sinf(angle));
+				ox = _mm_set1_ps(origin[k].x);
+				oy = _mm_set1_ps(origin[k].y);
+				oz = _mm_set1_ps(origin[k].z);
+				for (i = 0; i < BAKE_AO_RAYS; i += 4) {
+					__m128 ax = _mm_loadu_ps(&ao_x[i]), az = _mm_loadu_ps(&ao_z[i]);
+					dx = _mm_sub_ps(_mm_mul_ps(ax, c), _mm_mul_ps(az, s));
+					dy = _mm_loadu_ps(&ao_y[i]);
+					dz = _mm_add_ps(_mm_mul_ps(ax, s), _mm_mul_ps(az, c));
+					vis = Trace_Packet(w, n, -1, ox, oy, oz, dx, dy, dz, max_t);
+					_mm_storeu_ps(v, vis);
+					ao += v[0] + v[1] + v[2] + v[3];
+				}
+				ao /= BAKE_AO_RAYS;
+			}
+			else
+				ao = 1;
+			color[k].r = settings.ambient.r * ao;
+			color[k].g = settings.ambient.g * ao;
+			color[k].b = settings.ambient.b * ao;
+		}
+
+		// Lights, a ray from each of the 4 texels
+		Light_Packet(w, -1, origin, normal, 4, color);
+
+		texel = texels + (row * settings.resolution + col) * 4;
+		p = packed + row * settings.resolution + col;
+		for (k = 0; k < 4; k++, texel += 4, p++) {
+			texel[0] = (unsigned char)(fminf(color[k].b, 1) * 255 + 0.5f);
+			texel[1] = (unsigned char)(fminf(color[k].g, 1) * 255 + 0.5f);
+			texel[2] = (unsigned char)(fminf(color[k].r, 1) * 255 + 0.5f);
+			texel[3] = 255;
+			*p = (unsigned short)(((texel[2] * 31 + 127) / 255) << 11 | ((texel[1] * 63 + 127) / 255) << 5 | ((texel[0] * 31 + 127) / 255));
+		}
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Trees
+|
+| Input: Called from Bake_Thread()
+| Output: Lights trees first to last - 1 from their canopy's center.
+|___________________________________________________________________*/
+
+static void Bake_Trees(Worker* w, int first, int last)
+{
+	int i, t, n;
+	float ao, v[4];
+	gx3dVector origin;
+	gx3dColor* color;
+	__m128 ox, oy, oz, vis, max_t;
+	Tree* tree;
+
+	max_t = _mm_set1_ps(settings.ao_radius);
+	for (t = first; t < last; t++) {
+		tree = &trees[t];
+		origin.x = tree->x;
+		origin.y = tree->canopy_y;
+		origin.z = tree->z;
+		ox = _mm_set1_ps(origin.x);
+		oy = _mm_set1_ps(origin.y);
+		oz = _mm_set1_ps(origin.z);
+
+		ao = 0;
+		n = Gather_Trees(w, origin.x - settings.ao_radius, origin.z - settings.ao_radius, origin.x + settings.ao_radius, origin.z + settings.ao_radius);
+		for (i = 0; i < BAKE_AO_RAYS; i += 4) {
+			vis = Trace_Packet(w, n, t, ox, oy, oz, _mm_loadu_ps(&ao_x[i]), _mm_loadu_ps(&ao_y[i]), _mm_loadu_ps(&ao_z[i]), max_t);
+			_mm_storeu_ps(v, vis);
+			ao += v[0] + v[1] + v[2] + v[3];
+		}
+		ao /= BAKE_AO_RAYS;
+
+		color = &tree_light[t];
+		color->r = settings.ambient.r * ao;
+		color->g = settings.ambient.g * ao;
+		color->b = settings.ambient.b * ao;
+		color->a = 0;
+		Light_Packet(w, t, &origin, NULL, 1, color);
+		color->r = fminf(color->r, 1);
+		color->g = fminf(color->g, 1);
+		color->b = fminf(color->b, 1);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Gather_Trees
+|
+| Input: Called from Bake_Row(), Bake_Trees(), Light_Packet()
+| Output: Lists the trees that may block rays within an area of the
+|   ground.  Returns the # listed.
+|___________________________________________________________________*/
+
+static int Gather_Trees(Worker* w, float x0, float z0, float x1, float z1)
+{
+	int i, n, cx, cz, cx0, cz0, cx1, cz1;
+
+	if (num_trees == 0)
+		return (0);
+
+#define CELL(_v_,_min_)  ((int)fminf(fmaxf(((_v_) - (_min_)) * BAKE_GRID_SIZE / settings.size, 0), BAKE_GRID_SIZE - 1))
+	cx0 = CELL(x0 - max_tree_radius, settings.min_x);
+	cz0 = CELL(z0 - max_tree_radius, settings.min_z);
+	cx1 = CELL(x1 + max_tree_radius, settings.min_x);
+	cz1 = CELL(z1 + max_tree_radius, settings.min_z);
+#undef CELL
+
+	n = 0;
+	for (cz = cz0; cz <= cz1; cz++)
+		for (cx = cx0; cx <= cx1; cx++)
+			for (i = cell_start[cz * BAKE_GRID_SIZE + cx]; i < cell_start[cz * BAKE_GRID_SIZE + cx + 1]; i++)
+				w->candidates[n++] = cell_trees[i];
+
+	return (n);
+}
+
+/*____________________________________________________________________
+|
+| Function: Trace_Packet
+|
+| Input: Called from Bake_Row(), Bake_Trees(), Light_Packet()
+| Output: Returns how much of each of 4 rays (normalized direction,
+|   up to max_t) gets past the candidate trees, except tree skip: 0 if
+|   blocked by a trunk, scaled by BAKE_CANOPY_TRANSMIT for each canopy
+|   it passes through.
+|___________________________________________________________________*/
+
+static __m128 Trace_Packet(Worker* w, int num_candidates, int skip, __m128 ox, __m128 oy, __m128 oz, __m128 dx, __m128 dy, __m128 dz, __m128 max_t)
+{
+	int i;
+	Tree* t;
+	__m128 vis, px, pz, py, a, b, c, disc, root, t0, y, hit, inside;
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1), eps = _mm_set1_ps(1e-6f);
+	const __m128 block = _mm_set1_ps(1 - BAKE_CANOPY_TRANSMIT);
+
+	vis = one;
+	w->rays += 4;
+	for (i = 0; i < num_candidates; i++) {
+		if (w->candidates[i] == skip)
+			continue;
+		t = &trees[w->candidates[i]];
+
+		// Trunk: solve |(p + t d).xz - axis|^2 = r^2 for the nearer root, in its height range
+		px = _mm_sub_ps(ox, _mm_set1_ps(t->x));
+		pz = _mm_sub_ps(oz, _mm_set1_ps(t->z));
+		a = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz));
+		b = _mm_add_ps(_mm_mul_ps(px, dx), _mm_mul_ps(pz, dz));
+		c = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(pz, pz)), _mm_set1_ps(t->trunk_radius * t->trunk_radius));
+		disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a, c));
+		root = _mm_sqrt_ps(_mm_max_ps(disc, zero));
+		t0 = _mm_div_ps(_mm_sub_ps(_mm_sub_ps(zero, b), root), _mm_max_ps(a, eps));
+		y = _mm_add_ps(oy, _mm_mul_ps(t0, dy));
+		hit = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(disc, zero), _mm_cmpgt_ps(a, eps)),
+		                 _mm_and_ps(_mm_cmpgt_ps(t0, zero), _mm_cmplt_ps(t0, max_t)));
+		hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(y, _mm_set1_ps(t->y0)), _mm_cmple_ps(y, _mm_set1_ps(t->y1))));
+		inside = _mm_and_ps(_mm_cmplt_ps(c, zero), _mm_and_ps(_mm_cmpge_ps(oy, _mm_set1_ps(t->y0)), _mm_cmple_ps(oy, _mm_set1_ps(t->y1))));
+		vis = _mm_andnot_ps(_mm_or_ps(hit, inside), vis);
+
+		// Canopy: the ray's segment overlaps the sphere
+		px = _mm_sub_ps(ox, _mm_set1_ps(t->x));
+		py = _mm_sub_ps(oy, _mm_set1_ps(t->canopy_y));
+		b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, dx), _mm_mul_ps(py, dy)), _mm_mul_ps(pz, dz));
+		c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py)), _mm_mul_ps(pz, pz)), _mm_set1_ps(t->canopy_radius * t->canopy_radius));
+		disc = _mm_sub_ps(_mm_mul_ps(b, b), c);
+		root = _mm_sqrt_ps(_mm_max_ps(disc, zero));
+		hit = _mm_and_ps(_mm_cmpgt_ps(disc, zero),
+		                 _mm_and_ps(_mm_cmpgt_ps(_mm_sub_ps(root, b), zero), _mm_cmplt_ps(_mm_sub_ps(_mm_sub_ps(zero, b), root), max_t)));
+		vis = _mm_sub_ps(vis, _mm_and_ps(hit, _mm_mul_ps(vis, block)));
+
+		if (_mm_movemask_ps(_mm_cmpgt_ps(vis, zero)) == 0)
+			break;
+	}
+
+	return (vis);
+}
+
+/*____________________________________________________________________
+|
+| Function: Ground_Blocks
+|
+| Input: Called from Light_Packet()
+| Output: Returns true if the ground rises above a ray (normalized
+|   direction) before distance.
+|___________________________________________________________________*/
+
+static bool Ground_Blocks(gx3dVector* origin, gx3dVector* dir, float distance)
+{
+	float t;
+
+	for (t = BAKE_GROUND_STEP; t < distance; t += BAKE_GROUND_STEP)
+		if (Terrain_Get_Height(origin->x + dir->x * t, origin->z + dir->z * t) > origin->y + dir->y * t)
+			return (true);
+
+	return (false);
+}
+
+/*____________________________________________________________________
+|
+| Function: Light_Packet
+|
+| Input: Called from Bake_Row(), Bake_Trees()
+| Output: Adds the light of every light to up to 4 points, shadowed
+|   by the trees (except tree skip) and the ground.  A tree's canopy
+|   (normal NULL) takes BAKE_TREE_DIFFUSE of each light.
+|___________________________________________________________________*/
+
+static void Light_Packet(Worker* w, int skip, gx3dVector* origin, gx3dVector* normal, int num_rays, gx3dColor* color)
+{
+	int i, k, n;
+	float d, att, ndotl, vis[4], x0, z0, x1, z1;
+	float ox[4], oy[4], oz[4], dx[4], dy[4], dz[4], max_t[4], scale[4];
+	gx3dVector dir;
+	Light* l;
+
+	for (i = 0; i < num_lights; i++) {
+		l = &lights[i];
+		x0 = x1 = l->src.x;
+		z0 = z1 = l->src.z;
+		for (k = 0; k < 4; k++) {
+			// Unused lanes trace nothing
+			ox[k] = oy[k] = oz[k] = dx[k] = dz[k] = max_t[k] = scale[k] = 0;
+			dy[k] = 1;
+			if (k >= num_rays)
+				continue;
+			dir.x = l->src.x - origin[k].x;
+			dir.y = l->src.y - origin[k].y;
+			dir.z = l->src.z - origin[k].z;
+			d = sqrtf(dir.x * dir.x + dir.y * dir.y + dir.z * dir.z);
+			if (d >= l->range || d <= 0)
+				continue;
+			dir.x /= d;
+			dir.y /= d;
+			dir.z /= d;
+			ndotl = normal == NULL ? BAKE_TREE_DIFFUSE : normal[k].x * dir.x + normal[k].y * dir.y + normal[k].z * dir.z;
+			att = l->attenuation[0] + l->attenuation[1] * d + l->attenuation[2] * d * d;
+			att = att > 0 ? 1 / att : 1;
+			// The light's ambient isn't shadowed
+			color[k].r += l->ambient.r * att;
+			color[k].g += l->ambient.g * att;
+			color[k].b += l->ambient.b * att;
+			if (ndotl <= 0 || Ground_Blocks(&origin[k], &dir, d))
+				continue;
+			ox[k] = origin[k].x;
+			oy[k] = origin[k].y;
+			oz[k] = origin[k].z;
+			dx[k] = dir.x;
+			dy[k] = dir.y;
+			dz[k] = dir.z;
+			max_t[k] = d;
+			scale[k] = ndotl * att;
+			x0 = fminf(x0, ox[k]);
+			z0 = fminf(z0, oz[k]);
+			x1 = fmaxf(x1, ox[k]);
+			z1 = fmaxf(z1, oz[k]);
+		}
+		if (scale[0] == 0 && scale[1] == 0 && scale[2] == 0 && scale[3] == 0)
+			continue;
+
+		n = Gather_Trees(w, x0, z0, x1, z1);
+		_mm_storeu_ps(vis, Trace_Packet(w, n, skip, _mm_loadu_ps(ox), _mm_loadu_ps(oy), _mm_loadu_ps(oz),
+			_mm_loadu_ps(dx), _mm_loadu_ps(dy), _mm_loadu_ps(dz), _mm_loadu_ps(max_t)));
+		for (k = 0; k < num_rays; k++) {
+			color[k].r += l->diffuse.r * scale[k] * vis[k];
+			color[k].g += l->diffuse.g * scale[k] * vis[k];
+			color[k].b += l->diffuse.b * scale[k] * vis[k];
+		}
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Save_Bake
+|
+| Input: Called from Bake_Finish()
+| Output: Writes the bake to its file.  Returns true on success.
+|___________________________________________________________________*/
+
+static bool Save_Bake(unsigned hash)
+{
+	int i;
+	unsigned bytes, texel_bytes;
+	DWORD written;
+	HANDLE file;
+	unsigned char *data, *p;
+	FileHeader* header;
+	bool ok;
+
+	texel_bytes = settings.resolution * settings.resolution * sizeof(unsigned short);
+	bytes = sizeof(FileHeader) + texel_bytes + num_trees * 3;
+	data = (unsigned char*)malloc(bytes);
+	if (data == NULL)
+		return (false);
+
+	header = (FileHeader*)data;
+	header->magic = BAKE_FILE_MAGIC;
+	header->version = BAKE_FILE_VERSION;
+	header->hash = hash;
+	header->resolution = settings.resolution;
+	header->num_trees = num_trees;
+	memcpy(data + sizeof(FileHeader), packed, texel_bytes);
+	p = data + sizeof(FileHeader) + texel_bytes;
+	for (i = 0; i < num_trees; i++, p += 3) {
+		p[0] = (unsigned char)(tree_light[i].r * 255 + 0.5f);
+		p[1] = (unsigned char)(tree_light[i].g * 255 + 0.5f);
+		p[2] = (unsigned char)(tree_light[i].b * 255 + 0.5f);
+	}
+
+	ok = false;
+	file = CreateFileA(bake_filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file != INVALID_HANDLE_VALUE) {
+		ok = WriteFile(file, data, bytes, &written, NULL) && written == bytes;
+		CloseHandle(file);
+	}
+	free(data);
+	if (ok)
+		stats.file_size = bytes;
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Load_Bake
+|
+| Input: Called from Bake_Start()
+| Output: Reads the bake from its file if it was made from the same
+|   scene (hash).  Returns true on success.
+|___________________________________________________________________*/
+
+static bool Load_Bake(unsigned hash)
+{
+	int i;
+	unsigned bytes, texel_bytes, r, g, b;
+	DWORD size, read;
+	HANDLE file;
+	unsigned char *data, *p;
+	FileHeader* header;
+	bool ok;
+
+	file = CreateFileA(bake_filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return (false);
+	texel_bytes = settings.resolution * settings.resolution * sizeof(unsigned short);
+	bytes = sizeof(FileHeader) + texel_bytes + num_trees * 3;
+	size = GetFileSize(file, NULL);
+	data = size == bytes ? (unsigned char*)malloc(bytes) : NULL;
+	ok = data && ReadFile(file, data, bytes, &read, NULL) && read == bytes;
+	CloseHandle(file);
+
+	header = (FileHeader*)data;
+	ok = ok && header->magic == BAKE_FILE_MAGIC && header->version == BAKE_FILE_VERSION && header->hash == hash &&
+	     header->resolution == settings.resolution && header->num_trees == (unsigned)num_trees;
+	if (ok) {
+		memcpy(packed, data + sizeof(FileHeader), texel_bytes);
+		for (i = 0; i < settings.resolution * settings.resolution; i++) {
+			r = packed[i] >> 11;
+			g = (packed[i] >> 5) & 63;
+			b = packed[i] & 31;
+			texels[i * 4 + 0] = (unsigned char)((b * 255 + 15) / 31);
+			texels[i * 4 + 1] = (unsigned char)((g * 255 + 31) / 63);
+			texels[i * 4 + 2] = (unsigned char)((r * 255 + 15) / 31);
+			texels[i * 4 + 3] = 255;
+		}
+		p = data + sizeof(FileHeader) + texel_bytes;
+		for (i = 0; i < num_trees; i++, p += 3) {
+			tree_light[i].r = p[0] / 255.0f;
+			tree_light[i].g = p[1] / 255.0f;
+			tree_light[i].b = p[2] / 255.0f;
+			tree_light[i].a = 0;
+		}
+		stats.file_size = bytes;
+	}
+	free(data);
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Get_Texture
+|
+| Input: Called from Program_Run()
+| Output: Returns the lightmap texture, or TEXMGR_INVALID if there is
+|   no bake of the current scene.  Texel (0,0) is at (min_x, min_z).
+|___________________________________________________________________*/
+
+TexId Bake_Get_Texture()
+{
+	return (baked ? texture : TEXMGR_INVALID);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Get_Tree_Light
+|
+| Input: Called from Light_Trees()
+| Output: Returns the baked light of a tree: its ambient light, in
+|   place of the static lights.
+|___________________________________________________________________*/
+
+void Bake_Get_Tree_Light(int tree, gx3dColor* color)
+{
+	if (baked && tree >= 0 && tree < num_trees)
+		*color = tree_light[tree];
+	else
+		*color = settings.ambient;
+}
+
+/*____________________________________________________________________
+|
+| Function: Bake_Get_Stats
+|
+| Input: Called from Program_Run(), Run_Bake()
+| Output: Returns baker statistics.
+|___________________________________________________________________*/
+
+void Bake_Get_Stats(BakeStats* out)
+{
+	*out = stats;
+}
@@ -0,0 +1,59 @@
+/*____________________________________________________________________
+|
+| File: bake.h
+|
+| Description: Light baker - precomputes the static lights and ambient
+|   occlusion of the forest into a lightmap for the ground and a light
+|   color for each tree.
+|___________________________________________________________________*/
+
+#ifndef _BAKE_H_
+#define _BAKE_H_
+
+#include "texmgr.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	float     min_x, min_z;  // area of the ground covered by the lightmap
+	float     size;
+	int       resolution;    // texels per side
+	gx3dColor ambient;       // sky light, before occlusion
+	float     ao_radius;     // occluders farther than this don't darken
+	int       threads;       // 0 for one per processor
+} BakeSettings;
+
+typedef struct {
+	unsigned bakes;
+	unsigned cache_hits;
+	unsigned failures;
+	unsigned trees;
+	unsigned lights;
+	unsigned threads;
+	unsigned long long rays;  // traced by the last bake
+	float    last_bake_time;  // ms
+	unsigned file_size;       // bytes of the saved bake
+} BakeStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int   Bake_Init (const char *filename, BakeSettings *settings);
+void  Bake_Free ();
+void  Bake_Add_Point_Light (gx3dLightData *data);
+void  Bake_Clear_Trees ();
+int   Bake_Add_Tree (gx3dVector *base, float height, float trunk_radius, float canopy_y, float canopy_radius);
+int   Bake_Run ();
+int   Bake_Start (int background);
+int   Bake_Is_Running ();
+int   Bake_Finish ();
+TexId Bake_Get_Texture ();
+void  Bake_Get_Tree_Light (int tree, gx3dColor *color);
+void  Bake_Get_Stats (BakeStats *stats);
+
+#endif
@@ -0,0 +1,1592 @@
+/*____________________________________________________________________
+|
+| File: bench.cpp
+|
+| Description: Benchmark suite for the game's hot paths, with JSON
+|   results and regression checks against a baseline.
+|
+|   Run the game with "-bench" to run the suite in place of the game:
+|
+|     -bench [-out file] [-baseline file] [-threshold percent]
+|
+|   Micro benchmarks time spawning the world (as World_Spawn() does for
+|   the game), frustum culling, page picking, Slender steering, particle update, matrix construction,
+|   loading every shipped BMP, LWO and WAV file and decoding every image
+|   in Objects\Images (with and without SIMD), decoding ADPCM voices
+|   of the sounds in wav as a mixer would (with and without SIMD) and
+|   baking the forest's lighting (on every processor and on one),
+|   each over BENCH_RUNS
+|   runs after a warm up run.  The BVH is built, refit and raycast at
+|   forest sizes up to 100k, reported to the debug file.  The scenario walks a scripted path
+|   through a generated forest, simulating and drawing every frame as
+|   the game does, and reports the mean and 95th percentile frame time
+|   of each walk.  Snapshots of a forest of BENCH_SNAPSHOT_TREES, at
+|   the game's density, are captured into the rewind ring, rewound to,
+|   saved to a file and loaded again, timing each.  The server scenario runs a multiplayer server with
+|   BENCH_NET_CLIENTS bots connected over loopback and reports the mean
+|   and 95th percentile tick time, and the bandwidth used per client.
+|
+|   Results are written as JSON with the mean, standard deviation,
+|   coefficient of variation, min, max and every run of each metric.
+|   Given a baseline (an earlier results file), a metric regresses when
+|   its mean is slower than the baseline's by more than the threshold
+|   and by more than BENCH_NOISE_SIGMAS of the baseline's run to run
+|   standard deviation.  Bench_Run() returns false if any metric
+|   regressed, and the JSON reports "passed": false.
+|
+| Functions:  Bench_Run
+|							 Parse_Options
+|							 Now
+|							 Measure
+|							 Add_Metric
+|							 Add_Run
+|							 Compute_Stats
+|							 Load_Assets
+|							 Free_Assets
+|							 Run_Placement
+|							 Setup_Scene
+|							 Run_Cull
+|							 Run_Pick
+|							 Run_Steer
+|							 Run_Particles
+|							 Run_Matrices
+|							 Find_Files
+|							 Run_Load_BMP
+|							 Find_Images
+|							 Run_Decode_BMP
+|							 Run_Load_LWO
+|							 Run_Load_WAV
+|							 Find_Sounds
+|							 Run_Decode_ADPCM
+|							 Setup_Bake
+|							 Run_Bake
+|							 Run_Walk
+|							 Walk_Position
+|							 Setup_Snapshot
+|							 Run_Snapshot
+|							 Run_Net
+|							 Compare_Doubles
+|							 Compare_Baseline
+|							 Find_Value
+|							 Write_Results
+|							 Write_String
+|							 Report
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "arena.h"
+#include "ecs.h"
+#include "bvh.h"
+#include "collide.h"
+#include "lightmgr.h"
+#include "terrain.h"
+#include "renderq.h"
+#include "slender.h"
+#include "bmp.h"
+#include "bake.h"
+#include "snapshot.h"
+#include "adpcm.h"
+#include "net.h"
+#include "server.h"
+#include "client.h"
+#include "world.h"
+#include "bench.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define BENCH_RESULTS_FILE    "bench.json"
+#define BENCH_THRESHOLD       10      // percent slower than the baseline to fail
+#define BENCH_NOISE_SIGMAS    2       // and by more than this many baseline std devs
+
+#define BENCH_RUNS            10
+#define BENCH_MAX_METRICS     32
+#define BENCH_SEED            1
+
+#define BENCH_ARENA_SIZE        (8 * 1024 * 1024)
+#define BENCH_FRAME_ARENA_SIZE  (1024 * 1024)
+
+// Forest, about the density of the game's
+#define BENCH_TREES           4000
+#define BENCH_SLENDER         1
+#define BENCH_FOREST_SIZE     1000.0f
+
+#define BENCH_VIEWS           8       // culling views, turning around the center
+#define BENCH_RAYS            10000
+#define BENCH_SLENDERS        10000
+#define BENCH_PARTICLE_STEPS  600
+#define BENCH_MATRICES        10000
+#define BENCH_MAX_IMAGES      64
+#define BENCH_MAX_MODELS      32
+#define BENCH_MAX_SOUNDS      16
+#define BENCH_VOICES          32      // playing at once, each looping a sound from a different place
+#define BENCH_VOICE_FRAMES    44100   // decoded per voice per run
+#define BENCH_MIX_FRAMES      256     // per read, as an audio callback would
+#define BENCH_BAKE_RESOLUTION 256     // lightmap texels per side, over the whole forest
+#define BENCH_BAKE_AO_RADIUS  8.0f
+
+// Scenario
+#define BENCH_WALK_RUNS       3
+#define BENCH_WALK_FRAMES     600
+#define BENCH_WALK_SPEED      0.25f   // world units per frame
+#define BENCH_FRAME_TIME      16      // milliseconds simulated per frame
+#define BENCH_EYE_HEIGHT      5.0f
+#define BENCH_MAX_DRAWS       4096
+#define BENCH_SNAPSHOT_TREES  100000
+#define BENCH_SNAPSHOT_FILE   "bench.snp"
+#define BENCH_SNAPSHOT_ARENA_SIZE (128 * 1024 * 1024)  // the world, its colliders and BVH
+#define BENCH_NET_RUNS        3
+#define BENCH_NET_CLIENTS     64
+#define BENCH_NET_TICKS       400     // 20 seconds of play at SERVER_TICK_RATE
+#define BENCH_NET_WARM_UP     20      // ticks for the bots to connect, not timed
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	char   name[32];
+	int    ops;               // operations per run
+	int    num_runs;
+	double runs[BENCH_RUNS];  // milliseconds
+	double mean, std_dev, min, max;
+	double baseline;          // baseline mean, < 0 if none
+	int    regressed;
+} Metric;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Parse_Options(char* options, char* results_file, char* baseline_file, double* threshold);
+static double Now();
+static void Measure(const char* name, int ops, void (*run)());
+static Metric* Add_Metric(const char* name, int ops);
+static void Add_Run(Metric* metric, double ms);
+static void Compute_Stats(Metric* metric);
+static int Load_Assets();
+static void Free_Assets();
+static void Run_Placement();
+static int Setup_Scene();
+static void Run_Cull();
+static void Run_Pick();
+static void Run_Steer();
+static void Run_Particles();
+static void Run_Matrices();
+static int Find_Files(const char* dir, const char* pattern, char (*files)[MAX_PATH], int max_files);
+static void Run_Load_BMP();
+static int Find_Images();
+static void Run_Decode_BMP();
+static void Run_Load_LWO();
+static void Run_Load_WAV();
+static int Find_Sounds();
+static void Run_Decode_ADPCM();
+static int Setup_Bake(int threads);
+static void Run_Bake();
+static void Run_Walk(double* frame_times);
+static void Walk_Position(float distance, gx3dVector* position, gx3dVector* heading);
+static int Setup_Snapshot(Arena snapshot_arena);
+static int Run_Snapshot(double* capture, double* rewind, double* save, double* load);
+static void Run_Net(double* tick_times, ServerStats* server_stats, unsigned* dropped);
+static int Compare_Doubles(const void* d1, const void* d2);
+static int Compare_Baseline(char* baseline_file, double threshold);
+static int Find_Value(char* text, const char* name, const char* field, double* value);
+static int Write_Results(char* results_file, char* baseline_file, double threshold, int regressions);
+static void Write_String(FILE* fp, const char* str);
+static void Report(char* results_file, int regressions);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static LARGE_INTEGER      freq;
+static Metric             metrics[BENCH_MAX_METRICS];
+static int                num_metrics;
+static Arena              arena, frame_arena;
+static Bvh                bvh;
+static WorldShapes        shapes;
+static gx3dRay*           rays;
+static gx3dVector*        slenders;
+static unsigned           visible, hits;  // results, so the work isn't skipped
+static gx3dObject*        obj_tree, * obj_skydome, * obj_paper, * obj_slender;
+static gx3dTexture        tex_tree, tex_skydome, tex_ground, tex_paper, tex_slender;
+static gx3dParticleSystem psys_fire;
+static char               images[BENCH_MAX_IMAGES][2][MAX_PATH];  // image and alpha file (empty if none)
+static int                num_images;
+static char               models[BENCH_MAX_MODELS][MAX_PATH];
+static int                num_models;
+static char               wavs[BENCH_MAX_SOUNDS][MAX_PATH];
+static int                num_wavs;
+static unsigned char*     image_buffer;                           // reused by every decode
+static unsigned           image_buffer_size;
+static AdpcmSound         sounds[BENCH_MAX_SOUNDS];
+static int                num_sounds;
+static AdpcmVoice*        voices;
+
+// Scripted walk, a loop around the fire
+static const float walk_path[][2] = {
+	{ 0, -100 }, { 60, -40 }, { 40, 60 }, { -50, 70 }, { -70, -30 }, { 0, -100 }
+};
+
+/*____________________________________________________________________
+|
+| Function: Bench_Run
+|
+| Input: Called from Program_Run()
+| Output: Runs the benchmark suite with the given command line options
+|   and writes the results file, comparing against a baseline if one is
+|   given.  Needs graphics, sound and the terrain initialized and owns
+|   the entity store while running.  Returns true if nothing regressed.
+|___________________________________________________________________*/
+
+int Bench_Run(char* options)
+{
+	char results_file[MAX_PATH], baseline_file[MAX_PATH], str[128];
+	double threshold, *frame_times, *tick_times;
+	int i, regressions;
+	Arena snapshot_arena;
+	Metric* walk_mean, * walk_p95;
+
+	Parse_Options(options, results_file, baseline_file, &threshold);
+	QueryPerformanceFrequency(&freq);
+	num_metrics = 0;
+	visible = 0;
+	hits = 0;
+
+	arena = Arena_Create(BENCH_ARENA_SIZE);
+	frame_arena = Arena_Create(BENCH_FRAME_ARENA_SIZE);
+	frame_times = (double*)malloc(BENCH_WALK_FRAMES * sizeof(double));
+	if (arena == NULL || frame_arena == NULL || frame_times == NULL || NOT Load_Assets()) {
+		debug_WriteFile("Bench_Run(): can't create the arenas or load the assets");
+		Free_Assets();
+		Arena_Free(frame_arena);
+		Arena_Free(arena);
+		free(frame_times);
+		return (FALSE);
+	}
+
+	// Micro benchmarks
+	shapes.tree_height = obj_tree->bound_box.max.y;
+	shapes.tree_radius = obj_tree->bound_sphere.radius;
+	shapes.paper_radius = obj_paper->bound_sphere.radius;
+	shapes.slender_radius = obj_slender->bound_sphere.radius;
+	World_Set_Size(BENCH_TREES, BENCH_SLENDER, (int)(BENCH_FOREST_SIZE / 2));
+	Measure("world_spawn", BENCH_TREES + NUM_PAPER + BENCH_SLENDER, Run_Placement);
+	if (Setup_Scene()) {
+		Measure("frustum_cull", BENCH_TREES * BENCH_VIEWS, Run_Cull);
+		Measure("page_pick", BENCH_RAYS, Run_Pick);
+		Measure("slender_steer", BENCH_SLENDERS, Run_Steer);
+	}
+	else
+		debug_WriteFile("Bench_Run(): can't build the scene, skipping the scene benchmarks");
+	Measure("particle_update", BENCH_PARTICLE_STEPS, Run_Particles);
+	Measure("matrix_build", BENCH_MATRICES, Run_Matrices);
+
+	// Every shipped asset, without what the game writes itself
+	num_models = Find_Files("Objects", "*.lwo", models, BENCH_MAX_MODELS);
+	num_wavs = Find_Files("wav", "*.wav", wavs, BENCH_MAX_SOUNDS);
+	if (Find_Images())
+		Measure("load_bmp", num_images, Run_Load_BMP);
+	if (num_models)
+		Measure("load_lwo", num_models, Run_Load_LWO);
+	if (num_wavs)
+		Measure("load_wav", num_wavs, Run_Load_WAV);
+	if (num_images) {
+		BmpStats before, after;
+		Metric* simd, * scalar;
+		int was_simd;
+		Bmp_Get_Stats(&before);
+		Run_Decode_BMP();
+		Bmp_Get_Stats(&after);
+		Measure("decode_bmp", num_images, Run_Decode_BMP);
+		simd = &metrics[num_metrics - 1];
+		was_simd = Bmp_Use_SIMD(FALSE);
+		Measure("decode_bmp_scalar", num_images, Run_Decode_BMP);
+		scalar = &metrics[num_metrics - 1];
+		Bmp_Use_SIMD(was_simd);
+		sprintf(str, "Decoded %d images, %.1f MB: %.0f MB/s, %.0f MB/s without SIMD", num_images, (after.bytes - before.bytes) / 1e6,
+		        (after.bytes - before.bytes) / 1e3 / simd->mean, (after.bytes - before.bytes) / 1e3 / scalar->mean);
+		debug_WriteFile(str);
+	}
+	else
+		debug_WriteFile("Bench_Run(): can't find the images, skipping the decode benchmarks");
+	free(image_buffer);
+	image_buffer = NULL;
+	if (Find_Sounds()) {
+		Metric* simd, * scalar;
+		int was_simd;
+		double seconds = 0;
+		for (i = 0; i < BENCH_VOICES; i++)
+			seconds += (double)BENCH_VOICE_FRAMES / sounds[i % num_sounds].sample_rate;
+		Measure("decode_adpcm", BENCH_VOICES, Run_Decode_ADPCM);
+		simd = &metrics[num_metrics - 1];
+		was_simd = Adpcm_Use_SIMD(FALSE);
+		Measure("decode_adpcm_scalar", BENCH_VOICES, Run_Decode_ADPCM);
+		scalar = &metrics[num_metrics - 1];
+		Adpcm_Use_SIMD(was_simd);
+		sprintf(str, "Decoded %.1f s of ADPCM voices: %.0f voices per core, %.0f without SIMD", seconds, seconds * 1000 / simd->mean, seconds * 1000 / scalar->mean);
+		debug_WriteFile(str);
+	}
+	else
+		debug_WriteFile("Bench_Run(): can't find the sounds, skipping the ADPCM benchmarks");
+	for (i = 0; i < num_sounds; i++)
+		Adpcm_Free(&sounds[i]);
+	free(voices);
+	voices = NULL;
+	if (Setup_Bake(0)) {
+		BakeStats bake_stats;
+		Metric* all, * one;
+		Measure("bake_lighting", 1, Run_Bake);
+		all = &metrics[num_metrics - 1];
+		Bake_Get_Stats(&bake_stats);
+		if (Setup_Bake(1)) {
+			Measure("bake_lighting_1thread", 1, Run_Bake);
+			one = &metrics[num_metrics - 1];
+			sprintf(str, "Baked %llu rays: %.1f Mrays/s on %u threads, %.1f Mrays/s on one", bake_stats.rays,
+			        bake_stats.rays / 1e3 / all->mean, bake_stats.threads, bake_stats.rays / 1e3 / one->mean);
+			debug_WriteFile(str);
+		}
+	}
+	else
+		debug_WriteFile("Bench_Run(): can't set up the light baker, skipping the bake benchmarks");
+	Bake_Free();
+
+	// BVH build, refit and raycasts at forest sizes up to 100k (to the debug file)
+	Bvh_Benchmark();
+
+	// Scenario
+	if (bvh) {
+		RenderQ_Init();
+		walk_mean = Add_Metric("walk_frame", 1);
+		walk_p95 = Add_Metric("walk_frame_p95", 1);
+		for (i = 0; i < BENCH_WALK_RUNS; i++) {
+			double sum = 0;
+			Run_Walk(frame_times);
+			for (int f = 0; f < BENCH_WALK_FRAMES; f++)
+				sum += frame_times[f];
+			qsort(frame_times, BENCH_WALK_FRAMES, sizeof(double), Compare_Doubles);
+			Add_Run(walk_mean, sum / BENCH_WALK_FRAMES);
+			Add_Run(walk_p95, frame_times[(int)(0.95f * (BENCH_WALK_FRAMES - 1))]);
+		}
+		Compute_Stats(walk_mean);
+		Compute_Stats(walk_p95);
+		RenderQ_Free();
+	}
+
+	// The server owns the entity store, release the benchmark world first
+	Ecs_Free();
+	Bvh_Free(bvh);
+	bvh = NULL;
+	Collide_Free();
+
+	// Snapshots of a stress test sized forest, in an arena as the game's level is
+	snapshot_arena = Arena_Create(BENCH_SNAPSHOT_ARENA_SIZE);
+	if (snapshot_arena && Setup_Snapshot(snapshot_arena)) {
+		SnapshotStats snapshot_stats;
+		double times[4];
+		Metric* capture, * rewind, * save, * load;
+		capture = Add_Metric("snapshot_capture", 1);
+		rewind = Add_Metric("snapshot_rewind", 1);
+		save = Add_Metric("snapshot_save", 1);
+		load = Add_Metric("snapshot_load", 1);
+		// A warm up run, then the timed ones
+		for (i = -1; i < BENCH_RUNS && Run_Snapshot(&times[0], &times[1], &times[2], &times[3]); i++)
+			if (i >= 0) {
+				Add_Run(capture, times[0]);
+				Add_Run(rewind, times[1]);
+				Add_Run(save, times[2]);
+				Add_Run(load, times[3]);
+			}
+		Compute_Stats(capture);
+		Compute_Stats(rewind);
+		Compute_Stats(save);
+		Compute_Stats(load);
+		Snapshot_Get_Stats(&snapshot_stats);
+		sprintf(str, "Snapshots of %d trees, %.1f MB: %u failed", BENCH_SNAPSHOT_TREES, snapshot_stats.size / 1e6, snapshot_stats.failures);
+		debug_WriteFile(str);
+	}
+	else
+		debug_WriteFile("Bench_Run(): can't spawn the snapshot world, skipping the snapshot benchmarks");
+	// The entity store may be using a restored snapshot, free it first
+	Ecs_Free();
+	Snapshot_Free();
+	Bvh_Free(bvh);
+	bvh = NULL;
+	Collide_Free();
+	Arena_Free(snapshot_arena);
+	DeleteFileA(BENCH_SNAPSHOT_FILE);
+	World_Set_Size(NUM_TREES, NUM_SLENDER, WORLD_SPAWN_RANGE);
+	tick_times = (double*)malloc(BENCH_NET_TICKS * sizeof(double));
+	if (tick_times && Net_Init()) {
+		ServerStats server_stats;
+		double seconds, sum;
+		unsigned dropped;
+		Metric* tick_mean, * tick_p95;
+		tick_mean = Add_Metric("net_server_tick", 1);
+		tick_p95 = Add_Metric("net_server_tick_p95", 1);
+		for (i = 0; i < BENCH_NET_RUNS; i++) {
+			Run_Net(tick_times, &server_stats, &dropped);
+			sum = 0;
+			for (int t = 0; t < BENCH_NET_TICKS; t++)
+				sum += tick_times[t];
+			qsort(tick_times, BENCH_NET_TICKS, sizeof(double), Compare_Doubles);
+			Add_Run(tick_mean, sum / BENCH_NET_TICKS);
+			Add_Run(tick_p95, tick_times[(int)(0.95f * (BENCH_NET_TICKS - 1))]);
+		}
+		Compute_Stats(tick_mean);
+		Compute_Stats(tick_p95);
+		seconds = (double)server_stats.ticks / SERVER_TICK_RATE;
+		sprintf(str, "Served %u of %d clients over loopback: %.0f bytes/s down and %.0f up per client, %u of %u snapshots deltas (%u undecodable)", server_stats.clients,
+		        BENCH_NET_CLIENTS, server_stats.bytes_sent / seconds / BENCH_NET_CLIENTS, server_stats.bytes_received / seconds / BENCH_NET_CLIENTS,
+		        server_stats.delta_snapshots, server_stats.delta_snapshots + server_stats.full_snapshots, dropped);
+		debug_WriteFile(str);
+		Net_Free();
+	}
+	else
+		debug_WriteFile("Bench_Run(): can't start the sockets library, skipping the server benchmark");
+	free(tick_times);
+
+	regressions = 0;
+	if (baseline_file[0])
+		regressions = Compare_Baseline(baseline_file, threshold);
+	if (NOT Write_Results(results_file, baseline_file, threshold, regressions))
+		debug_WriteFile("Bench_Run(): can't write the results file");
+	Report(results_file, regressions);
+
+	// Release the benchmark assets
+	Free_Assets();
+	Arena_Free(frame_arena);
+	Arena_Free(arena);
+	free(frame_times);
+
+	return (regressions == 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Parse_Options
+|
+| Input: Called from Bench_Run()
+| Output: Gets the results file, baseline file (empty for none) and
+|   regression threshold (a fraction) from the command line options.
+|___________________________________________________________________*/
+
+static void Parse_Options(char* options, char* results_file, char* baseline_file, double* threshold)
+{
+	char* option;
+	double percent = BENCH_THRESHOLD;
+
+	strcpy(results_file, BENCH_RESULTS_FILE);
+	baseline_file[0] = 0;
+	if ((option = strstr(options, "-out ")) != NULL)
+		sscanf(option + 5, "%259s", results_file);
+	if ((option = strstr(options, "-baseline ")) != NULL)
+		sscanf(option + 10, "%259s", baseline_file);
+	if ((option = strstr(options, "-threshold ")) != NULL)
+		sscanf(option + 11, "%lf", &percent);
+	*threshold = percent / 100;
+}
+
+/*____________________________________________________________________
+|
+| Function: Now
+|
+| Input: Called from Measure(), Run_Walk()
+| Output: Returns the time in milliseconds.
+|___________________________________________________________________*/
+
+static double Now()
+{
+	LARGE_INTEGER t;
+
+	QueryPerformanceCounter(&t);
+
+	return ((double)t.QuadPart * 1000 / freq.QuadPart);
+}
+
+/*____________________________________________________________________
+|
+| Function: Measure
+|
+| Input: Called from Bench_Run()
+| Output: Times BENCH_RUNS runs of a benchmark after a warm up run.
+|___________________________________________________________________*/
+
+static void Measure(const char* name, int ops, void (*run)())
+{
+	int i;
+	double t0;
+	Metric* metric = Add_Metric(name, ops);
+
+	if (metric == NULL)
+		return;
+	run();
+	for (i = 0; i < BENCH_RUNS; i++) {
+		t0 = Now();
+		run();
+		Add_Run(metric, Now() - t0);
+	}
+	Compute_Stats(metric);
+}
+
+/*____________________________________________________________________
+|
+| Function: Add_Metric
+|
+| Input: Called from Bench_Run(), Measure()
+| Output: Returns a new metric, or NULL if there is no room.
+|___________________________________________________________________*/
+
+static Metric* Add_Metric(const char* name, int ops)
+{
+	Metric* metric;
+
+	if (num_metrics == BENCH_MAX_METRICS)
+		return (NULL);
+	metric = &metrics[num_metrics++];
+	memset(metric, 0, sizeof(Metric));
+	strncpy(metric->name, name, sizeof(metric->name) - 1);
+	metric->ops = ops;
+	metric->baseline = -1;
+
+	return (metric);
+}
+
+/*____________________________________________________________________
+|
+| Function: Add_Run
+|
+| Input: Called from Bench_Run(), Measure()
+| Output: Records the time of a run.
+|___________________________________________________________________*/
+
+static void Add_Run(Metric* metric, double ms)
+{
+	if (metric && metric->num_runs < BENCH_RUNS)
+		metric->runs[metric->num_runs++] = ms;
+}
+
+/*____________________________________________________________________
+|
+| Function: Compute_Stats
+|
+| Input: Called from Bench_Run(), Measure()
+| Output: Computes the mean, (sample) standard deviation, min and max of
+|   a metric's runs.
+|___________________________________________________________________*/
+
+static void Compute_Stats(Metric* metric)
+{
+	int i;
+	double sum = 0, sum_sq = 0;
+
+	if (metric == NULL || metric->num_runs == 0)
+		return;
+	metric->min = metric->max = metric->runs[0];
+	for (i = 0; i < metric->num_runs; i++) {
+		sum += metric->runs[i];
+		if (metric->runs[i] < metric->min)
+			metric->min = metric->runs[i];
+		if (metric->runs[i] > metric->max)
+			metric->max = metric->runs[i];
+	}
+	metric->mean = sum / metric->num_runs;
+	for (i = 0; i < metric->num_runs; i++)
+		sum_sq += (metric->runs[i] - metric->mean) * (metric->runs[i] - metric->mean);
+	metric->std_dev = (metric->num_runs > 1) ? sqrt(sum_sq / (metric->num_runs - 1)) : 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Load_Assets
+|
+| Input: Called from Bench_Run()
+| Output: Loads the models, textures and particle system the scene
+|   uses.  Returns true on success.
+|___________________________________________________________________*/
+
+static int Load_Assets()
+{
+	obj_tree = obj_skydome = obj_paper = obj_slender = NULL;
+	gx3d_ReadLWO2File("Objects\\ptree6.lwo", &obj_tree, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
+	gx3d_ReadLWO2File("Objects\\skydome.lwo", &obj_skydome, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
+	gx3d_ReadLWO2File("Objects\\billboard_paper.lwo", &obj_paper, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
+	gx3d_ReadLWO2File("Objects\\billboard_slender.lwo", &obj_slender, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
+	tex_tree = gx3d_InitTexture_File("Objects\\Images\\ptree_d512.bmp", "Objects\\Images\\ptree_d512_fa.bmp", 0);
+	tex_skydome = gx3d_InitTexture_File("Objects\\Images\\Night.bmp", 0, 0);
+	tex_ground = gx3d_InitTexture_File("Objects\\Images\\Ground.bmp", 0, 0);
+	tex_paper = gx3d_InitTexture_File("Objects\\Images\\Paper.bmp", "Objects\\Images\\Paper_FA.bmp", 0);
+	tex_slender = gx3d_InitTexture_File("Objects\\Images\\Slender.bmp", "Objects\\Images\\Slender_FA.bmp", 0);
+	psys_fire = Script_ParticleSystem_Create("fire.gxps");
+
+	return (obj_tree && obj_skydome && obj_paper && obj_slender && tex_tree && tex_skydome && tex_ground && tex_paper && tex_slender && psys_fire);
+}
+
+/*____________________________________________________________________
+|
+| Function: Free_Assets
+|
+| Input: Called from Bench_Run()
+| Output: Frees whatever Load_Assets() loaded.
+|___________________________________________________________________*/
+
+static void Free_Assets()
+{
+	if (obj_tree)
+		gx3d_FreeObject(obj_tree);
+	if (obj_skydome)
+		gx3d_FreeObject(obj_skydome);
+	if (obj_paper)
+		gx3d_FreeObject(obj_paper);
+	if (obj_slender)
+		gx3d_FreeObject(obj_slender);
+	if (tex_tree)
+		gx3d_FreeTexture(tex_tree);
+	if (tex_skydome)
+		gx3d_FreeTexture(tex_skydome);
+	if (tex_ground)
+		gx3d_FreeTexture(tex_ground);
+	if (tex_paper)
+		gx3d_FreeTexture(tex_paper);
+	if (tex_slender)
+		gx3d_FreeTexture(tex_slender);
+	if (psys_fire)
+		gx3d_FreeParticleSystem(psys_fire);
+	obj_tree = obj_skydome = obj_paper = obj_slender = NULL;
+	tex_tree = tex_skydome = tex_ground = tex_paper = tex_slender = NULL;
+	psys_fire = NULL;
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Placement
+|
+| Input: Called from Measure()
+| Output: Spawns the forest with World_Spawn() on the heap, as the
+|   game and server do: the entities, trunk colliders and scene BVH.
+|___________________________________________________________________*/
+
+static void Run_Placement()
+{
+	Ecs_Free();
+	Bvh_Free(bvh);
+	Ecs_Init(NULL);
+	World_Define_Components();
+	bvh = World_Spawn(NULL, BENCH_SEED, &shapes, 0, 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Setup_Scene
+|
+| Input: Called from Bench_Run()
+| Output: Makes the rays and Slender positions for the micro
+|   benchmarks, over the forest Run_Placement() spawned.  Returns true
+|   on success.
+|___________________________________________________________________*/
+
+static int Setup_Scene()
+{
+	int i;
+	float angle;
+
+	rays = (gx3dRay*)Arena_Alloc(arena, BENCH_RAYS * sizeof(gx3dRay));
+	slenders = (gx3dVector*)Arena_Alloc(arena, BENCH_SLENDERS * sizeof(gx3dVector));
+	if (bvh == NULL || rays == NULL || slenders == NULL)
+		return (FALSE);
+
+	// Pick rays from eye height in random directions, as the player would click
+	srand(BENCH_SEED);
+	for (i = 0; i < BENCH_RAYS; i++) {
+		angle = rand() / (float)RAND_MAX * 6.2831853f;
+		rays[i].origin.x = (rand() / (float)RAND_MAX - 0.5f) * BENCH_FOREST_SIZE;
+		rays[i].origin.z = (rand() / (float)RAND_MAX - 0.5f) * BENCH_FOREST_SIZE;
+		rays[i].origin.y = Terrain_Get_Height(rays[i].origin.x, rays[i].origin.z) + BENCH_EYE_HEIGHT;
+		rays[i].direction.x = cosf(angle);
+		rays[i].direction.y = 0;
+		rays[i].direction.z = sinf(angle);
+	}
+	for (i = 0; i < BENCH_SLENDERS; i++) {
+		slenders[i].x = (float)(rand() % 301) - 150;
+		slenders[i].z = (float)(rand() % 301) - 150;
+		slenders[i].y = 0;
+	}
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Cull
+|
+| Input: Called from Measure()
+| Output: Tests every tree against the view frustum from the center of
+|   the forest, turning through BENCH_VIEWS headings.
+|___________________________________________________________________*/
+
+static void Run_Cull()
+{
+	int v, i;
+	float angle;
+	gx3dVector from, to, up = { 0, 1, 0 };
+	EcsQuery query;
+
+	visible = 0;
+	for (v = 0; v < BENCH_VIEWS; v++) {
+		angle = v * 6.2831853f / BENCH_VIEWS;
+		from.x = 0;
+		from.y = Terrain_Get_Height(0, 0) + BENCH_EYE_HEIGHT;
+		from.z = 0;
+		to.x = cosf(angle);
+		to.y = from.y;
+		to.z = sinf(angle);
+		gx3d_CameraSetPosition(&from, &to, &up, gx3d_CAMERA_ORIENTATION_LOOKTO_FIXED);
+		gx3d_CameraSetViewMatrix();
+
+		Ecs_Query_Begin(&query, ECS_MASK(COMP_TREE) | ECS_MASK(COMP_BOUNDS));
+		while (Ecs_Query_Next(&query)) {
+			gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+			for (i = 0; i < query.count; i++)
+				if (gx3d_Relation_Sphere_Frustum(&bounds[i]) != gxRELATION_OUTSIDE)
+					visible++;
+		}
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Pick
+|
+| Input: Called from Measure()
+| Output: Casts the page picking rays into the scene BVH.
+|___________________________________________________________________*/
+
+static void Run_Pick()
+{
+	int i;
+	BvhHit hit;
+
+	hits = 0;
+	for (i = 0; i < BENCH_RAYS; i++)
+		if (Bvh_Raycast(bvh, &rays[i], PICK_DISTANCE, BVH_MASK(ENTITY_TREE) | BVH_MASK(ENTITY_PAPER), &hit) && hit.type == ENTITY_PAPER)
+			hits++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Steer
+|
+| Input: Called from Measure()
+| Output: Steers BENCH_SLENDERS Slenders one frame towards the center.
+|___________________________________________________________________*/
+
+static void Run_Steer()
+{
+	gx3dVector target = { 0, 0, 0 };
+
+	Slender_Steer(slenders, BENCH_SLENDERS, &target, 1);
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Particles
+|
+| Input: Called from Measure()
+| Output: Updates the fire particle system for BENCH_PARTICLE_STEPS
+|   frames.
+|___________________________________________________________________*/
+
+static void Run_Particles()
+{
+	int i;
+	gx3dMatrix m;
+
+	gx3d_GetTranslateMatrix(&m, 0, -0.5, 0);
+	gx3d_SetParticleSystemMatrix(psys_fire, &m);
+	for (i = 0; i < BENCH_PARTICLE_STEPS; i++)
+		gx3d_UpdateParticleSystem(psys_fire, BENCH_FRAME_TIME);
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Matrices
+|
+| Input: Called from Measure()
+| Output: Builds BENCH_MATRICES billboard matrices, as the game does for
+|   each page and Slender.
+|___________________________________________________________________*/
+
+static void Run_Matrices()
+{
+	int i;
+	float angle;
+	gx3dMatrix m, m1, m2, m3;
+	gx3dVector normal = { 0, 0, 1 }, heading;
+
+	for (i = 0; i < BENCH_MATRICES; i++) {
+		angle = i * 0.001f;
+		heading.x = cosf(angle);
+		heading.y = 0;
+		heading.z = sinf(angle);
+		gx3d_GetScaleMatrix(&m1, 6, 6, 6);
+		gx3d_GetBillboardRotateYMatrix(&m2, &normal, &heading);
+		gx3d_GetTranslateMatrix(&m3, (float)i, 0, (float)-i);
+		gx3d_MultiplyMatrix(&m1, &m2, &m);
+		gx3d_MultiplyMatrix(&m, &m3, &m);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Find_Files
+|
+| Input: Called from Bench_Run()
+| Output: Lists up to max_files files in dir matching pattern, as paths
+|   from the game's directory.  Returns the # found.
+|___________________________________________________________________*/
+
+static int Find_Files(const char* dir, const char* pattern, char (*files)[MAX_PATH], int max_files)
+{
+	int n;
+	char path[MAX_PATH];
+	HANDLE find;
+	WIN32_FIND_DATAA data;
+
+	n = 0;
+	sprintf(path, "%s\\%s", dir, pattern);
+	find = FindFirstFileA(path, &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return (0);
+	do {
+		if (n < max_files && NOT (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			sprintf(files[n++], "%s\\%s", dir, data.cFileName);
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+
+	return (n);
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Load_BMP
+|
+| Input: Called from Measure()
+| Output: Loads and frees every texture found by Find_Images(), with
+|   its alpha map.
+|___________________________________________________________________*/
+
+static void Run_Load_BMP()
+{
+	int i;
+	gx3dTexture texture;
+
+	for (i = 0; i < num_images; i++) {
+		texture = gx3d_InitTexture_File(images[i][0], images[i][1][0] ? images[i][1] : 0, 0);
+		if (texture)
+			gx3d_FreeTexture(texture);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Find_Images
+|
+| Input: Called from Bench_Run()
+| Output: Lists the images in Objects\Images with their alpha files
+|   (skipping the atlas pages, lightmap and glyphs, which the game
+|   writes) and allocates a buffer big enough for any of them.  Returns
+|   the # found.
+|___________________________________________________________________*/
+
+static int Find_Images()
+{
+	int i, width, height;
+	unsigned size;
+	char* name;
+	HANDLE find;
+	WIN32_FIND_DATAA data;
+
+	num_images = 0;
+	image_buffer_size = 0;
+	find = FindFirstFileA("Objects\\Images\\*.bmp", &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return (0);
+	do {
+		name = data.cFileName;
+		if (num_images == BENCH_MAX_IMAGES || _strnicmp(name, "Atlas", 5) == 0 || _strnicmp(name, "Lightmap", 8) == 0 || _strnicmp(name, "Glyphs", 6) == 0 ||
+			(strlen(name) > 7 && _stricmp(name + strlen(name) - 7, "_fa.bmp") == 0))
+			continue;
+		sprintf(images[num_images][0], "Objects\\Images\\%s", name);
+		images[num_images][1][0] = 0;
+		num_images++;
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+
+	for (i = 0; i < num_images; i++) {
+		// Pair each image with its alpha file, if any
+		strcpy(images[i][1], images[i][0]);
+		strcpy(images[i][1] + strlen(images[i][1]) - 4, "_fa.bmp");
+		if (NOT Bmp_Get_Size(images[i][1], &width, &height))
+			images[i][1][0] = 0;
+		if (Bmp_Get_Size(images[i][0], &width, &height)) {
+			size = width * height * 4;
+			if (size > image_buffer_size)
+				image_buffer_size = size;
+		}
+	}
+	image_buffer = (unsigned char*)malloc(image_buffer_size);
+
+	return (image_buffer ? num_images : 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Decode_BMP
+|
+| Input: Called from Measure()
+| Output: Decodes every image found by Find_Images() into the same
+|   buffer.
+|___________________________________________________________________*/
+
+static void Run_Decode_BMP()
+{
+	int i;
+	BmpImage image;
+
+	for (i = 0; i < num_images; i++)
+		if (Bmp_Load(images[i][0], images[i][1][0] ? images[i][1] : 0, &image, image_buffer, image_buffer_size)) {
+			visible += image.texels[0];
+			Bmp_Free(&image);
+		}
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Load_LWO
+|
+| Input: Called from Measure()
+| Output: Loads and frees every shipped model.
+|___________________________________________________________________*/
+
+static void Run_Load_LWO()
+{
+	int i;
+	gx3dObject* object;
+
+	for (i = 0; i < num_models; i++) {
+		object = NULL;
+		gx3d_ReadLWO2File(models[i], &object, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
+		if (object)
+			gx3d_FreeObject(object);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Load_WAV
+|
+| Input: Called from Measure()
+| Output: Loads and frees every shipped sound.
+|___________________________________________________________________*/
+
+static void Run_Load_WAV()
+{
+	int i;
+	Sound sound;
+
+	for (i = 0; i < num_wavs; i++) {
+		sound = snd_LoadSound(wavs[i], snd_CONTROL_VOLUME, 0);
+		if (sound)
+			snd_FreeSound(sound);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Find_Sounds
+|
+| Input: Called from Bench_Run()
+| Output: Encodes the sounds in wav to ADPCM and allocates the voices
+|   to play them.  Returns the # of sounds.
+|___________________________________________________________________*/
+
+static int Find_Sounds()
+{
+	char filename[MAX_PATH];
+	HANDLE find;
+	WIN32_FIND_DATAA data;
+
+	num_sounds = 0;
+	find = FindFirstFileA("wav\\*.wav", &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return (0);
+	do {
+		sprintf(filename, "wav\\%s", data.cFileName);
+		if (num_sounds < BENCH_MAX_SOUNDS && Adpcm_Encode_Wav(filename, &sounds[num_sounds]))
+			num_sounds++;
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+	voices = (AdpcmVoice*)malloc(BENCH_VOICES * sizeof(AdpcmVoice));
+
+	return (voices ? num_sounds : 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Decode_ADPCM
+|
+| Input: Called from Measure()
+| Output: Reads BENCH_VOICE_FRAMES from each of BENCH_VOICES voices,
+|   BENCH_MIX_FRAMES at a time.
+|___________________________________________________________________*/
+
+static void Run_Decode_ADPCM()
+{
+	int i;
+	unsigned frames;
+	short out[BENCH_MIX_FRAMES * ADPCM_MAX_CHANNELS];
+	AdpcmSound* sound;
+
+	for (i = 0; i < BENCH_VOICES; i++) {
+		sound = &sounds[i % num_sounds];
+		Adpcm_Voice_Init(&voices[i], sound, TRUE);
+		Adpcm_Seek(&voices[i], (i * 7919u) % sound->num_samples);
+		for (frames = 0; frames < BENCH_VOICE_FRAMES; frames += BENCH_MIX_FRAMES) {
+			Adpcm_Read(&voices[i], out, BENCH_MIX_FRAMES);
+			visible += out[0];
+		}
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Setup_Bake
+|
+| Input: Called from Bench_Run()
+| Output: Sets up a bake of the forest lit by the fire, as the game
+|   bakes it, on the given # of threads (0 for one per processor).
+|   The bake isn't saved.  Returns true on success.
+|___________________________________________________________________*/
+
+static int Setup_Bake(int threads)
+{
+	BakeSettings settings = { -BENCH_FOREST_SIZE / 2, -BENCH_FOREST_SIZE / 2, BENCH_FOREST_SIZE, BENCH_BAKE_RESOLUTION, { 0.1f, 0.1f, 0.1f, 0 }, BENCH_BAKE_AO_RADIUS, threads };
+	gx3dLightData light;
+	EcsQuery query;
+	float width, depth, canopy_radius;
+
+	if (NOT Bake_Init(NULL, &settings))
+		return (FALSE);
+
+	memset(&light, 0, sizeof(light));
+	light.light_type = gx3d_LIGHT_TYPE_POINT;
+	light.point.diffuse_color.r = light.point.diffuse_color.g = light.point.diffuse_color.b = 1;
+	light.point.ambient_color.r = light.point.ambient_color.g = light.point.ambient_color.b = 1;
+	light.point.range = 30;
+	light.point.linear_attenuation = 0.1f;
+	light.point.src.y = Terrain_Get_Height(0, 0) + 0.5f;
+	Bake_Add_Point_Light(&light);
+
+	width = obj_tree->bound_box.max.x - obj_tree->bound_box.min.x;
+	depth = obj_tree->bound_box.max.z - obj_tree->bound_box.min.z;
+	canopy_radius = (width > depth ? width : depth) / 2;
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_TREE) | ECS_MASK(COMP_POSITION));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		for (int i = 0; i < query.count; i++)
+			if (Bake_Add_Tree(&pos[i], obj_tree->bound_box.max.y, TREE_TRUNK_RADIUS, obj_tree->bound_box.max.y - canopy_radius, canopy_radius) < 0)
+				return (FALSE);
+	}
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Bake
+|
+| Input: Called from Measure()
+| Output: Bakes the lighting set up by Setup_Bake().
+|___________________________________________________________________*/
+
+static void Run_Bake()
+{
+	if (Bake_Run())
+		hits++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Walk
+|
+| Input: Called from Bench_Run()
+| Output: Walks the scripted path through the forest for
+|   BENCH_WALK_FRAMES frames, simulating and drawing each as the game
+|   does, as fast as possible.  Returns each frame's time.
+|___________________________________________________________________*/
+
+static void Run_Walk(double* frame_times)
+{
+	static gx3dVector billboard_normal = { 0, 0, 1 };
+	static gx3dColor color3d_white = { 1, 1, 1, 0 };
+	static gx3dColor color3d_dim = { 0.1f, 0.1f, 0.1f };
+	static gx3dMaterialData material_default = {
+	  { 1, 1, 1, 1 }, { 1, 1, 1, 1 }, { 1, 1, 1, 1 }, { 0, 0, 0, 0 }, 10
+	};
+	int f, i;
+	double t0;
+	gx3dVector position, heading, to, up = { 0, 1, 0 };
+	gx3dMatrix m, m1, m2, m3;
+	gx3dRay ray;
+	gxColor black = { 0, 0, 0, 0 };
+	BvhHit hit;
+	EcsQuery query;
+
+	srand(BENCH_SEED);
+	for (f = 0; f < BENCH_WALK_FRAMES; f++) {
+		t0 = Now();
+
+		// Move along the path
+		Walk_Position(f * BENCH_WALK_SPEED, &position, &heading);
+		to.x = position.x + heading.x;
+		to.y = position.y + heading.y;
+		to.z = position.z + heading.z;
+		gx3d_CameraSetPosition(&position, &to, &up, gx3d_CAMERA_ORIENTATION_LOOKTO_FIXED);
+		gx3d_CameraSetViewMatrix();
+		Terrain_Update(&position);
+
+		// Move Slender and refit the BVH around him
+		Ecs_Query_Begin(&query, ECS_MASK(COMP_SLENDER) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS) | ECS_MASK(COMP_BVH_ENTRY));
+		while (Ecs_Query_Next(&query)) {
+			gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+			gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+			BvhEntry* entry = ECS_COLUMN(&query, BvhEntry, COMP_BVH_ENTRY);
+			Slender_Steer(pos, query.count, &position, 1);
+			for (i = 0; i < query.count; i++) {
+				bounds[i].center = pos[i];
+				Bvh_Move_Entry(bvh, entry[i], &pos[i]);
+			}
+		}
+		Bvh_Refit(bvh);
+
+		// Try to pick a page every frame
+		ray.origin = position;
+		ray.direction = heading;
+		if (Bvh_Raycast(bvh, &ray, PICK_DISTANCE, BVH_MASK(ENTITY_TREE) | BVH_MASK(ENTITY_PAPER), &hit) && hit.type == ENTITY_PAPER)
+			hits++;
+
+		gx3d_SetFogColor(0, 0, 0);
+		gx3d_SetLinearPixelFog(15, 150);
+		gx3d_ClearViewport(gx3d_CLEAR_SURFACE | gx3d_CLEAR_ZBUFFER, black, gx3d_MAX_ZBUFFER_VALUE, 0);
+		if (gx3d_BeginRender()) {
+			gx3d_SetMaterial(&material_default);
+			LightMgr_Reserve_Lights(0);
+			LightMgr_Begin_Frame();
+			gx3d_EnableFog();
+
+			RenderQ_Begin(frame_arena, BENCH_MAX_DRAWS, &position, color3d_dim);
+			Terrain_Queue(tex_ground, NULL);
+			gx3d_GetScaleMatrix(&m1, 200, 100, 200);
+			gx3d_GetTranslateMatrix(&m2, 0, 0, 0);
+			gx3d_MultiplyMatrix(&m1, &m2, &m);
+			gx3dSphere sky_bounds = { { 0, 0, 0 }, 200 };
+			RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_SKY, obj_skydome, &m, tex_skydome, &sky_bounds, FALSE);
+
+			Ecs_Query_Begin(&query, ECS_MASK(COMP_TREE) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS));
+			while (Ecs_Query_Next(&query)) {
+				gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+				gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+				for (i = 0; i < query.count; i++)
+					if (gx3d_Relation_Sphere_Frustum(&bounds[i]) != gxRELATION_OUTSIDE) {
+						gx3d_GetTranslateMatrix(&m, pos[i].x, pos[i].y, pos[i].z);
+						RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_CUTOUT, obj_tree, &m, tex_tree, &bounds[i], TRUE);
+					}
+			}
+			Ecs_Query_Begin(&query, ECS_MASK(COMP_PAGE) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS));
+			while (Ecs_Query_Next(&query)) {
+				gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+				gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+				for (i = 0; i < query.count; i++)
+					if (gx3d_Relation_Sphere_Frustum(&bounds[i]) != gxRELATION_OUTSIDE) {
+						gx3d_GetScaleMatrix(&m1, 1, 1, 1);
+						gx3d_GetBillboardRotateYMatrix(&m2, &billboard_normal, &heading);
+						gx3d_GetTranslateMatrix(&m3, pos[i].x, pos[i].y, pos[i].z);
+						gx3d_MultiplyMatrix(&m1, &m2, &m);
+						gx3d_MultiplyMatrix(&m, &m3, &m);
+						RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_BLEND, obj_paper, &m, tex_paper, &bounds[i], TRUE);
+					}
+			}
+			Ecs_Query_Begin(&query, ECS_MASK(COMP_SLENDER) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS));
+			while (Ecs_Query_Next(&query)) {
+				gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+				gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+				for (i = 0; i < query.count; i++) {
+					gx3d_GetScaleMatrix(&m1, 6, 6, 6);
+					gx3d_GetBillboardRotateYMatrix(&m2, &billboard_normal, &heading);
+					gx3d_GetTranslateMatrix(&m3, pos[i].x, pos[i].y, pos[i].z);
+					gx3d_MultiplyMatrix(&m1, &m2, &m);
+					gx3d_MultiplyMatrix(&m, &m3, &m);
+					RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_BLEND, obj_slender, &m, tex_slender, &bounds[i], TRUE);
+				}
+			}
+			RenderQ_Submit();
+			gx3d_DisableFog();
+
+			gx3d_SetAmbientLight(color3d_white);
+			gx3d_EnableAlphaBlending();
+			gx3d_GetTranslateMatrix(&m, 0, -0.5, 0);
+			gx3d_SetParticleSystemMatrix(psys_fire, &m);
+			gx3d_UpdateParticleSystem(psys_fire, BENCH_FRAME_TIME);
+			gx3d_DrawParticleSystem(psys_fire, &heading, FALSE);
+			gx3d_DisableAlphaBlending();
+
+			gx3d_EndRender();
+			gxFlipVisualActivePages(FALSE);
+		}
+		Arena_Reset(frame_arena);
+
+		frame_times[f] = Now() - t0;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Walk_Position
+|
+| Input: Called from Run_Walk()
+| Output: Returns the eye position and heading at a distance along the
+|   scripted path, which loops.
+|___________________________________________________________________*/
+
+static void Walk_Position(float distance, gx3dVector* position, gx3dVector* heading)
+{
+	int i, num_segments = sizeof(walk_path) / sizeof(walk_path[0]) - 1;
+	float dx, dz, length, total = 0;
+
+	for (i = 0; i < num_segments; i++) {
+		dx = walk_path[i + 1][0] - walk_path[i][0];
+		dz = walk_path[i + 1][1] - walk_path[i][1];
+		total += sqrtf(dx * dx + dz * dz);
+	}
+	distance = fmodf(distance, total);
+
+	for (i = 0; i < num_segments; i++) {
+		dx = walk_path[i + 1][0] - walk_path[i][0];
+		dz = walk_path[i + 1][1] - walk_path[i][1];
+		length = sqrtf(dx * dx + dz * dz);
+		if (distance <= length || i == num_segments - 1)
+			break;
+		distance -= length;
+	}
+	heading->x = dx / length;
+	heading->y = 0;
+	heading->z = dz / length;
+	position->x = walk_path[i][0] + heading->x * distance;
+	position->z = walk_path[i][1] + heading->z * distance;
+	position->y = Terrain_Get_Height(position->x, position->z) + BENCH_EYE_HEIGHT;
+}
+
+/*____________________________________________________________________
+|
+| Function: Setup_Snapshot
+|
+| Input: Called from Bench_Run()
+| Output: Spawns a forest of BENCH_SNAPSHOT_TREES at the game's density
+|   into the arena, as the game does into its level arena (a restore
+|   needs the entity store in an arena), and a ring sized for it.
+|   Returns true if the whole forest was spawned.
+|___________________________________________________________________*/
+
+static int Setup_Snapshot(Arena snapshot_arena)
+{
+	World_Set_Size(BENCH_SNAPSHOT_TREES, BENCH_SLENDER, (int)(WORLD_SPAWN_RANGE * sqrt((double)BENCH_SNAPSHOT_TREES / NUM_TREES)));
+	Ecs_Init(snapshot_arena);
+	World_Define_Components();
+	bvh = World_Spawn(snapshot_arena, BENCH_SEED, &shapes, 0, 0);
+	if (bvh == NULL || Ecs_Count(ECS_MASK(COMP_TREE)) < BENCH_SNAPSHOT_TREES)
+		return (FALSE);
+
+	return (Snapshot_Init(1, sizeof(int)));
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Snapshot
+|
+| Input: Called from Bench_Run()
+| Output: Captures a snapshot into the ring and rewinds to it, then
+|   saves one to a file and loads it, getting the ms each took from
+|   the snapshot stats.  Returns true on success.
+|___________________________________________________________________*/
+
+static int Run_Snapshot(double* capture, double* rewind, double* save, double* load)
+{
+	int state = 0;
+	void* user;
+	unsigned user_size, frame;
+	SnapshotStats stats;
+
+	if (NOT Snapshot_Capture(&state, sizeof(state), 0))
+		return (FALSE);
+	Snapshot_Get_Stats(&stats);
+	*capture = stats.last_capture_time;
+	if (NOT Snapshot_Rewind(1, &user, &user_size, &frame))
+		return (FALSE);
+	Snapshot_Get_Stats(&stats);
+	*rewind = stats.last_restore_time;
+	if (NOT Snapshot_Save(BENCH_SNAPSHOT_FILE, &state, sizeof(state)))
+		return (FALSE);
+	Snapshot_Get_Stats(&stats);
+	*save = stats.last_save_time;
+	if (NOT Snapshot_Load(BENCH_SNAPSHOT_FILE, &user, &user_size))
+		return (FALSE);
+	Snapshot_Get_Stats(&stats);
+	*load = stats.last_restore_time;
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Net
+|
+| Input: Called from Bench_Run()
+| Output: Runs a server with BENCH_NET_CLIENTS bots over loopback for
+|   BENCH_NET_TICKS ticks, as fast as it can, timing each tick.
+|   Returns the server's stats for the run and the # of snapshots the
+|   bots couldn't decode.
+|___________________________________________________________________*/
+
+static void Run_Net(double* tick_times, ServerStats* server_stats, unsigned* dropped)
+{
+	int i, t;
+	double t0;
+	NetAddress address;
+	Client bots[BENCH_NET_CLIENTS];
+	ClientStats client_stats;
+
+	memset(server_stats, 0, sizeof(ServerStats));
+	*dropped = 0;
+	if (NOT Server_Init(0, BENCH_NET_CLIENTS, BENCH_SEED)) {
+		memset(tick_times, 0, BENCH_NET_TICKS * sizeof(double));
+		return;
+	}
+	srand(BENCH_SEED);
+	Net_Resolve("127.0.0.1", (unsigned short)Server_Get_Port(), &address);
+	for (i = 0; i < BENCH_NET_CLIENTS; i++)
+		bots[i] = Client_Create(&address);
+
+	for (t = -BENCH_NET_WARM_UP; t < BENCH_NET_TICKS; t++) {
+		t0 = Now();
+		Server_Tick();
+		if (t >= 0)
+			tick_times[t] = Now() - t0;
+		for (i = 0; i < BENCH_NET_CLIENTS; i++)
+			if (bots[i])
+				Client_Bot_Update(bots[i], 1000 / SERVER_TICK_RATE);
+	}
+
+	Server_Get_Stats(server_stats);
+	for (i = 0; i < BENCH_NET_CLIENTS; i++)
+		if (bots[i]) {
+			Client_Get_Stats(bots[i], &client_stats);
+			*dropped += client_stats.no_baseline + client_stats.malformed;
+			Client_Free(bots[i]);
+		}
+	Server_Free();
+}
+
+/*____________________________________________________________________
+|
+| Function: Compare_Doubles
+|
+| Input: Called from Bench_Run() (qsort)
+| Output: Orders doubles ascending.
+|___________________________________________________________________*/
+
+static int Compare_Doubles(const void* d1, const void* d2)
+{
+	double v1 = *(double*)d1, v2 = *(double*)d2;
+
+	return ((v1 > v2) - (v1 < v2));
+}
+
+/*____________________________________________________________________
+|
+| Function: Compare_Baseline
+|
+| Input: Called from Bench_Run()
+| Output: Compares each metric with the same metric in a baseline
+|   results file.  Returns the # of regressions, counting a missing
+|   baseline file as one.
+|___________________________________________________________________*/
+
+static int Compare_Baseline(char* baseline_file, double threshold)
+{
+	int i, regressions = 0;
+	long size;
+	char* text;
+	double mean, std_dev;
+	Metric* metric;
+	FILE* fp;
+
+	fp = fopen(baseline_file, "rb");
+	if (fp == NULL) {
+		debug_WriteFile("Compare_Baseline(): can't open the baseline file");
+		return (1);
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	text = (char*)malloc(size + 1);
+	if (text == NULL || fread(text, 1, size, fp) != (size_t)size) {
+		debug_WriteFile("Compare_Baseline(): can't read the baseline file");
+		free(text);
+		fclose(fp);
+		return (1);
+	}
+	text[size] = 0;
+	fclose(fp);
+
+	for (i = 0; i < num_metrics; i++) {
+		metric = &metrics[i];
+		if (Find_Value(text, metric->name, "\"mean\":", &mean) && Find_Value(text, metric->name, "\"std_dev\":", &std_dev)) {
+			metric->baseline = mean;
+			if (metric->mean > mean * (1 + threshold) && metric->mean - mean > BENCH_NOISE_SIGMAS * std_dev) {
+				metric->regressed = TRUE;
+				regressions++;
+			}
+		}
+	}
+	free(text);
+
+	return (regressions);
+}
+
+/*____________________________________________________________________
+|
+| Function: Find_Value
+|
+| Input: Called from Compare_Baseline()
+| Output: Finds a field of the named metric in a results file's text.
+|   Returns true if found.
+|___________________________________________________________________*/
+
+static int Find_Value(char* text, const char* name, const char* field, double* value)
+{
+	char key[64], * s, * end;
+
+	sprintf(key, "\"name\": \"%s\"", name);
+	s = strstr(text, key);
+	if (s == NULL)
+		return (FALSE);
+	end = strchr(s, '}');
+	s = strstr(s, field);
+	if (s == NULL || (end && s > end))
+		return (FALSE);
+
+	return (sscanf(s + strlen(field), "%lf", value) == 1);
+}
+
+/*____________________________________________________________________
+|
+| Function: Write_Results
+|
+| Input: Called from Bench_Run()
+| Output: Writes the metrics as JSON.  Returns true on success.
+|___________________________________________________________________*/
+
+static int Write_Results(char* results_file, char* baseline_file, double threshold, int regressions)
+{
+	int i, r;
+	Metric* metric;
+	FILE* fp;
+
+	fp = fopen(results_file, "w");
+	if (fp == NULL)
+		return (FALSE);
+
+	fprintf(fp, "{\n  \"runs\": %d,\n  \"metrics\": [\n", BENCH_RUNS);
+	for (i = 0; i < num_metrics; i++) {
+		metric = &metrics[i];
+		fprintf(fp, "    { \"name\": \"%s\", \"unit\": \"ms\", \"ops\": %d, ", metric->name, metric->ops);
+		fprintf(fp, "\"mean\": %.6f, \"std_dev\": %.6f, \"cv\": %.4f, \"min\": %.6f, \"max\": %.6f, ",
+			metric->mean, metric->std_dev, metric->mean > 0 ? metric->std_dev / metric->mean : 0, metric->min, metric->max);
+		fprintf(fp, "\"ns_per_op\": %.1f, \"runs\": [", metric->ops ? metric->mean * 1000000 / metric->ops : 0);
+		for (r = 0; r < metric->num_runs; r++)
+			fprintf(fp, "%s%.6f", r ? ", " : "", metric->runs[r]);
+		fprintf(fp, "]");
+		if (metric->baseline >= 0)
+			fprintf(fp, ", \"baseline\": %.6f, \"change\": %.4f, \"regressed\": %s",
+				metric->baseline, metric->baseline > 0 ? metric->mean / metric->baseline - 1 : 0, metric->regressed ? "true" : "false");
+		fprintf(fp, " }%s\n", i < num_metrics - 1 ? "," : "");
+	}
+	fprintf(fp, "  ],\n  \"baseline\": ");
+	if (baseline_file[0])
+		Write_String(fp, baseline_file);
+	else
+		fprintf(fp, "null");
+	fprintf(fp, ",\n  \"threshold\": %.4f,\n  \"regressions\": %d,\n  \"passed\": %s\n}\n", threshold, regressions, regressions ? "false" : "true");
+
+	return (fclose(fp) == 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Write_String
+|
+| Input: Called from Write_Results()
+| Output: Writes a JSON string, escaping quotes and backslashes.
+|___________________________________________________________________*/
+
+static void Write_String(FILE* fp, const char* str)
+{
+	fputc('"', fp);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', fp);
+		fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+/*____________________________________________________________________
+|
+| Function: Report
+|
+| Input: Called from Bench_Run()
+| Output: Writes a summary of the results to the debug file.
+|___________________________________________________________________*/
+
+static void Report(char* results_file, int regressions)
+{
+	int i;
+	char str[256];
+	Metric* metric;
+
+	debug_WriteFile("_______________ Benchmark ________________");
+	for (i = 0; i < num_metrics; i++) {
+		metric = &metrics[i];
+		sprintf(str, "%-16s %9.3f ms +/- %.3f (min %.3f, max %.3f)", metric->name, metric->mean, metric->std_dev, metric->min, metric->max);
+		if (metric->baseline >= 0)
+			sprintf(str + strlen(str), ", baseline %.3f%s", metric->baseline, metric->regressed ? " REGRESSED" : "");
+		debug_WriteFile(str);
+	}
+	sprintf(str, "visible trees: %u, pages picked: %u", visible, hits);
+	debug_WriteFile(str);
+	sprintf(str, "results: %s, %s (%d regressions)", results_file, regressions ? "FAILED" : "passed", regressions);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+}
@@ -0,0 +1,19 @@
+/*____________________________________________________________________
+|
+| File: bench.h
+|
+| Description: Benchmark suite for the game's hot paths, with JSON
+|   results and regression checks against a baseline.
+|___________________________________________________________________*/
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int Bench_Run (char *options);
+
+#endif
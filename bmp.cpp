@@ -0,0 +1,521 @@
+/*____________________________________________________________________
+|
+| File: bmp.cpp
+|
+| Description: BMP decoder - reads an image file and its optional alpha
+|   file into 32-bit texels ready to upload.
+|
+|   Both files are memory mapped and decoded straight from the mapping
+|   in one pass, top row first: each row is flipped (files are stored
+|   bottom up), its B, G, R texels widened to 32 bits and the alpha
+|   file's row merged in, writing each texel once into the caller's
+|   buffer (or a malloc'd one).  8, 24 and 32-bit files are supported,
+|   for both the image and the alpha file.  Alpha is the green channel
+|   of the alpha file (they are grey), else opaque.
+|
+|   24 and 32-bit rows are done 16 texels at a time with SSSE3 byte
+|   shuffles, when the CPU has them.  8-bit rows go through a palette
+|   lookup table.
+|
+|   Bmp_Save() writes texels back out as a 24-bit file, for images made
+|   at run time (atlas pages, the lightmap) that the toolkit has to
+|   load from a file.
+|
+| Functions:  Bmp_Get_Size
+|             Bmp_Load
+|							 Map_File
+|							 Unmap_File
+|							 Parse_Header
+|							 Decode_Row
+|							 Alpha_Row
+|							 Has_SSSE3
+|             Bmp_Save
+|             Bmp_Free
+|             Bmp_Use_SIMD
+|             Bmp_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include <intrin.h>
+#include <tmmintrin.h>
+
+#include "bmp.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define BMP_MAX_WIDTH  4096  // texels
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	HANDLE         file, mapping;
+	unsigned char* data;
+	DWORD          size;
+} MappedFile;
+
+typedef struct {
+	int            width, height;
+	int            bpp;
+	int            stride;      // bytes per row, padded to 4
+	bool           bottom_up;
+	unsigned char* pixels;      // first row in the file
+	unsigned       palette[256];  // 8-bit only, 0x00RRGGBB
+} Header;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static bool Map_File(const char* filename, MappedFile* mapped);
+static void Unmap_File(MappedFile* mapped);
+static bool Parse_Header(MappedFile* mapped, Header* header);
+static void Decode_Row(unsigned char* dst, Header* header, unsigned char* src, unsigned char* alpha);
+static void Alpha_Row(unsigned char* dst, Header* header, unsigned char* src);
+static bool Has_SSSE3();
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static int      use_simd = -1;  // -1 until checked
+static BmpStats stats;
+
+/*____________________________________________________________________
+|
+| Function: Bmp_Get_Size
+|
+| Input: Called from Atlas_Build(), Bench_Run()
+| Output: Gets the size of a BMP file's image.  Returns true on
+|   success.
+|___________________________________________________________________*/
+
+int Bmp_Get_Size(const char* filename, int* width, int* height)
+{
+	MappedFile mapped;
+	Header header;
+	bool ok;
+
+	if (NOT Map_File(filename, &mapped))
+		return (FALSE);
+	ok = Parse_Header(&mapped, &header);
+	Unmap_File(&mapped);
+	if (ok) {
+		*width = header.width;
+		*height = header.height;
+	}
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bmp_Load
+|
+| Input: Called from Atlas_Build(), Bench_Run()
+| Output: Decodes an image file, and an alpha file (0 if none) of the
+|   same size, into buffer if it is big enough (4 bytes a texel), else
+|   into a malloc'd buffer.  Returns true on success.  Call Bmp_Free()
+|   when done with the image.
+|___________________________________________________________________*/
+
+int Bmp_Load(const char* filename, const char* alpha_filename, BmpImage* image, void* buffer, unsigned buffer_size)
+{
+	int y;
+	unsigned size;
+	MappedFile color_file, alpha_file;
+	Header color, alpha;
+	unsigned char alpha_row[BMP_MAX_WIDTH + 16];
+	unsigned char *dst, *src;
+	bool ok;
+	LARGE_INTEGER freq, t0, t1;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	if (use_simd < 0)
+		use_simd = Has_SSSE3();
+
+	image->texels = NULL;
+	image->owned = FALSE;
+	alpha_file.data = NULL;
+	ok = Map_File(filename, &color_file);
+	if (ok) {
+		ok = Parse_Header(&color_file, &color) && color.width <= BMP_MAX_WIDTH;
+		if (ok && alpha_filename)
+			ok = Map_File(alpha_filename, &alpha_file) && Parse_Header(&alpha_file, &alpha) &&
+			     alpha.width == color.width && alpha.height == color.height;
+	}
+
+	if (ok) {
+		image->width = color.width;
+		image->height = color.height;
+		size = color.width * color.height * 4;
+		if (buffer && buffer_size >= size)
+			image->texels = (unsigned char*)buffer;
+		else {
+			image->texels = (unsigned char*)malloc(size);
+			image->owned = TRUE;
+		}
+		ok = (image->texels != NULL);
+	}
+
+	for (y = 0; ok && y < color.height; y++) {
+		dst = image->texels + y * color.width * 4;
+		src = color.pixels + color.stride * (color.bottom_up ? color.height - 1 - y : y);
+		if (alpha_filename) {
+			Alpha_Row(alpha_row, &alpha, alpha.pixels + alpha.stride * (alpha.bottom_up ? alpha.height - 1 - y : y));
+			Decode_Row(dst, &color, src, alpha_row);
+		}
+		else
+			Decode_Row(dst, &color, src, NULL);
+	}
+
+	if (ok) {
+		stats.loads++;
+		stats.texels += color.width * color.height;
+		stats.bytes += color_file.size + (alpha_filename ? alpha_file.size : 0);
+	}
+	else {
+		stats.failures++;
+		Bmp_Free(image);
+	}
+	if (color_file.data)
+		Unmap_File(&color_file);
+	if (alpha_file.data)
+		Unmap_File(&alpha_file);
+
+	QueryPerformanceCounter(&t1);
+	stats.last_load_time = (float)((t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart);
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Map_File
+|
+| Input: Called from Bmp_Get_Size(), Bmp_Load()
+| Output: Maps a file read only.  Returns true on success, else
+|   mapped->data is NULL.
+|___________________________________________________________________*/
+
+static bool Map_File(const char* filename, MappedFile* mapped)
+{
+	mapped->data = NULL;
+	mapped->mapping = NULL;
+	mapped->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mapped->file == INVALID_HANDLE_VALUE)
+		return (false);
+
+	mapped->size = GetFileSize(mapped->file, NULL);
+	if (mapped->size != INVALID_FILE_SIZE && mapped->size)
+		mapped->mapping = CreateFileMappingA(mapped->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapped->mapping)
+		mapped->data = (unsigned char*)MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (mapped->data == NULL) {
+		if (mapped->mapping)
+			CloseHandle(mapped->mapping);
+		CloseHandle(mapped->file);
+		return (false);
+	}
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: Unmap_File
+|
+| Input: Called from Bmp_Get_Size(), Bmp_Load()
+| Output: Unmaps and closes a file mapped by Map_File().
+|___________________________________________________________________*/
+
+static void Unmap_File(MappedFile* mapped)
+{
+	UnmapViewOfFile(mapped->data);
+	CloseHandle(mapped->mapping);
+	CloseHandle(mapped->file);
+	mapped->data = NULL;
+}
+
+/*____________________________________________________________________
+|
+| Function: Parse_Header
+|
+| Input: Called from Bmp_Get_Size(), Bmp_Load()
+| Output: Reads and checks the header of a mapped uncompressed 8, 24 or
+|   32-bit BMP file.  Returns true if it can be decoded.
+|___________________________________________________________________*/
+
+static bool Parse_Header(MappedFile* mapped, Header* header)
+{
+	int i;
+	unsigned offset, info_size, colors;
+	unsigned char* data = mapped->data;
+
+	if (mapped->size < 54 || data[0] != 'B' || data[1] != 'M')
+		return (false);
+	offset = *(unsigned*)(data + 10);
+	info_size = *(unsigned*)(data + 14);
+	header->width = *(int*)(data + 18);
+	header->height = abs(*(int*)(data + 22));
+	header->bottom_up = (*(int*)(data + 22) > 0);
+	header->bpp = *(unsigned short*)(data + 28);
+	header->stride = (header->width * header->bpp / 8 + 3) & ~3;
+	header->pixels = data + offset;
+
+	if (*(unsigned*)(data + 30) != 0 || (header->bpp != 8 && header->bpp != 24 && header->bpp != 32) ||
+	    header->width <= 0 || header->height == 0 || offset > mapped->size ||
+	    (unsigned long long)header->stride * header->height > mapped->size - offset)
+		return (false);
+
+	if (header->bpp == 8) {
+		colors = *(unsigned*)(data + 46) ? *(unsigned*)(data + 46) : 256;
+		if (colors > 256 || 14 + info_size + colors * 4 > offset)
+			return (false);
+		memset(header->palette, 0, sizeof(header->palette));
+		for (i = 0; i < (int)colors; i++)
+			header->palette[i] = *(unsigned*)(data + 14 + info_size + i * 4) & 0xFFFFFF;
+	}
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: Decode_Row
+|
+| Input: Called from Bmp_Load()
+| Output: Writes a row of 32-bit texels from a row of the image file
+|   and a row of alpha (NULL if opaque).
+|___________________________________________________________________*/
+
+static void Decode_Row(unsigned char* dst, Header* header, unsigned char* src, unsigned char* alpha)
+{
+	int x = 0, width = header->width;
+	unsigned* out = (unsigned*)dst;
+
+	switch (header->bpp) {
+		case 8:
+			for (; x < width; x++)
+				out[x] = header->palette[src[x]] | ((alpha ? alpha[x] : 255u) << 24);
+			break;
+		case 24:
+			if (use_simd) {
+				const __m128i widen = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+				const __m128i spread0 = _mm_setr_epi8(-1, -1, -1, 0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3);
+				const __m128i spread1 = _mm_setr_epi8(-1, -1, -1, 4, -1, -1, -1, 5, -1, -1, -1, 6, -1, -1, -1, 7);
+				const __m128i spread2 = _mm_setr_epi8(-1, -1, -1, 8, -1, -1, -1, 9, -1, -1, -1, 10, -1, -1, -1, 11);
+				const __m128i spread3 = _mm_setr_epi8(-1, -1, -1, 12, -1, -1, -1, 13, -1, -1, -1, 14, -1, -1, -1, 15);
+				for (; x + 16 <= width; x += 16, src += 48) {
+					__m128i c0 = _mm_loadu_si128((__m128i*)src);
+					__m128i c1 = _mm_loadu_si128((__m128i*)(src + 16));
+					__m128i c2 = _mm_loadu_si128((__m128i*)(src + 32));
+					__m128i a = alpha ? _mm_loadu_si128((__m128i*)(alpha + x)) : _mm_set1_epi8(-1);
+					_mm_storeu_si128((__m128i*)(out + x), _mm_or_si128(_mm_shuffle_epi8(c0, widen), _mm_shuffle_epi8(a, spread0)));
+					_mm_storeu_si128((__m128i*)(out + x + 4), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c1, c0, 12), widen), _mm_shuffle_epi8(a, spread1)));
+					_mm_storeu_si128((__m128i*)(out + x + 8), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c2, c1, 8), widen), _mm_shuffle_epi8(a, spread2)));
+					_mm_storeu_si128((__m128i*)(out + x + 12), _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c2, 4), widen), _mm_shuffle_epi8(a, spread3)));
+				}
+			}
+			for (; x < width; x++, src += 3)
+				out[x] = src[0] | (src[1] << 8) | (src[2] << 16) | ((alpha ? alpha[x] : 255u) << 24);
+			break;
+		case 32:
+			// The fourth byte isn't alpha in an uncompressed BMP
+			if (use_simd) {
+				const __m128i color = _mm_set1_epi32(0xFFFFFF);
+				const __m128i spread = _mm_setr_epi8(-1, -1, -1, 0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3);
+				for (; x + 4 <= width; x += 4, src += 16) {
+					__m128i a = alpha ? _mm_cvtsi32_si128(*(int*)(alpha + x)) : _mm_set1_epi8(-1);
+					_mm_storeu_si128((__m128i*)(out + x), _mm_or_si128(_mm_and_si128(_mm_loadu_si128((__m128i*)src), color), _mm_shuffle_epi8(a, spread)));
+				}
+			}
+			for (; x < width; x++, src += 4)
+				out[x] = src[0] | (src[1] << 8) | (src[2] << 16) | ((alpha ? alpha[x] : 255u) << 24);
+			break;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Alpha_Row
+|
+| Input: Called from Bmp_Load()
+| Output: Writes a row of alpha bytes from a row of an alpha file.
+|___________________________________________________________________*/
+
+static void Alpha_Row(unsigned char* dst, Header* header, unsigned char* src)
+{
+	int x = 0, width = header->width;
+
+	switch (header->bpp) {
+		case 8:
+			for (; x < width; x++)
+				dst[x] = (unsigned char)(header->palette[src[x]] >> 8);
+			break;
+		case 24:
+			if (use_simd) {
+				const __m128i green0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+				const __m128i green1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+				const __m128i green2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+				for (; x + 16 <= width; x += 16, src += 48) {
+					__m128i g = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)src), green0);
+					g = _mm_or_si128(g, _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(src + 16)), green1));
+					g = _mm_or_si128(g, _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(src + 32)), green2));
+					_mm_storeu_si128((__m128i*)(dst + x), g);
+				}
+			}
+			for (; x < width; x++, src += 3)
+				dst[x] = src[1];
+			break;
+		case 32:
+			if (use_simd) {
+				const __m128i green = _mm_setr_epi8(1, 5, 9, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+				for (; x + 4 <= width; x += 4, src += 16)
+					*(int*)(dst + x) = _mm_cvtsi128_si32(_mm_shuffle_epi8(_mm_loadu_si128((__m128i*)src), green));
+			}
+			for (; x < width; x++, src += 4)
+				dst[x] = src[1];
+			break;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Has_SSSE3
+|
+| Input: Called from Bmp_Load(), Bmp_Use_SIMD()
+| Output: Returns true if the CPU supports SSSE3.
+|___________________________________________________________________*/
+
+static bool Has_SSSE3()
+{
+	int info[4];
+
+	__cpuid(info, 1);
+
+	return ((info[2] & (1 << 9)) != 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bmp_Save
+|
+| Input: Called from Atlas_Build(), Bake_Run()
+| Output: Writes an image's texels (alpha dropped) to a 24-bit BMP
+|   file.  Returns true on success.
+|___________________________________________________________________*/
+
+int Bmp_Save(const char* filename, BmpImage* image)
+{
+	HANDLE file;
+	DWORD written;
+	unsigned char *data, *dst, *src;
+	unsigned pitch, bytes;
+	int x, y;
+	bool ok;
+
+	pitch = (image->width * 3 + 3) & ~3;
+	bytes = 54 + pitch * image->height;
+	data = (unsigned char*)calloc(bytes, 1);
+	if (data == NULL)
+		return (FALSE);
+
+	data[0] = 'B';
+	data[1] = 'M';
+	*(unsigned*)(data + 2) = bytes;
+	*(unsigned*)(data + 10) = 54;
+	*(unsigned*)(data + 14) = 40;
+	*(int*)(data + 18) = image->width;
+	*(int*)(data + 22) = image->height;
+	*(unsigned short*)(data + 26) = 1;
+	*(unsigned short*)(data + 28) = 24;
+	*(unsigned*)(data + 34) = pitch * image->height;
+
+	// Bottom row first
+	for (y = 0; y < image->height; y++) {
+		src = image->texels + (image->height - 1 - y) * image->width * 4;
+		dst = data + 54 + y * pitch;
+		for (x = 0; x < image->width; x++, src += 4, dst += 3) {
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+		}
+	}
+
+	ok = false;
+	file = CreateFileA(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file != INVALID_HANDLE_VALUE) {
+		ok = WriteFile(file, data, bytes, &written, NULL) && written == bytes;
+		CloseHandle(file);
+	}
+	free(data);
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bmp_Free
+|
+| Input: Called from Atlas_Build(), Bench_Run(), Bmp_Load()
+| Output: Frees an image's texels if Bmp_Load() allocated them.
+|___________________________________________________________________*/
+
+void Bmp_Free(BmpImage* image)
+{
+	if (image->owned && image->texels)
+		free(image->texels);
+	image->texels = NULL;
+	image->owned = FALSE;
+}
+
+/*____________________________________________________________________
+|
+| Function: Bmp_Use_SIMD
+|
+| Input: Called from Bench_Run()
+| Output: Turns the SSSE3 path on (if the CPU has it) or off.  Returns
+|   whether it was on.
+|___________________________________________________________________*/
+
+int Bmp_Use_SIMD(int use)
+{
+	int was;
+
+	if (use_simd < 0)
+		use_simd = Has_SSSE3();
+	was = use_simd;
+	use_simd = use && Has_SSSE3();
+
+	return (was);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bmp_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns decoder statistics.
+|___________________________________________________________________*/
+
+void Bmp_Get_Stats(BmpStats* out)
+{
+	*out = stats;
+	out->simd = (use_simd > 0);
+}
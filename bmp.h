@@ -0,0 +1,44 @@
+/*____________________________________________________________________
+|
+| File: bmp.h
+|
+| Description: BMP decoder - reads an image file and its optional alpha
+|   file into 32-bit texels ready to upload.
+|___________________________________________________________________*/
+
+#ifndef _BMP_H_
+#define _BMP_H_
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	int            width, height;
+	unsigned char* texels;   // B, G, R, A (Direct3D A8R8G8B8 order), top row first
+	int            owned;    // texels were malloc'd by Bmp_Load()
+} BmpImage;
+
+typedef struct {
+	unsigned           loads;
+	unsigned           failures;
+	unsigned long long texels;     // decoded
+	unsigned long long bytes;      // of files read
+	int                simd;       // true if the SSSE3 path is in use
+	float              last_load_time;  // ms
+} BmpStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int  Bmp_Get_Size (const char *filename, int *width, int *height);
+int  Bmp_Load (const char *filename, const char *alpha_filename, BmpImage *image, void *buffer, unsigned buffer_size);
+int  Bmp_Save (const char *filename, BmpImage *image);
+void Bmp_Free (BmpImage *image);
+int  Bmp_Use_SIMD (int use);
+void Bmp_Get_Stats (BmpStats *stats);
+
+#endif
@@ -0,0 +1,981 @@
+/*____________________________________________________________________
+|
+| File: bvh.cpp
+|
+| Description: Bounding volume hierarchy for scene raycasts.
+|
+|   Entries are spheres or vertical capsules tagged with an entity
+|   type and a user value.  Bvh_Build() builds the tree top down with a
+|   binned surface area heuristic.  Nodes are allocated parent before
+|   children, children in adjacent pairs.  Moving an entry only marks
+|   it dirty; Bvh_Refit() then recomputes the bounds of the dirty
+|   leaves and their ancestors in place, so dynamic entries never
+|   force a rebuild.  Adding entries after a build schedules a rebuild
+|   at the next refit.
+|
+|   Queries walk the tree with a fixed stack, which holds at most one
+|   node per level plus one, so the tree is kept within BVH_MAX_DEPTH:
+|   past BVH_SAH_DEPTH (when the SAH has kept splitting off a few
+|   items, as it does with many co-located ones) nodes are split in
+|   half by count instead, which ends any range of items within 32
+|   more levels.
+|
+| Functions:  Bvh_Create
+|             Bvh_Free
+|             Bvh_Add_Sphere
+|             Bvh_Add_Capsule
+|							 Add_Entry
+|							 Get_Entry_Box
+|             Bvh_Move_Entry
+|             Bvh_Enable_Entry
+|             Bvh_Build
+|							 Build_Node
+|							 Set_Node_Box
+|             Bvh_Refit
+|             Bvh_Raycast
+|							 Ray_Box
+|							 Ray_Sphere
+|							 Ray_Capsule
+|             Bvh_Raycast_Batch
+|             Bvh_Count_Hits
+|             Bvh_Get_Stats
+|             Bvh_Benchmark
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include <assert.h>
+
+#include "bvh.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define BVH_LEAF_SIZE     4
+#define BVH_NUM_BINS      12
+#define BVH_STACK_SIZE    64
+#define BVH_MAX_DEPTH     (BVH_STACK_SIZE - 1)  // a leaf at this depth leaves a query's stack full
+#define BVH_SAH_DEPTH     (BVH_MAX_DEPTH - 32)  // split by count past this depth
+#define BVH_INITIAL_SIZE  256
+#define BVH_BIG           1e30f
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	gx3dVector position;  // sphere center or capsule base
+	float      radius;
+	float      height;    // capsules only
+	int        shape;
+	unsigned   type;
+	int        user;
+	bool       enabled;
+	bool       dirty;
+	gx3dBox    box;
+	gx3dVector centroid;
+} BvhItem;
+
+typedef struct {
+	gx3dBox box;
+	int     first;  // leaf = first index in item_index, internal = left child (right child = first + 1)
+	int     count;  // # of items in a leaf, 0 = internal node
+} BvhNode;
+
+struct BvhData {
+	Arena    arena;       // memory comes from here (NULL for the heap)
+	BvhItem* items;
+	int      num_items, max_items;
+	int*     item_index;  // leaf item ranges index into this
+	int*     item_leaf;   // leaf node holding each item
+	BvhNode* nodes;
+	int*     parent;
+	int      num_nodes;
+	bool     needs_build;
+	int*     dirty;       // dirty items to refit
+	int      num_dirty;
+	BvhStats stats;
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static BvhEntry Add_Entry(Bvh bvh, BvhItem* item);
+static void Get_Entry_Box(BvhItem* item);
+static void Build_Node(Bvh bvh, int node, int first, int count, int depth);
+static void Set_Node_Box(Bvh bvh, int node);
+static bool Ray_Box(gx3dBox* box, gx3dVector* origin, gx3dVector* inv_dir, float max_t, float* t);
+static bool Ray_Sphere(gx3dVector* origin, gx3dVector* dir, gx3dVector* center, float radius, float max_t, float* t, gx3dVector* normal);
+static bool Ray_Capsule(gx3dVector* origin, gx3dVector* dir, BvhItem* item, float max_t, float* t, gx3dVector* normal);
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Create
+|
+| Input: Called from Program_Run()
+| Output: Returns a new empty BVH allocating from arena (NULL for the
+|   heap), or NULL on error.
+|___________________________________________________________________*/
+
+Bvh Bvh_Create(Arena arena)
+{
+	Bvh bvh = (Bvh)Arena_Alloc(arena, sizeof(struct BvhData));
+
+	if (bvh) {
+		memset(bvh, 0, sizeof(struct BvhData));
+		bvh->arena = arena;
+	}
+
+	return (bvh);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Free
+|
+| Input: Called from Program_Run()
+| Output: Frees a BVH.  Arena memory is released by resetting the
+|   arena.
+|___________________________________________________________________*/
+
+void Bvh_Free(Bvh bvh)
+{
+	if (bvh) {
+		Arena arena = bvh->arena;
+		Arena_Dealloc(arena, bvh->items);
+		Arena_Dealloc(arena, bvh->item_index);
+		Arena_Dealloc(arena, bvh->item_leaf);
+		Arena_Dealloc(arena, bvh->nodes);
+		Arena_Dealloc(arena, bvh->parent);
+		Arena_Dealloc(arena, bvh->dirty);
+		Arena_Dealloc(arena, bvh);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Add_Sphere
+|
+| Input: Called from Program_Run()
+| Output: Adds a sphere entry.  Returns the entry or BVH_INVALID_ENTRY.
+|___________________________________________________________________*/
+
+BvhEntry Bvh_Add_Sphere(Bvh bvh, gx3dVector* center, float radius, unsigned type, int user)
+{
+	BvhItem item;
+
+	item.position = *center;
+	item.radius = radius;
+	item.height = 0;
+	item.shape = BVH_SHAPE_SPHERE;
+	item.type = type;
+	item.user = user;
+	return (Add_Entry(bvh, &item));
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Add_Capsule
+|
+| Input: Called from Program_Run()
+| Output: Adds a vertical capsule entry whose axis runs from base up
+|   height units.  Returns the entry or BVH_INVALID_ENTRY.
+|___________________________________________________________________*/
+
+BvhEntry Bvh_Add_Capsule(Bvh bvh, gx3dVector* base, float height, float radius, unsigned type, int user)
+{
+	BvhItem item;
+
+	item.position = *base;
+	item.radius = radius;
+	item.height = height;
+	item.shape = BVH_SHAPE_CAPSULE;
+	item.type = type;
+	item.user = user;
+	return (Add_Entry(bvh, &item));
+}
+
+/*____________________________________________________________________
+|
+| Function: Add_Entry
+|
+| Input: Called from Bvh_Add_Sphere(), Bvh_Add_Capsule()
+| Output: Adds an item.  The tree is rebuilt at the next build/refit.
+|___________________________________________________________________*/
+
+static BvhEntry Add_Entry(Bvh bvh, BvhItem* item)
+{
+	if (bvh->num_items == bvh->max_items) {
+		int new_max = bvh->max_items ? bvh->max_items * 2 : BVH_INITIAL_SIZE;
+		BvhItem* items = (BvhItem*)Arena_Realloc(bvh->arena, bvh->items, bvh->max_items * sizeof(BvhItem), new_max * sizeof(BvhItem));
+		if (items == NULL)
+			return (BVH_INVALID_ENTRY);
+		bvh->items = items;
+		bvh->max_items = new_max;
+	}
+
+	item->enabled = true;
+	item->dirty = false;
+	Get_Entry_Box(item);
+	bvh->items[bvh->num_items] = *item;
+	bvh->needs_build = true;
+
+	return (bvh->num_items++);
+}
+
+/*____________________________________________________________________
+|
+| Function: Get_Entry_Box
+|
+| Input: Called from Add_Entry(), Bvh_Refit()
+| Output: Computes the bounding box and centroid of an item.
+|___________________________________________________________________*/
+
+static void Get_Entry_Box(BvhItem* item)
+{
+	item->box.min.x = item->position.x - item->radius;
+	item->box.min.y = item->position.y - item->radius;
+	item->box.min.z = item->position.z - item->radius;
+	item->box.max.x = item->position.x + item->radius;
+	item->box.max.y = item->position.y + item->height + item->radius;
+	item->box.max.z = item->position.z + item->radius;
+	item->centroid.x = (item->box.min.x + item->box.max.x) / 2;
+	item->centroid.y = (item->box.min.y + item->box.max.y) / 2;
+	item->centroid.z = (item->box.min.z + item->box.max.z) / 2;
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Move_Entry
+|
+| Input: Called from Program_Run()
+| Output: Moves an entry (sphere center or capsule base).  Its bounds
+|   are updated at the next Bvh_Refit().
+|___________________________________________________________________*/
+
+void Bvh_Move_Entry(Bvh bvh, BvhEntry entry, gx3dVector* position)
+{
+	BvhItem* item = &bvh->items[entry];
+
+	item->position = *position;
+	if (NOT item->dirty && NOT bvh->needs_build) {
+		item->dirty = true;
+		bvh->dirty[bvh->num_dirty++] = entry;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Enable_Entry
+|
+| Input: Called from Program_Run()
+| Output: Enables or disables an entry.  Disabled entries stay in the
+|   tree but are never hit.
+|___________________________________________________________________*/
+
+void Bvh_Enable_Entry(Bvh bvh, BvhEntry entry, int enable)
+{
+	bvh->items[entry].enabled = (enable != 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Build
+|
+| Input: Called from Program_Run() after entries are added.
+| Output: Builds the tree over all entries.
+|___________________________________________________________________*/
+
+void Bvh_Build(Bvh bvh)
+{
+	int i, n = bvh->num_items;
+
+	Arena_Dealloc(bvh->arena, bvh->item_index);
+	Arena_Dealloc(bvh->arena, bvh->item_leaf);
+	Arena_Dealloc(bvh->arena, bvh->nodes);
+	Arena_Dealloc(bvh->arena, bvh->parent);
+	Arena_Dealloc(bvh->arena, bvh->dirty);
+	bvh->item_index = (int*)Arena_Alloc(bvh->arena, (n + 1) * sizeof(int));
+	bvh->item_leaf = (int*)Arena_Alloc(bvh->arena, (n + 1) * sizeof(int));
+	bvh->nodes = (BvhNode*)Arena_Alloc(bvh->arena, (2 * n + 1) * sizeof(BvhNode));
+	bvh->parent = (int*)Arena_Alloc(bvh->arena, (2 * n + 1) * sizeof(int));
+	bvh->dirty = (int*)Arena_Alloc(bvh->arena, (n + 1) * sizeof(int));
+	bvh->num_nodes = 0;
+	bvh->num_dirty = 0;
+	bvh->needs_build = false;
+	if (bvh->item_index == NULL || bvh->item_leaf == NULL || bvh->nodes == NULL || bvh->parent == NULL || bvh->dirty == NULL) {
+		debug_WriteFile("Bvh_Build(): out of memory");
+		bvh->num_items = 0;
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		bvh->items[i].dirty = false;
+		Get_Entry_Box(&bvh->items[i]);
+		bvh->item_index[i] = i;
+	}
+
+	bvh->num_nodes = 1;
+	bvh->parent[0] = -1;
+	bvh->stats.depth = 0;
+	if (n)
+		Build_Node(bvh, 0, 0, n, 0);
+	else {
+		bvh->nodes[0].first = 0;
+		bvh->nodes[0].count = 0;
+		memset(&bvh->nodes[0].box, 0, sizeof(gx3dBox));
+	}
+
+	bvh->stats.builds++;
+	bvh->stats.entries = n;
+	bvh->stats.nodes = bvh->num_nodes;
+}
+
+/*____________________________________________________________________
+|
+| Function: Build_Node
+|
+| Input: Called from Bvh_Build(), Build_Node()
+| Output: Makes node (at depth) cover item_index[first..first+count-1],
+|   splitting it with a binned SAH if it holds more than BVH_LEAF_SIZE
+|   items, or in half past BVH_SAH_DEPTH.
+|___________________________________________________________________*/
+
+static void Build_Node(Bvh bvh, int node, int first, int count, int depth)
+{
+	int i, b, axis, best_split, left_count, bin_count[BVH_NUM_BINS];
+	float cmin, cmax, c, extent[3], scale, cost, best_cost;
+	gx3dBox bin_box[BVH_NUM_BINS], centroid_box;
+	float left_area[BVH_NUM_BINS], right_area[BVH_NUM_BINS];
+	int left_n[BVH_NUM_BINS], right_n[BVH_NUM_BINS];
+
+	BvhNode* n = &bvh->nodes[node];
+	n->first = first;
+	n->count = count;
+	Set_Node_Box(bvh, node);
+	if (count <= BVH_LEAF_SIZE) {
+		for (i = first; i < first + count; i++)
+			bvh->item_leaf[bvh->item_index[i]] = node;
+		assert(depth <= BVH_MAX_DEPTH);
+		if ((unsigned)depth > bvh->stats.depth)
+			bvh->stats.depth = depth;
+		return;
+	}
+
+	/*____________________________________________________________________
+	|
+	| Bin the centroids along the widest centroid axis
+	|___________________________________________________________________*/
+
+	centroid_box.min = centroid_box.max = bvh->items[bvh->item_index[first]].centroid;
+	for (i = first + 1; i < first + count; i++) {
+		gx3dVector* v = &bvh->items[bvh->item_index[i]].centroid;
+		centroid_box.min.x = fminf(centroid_box.min.x, v->x);
+		centroid_box.min.y = fminf(centroid_box.min.y, v->y);
+		centroid_box.min.z = fminf(centroid_box.min.z, v->z);
+		centroid_box.max.x = fmaxf(centroid_box.max.x, v->x);
+		centroid_box.max.y = fmaxf(centroid_box.max.y, v->y);
+		centroid_box.max.z = fmaxf(centroid_box.max.z, v->z);
+	}
+	extent[0] = centroid_box.max.x - centroid_box.min.x;
+	extent[1] = centroid_box.max.y - centroid_box.min.y;
+	extent[2] = centroid_box.max.z - centroid_box.min.z;
+	axis = 0;
+	if (extent[1] > extent[axis])
+		axis = 1;
+	if (extent[2] > extent[axis])
+		axis = 2;
+	cmin = (&centroid_box.min.x)[axis];
+	cmax = (&centroid_box.max.x)[axis];
+
+	best_split = -1;
+	if (cmax > cmin && depth < BVH_SAH_DEPTH) {
+		scale = BVH_NUM_BINS / (cmax - cmin);
+		for (b = 0; b < BVH_NUM_BINS; b++) {
+			bin_count[b] = 0;
+			bin_box[b].min.x = bin_box[b].min.y = bin_box[b].min.z = BVH_BIG;
+			bin_box[b].max.x = bin_box[b].max.y = bin_box[b].max.z = -BVH_BIG;
+		}
+		for (i = first; i < first + count; i++) {
+			BvhItem* item = &bvh->items[bvh->item_index[i]];
+			b = (int)(((&item->centroid.x)[axis] - cmin) * scale);
+			if (b >= BVH_NUM_BINS)
+				b = BVH_NUM_BINS - 1;
+			bin_count[b]++;
+			bin_box[b].min.x = fminf(bin_box[b].min.x, item->box.min.x);
+			bin_box[b].min.y = fminf(bin_box[b].min.y, item->box.min.y);
+			bin_box[b].min.z = fminf(bin_box[b].min.z, item->box.min.z);
+			bin_box[b].max.x = fmaxf(bin_box[b].max.x, item->box.max.x);
+			bin_box[b].max.y = fmaxf(bin_box[b].max.y, item->box.max.y);
+			bin_box[b].max.z = fmaxf(bin_box[b].max.z, item->box.max.z);
+		}
+
+		// Sweep the bins from both sides to get the area and count left/right of each split
+		gx3dBox acc;
+		int acc_n;
+		for (int pass = 0; pass < 2; pass++) {
+			acc.min.x = acc.min.y = acc.min.z = BVH_BIG;
+			acc.max.x = acc.max.y = acc.max.z = -BVH_BIG;
+			acc_n = 0;
+			for (int k = 0; k < BVH_NUM_BINS - 1; k++) {
+				b = pass ? BVH_NUM_BINS - 1 - k : k;
+				acc_n += bin_count[b];
+				acc.min.x = fminf(acc.min.x, bin_box[b].min.x);
+				acc.min.y = fminf(acc.min.y, bin_box[b].min.y);
+				acc.min.z = fminf(acc.min.z, bin_box[b].min.z);
+				acc.max.x = fmaxf(acc.max.x, bin_box[b].max.x);
+				acc.max.y = fmaxf(acc.max.y, bin_box[b].max.y);
+				acc.max.z = fmaxf(acc.max.z, bin_box[b].max.z);
+				float dx = acc.max.x - acc.min.x, dy = acc.max.y - acc.min.y, dz = acc.max.z - acc.min.z;
+				float area = acc_n ? dx * dy + dy * dz + dz * dx : 0;
+				if (pass == 0) {
+					left_area[k] = area;
+					left_n[k] = acc_n;
+				}
+				else {
+					right_area[BVH_NUM_BINS - 2 - k] = area;
+					right_n[BVH_NUM_BINS - 2 - k] = acc_n;
+				}
+			}
+		}
+		best_cost = BVH_BIG;
+		for (b = 0; b < BVH_NUM_BINS - 1; b++) {
+			if (left_n[b] == 0 || right_n[b] == 0)
+				continue;
+			cost = left_area[b] * left_n[b] + right_area[b] * right_n[b];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_split = b;
+			}
+		}
+	}
+
+	/*____________________________________________________________________
+	|
+	| Partition the items (by median if binning couldn't separate them)
+	|___________________________________________________________________*/
+
+	if (best_split >= 0) {
+		float split = cmin + (best_split + 1) * (cmax - cmin) / BVH_NUM_BINS;
+		int lo = first, hi = first + count - 1;
+		while (lo <= hi) {
+			c = (&bvh->items[bvh->item_index[lo]].centroid.x)[axis];
+			if (c < split)
+				lo++;
+			else {
+				int tmp = bvh->item_index[lo];
+				bvh->item_index[lo] = bvh->item_index[hi];
+				bvh->item_index[hi--] = tmp;
+			}
+		}
+		left_count = lo - first;
+		if (left_count == 0 || left_count == count)
+			left_count = count / 2;
+	}
+	else
+		left_count = count / 2;
+
+	int left = bvh->num_nodes;
+	bvh->num_nodes += 2;
+	n = &bvh->nodes[node];
+	n->first = left;
+	n->count = 0;
+	bvh->parent[left] = node;
+	bvh->parent[left + 1] = node;
+	Build_Node(bvh, left, first, left_count, depth + 1);
+	Build_Node(bvh, left + 1, first + left_count, count - left_count, depth + 1);
+}
+
+/*____________________________________________________________________
+|
+| Function: Set_Node_Box
+|
+| Input: Called from Build_Node(), Bvh_Refit()
+| Output: Recomputes a node's box from its items (leaf) or children.
+|___________________________________________________________________*/
+
+static void Set_Node_Box(Bvh bvh, int node)
+{
+	int i;
+	gx3dBox* box = &bvh->nodes[node].box;
+	BvhNode* n = &bvh->nodes[node];
+
+	if (n->count) {
+		*box = bvh->items[bvh->item_index[n->first]].box;
+		for (i = n->first + 1; i < n->first + n->count; i++) {
+			gx3dBox* b = &bvh->items[bvh->item_index[i]].box;
+			box->min.x = fminf(box->min.x, b->min.x);
+			box->min.y = fminf(box->min.y, b->min.y);
+			box->min.z = fminf(box->min.z, b->min.z);
+			box->max.x = fmaxf(box->max.x, b->max.x);
+			box->max.y = fmaxf(box->max.y, b->max.y);
+			box->max.z = fmaxf(box->max.z, b->max.z);
+		}
+	}
+	else {
+		gx3dBox* l = &bvh->nodes[n->first].box;
+		gx3dBox* r = &bvh->nodes[n->first + 1].box;
+		box->min.x = fminf(l->min.x, r->min.x);
+		box->min.y = fminf(l->min.y, r->min.y);
+		box->min.z = fminf(l->min.z, r->min.z);
+		box->max.x = fmaxf(l->max.x, r->max.x);
+		box->max.y = fmaxf(l->max.y, r->max.y);
+		box->max.z = fmaxf(l->max.z, r->max.z);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Refit
+|
+| Input: Called from Program_Run() once per frame after entries move.
+| Output: Refits the leaves of moved entries and their ancestors, or
+|   rebuilds if entries were added since the last build.
+|___________________________________________________________________*/
+
+void Bvh_Refit(Bvh bvh)
+{
+	int i, node;
+
+	if (bvh->needs_build) {
+		Bvh_Build(bvh);
+		return;
+	}
+	if (bvh->num_dirty == 0)
+		return;
+
+	for (i = 0; i < bvh->num_dirty; i++) {
+		BvhItem* item = &bvh->items[bvh->dirty[i]];
+		item->dirty = false;
+		Get_Entry_Box(item);
+		for (node = bvh->item_leaf[bvh->dirty[i]]; node >= 0; node = bvh->parent[node])
+			Set_Node_Box(bvh, node);
+	}
+	bvh->num_dirty = 0;
+	bvh->stats.refits++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Raycast
+|
+| Input: Called from Program_Run()
+| Output: Finds the first enabled entry whose type is in mask along
+|   a ray, within max_distance.  The ray direction need not be unit
+|   length; distances are in world units.  Returns true on a hit.
+|___________________________________________________________________*/
+
+int Bvh_Raycast(Bvh bvh, gx3dRay* ray, float max_distance, unsigned mask, BvhHit* hit)
+{
+	int stack[BVH_STACK_SIZE], sp, node, i, found;
+	float len, best, t, tl, tr;
+	gx3dVector dir, inv_dir, normal;
+
+	if (bvh->num_items == 0 || bvh->needs_build)
+		return (FALSE);
+
+	len = sqrtf(ray->direction.x * ray->direction.x + ray->direction.y * ray->direction.y + ray->direction.z * ray->direction.z);
+	if (len == 0)
+		return (FALSE);
+	dir.x = ray->direction.x / len;
+	dir.y = ray->direction.y / len;
+	dir.z = ray->direction.z / len;
+	inv_dir.x = dir.x != 0 ? 1 / dir.x : BVH_BIG;
+	inv_dir.y = dir.y != 0 ? 1 / dir.y : BVH_BIG;
+	inv_dir.z = dir.z != 0 ? 1 / dir.z : BVH_BIG;
+
+	bvh->stats.rays++;
+	best = max_distance;
+	found = -1;
+	sp = 0;
+	if (Ray_Box(&bvh->nodes[0].box, &ray->origin, &inv_dir, best, &t))
+		stack[sp++] = 0;
+
+	while (sp) {
+		node = stack[--sp];
+		BvhNode* n = &bvh->nodes[node];
+		bvh->stats.nodes_visited++;
+		if (n->count) {
+			for (i = n->first; i < n->first + n->count; i++) {
+				BvhItem* item = &bvh->items[bvh->item_index[i]];
+				if (NOT item->enabled || NOT(mask & BVH_MASK(item->type)))
+					continue;
+				bvh->stats.shapes_tested++;
+				bool h;
+				if (item->shape == BVH_SHAPE_SPHERE)
+					h = Ray_Sphere(&ray->origin, &dir, &item->position, item->radius, best, &t, &normal);
+				else
+					h = Ray_Capsule(&ray->origin, &dir, item, best, &t, &normal);
+				if (h) {
+					best = t;
+					found = bvh->item_index[i];
+					hit->normal = normal;
+				}
+			}
+		}
+		else {
+			// Visit the nearer child first
+			bool hl = Ray_Box(&bvh->nodes[n->first].box, &ray->origin, &inv_dir, best, &tl);
+			bool hr = Ray_Box(&bvh->nodes[n->first + 1].box, &ray->origin, &inv_dir, best, &tr);
+			if (hl && hr) {
+				if (tl <= tr) {
+					stack[sp++] = n->first + 1;
+					stack[sp++] = n->first;
+				}
+				else {
+					stack[sp++] = n->first;
+					stack[sp++] = n->first + 1;
+				}
+			}
+			else if (hl)
+				stack[sp++] = n->first;
+			else if (hr)
+				stack[sp++] = n->first + 1;
+		}
+	}
+
+	if (found < 0)
+		return (FALSE);
+
+	hit->entry = found;
+	hit->type = bvh->items[found].type;
+	hit->user = bvh->items[found].user;
+	hit->distance = best;
+	hit->point.x = ray->origin.x + dir.x * best;
+	hit->point.y = ray->origin.y + dir.y * best;
+	hit->point.z = ray->origin.z + dir.z * best;
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Ray_Box
+|
+| Input: Called from Bvh_Raycast()
+| Output: Slab test.  Returns true if the ray enters the box before
+|   max_t, with t = entry distance.
+|___________________________________________________________________*/
+
+static bool Ray_Box(gx3dBox* box, gx3dVector* origin, gx3dVector* inv_dir, float max_t, float* t)
+{
+	float t0, t1, tmin, tmax;
+
+	t0 = (box->min.x - origin->x) * inv_dir->x;
+	t1 = (box->max.x - origin->x) * inv_dir->x;
+	tmin = fminf(t0, t1);
+	tmax = fmaxf(t0, t1);
+	t0 = (box->min.y - origin->y) * inv_dir->y;
+	t1 = (box->max.y - origin->y) * inv_dir->y;
+	tmin = fmaxf(tmin, fminf(t0, t1));
+	tmax = fminf(tmax, fmaxf(t0, t1));
+	t0 = (box->min.z - origin->z) * inv_dir->z;
+	t1 = (box->max.z - origin->z) * inv_dir->z;
+	tmin = fmaxf(tmin, fminf(t0, t1));
+	tmax = fminf(tmax, fmaxf(t0, t1));
+
+	*t = tmin;
+	return (tmax >= fmaxf(tmin, 0) && tmin <= max_t);
+}
+
+/*____________________________________________________________________
+|
+| Function: Ray_Sphere
+|
+| Input: Called from Bvh_Raycast(), Ray_Capsule()
+| Output: Returns true if a unit direction ray hits a sphere before
+|   max_t, with the hit distance and normal.  A ray starting inside
+|   hits at t = 0.
+|___________________________________________________________________*/
+
+static bool Ray_Sphere(gx3dVector* origin, gx3dVector* dir, gx3dVector* center, float radius, float max_t, float* t, gx3dVector* normal)
+{
+	float ox, oy, oz, b, c, disc, hit_t;
+
+	ox = origin->x - center->x;
+	oy = origin->y - center->y;
+	oz = origin->z - center->z;
+	b = ox * dir->x + oy * dir->y + oz * dir->z;
+	c = ox * ox + oy * oy + oz * oz - radius * radius;
+	if (c < 0) {
+		hit_t = 0;
+		normal->x = -dir->x;
+		normal->y = -dir->y;
+		normal->z = -dir->z;
+	}
+	else {
+		if (b > 0)
+			return (false);
+		disc = b * b - c;
+		if (disc < 0)
+			return (false);
+		hit_t = -b - sqrtf(disc);
+		normal->x = (ox + dir->x * hit_t) / radius;
+		normal->y = (oy + dir->y * hit_t) / radius;
+		normal->z = (oz + dir->z * hit_t) / radius;
+	}
+	if (hit_t > max_t)
+		return (false);
+	*t = hit_t;
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: Ray_Capsule
+|
+| Input: Called from Bvh_Raycast()
+| Output: Returns true if a unit direction ray hits a vertical capsule
+|   before max_t, with the hit distance and normal.
+|___________________________________________________________________*/
+
+static bool Ray_Capsule(gx3dVector* origin, gx3dVector* dir, BvhItem* item, float max_t, float* t, gx3dVector* normal)
+{
+	float ox, oz, a, b, c, disc, hit_t, y, y0, y1, r;
+	bool found = false;
+	gx3dVector cap, n;
+
+	r = item->radius;
+	y0 = item->position.y;
+	y1 = item->position.y + item->height;
+	ox = origin->x - item->position.x;
+	oz = origin->z - item->position.z;
+
+	// Cylinder side
+	c = ox * ox + oz * oz - r * r;
+	if (c < 0 && origin->y >= y0 && origin->y <= y1) {
+		*t = 0;
+		normal->x = -dir->x;
+		normal->y = -dir->y;
+		normal->z = -dir->z;
+		return (true);
+	}
+	a = dir->x * dir->x + dir->z * dir->z;
+	if (a > 0 && c >= 0) {
+		b = ox * dir->x + oz * dir->z;
+		disc = b * b - a * c;
+		if (b < 0 && disc >= 0) {
+			hit_t = (-b - sqrtf(disc)) / a;
+			y = origin->y + dir->y * hit_t;
+			if (hit_t <= max_t && y >= y0 && y <= y1) {
+				max_t = hit_t;
+				normal->x = (ox + dir->x * hit_t) / r;
+				normal->y = 0;
+				normal->z = (oz + dir->z * hit_t) / r;
+				*t = hit_t;
+				found = true;
+			}
+		}
+	}
+
+	// End caps
+	cap = item->position;
+	if (Ray_Sphere(origin, dir, &cap, r, max_t, &hit_t, &n)) {
+		max_t = hit_t;
+		*t = hit_t;
+		*normal = n;
+		found = true;
+	}
+	cap.y = y1;
+	if (Ray_Sphere(origin, dir, &cap, r, max_t, &hit_t, &n)) {
+		*t = hit_t;
+		*normal = n;
+		found = true;
+	}
+
+	return (found);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Raycast_Batch
+|
+| Input: Called from Program_Run()
+| Output: Casts num_rays rays.  hit_flags[i] is set true if ray i hit,
+|   with the hit in hits[i].  max_distances may be NULL for no limit.
+|   Returns the # of rays that hit.
+|___________________________________________________________________*/
+
+int Bvh_Raycast_Batch(Bvh bvh, gx3dRay* rays, float* max_distances, int num_rays, unsigned mask, BvhHit* hits, int* hit_flags)
+{
+	int i, num_hits = 0;
+
+	for (i = 0; i < num_rays; i++) {
+		hit_flags[i] = Bvh_Raycast(bvh, &rays[i], max_distances ? max_distances[i] : BVH_BIG, mask, &hits[i]);
+		if (hit_flags[i])
+			num_hits++;
+	}
+	return (num_hits);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Count_Hits
+|
+| Input: Called from AudioProp_Update()
+| Output: Returns the # of enabled entries whose type is in mask that
+|   a ray passes through within max_distance, up to max_hits.
+|___________________________________________________________________*/
+
+int Bvh_Count_Hits(Bvh bvh, gx3dRay* ray, float max_distance, unsigned mask, int max_hits)
+{
+	int stack[BVH_STACK_SIZE], sp, i, hits;
+	float len, t;
+	gx3dVector dir, inv_dir, normal;
+
+	if (bvh->num_items == 0 || bvh->needs_build)
+		return (0);
+
+	len = sqrtf(ray->direction.x * ray->direction.x + ray->direction.y * ray->direction.y + ray->direction.z * ray->direction.z);
+	if (len == 0)
+		return (0);
+	dir.x = ray->direction.x / len;
+	dir.y = ray->direction.y / len;
+	dir.z = ray->direction.z / len;
+	inv_dir.x = dir.x != 0 ? 1 / dir.x : BVH_BIG;
+	inv_dir.y = dir.y != 0 ? 1 / dir.y : BVH_BIG;
+	inv_dir.z = dir.z != 0 ? 1 / dir.z : BVH_BIG;
+
+	bvh->stats.rays++;
+	hits = 0;
+	sp = 0;
+	stack[sp++] = 0;
+	while (sp && hits < max_hits) {
+		BvhNode* n = &bvh->nodes[stack[--sp]];
+		if (NOT Ray_Box(&n->box, &ray->origin, &inv_dir, max_distance, &t))
+			continue;
+		bvh->stats.nodes_visited++;
+		if (n->count) {
+			for (i = n->first; i < n->first + n->count && hits < max_hits; i++) {
+				BvhItem* item = &bvh->items[bvh->item_index[i]];
+				if (NOT item->enabled || NOT(mask & BVH_MASK(item->type)))
+					continue;
+				bvh->stats.shapes_tested++;
+				if (item->shape == BVH_SHAPE_SPHERE) {
+					if (Ray_Sphere(&ray->origin, &dir, &item->position, item->radius, max_distance, &t, &normal))
+						hits++;
+				}
+				else if (Ray_Capsule(&ray->origin, &dir, item, max_distance, &t, &normal))
+					hits++;
+			}
+		}
+		else {
+			stack[sp++] = n->first;
+			stack[sp++] = n->first + 1;
+		}
+	}
+
+	return (hits);
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns BVH statistics.
+|___________________________________________________________________*/
+
+void Bvh_Get_Stats(Bvh bvh, BvhStats* stats)
+{
+	*stats = bvh->stats;
+}
+
+/*____________________________________________________________________
+|
+| Function: Bvh_Benchmark
+|
+| Input: Called from Bench_Run()
+| Output: Times building, refitting and querying random forests of
+|   increasing size and writes the results to the debug file.
+|___________________________________________________________________*/
+
+void Bvh_Benchmark()
+{
+	static const int sizes[] = { 1000, 10000, 100000 };
+	const int num_rays = 100000, num_dynamic = 1000;
+	int s, i, hits;
+	char str[256];
+	LARGE_INTEGER freq, t0, t1;
+	double build_ms, refit_ms, query_ms;
+
+	QueryPerformanceFrequency(&freq);
+	debug_WriteFile("_______________ BVH Benchmark ____________");
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		int n = sizes[s];
+		float extent = sqrtf((float)n) * 15;  // about the density of the game's forest
+		Bvh bvh = Bvh_Create(NULL);
+		BvhEntry* dynamic = (BvhEntry*)malloc(num_dynamic * sizeof(BvhEntry));
+		gx3dRay* rays = (gx3dRay*)malloc(num_rays * sizeof(gx3dRay));
+		if (bvh == NULL || dynamic == NULL || rays == NULL) {
+			Bvh_Free(bvh);
+			free(dynamic);
+			free(rays);
+			break;
+		}
+
+		srand(s + 1);
+		for (i = 0; i < n; i++) {
+			gx3dVector base = { (rand() / (float)RAND_MAX - 0.5f) * extent, 0, (rand() / (float)RAND_MAX - 0.5f) * extent };
+			Bvh_Add_Capsule(bvh, &base, 10, 0.5f, 0, i);
+		}
+		for (i = 0; i < num_dynamic; i++) {
+			gx3dVector center = { (rand() / (float)RAND_MAX - 0.5f) * extent, 1, (rand() / (float)RAND_MAX - 0.5f) * extent };
+			dynamic[i] = Bvh_Add_Sphere(bvh, &center, 1, 1, i);
+		}
+		for (i = 0; i < num_rays; i++) {
+			float angle = rand() / (float)RAND_MAX * 6.2831853f;
+			rays[i].origin.x = (rand() / (float)RAND_MAX - 0.5f) * extent;
+			rays[i].origin.y = 5;
+			rays[i].origin.z = (rand() / (float)RAND_MAX - 0.5f) * extent;
+			rays[i].direction.x = cosf(angle);
+			rays[i].direction.y = -0.05f;
+			rays[i].direction.z = sinf(angle);
+		}
+
+		QueryPerformanceCounter(&t0);
+		Bvh_Build(bvh);
+		QueryPerformanceCounter(&t1);
+		build_ms = (t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart;
+
+		QueryPerformanceCounter(&t0);
+		for (int frame = 0; frame < 10; frame++) {
+			for (i = 0; i < num_dynamic; i++) {
+				gx3dVector center = bvh->items[dynamic[i]].position;
+				center.x += 0.1f;
+				Bvh_Move_Entry(bvh, dynamic[i], &center);
+			}
+			Bvh_Refit(bvh);
+		}
+		QueryPerformanceCounter(&t1);
+		refit_ms = (t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart / 10;
+
+		BvhHit hit;
+		hits = 0;
+		QueryPerformanceCounter(&t0);
+		for (i = 0; i < num_rays; i++)
+			hits += Bvh_Raycast(bvh, &rays[i], 50, BVH_MASK_ALL, &hit);
+		QueryPerformanceCounter(&t1);
+		query_ms = (t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart;
+
+		sprintf(str, "%d entries: build %.2f ms, refit %d dynamic %.3f ms, %d rays %.2f ms (%.0f ns/ray, %d hits), %u nodes",
+			n + num_dynamic, build_ms, num_dynamic, refit_ms, num_rays, query_ms, query_ms * 1e6 / num_rays, hits, bvh->stats.nodes);
+		debug_WriteFile(str);
+
+		Bvh_Free(bvh);
+		free(dynamic);
+		free(rays);
+	}
+	debug_WriteFile("__________________________________________");
+}
@@ -0,0 +1,75 @@
+/*____________________________________________________________________
+|
+| File: bvh.h
+|
+| Description: Scene raycast queries over a bounding volume hierarchy
+|   of static and dynamic colliders.
+|___________________________________________________________________*/
+
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include "arena.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define BVH_SHAPE_SPHERE   0
+#define BVH_SHAPE_CAPSULE  1   // vertical capsule, axis from base up height units
+
+#define BVH_INVALID_ENTRY  (-1)
+
+// Filter mask bit for an entity type
+#define BVH_MASK(_type_)   (1u << (_type_))
+#define BVH_MASK_ALL       0xFFFFFFFFu
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct BvhData* Bvh;
+typedef int BvhEntry;
+
+typedef struct {
+	BvhEntry   entry;     // entry hit
+	unsigned   type;      // entity type of the entry
+	int        user;      // user value of the entry
+	float      distance;  // along the ray
+	gx3dVector point;
+	gx3dVector normal;
+} BvhHit;
+
+typedef struct {
+	unsigned entries;
+	unsigned nodes;
+	unsigned builds;
+	unsigned refits;
+	unsigned rays;
+	unsigned nodes_visited;
+	unsigned shapes_tested;
+	unsigned depth;          // of the deepest leaf
+} BvhStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+Bvh      Bvh_Create (Arena arena);
+void     Bvh_Free (Bvh bvh);
+BvhEntry Bvh_Add_Sphere (Bvh bvh, gx3dVector *center, float radius, unsigned type, int user);
+BvhEntry Bvh_Add_Capsule (Bvh bvh, gx3dVector *base, float height, float radius, unsigned type, int user);
+void     Bvh_Move_Entry (Bvh bvh, BvhEntry entry, gx3dVector *position);
+void     Bvh_Enable_Entry (Bvh bvh, BvhEntry entry, int enable);
+void     Bvh_Build (Bvh bvh);
+void     Bvh_Refit (Bvh bvh);
+int      Bvh_Raycast (Bvh bvh, gx3dRay *ray, float max_distance, unsigned mask, BvhHit *hit);
+int      Bvh_Raycast_Batch (Bvh bvh, gx3dRay *rays, float *max_distances, int num_rays, unsigned mask, BvhHit *hits, int *hit_flags);
+int      Bvh_Count_Hits (Bvh bvh, gx3dRay *ray, float max_distance, unsigned mask, int max_hits);
+void     Bvh_Get_Stats (Bvh bvh, BvhStats *stats);
+void     Bvh_Benchmark ();
+
+#endif
@@ -0,0 +1,377 @@
+/*____________________________________________________________________
+|
+| File: client.cpp
+|
+| Description: Multiplayer client connection, and a bot that plays
+|   through one.
+|
+|   A client sends connects until the server welcomes it, then an
+|   input message per update: its newest inputs, each with a sequence
+|   #, and the tick of the newest snapshot it has received, which the
+|   server takes as the baseline for the next.  Snapshots are decoded
+|   against the baseline they name and kept NET_HISTORY ticks, like
+|   the server keeps them; a snapshot older than the newest one is
+|   dropped.
+|
+|   The bot plays as a person would with what a client is told, and
+|   the terrain, which every client has: it runs from any Slender
+|   within BOT_FLEE_DISTANCE, else walks to the nearest page left and
+|   picks it up, sidestepping when a trunk stops it.
+|
+| Functions:  Client_Create
+|             Client_Free
+|             Client_Update
+|							 Receive_Snapshot
+|							 Send_Input
+|             Client_Bot_Update
+|             Client_Get_State
+|             Client_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "terrain.h"
+#include "client.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define CLIENT_CONNECT_RETRY  500     // ms between connects until welcomed
+
+#define BOT_FLEE_DISTANCE     25.0f   // runs from a Slender this close
+#define BOT_RUN_DISTANCE      20.0f   // runs to a page farther than this
+#define BOT_REACH             1.5f    // stops to pick up a page this close
+#define BOT_STUCK_TIME        500     // ms without moving before sidestepping
+#define BOT_SIDESTEP_TIME     750     // ms
+
+#define CLIENT_PI             3.14159265f
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct ClientData {
+	NetSocket      sock;
+	NetAddress     server;
+	int            slot;                           // -1 until welcomed
+	int            retry;                          // ms until the next connect
+	unsigned       latest;                         // tick of the newest snapshot, 0 for none
+	NetState       history[NET_HISTORY];           // snapshots, by tick
+	NetInput       inputs[NET_INPUT_REDUNDANCY];   // the newest last
+	int            num_inputs;
+	unsigned short sequence;
+	ClientStats    stats;
+	// Bot
+	float          yaw;
+	unsigned short last_x, last_z;
+	int            stuck_time, sidestep_time;
+	unsigned       sidestep;
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Receive_Snapshot(Client client, NetBits* bits);
+static void Send_Input(Client client, unsigned elapsed, unsigned buttons, float yaw, float pitch);
+
+/*____________________________________________________________________
+|
+| Function: Client_Create
+|
+| Input: Called from Server_Run(), Run_Net()
+| Output: Opens a connection to a server.  Returns the client or NULL
+|   on failure.
+|___________________________________________________________________*/
+
+Client Client_Create(NetAddress* server)
+{
+	Client client;
+
+	client = (Client)calloc(1, sizeof(struct ClientData));
+	if (client == NULL)
+		return (NULL);
+	client->sock = Net_Open(0);
+	if (client->sock == NULL) {
+		free(client);
+		return (NULL);
+	}
+	client->server = *server;
+	client->slot = -1;
+	client->yaw = (rand() % 360) * CLIENT_PI / 180;
+
+	return (client);
+}
+
+/*____________________________________________________________________
+|
+| Function: Client_Free
+|
+| Input: Called from Server_Run(), Run_Net()
+| Output: Tells the server the client is leaving and closes it.
+|___________________________________________________________________*/
+
+void Client_Free(Client client)
+{
+	unsigned char packet[1];
+	NetBits bits;
+
+	if (client) {
+		if (client->slot != -1) {
+			Net_Bits_Init(&bits, packet, sizeof(packet));
+			Net_Write_Bits(&bits, NET_MSG_DISCONNECT, 8);
+			Net_Send(client->sock, &client->server, packet, Net_Bits_Size(&bits));
+		}
+		Net_Close(client->sock);
+		free(client);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Client_Update
+|
+| Input: Called from Client_Bot_Update()
+| Output: Takes in what the server has sent and sends it an input for
+|   the last elapsed ms: the buttons held and the view direction (yaw
+|   in radians from +z towards +x, pitch in radians up from level).
+|___________________________________________________________________*/
+
+void Client_Update(Client client, unsigned elapsed, unsigned buttons, float yaw, float pitch)
+{
+	int size, type;
+	unsigned char packet[NET_MAX_PACKET];
+	NetAddress from;
+	NetBits bits;
+
+	while ((size = Net_Receive(client->sock, &from, packet, sizeof(packet))) > 0) {
+		if (from.ip != client->server.ip || from.port != client->server.port)
+			continue;
+		client->stats.bytes_received += size;
+		Net_Bits_Init(&bits, packet, size);
+		type = Net_Read_Bits(&bits, 8);
+		if (type == NET_MSG_WELCOME) {
+			if (Net_Read_Bits(&bits, 16) == NET_PROTOCOL && client->slot == -1)
+				client->slot = Net_Read_Bits(&bits, 8);
+		}
+		else if (type == NET_MSG_SNAPSHOT && client->slot != -1)
+			Receive_Snapshot(client, &bits);
+	}
+
+	if (client->slot == -1) {
+		// Keep asking until the server answers (a full server is asked again too)
+		client->retry -= elapsed;
+		if (client->retry <= 0) {
+			Net_Bits_Init(&bits, packet, sizeof(packet));
+			Net_Write_Bits(&bits, NET_MSG_CONNECT, 8);
+			Net_Write_Bits(&bits, NET_PROTOCOL, 16);
+			if (Net_Send(client->sock, &client->server, packet, Net_Bits_Size(&bits)))
+				client->stats.bytes_sent += Net_Bits_Size(&bits);
+			client->stats.connects++;
+			client->retry = CLIENT_CONNECT_RETRY;
+		}
+	}
+	else
+		Send_Input(client, elapsed, buttons, yaw, pitch);
+}
+
+/*____________________________________________________________________
+|
+| Function: Receive_Snapshot
+|
+| Input: Called from Client_Update()
+| Output: Decodes a snapshot against its baseline into the history,
+|   if it's the newest yet.
+|___________________________________________________________________*/
+
+static void Receive_Snapshot(Client client, NetBits* bits)
+{
+	unsigned tick, delta;
+	NetState state, * baseline;
+
+	tick = Net_Read_Bits(bits, 32);
+	delta = Net_Read_Bits(bits, 8);
+	if (bits->overflow || tick <= client->latest)
+		return;
+
+	baseline = NULL;
+	if (delta) {
+		baseline = &client->history[(tick - delta) % NET_HISTORY];
+		if (delta >= NET_HISTORY || baseline->tick != tick - delta) {
+			client->stats.no_baseline++;
+			return;
+		}
+		client->stats.deltas++;
+	}
+	if (NOT Net_Read_State(bits, &state, baseline)) {
+		client->stats.malformed++;
+		return;
+	}
+	state.tick = tick;
+	client->history[tick % NET_HISTORY] = state;
+	client->latest = tick;
+	client->stats.snapshots++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Send_Input
+|
+| Input: Called from Client_Update()
+| Output: Sends the server a new input along with the few before it.
+|___________________________________________________________________*/
+
+static void Send_Input(Client client, unsigned elapsed, unsigned buttons, float yaw, float pitch)
+{
+	int i;
+	unsigned char packet[NET_MAX_PACKET];
+	NetInput* input;
+	NetBits bits;
+
+	if (client->num_inputs == NET_INPUT_REDUNDANCY)
+		memmove(&client->inputs[0], &client->inputs[1], (NET_INPUT_REDUNDANCY - 1) * sizeof(NetInput));
+	else
+		client->num_inputs++;
+	input = &client->inputs[client->num_inputs - 1];
+	input->sequence = ++client->sequence;
+	input->buttons = (unsigned char)buttons;
+	input->elapsed = (unsigned char)(elapsed < 255 ? elapsed : 255);
+	yaw = fmodf(yaw, 2 * CLIENT_PI);
+	if (yaw < 0)
+		yaw += 2 * CLIENT_PI;
+	input->yaw = (unsigned short)(yaw * (65536 / (2 * CLIENT_PI)));
+	if (pitch < -CLIENT_PI / 2)
+		pitch = -CLIENT_PI / 2;
+	else if (pitch > CLIENT_PI / 2)
+		pitch = CLIENT_PI / 2;
+	input->pitch = (unsigned short)((pitch / CLIENT_PI + 0.5f) * 65535);
+
+	Net_Bits_Init(&bits, packet, sizeof(packet));
+	Net_Write_Bits(&bits, NET_MSG_INPUT, 8);
+	Net_Write_Bits(&bits, client->latest, 32);
+	Net_Write_Bits(&bits, client->num_inputs, 3);
+	Net_Write_Bits(&bits, client->sequence, 16);
+	for (i = 0; i < client->num_inputs; i++)
+		Net_Write_Input(&bits, &client->inputs[i]);
+	if (Net_Send(client->sock, &client->server, packet, Net_Bits_Size(&bits)))
+		client->stats.bytes_sent += Net_Bits_Size(&bits);
+	client->stats.inputs++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Client_Bot_Update
+|
+| Input: Called from Server_Run(), Run_Net()
+| Output: Decides what the bot does for the next elapsed ms from the
+|   newest snapshot and updates its client with that.
+|___________________________________________________________________*/
+
+void Client_Bot_Update(Client client, unsigned elapsed)
+{
+	int i, me, target;
+	unsigned buttons = 0;
+	float x, z, dx, dz, d, nearest, pitch = 0;
+	NetState* state = Client_Get_State(client);
+
+	for (me = 0; state && me < state->num_players && state->slots[me] != client->slot; me++)
+		;
+	if (state && me < state->num_players && NET_FLAGS_STATUS(state->players[me].flags) == NET_STATUS_PLAYING) {
+		x = Net_Dequantize(state->players[me].x);
+		z = Net_Dequantize(state->players[me].z);
+
+		// Run from the nearest Slender if he's close
+		nearest = BOT_FLEE_DISTANCE;
+		target = -1;
+		for (i = 0; i < state->num_slenders; i++) {
+			dx = x - Net_Dequantize(state->slenders[i].x);
+			dz = z - Net_Dequantize(state->slenders[i].z);
+			d = sqrtf(dx * dx + dz * dz);
+			if (d < nearest) {
+				nearest = d;
+				target = i;
+				client->yaw = atan2f(dx, dz);
+			}
+		}
+		if (target != -1)
+			buttons = NET_BUTTON_FORWARD | NET_BUTTON_RUN;
+		else {
+			// Else go for the nearest page left
+			for (i = 0; i < state->num_pages; i++)
+				if (NOT (state->pages_taken & (1 << i))) {
+					dx = Net_Dequantize(state->pages[i].x) - x;
+					dz = Net_Dequantize(state->pages[i].z) - z;
+					d = sqrtf(dx * dx + dz * dz);
+					if (target == -1 || d < nearest) {
+						nearest = d;
+						target = i;
+						client->yaw = atan2f(dx, dz);
+					}
+				}
+			if (target == -1)
+				buttons = NET_BUTTON_FORWARD;
+			else if (nearest > BOT_REACH)
+				buttons = NET_BUTTON_FORWARD | (nearest > BOT_RUN_DISTANCE ? NET_BUTTON_RUN : 0);
+			else {
+				// Look down at it and pick it up
+				pitch = atan2f(Net_Dequantize(state->pages[target].y) - (Terrain_Get_Height(x, z) + NET_EYE_HEIGHT), nearest);
+				buttons = NET_BUTTON_PICK;
+			}
+		}
+
+		// Stopped by a trunk?  Sidestep for a while
+		if (buttons & NET_BUTTON_FORWARD && state->players[me].x == client->last_x && state->players[me].z == client->last_z)
+			client->stuck_time += elapsed;
+		else
+			client->stuck_time = 0;
+		client->last_x = state->players[me].x;
+		client->last_z = state->players[me].z;
+		if (client->stuck_time > BOT_STUCK_TIME) {
+			client->sidestep = (rand() & 1) ? NET_BUTTON_LEFT : NET_BUTTON_RIGHT;
+			client->sidestep_time = BOT_SIDESTEP_TIME;
+			client->stuck_time = 0;
+		}
+		if (client->sidestep_time > 0) {
+			buttons = (buttons & ~NET_BUTTON_PICK) | client->sidestep;
+			client->sidestep_time -= elapsed;
+		}
+	}
+
+	Client_Update(client, elapsed, buttons, client->yaw, pitch);
+}
+
+/*____________________________________________________________________
+|
+| Function: Client_Get_State
+|
+| Input: Called from Client_Bot_Update()
+| Output: Returns the newest snapshot, NULL before the first.
+|___________________________________________________________________*/
+
+NetState* Client_Get_State(Client client)
+{
+	return (client->latest ? &client->history[client->latest % NET_HISTORY] : NULL);
+}
+
+/*____________________________________________________________________
+|
+| Function: Client_Get_Stats
+|
+| Input: Called from Run_Net()
+| Output: Returns the client's stats.
+|___________________________________________________________________*/
+
+void Client_Get_Stats(Client client, ClientStats* out)
+{
+	*out = client->stats;
+}
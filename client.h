@@ -0,0 +1,44 @@
+/*____________________________________________________________________
+|
+| File: client.h
+|
+| Description: Multiplayer client connection, and a bot that plays
+|   through one.
+|___________________________________________________________________*/
+
+#ifndef _CLIENT_H_
+#define _CLIENT_H_
+
+#include "net.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct ClientData* Client;
+
+typedef struct {
+	unsigned           connects;          // connect messages sent
+	unsigned           snapshots;         // states received
+	unsigned           deltas;            // of them, sent as a delta
+	unsigned           no_baseline;       // deltas dropped, their baseline was gone
+	unsigned           malformed;
+	unsigned           inputs;            // input messages sent
+	unsigned long long bytes_sent;        // UDP payload
+	unsigned long long bytes_received;
+} ClientStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+Client    Client_Create (NetAddress *server);
+void      Client_Free (Client client);
+void      Client_Update (Client client, unsigned elapsed, unsigned buttons, float yaw, float pitch);
+void      Client_Bot_Update (Client client, unsigned elapsed);
+NetState *Client_Get_State (Client client);
+void      Client_Get_Stats (Client client, ClientStats *stats);
+
+#endif
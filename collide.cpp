@@ -0,0 +1,584 @@
+/*____________________________________________________________________
+|
+| File: collide.cpp
+|
+| Description: Continuous swept sphere collision against static
+|   vertical capsules (tree trunks) with sliding response.
+|
+|   Broadphase: capsules are bucketed by center into a uniform XZ grid
+|   and stored sorted by cell in structure-of-arrays form, so the
+|   capsules of a run of cells in one grid row are contiguous.  A query
+|   only visits the cells under the swept bounds of the move, so its
+|   cost depends on local tree density rather than total tree count.
+|
+|   Narrowphase: trunks are vertical, so the swept test is a moving
+|   circle against a circle in XZ, applied where the sphere and capsule
+|   overlap in Y.  Candidates are tested 4 at a time with SSE.
+|
+|   Response: overlaps are pushed out first, then the move is swept,
+|   stopped at the first contact and the remainder slid along the
+|   contact normal, for up to COLLIDE_MAX_ITERATIONS contacts per move.
+|
+| Functions:  Collide_Init
+|             Collide_Free
+|             Collide_Add_Capsule
+|             Collide_Build
+|             Collide_Sweep_Sphere
+|							 Sweep_Run
+|							 Get_Cell_Range
+|             Collide_Move_Sphere
+|							 Depenetrate
+|             Collide_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include <xmmintrin.h>
+
+#include "collide.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define COLLIDE_CELL_SIZE       4.0f   // world units (grows if the grid would be too large)
+#define COLLIDE_MAX_GRID_DIM    2048
+#define COLLIDE_MAX_ITERATIONS  4      // contacts resolved per move
+#define COLLIDE_SKIN            0.01f  // gap kept between the sphere and a capsule
+#define COLLIDE_MIN_MOVE        1e-5f
+#define COLLIDE_INITIAL_SIZE    256
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	int x0, z0, x1, z1;
+} CellRange;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Sweep_Run(int start, int end, float cx, float cz, float cy0, float cy1, float radius, float dx, float dz, float *best_t, int *best);
+static int Get_Cell_Range(float x0, float z0, float x1, float z1, CellRange* range);
+static int Depenetrate(gx3dVector* center, float radius);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static Arena collide_arena;  // NULL for the heap
+
+// Capsules as added (unsorted)
+static float* add_x, * add_z, * add_y0, * add_y1, * add_r;
+static int num_added, max_added;
+
+// Capsules sorted by cell (x, z = axis, y0-y1 = extent including caps, r = radius)
+static float* cap_x, * cap_z, * cap_y0, * cap_y1, * cap_r;
+static int num_capsules;
+static float max_radius;
+
+// Broadphase grid
+static int* cell_start;
+static int grid_dx, grid_dz;
+static float grid_x, grid_z;   // world position of the grid's min corner
+static float cell_size, inv_cell_size;
+
+static CollideStats stats;
+
+/*____________________________________________________________________
+|
+| Function: Collide_Init
+|
+| Input: Called from Program_Run()
+| Output: Initializes an empty collision world allocating from arena
+|   (NULL for the heap).
+|___________________________________________________________________*/
+
+void Collide_Init(Arena arena)
+{
+	Collide_Free();
+	collide_arena = arena;
+	memset(&stats, 0, sizeof(stats));
+}
+
+/*____________________________________________________________________
+|
+| Function: Collide_Free
+|
+| Input: Called from Program_Run()
+| Output: Frees the collision world.  Arena memory is released by
+|   resetting the arena.
+|___________________________________________________________________*/
+
+void Collide_Free()
+{
+	Arena_Dealloc(collide_arena, add_x);
+	Arena_Dealloc(collide_arena, add_z);
+	Arena_Dealloc(collide_arena, add_y0);
+	Arena_Dealloc(collide_arena, add_y1);
+	Arena_Dealloc(collide_arena, add_r);
+	Arena_Dealloc(collide_arena, cap_x);
+	Arena_Dealloc(collide_arena, cap_z);
+	Arena_Dealloc(collide_arena, cap_y0);
+	Arena_Dealloc(collide_arena, cap_y1);
+	Arena_Dealloc(collide_arena, cap_r);
+	Arena_Dealloc(collide_arena, cell_start);
+	add_x = add_z = add_y0 = add_y1 = add_r = NULL;
+	cap_x = cap_z = cap_y0 = cap_y1 = cap_r = NULL;
+	cell_start = NULL;
+	num_added = max_added = 0;
+	num_capsules = 0;
+	grid_dx = grid_dz = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Collide_Add_Capsule
+|
+| Input: Called from Program_Run()
+| Output: Adds a vertical capsule of the given radius whose axis runs
+|   from base up height units.  Takes effect at the next
+|   Collide_Build().  Returns true on success.
+|___________________________________________________________________*/
+
+int Collide_Add_Capsule(gx3dVector* base, float height, float radius)
+{
+	if (num_added == max_added) {
+		int new_max = max_added ? max_added * 2 : COLLIDE_INITIAL_SIZE;
+		float* x = (float*)Arena_Realloc(collide_arena, add_x, max_added * sizeof(float), new_max * sizeof(float));
+		float* z = (float*)Arena_Realloc(collide_arena, add_z, max_added * sizeof(float), new_max * sizeof(float));
+		float* y0 = (float*)Arena_Realloc(collide_arena, add_y0, max_added * sizeof(float), new_max * sizeof(float));
+		float* y1 = (float*)Arena_Realloc(collide_arena, add_y1, max_added * sizeof(float), new_max * sizeof(float));
+		float* r = (float*)Arena_Realloc(collide_arena, add_r, max_added * sizeof(float), new_max * sizeof(float));
+		if (x) add_x = x;
+		if (z) add_z = z;
+		if (y0) add_y0 = y0;
+		if (y1) add_y1 = y1;
+		if (r) add_r = r;
+		if (x == NULL || z == NULL || y0 == NULL || y1 == NULL || r == NULL)
+			return (FALSE);
+		max_added = new_max;
+	}
+
+	add_x[num_added] = base->x;
+	add_z[num_added] = base->z;
+	add_y0[num_added] = base->y - radius;
+	add_y1[num_added] = base->y + height + radius;
+	add_r[num_added] = radius;
+	num_added++;
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Collide_Build
+|
+| Input: Called from Program_Run() after all capsules are added.
+| Output: Builds the broadphase grid.
+|___________________________________________________________________*/
+
+void Collide_Build()
+{
+	int i, c, num_cells, * cell_of, * fill;
+	float min_x, min_z, max_x, max_z;
+
+	Arena_Dealloc(collide_arena, cap_x);
+	Arena_Dealloc(collide_arena, cap_z);
+	Arena_Dealloc(collide_arena, cap_y0);
+	Arena_Dealloc(collide_arena, cap_y1);
+	Arena_Dealloc(collide_arena, cap_r);
+	Arena_Dealloc(collide_arena, cell_start);
+	cap_x = cap_z = cap_y0 = cap_y1 = cap_r = NULL;
+	cell_start = NULL;
+	num_capsules = 0;
+	grid_dx = grid_dz = 0;
+	max_radius = 0;
+
+	if (num_added == 0)
+		return;
+
+	/*____________________________________________________________________
+	|
+	| Size the grid to the capsules
+	|___________________________________________________________________*/
+
+	min_x = max_x = add_x[0];
+	min_z = max_z = add_z[0];
+	for (i = 1; i < num_added; i++) {
+		min_x = fminf(min_x, add_x[i]);
+		max_x = fmaxf(max_x, add_x[i]);
+		min_z = fminf(min_z, add_z[i]);
+		max_z = fmaxf(max_z, add_z[i]);
+	}
+	for (i = 0; i < num_added; i++)
+		max_radius = fmaxf(max_radius, add_r[i]);
+
+	cell_size = COLLIDE_CELL_SIZE;
+	while ((max_x - min_x) / cell_size >= COLLIDE_MAX_GRID_DIM || (max_z - min_z) / cell_size >= COLLIDE_MAX_GRID_DIM)
+		cell_size *= 2;
+	inv_cell_size = 1 / cell_size;
+	grid_x = min_x;
+	grid_z = min_z;
+	grid_dx = (int)((max_x - min_x) * inv_cell_size) + 1;
+	grid_dz = (int)((max_z - min_z) * inv_cell_size) + 1;
+	num_cells = grid_dx * grid_dz;
+
+	/*____________________________________________________________________
+	|
+	| Counting sort the capsules by cell
+	|___________________________________________________________________*/
+
+	cell_start = (int*)Arena_Alloc(collide_arena, (num_cells + 1) * sizeof(int));
+	cell_of = (int*)Arena_Alloc(collide_arena, num_added * sizeof(int));
+	fill = (int*)Arena_Alloc(collide_arena, num_cells * sizeof(int));
+	cap_x = (float*)Arena_Alloc(collide_arena, num_added * sizeof(float));
+	cap_z = (float*)Arena_Alloc(collide_arena, num_added * sizeof(float));
+	cap_y0 = (float*)Arena_Alloc(collide_arena, num_added * sizeof(float));
+	cap_y1 = (float*)Arena_Alloc(collide_arena, num_added * sizeof(float));
+	cap_r = (float*)Arena_Alloc(collide_arena, num_added * sizeof(float));
+	if (cell_start == NULL || cell_of == NULL || fill == NULL || cap_x == NULL || cap_z == NULL || cap_y0 == NULL || cap_y1 == NULL || cap_r == NULL) {
+		Arena_Dealloc(collide_arena, cell_of);
+		Arena_Dealloc(collide_arena, fill);
+		Collide_Free();
+		debug_WriteFile("Collide_Build(): out of memory");
+		return;
+	}
+	memset(cell_start, 0, (num_cells + 1) * sizeof(int));
+
+	for (i = 0; i < num_added; i++) {
+		int cx = (int)((add_x[i] - grid_x) * inv_cell_size);
+		int cz = (int)((add_z[i] - grid_z) * inv_cell_size);
+		cell_of[i] = cz * grid_dx + cx;
+		cell_start[cell_of[i] + 1]++;
+	}
+	for (c = 0; c < num_cells; c++)
+		cell_start[c + 1] += cell_start[c];
+	memcpy(fill, cell_start, num_cells * sizeof(int));
+	for (i = 0; i < num_added; i++) {
+		int j = fill[cell_of[i]]++;
+		cap_x[j] = add_x[i];
+		cap_z[j] = add_z[i];
+		cap_y0[j] = add_y0[i];
+		cap_y1[j] = add_y1[i];
+		cap_r[j] = add_r[i];
+	}
+	num_capsules = num_added;
+
+	Arena_Dealloc(collide_arena, cell_of);
+	Arena_Dealloc(collide_arena, fill);
+
+	stats.capsules = num_capsules;
+	stats.cell_size = cell_size;
+	stats.grid_dx = grid_dx;
+	stats.grid_dz = grid_dz;
+}
+
+/*____________________________________________________________________
+|
+| Function: Get_Cell_Range
+|
+| Input: Called from Collide_Sweep_Sphere(), Depenetrate()
+| Output: Gets the grid cells holding capsules that could touch the
+|   given XZ bounds.  Returns false if there are none.
+|___________________________________________________________________*/
+
+static int Get_Cell_Range(float x0, float z0, float x1, float z1, CellRange* range)
+{
+	if (num_capsules == 0)
+		return (FALSE);
+
+	// Capsules are bucketed by center, so widen by the largest radius
+	x0 = (x0 - max_radius - grid_x) * inv_cell_size;
+	z0 = (z0 - max_radius - grid_z) * inv_cell_size;
+	x1 = (x1 + max_radius - grid_x) * inv_cell_size;
+	z1 = (z1 + max_radius - grid_z) * inv_cell_size;
+	if (x1 < 0 || z1 < 0 || x0 >= grid_dx || z0 >= grid_dz)
+		return (FALSE);
+
+	range->x0 = x0 < 0 ? 0 : (int)x0;
+	range->z0 = z0 < 0 ? 0 : (int)z0;
+	range->x1 = x1 >= grid_dx ? grid_dx - 1 : (int)x1;
+	range->z1 = z1 >= grid_dz ? grid_dz - 1 : (int)z1;
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Collide_Sweep_Sphere
+|
+| Input: Called from Collide_Move_Sphere()
+| Output: Sweeps a sphere by move (XZ only) against the capsules.
+|   Returns true on a hit, with t = fraction of move to the first
+|   contact and normal = contact normal.  A sphere already overlapping
+|   a capsule and moving into it hits at t = 0.
+|___________________________________________________________________*/
+
+int Collide_Sweep_Sphere(gx3dSphere* sphere, gx3dVector* move, float* t, gx3dVector* normal)
+{
+	int z, best;
+	float best_t, cx, cz, px, pz, len;
+	CellRange range;
+
+	cx = sphere->center.x;
+	cz = sphere->center.z;
+	if (NOT Get_Cell_Range(fminf(cx, cx + move->x) - sphere->radius, fminf(cz, cz + move->z) - sphere->radius,
+		fmaxf(cx, cx + move->x) + sphere->radius, fmaxf(cz, cz + move->z) + sphere->radius, &range))
+		return (FALSE);
+
+	// Each grid row's run of cells is contiguous in the sorted capsule arrays
+	best = -1;
+	best_t = 1;
+	for (z = range.z0; z <= range.z1; z++)
+		Sweep_Run(cell_start[z * grid_dx + range.x0], cell_start[z * grid_dx + range.x1 + 1],
+			cx, cz, sphere->center.y - sphere->radius, sphere->center.y + sphere->radius, sphere->radius,
+			move->x, move->z, &best_t, &best);
+
+	if (best < 0)
+		return (FALSE);
+
+	*t = best_t;
+	px = cx + move->x * best_t - cap_x[best];
+	pz = cz + move->z * best_t - cap_z[best];
+	len = sqrtf(px * px + pz * pz);
+	if (len > 0) {
+		normal->x = px / len;
+		normal->y = 0;
+		normal->z = pz / len;
+	}
+	else {
+		// Centered on the axis, push straight back
+		len = sqrtf(move->x * move->x + move->z * move->z);
+		normal->x = -move->x / len;
+		normal->y = 0;
+		normal->z = -move->z / len;
+	}
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Sweep_Run
+|
+| Input: Called from Collide_Sweep_Sphere()
+| Output: Tests a contiguous run of capsules against a moving circle,
+|   4 at a time.  Updates best_t/best with any earlier hit.
+|
+|   With p = circle center - capsule axis, d = move and R = sum of
+|   radii, the contact time solves |p + t d|^2 = R^2:
+|     t = (-b - sqrt(b^2 - a c)) / a,  a = d.d, b = p.d, c = p.p - R^2
+|   A hit needs b < 0 (approaching) and either c < 0 (already touching,
+|   t = 0) or a real root with t <= best_t.
+|___________________________________________________________________*/
+
+static void Sweep_Run(int start, int end, float cx, float cz, float cy0, float cy1, float radius, float dx, float dz, float* best_t, int* best)
+{
+	int i, lane, mask;
+	float a, px, pz, rr, b, c, disc, t;
+	float lanes_t[4];
+
+	a = dx * dx + dz * dz;
+	if (a < COLLIDE_MIN_MOVE * COLLIDE_MIN_MOVE)
+		return;
+	stats.candidates += end - start;
+
+	__m128 v_cx = _mm_set1_ps(cx), v_cz = _mm_set1_ps(cz);
+	__m128 v_cy0 = _mm_set1_ps(cy0), v_cy1 = _mm_set1_ps(cy1);
+	__m128 v_radius = _mm_set1_ps(radius);
+	__m128 v_dx = _mm_set1_ps(dx), v_dz = _mm_set1_ps(dz);
+	__m128 v_a = _mm_set1_ps(a), v_zero = _mm_setzero_ps();
+
+	for (i = start; i + 4 <= end; i += 4) {
+		__m128 v_px = _mm_sub_ps(v_cx, _mm_loadu_ps(cap_x + i));
+		__m128 v_pz = _mm_sub_ps(v_cz, _mm_loadu_ps(cap_z + i));
+		__m128 v_rr = _mm_add_ps(v_radius, _mm_loadu_ps(cap_r + i));
+		__m128 v_b = _mm_add_ps(_mm_mul_ps(v_px, v_dx), _mm_mul_ps(v_pz, v_dz));
+		__m128 v_c = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(v_px, v_px), _mm_mul_ps(v_pz, v_pz)), _mm_mul_ps(v_rr, v_rr));
+		__m128 v_disc = _mm_sub_ps(_mm_mul_ps(v_b, v_b), _mm_mul_ps(v_a, v_c));
+		__m128 v_t = _mm_div_ps(_mm_sub_ps(_mm_sub_ps(v_zero, v_b), _mm_sqrt_ps(_mm_max_ps(v_disc, v_zero))), v_a);
+		// Already touching = hit at t = 0
+		__m128 v_touching = _mm_cmplt_ps(v_c, v_zero);
+		v_t = _mm_or_ps(_mm_and_ps(v_touching, v_zero), _mm_andnot_ps(v_touching, v_t));
+		__m128 v_hit = _mm_and_ps(_mm_cmplt_ps(v_b, v_zero), _mm_or_ps(v_touching, _mm_cmpge_ps(v_disc, v_zero)));
+		v_hit = _mm_and_ps(v_hit, _mm_cmple_ps(v_t, _mm_set1_ps(*best_t)));
+		// Overlap in y
+		v_hit = _mm_and_ps(v_hit, _mm_cmple_ps(_mm_loadu_ps(cap_y0 + i), v_cy1));
+		v_hit = _mm_and_ps(v_hit, _mm_cmpge_ps(_mm_loadu_ps(cap_y1 + i), v_cy0));
+		mask = _mm_movemask_ps(v_hit);
+		if (mask) {
+			_mm_storeu_ps(lanes_t, v_t);
+			for (lane = 0; lane < 4; lane++)
+				if ((mask & (1 << lane)) && lanes_t[lane] <= *best_t) {
+					*best_t = lanes_t[lane];
+					*best = i + lane;
+				}
+		}
+	}
+
+	// Remaining capsules
+	for (; i < end; i++) {
+		if (cap_y0[i] > cy1 || cap_y1[i] < cy0)
+			continue;
+		px = cx - cap_x[i];
+		pz = cz - cap_z[i];
+		rr = radius + cap_r[i];
+		b = px * dx + pz * dz;
+		if (b >= 0)
+			continue;
+		c = px * px + pz * pz - rr * rr;
+		if (c < 0)
+			t = 0;
+		else {
+			disc = b * b - a * c;
+			if (disc < 0)
+				continue;
+			t = (-b - sqrtf(disc)) / a;
+		}
+		if (t <= *best_t) {
+			*best_t = t;
+			*best = i;
+		}
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Collide_Move_Sphere
+|
+| Input: Called from Program_Run()
+| Output: Moves a sphere by move, stopping at capsules and sliding
+|   along them.  The y part of move is applied without collision.
+|   Returns true if the sphere touched anything, with the final
+|   center in result.
+|___________________________________________________________________*/
+
+int Collide_Move_Sphere(gx3dSphere* sphere, gx3dVector* move, gx3dVector* result)
+{
+	int iteration, collided;
+	float t, len, dot, step;
+	gx3dVector normal, remaining;
+	gx3dSphere s;
+
+	stats.moves++;
+
+	s = *sphere;
+	remaining.x = move->x;
+	remaining.y = 0;
+	remaining.z = move->z;
+
+	// Resolve contacts already present (e.g. after a teleport)
+	collided = Depenetrate(&s.center, s.radius);
+
+	for (iteration = 0; iteration < COLLIDE_MAX_ITERATIONS; iteration++) {
+		len = sqrtf(remaining.x * remaining.x + remaining.z * remaining.z);
+		if (len < COLLIDE_MIN_MOVE)
+			break;
+
+		if (NOT Collide_Sweep_Sphere(&s, &remaining, &t, &normal)) {
+			s.center.x += remaining.x;
+			s.center.z += remaining.z;
+			break;
+		}
+
+		// Move up to the contact, leaving a small gap
+		step = t - COLLIDE_SKIN / len;
+		if (step > 0) {
+			s.center.x += remaining.x * step;
+			s.center.z += remaining.z * step;
+		}
+
+		// Slide the rest of the move along the contact
+		remaining.x *= (1 - t);
+		remaining.z *= (1 - t);
+		dot = remaining.x * normal.x + remaining.z * normal.z;
+		if (dot < 0) {
+			remaining.x -= normal.x * dot;
+			remaining.z -= normal.z * dot;
+		}
+
+		collided = TRUE;
+		stats.contacts++;
+	}
+
+	result->x = s.center.x;
+	result->y = s.center.y + move->y;
+	result->z = s.center.z;
+
+	return (collided);
+}
+
+/*____________________________________________________________________
+|
+| Function: Depenetrate
+|
+| Input: Called from Collide_Move_Sphere()
+| Output: Pushes a sphere out of every capsule it overlaps.  Returns
+|   true if it overlapped any.
+|___________________________________________________________________*/
+
+static int Depenetrate(gx3dVector* center, float radius)
+{
+	int x, z, i, pass, pushed;
+	float px, pz, rr, d2, d;
+	CellRange range;
+
+	pushed = FALSE;
+	for (pass = 0; pass < COLLIDE_MAX_ITERATIONS; pass++) {
+		int moved = FALSE;
+		if (NOT Get_Cell_Range(center->x - radius, center->z - radius, center->x + radius, center->z + radius, &range))
+			break;
+		for (z = range.z0; z <= range.z1; z++) {
+			x = z * grid_dx;
+			for (i = cell_start[x + range.x0]; i < cell_start[x + range.x1 + 1]; i++) {
+				if (cap_y0[i] > center->y + radius || cap_y1[i] < center->y - radius)
+					continue;
+				px = center->x - cap_x[i];
+				pz = center->z - cap_z[i];
+				rr = radius + cap_r[i];
+				d2 = px * px + pz * pz;
+				if (d2 >= rr * rr)
+					continue;
+				d = sqrtf(d2);
+				if (d > 0) {
+					center->x += px / d * (rr - d + COLLIDE_SKIN);
+					center->z += pz / d * (rr - d + COLLIDE_SKIN);
+				}
+				else
+					center->x += rr + COLLIDE_SKIN;
+				moved = TRUE;
+				stats.contacts++;
+			}
+		}
+		if (NOT moved)
+			break;
+		pushed = TRUE;
+	}
+
+	return (pushed);
+}
+
+/*____________________________________________________________________
+|
+| Function: Collide_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns collision statistics.
+|___________________________________________________________________*/
+
+void Collide_Get_Stats(CollideStats* s)
+{
+	*s = stats;
+}
@@ -0,0 +1,41 @@
+/*____________________________________________________________________
+|
+| File: collide.h
+|
+| Description: Continuous collision of a moving sphere (the player)
+|   against static vertical capsules (tree trunks).
+|___________________________________________________________________*/
+
+#ifndef _COLLIDE_H_
+#define _COLLIDE_H_
+
+#include "arena.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	unsigned moves;         // # of calls to Collide_Move_Sphere()
+	unsigned contacts;      // # of contacts resolved
+	unsigned candidates;    // # of capsules tested by the narrowphase
+	unsigned capsules;      // # of capsules in the world
+	float    cell_size;     // broadphase grid cell size
+	int      grid_dx, grid_dz;  // broadphase grid dimensions
+} CollideStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+void Collide_Init (Arena arena);
+void Collide_Free ();
+int  Collide_Add_Capsule (gx3dVector *base, float height, float radius);
+void Collide_Build ();
+int  Collide_Sweep_Sphere (gx3dSphere *sphere, gx3dVector *move, float *t, gx3dVector *normal);
+int  Collide_Move_Sphere (gx3dSphere *sphere, gx3dVector *move, gx3dVector *result);
+void Collide_Get_Stats (CollideStats *stats);
+
+#endif
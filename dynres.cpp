@@ -0,0 +1,284 @@
+/*____________________________________________________________________
+|
+| File: dynres.cpp
+|
+| Description: Dynamic resolution scaling.  The 3D scene is drawn into
+|   the top left corner of an internal render texture the size of the
+|   screen, using a viewport scaled by the current resolution scale.
+|   The used part of the texture is then stretched over the screen with
+|   a full screen quad, so HUD and screen overlays drawn afterwards stay
+|   at native resolution.
+|
+|   Every DYNRES_UPDATE_FRAMES frames a PID controller compares the mean
+|   frame work time with the frame time budget and adjusts the scale.
+|
+| Functions:  DynRes_Init
+|             DynRes_Free
+|             DynRes_Update
+|             DynRes_Get_Scale
+|             DynRes_Begin_Scene
+|             DynRes_End_Scene
+|             DynRes_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "main.h"
+#include "dynres.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define DYNRES_UPDATE_FRAMES 4      // frames averaged per controller update
+#define DYNRES_MIN_SCALE     0.5f
+#define DYNRES_MAX_SCALE     1.0f
+#define DYNRES_SCALE_STEP    (1.0f / 64)  // scale is snapped to this step to stop viewport jitter
+
+// PID gains, applied to the budget error as a fraction of the budget
+#define DYNRES_KP            0.10f
+#define DYNRES_KI            0.02f
+#define DYNRES_KD            0.05f
+#define DYNRES_INTEGRAL_MAX  5.0f
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static gx3dTexture render_texture;
+static gx3dObject* screen_quad;
+static float       screen_quad_scale;  // scale at which screen_quad exactly covers the screen
+static int         screen_dx, screen_dy;
+
+static float budget;          // ms
+static float scale;           // applied scale
+static float raw_scale;       // unsnapped controller output
+static float integral, last_error;
+static float window_sum;
+static int   window_frames;
+
+static unsigned stat_updates;
+static float    stat_min_scale, stat_scale_sum, stat_work_sum;
+
+/*____________________________________________________________________
+|
+| Function: DynRes_Init
+|
+| Input: Called from Program_Run()
+| Output: Creates the internal render target.  budget is the frame
+|   time budget in ms.  obj_quad is a screen quad that covers the
+|   screen when scaled by screen_scale (as in Draw_Screen).  Returns
+|   true if scaling is available, else false (the scene will be drawn
+|   directly at native resolution).
+|___________________________________________________________________*/
+
+int DynRes_Init(float budget_ms, float screen_scale, gx3dObject* obj_quad)
+{
+	screen_dx = gxGetScreenWidth();
+	screen_dy = gxGetScreenHeight();
+	screen_quad = obj_quad;
+	screen_quad_scale = screen_scale;
+
+	budget = budget_ms;
+	scale = DYNRES_MAX_SCALE;
+	raw_scale = DYNRES_MAX_SCALE;
+	integral = 0;
+	last_error = 0;
+	window_sum = 0;
+	window_frames = 0;
+
+	stat_updates = 0;
+	stat_min_scale = DYNRES_MAX_SCALE;
+	stat_scale_sum = 0;
+	stat_work_sum = 0;
+
+	render_texture = gx3d_InitRenderTexture(screen_dx, screen_dy);
+
+	return (render_texture != NULL);
+}
+
+/*____________________________________________________________________
+|
+| Function: DynRes_Free
+|
+| Input: Called from Program_Run()
+| Output: Frees the internal render target.
+|___________________________________________________________________*/
+
+void DynRes_Free()
+{
+	if (render_texture) {
+		gx3d_FreeTexture(render_texture);
+		render_texture = NULL;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: DynRes_Update
+|
+| Input: Called from Program_Run() once per frame with the time (ms)
+|   the last frame spent working.
+| Output: Adjusts the resolution scale every DYNRES_UPDATE_FRAMES.
+|___________________________________________________________________*/
+
+void DynRes_Update(float work_time)
+{
+	float mean, error, derivative;
+
+	if (render_texture == NULL || budget <= 0)
+		return;
+
+	window_sum += work_time;
+	if (++window_frames < DYNRES_UPDATE_FRAMES)
+		return;
+
+	mean = window_sum / window_frames;
+	window_sum = 0;
+	window_frames = 0;
+
+	// Positive error = headroom, negative = over budget
+	error = (budget - mean) / budget;
+	derivative = error - last_error;
+	last_error = error;
+
+	// Don't wind up the integral while pinned at a limit
+	if (NOT((raw_scale >= DYNRES_MAX_SCALE && error > 0) || (raw_scale <= DYNRES_MIN_SCALE && error < 0))) {
+		integral += error;
+		if (integral > DYNRES_INTEGRAL_MAX)
+			integral = DYNRES_INTEGRAL_MAX;
+		else if (integral < -DYNRES_INTEGRAL_MAX)
+			integral = -DYNRES_INTEGRAL_MAX;
+	}
+
+	raw_scale += DYNRES_KP * error + DYNRES_KI * integral + DYNRES_KD * derivative;
+	if (raw_scale > DYNRES_MAX_SCALE)
+		raw_scale = DYNRES_MAX_SCALE;
+	else if (raw_scale < DYNRES_MIN_SCALE)
+		raw_scale = DYNRES_MIN_SCALE;
+
+	scale = floorf(raw_scale / DYNRES_SCALE_STEP + 0.5f) * DYNRES_SCALE_STEP;
+
+	stat_updates++;
+	stat_scale_sum += scale;
+	stat_work_sum += mean;
+	if (scale < stat_min_scale)
+		stat_min_scale = scale;
+}
+
+/*____________________________________________________________________
+|
+| Function: DynRes_Get_Scale
+|
+| Input: Called from Program_Run()
+| Output: Returns the current scale of each screen dimension (0-1).
+|___________________________________________________________________*/
+
+float DynRes_Get_Scale()
+{
+	return (scale);
+}
+
+/*____________________________________________________________________
+|
+| Function: DynRes_Begin_Scene
+|
+| Input: Called from Program_Run() after gx3d_BeginRender().
+| Output: Directs 3D drawing into the scaled internal target and
+|   clears it.
+|___________________________________________________________________*/
+
+void DynRes_Begin_Scene(gxColor clear_color)
+{
+	gxRectangle viewport;
+
+	if (render_texture) {
+		gx3d_SetRenderTexture(render_texture);
+		viewport.xleft = 0;
+		viewport.ytop = 0;
+		viewport.xright = (int)(screen_dx * scale) - 1;
+		viewport.ybottom = (int)(screen_dy * scale) - 1;
+		gx3d_SetViewport(&viewport);
+	}
+	gx3d_ClearViewport(gx3d_CLEAR_SURFACE | gx3d_CLEAR_ZBUFFER, clear_color, gx3d_MAX_ZBUFFER_VALUE, 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: DynRes_End_Scene
+|
+| Input: Called from Program_Run() after the 3D scene is drawn.
+| Output: Restores drawing to the screen at native resolution and
+|   stretches the scene over it.
+|___________________________________________________________________*/
+
+void DynRes_End_Scene()
+{
+	gx3dMatrix view_save, m, m1, m2;
+	gx3dColor color3d_white = { 1, 1, 1, 0 };
+	float k, half_dx, half_dy;
+
+	if (render_texture == NULL)
+		return;
+
+	gx3d_SetRenderTexture(NULL);
+	gx3d_SetViewport(&Pgm_screen);
+
+	/*____________________________________________________________________
+	|
+	| Draw the scaled scene over the whole screen.  The quad is enlarged
+	| by 1/scale about its top left corner, so the used top left part of
+	| the texture fills the screen and the rest falls off screen.
+	|___________________________________________________________________*/
+
+	k = 1 / scale;
+	half_dx = (screen_quad->bound_box.max.x - screen_quad->bound_box.min.x) / 2 * screen_quad_scale;
+	half_dy = (screen_quad->bound_box.max.y - screen_quad->bound_box.min.y) / 2 * screen_quad_scale;
+
+	gx3d_GetViewMatrix(&view_save);
+	gx3dVector tfrom = { 0,0,-1 }, tto = { 0,0,0 }, twup = { 0,1,0 };
+	gx3d_CameraSetPosition(&tfrom, &tto, &twup, gx3d_CAMERA_ORIENTATION_LOOKTO_FIXED);
+	gx3d_CameraSetViewMatrix();
+	gx3d_DisableZBuffer();
+	gx3d_SetAmbientLight(color3d_white);
+	gx3d_GetScaleMatrix(&m1, screen_quad_scale * k, screen_quad_scale * k, screen_quad_scale * k);
+	gx3d_GetTranslateMatrix(&m2, (k - 1) * half_dx, -(k - 1) * half_dy, .5);
+	gx3d_MultiplyMatrix(&m1, &m2, &m);
+	gx3d_SetObjectMatrix(screen_quad, &m);
+	gx3d_SetTexture(0, render_texture);
+	gx3d_DrawObject(screen_quad);
+	gx3d_EnableZBuffer();
+	gx3d_SetViewMatrix(&view_save);
+}
+
+/*____________________________________________________________________
+|
+| Function: DynRes_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns scaling statistics.
+|___________________________________________________________________*/
+
+void DynRes_Get_Stats(DynResStats* stats)
+{
+	stats->updates = stat_updates;
+	stats->scale = scale;
+	stats->min_scale = stat_min_scale;
+	stats->budget = budget;
+	if (stat_updates) {
+		stats->mean_scale = stat_scale_sum / stat_updates;
+		stats->mean_work_time = stat_work_sum / stat_updates;
+	}
+	else {
+		stats->mean_scale = scale;
+		stats->mean_work_time = 0;
+	}
+}
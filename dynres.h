@@ -0,0 +1,39 @@
+/*____________________________________________________________________
+|
+| File: dynres.h
+|
+| Description: Dynamic resolution scaling - renders the 3D scene at a
+|   reduced internal resolution chosen to fit a frame time budget.
+|___________________________________________________________________*/
+
+#ifndef _DYNRES_H_
+#define _DYNRES_H_
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	unsigned updates;     // # of controller updates
+	float    scale;       // current scale of each screen dimension
+	float    min_scale;   // lowest scale used
+	float    mean_scale;  // mean scale over all updates
+	float    budget;      // frame time budget (ms)
+	float    mean_work_time;  // mean measured frame work time (ms)
+} DynResStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int   DynRes_Init (float budget, float screen_scale, gx3dObject *obj_quad);
+void  DynRes_Free ();
+void  DynRes_Update (float work_time);
+float DynRes_Get_Scale ();
+void  DynRes_Begin_Scene (gxColor clear_color);
+void  DynRes_End_Scene ();
+void  DynRes_Get_Stats (DynResStats *stats);
+
+#endif
@@ -0,0 +1,854 @@
+/*____________________________________________________________________
+|
+| File: ecs.cpp
+|
+| Description: Archetype based entity-component store.
+|
+|   Entities with the same set of components share an archetype.  An
+|   archetype stores its entities in fixed size chunks, each chunk
+|   holding one contiguous array per component, so a system iterating
+|   a query streams through just the component arrays it reads.  Every
+|   chunk but the last of an archetype is full: removing an entity moves
+|   the archetype's last entity into the hole (swap-remove), so create
+|   and destroy are O(1) and there are no dead slots to skip.
+|
+|   An entity handle is an index into the entity table plus a
+|   generation, so handles to destroyed entities are detected.
+|
+|   Memory comes from the arena passed to Ecs_Init() (the heap if NULL).
+|   Chunks are all the same size and emptied chunks are kept on a free
+|   list for reuse, so creating and destroying entities in steady state
+|   allocates nothing.
+|
+|   Ecs_Save_Image() copies the store into one flat block: a header,
+|   the archetype and chunk tables, the entity table and the raw chunks,
+|   with pointers stored as offsets.  Ecs_Load_Image() adopts such a
+|   block in place, fixing up the chunk pointers and using the chunks
+|   where they are, so loading costs the same for any entity count.
+|   Every offset, count and entity record in the block is checked
+|   against its size before it's adopted, so a truncated or corrupt
+|   file is refused rather than read out of bounds.
+|
+| Functions:  Ecs_Init
+|             Ecs_Free
+|             Ecs_Define_Component
+|             Ecs_Create_Entity
+|							 Get_Archetype
+|							 Add_Row
+|							 Remove_Row
+|             Ecs_Destroy_Entity
+|             Ecs_Is_Alive
+|             Ecs_Add_Component
+|             Ecs_Remove_Component
+|							 Move_Entity
+|             Ecs_Has_Component
+|             Ecs_Get_Component
+|             Ecs_Count
+|             Ecs_Query_Begin
+|             Ecs_Query_Next
+|             Ecs_Get_Image_Size
+|             Ecs_Save_Image
+|             Ecs_Load_Image
+|							 Check_Image
+|							 In_Image
+|             Ecs_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "ecs.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define ECS_CHUNK_SIZE      16384  // bytes (larger if one entity doesn't fit)
+#define ECS_ALIGN           16     // alignment of the component arrays in a chunk
+#define ECS_MAX_ARCHETYPES  64
+#define ECS_INDEX_BITS      20
+#define ECS_INDEX_MASK      ((1u << ECS_INDEX_BITS) - 1)
+#define ECS_GENERATION_MASK (0xFFFFFFFFu >> ECS_INDEX_BITS)
+#define ECS_INITIAL_SIZE    256
+
+#define ECS_IMAGE_ALIGN(_n_)  (((_n_) + ECS_ALIGN - 1) & ~(ECS_ALIGN - 1))
+
+#define ECS_INDEX(_e_)       ((_e_) & ECS_INDEX_MASK)
+#define ECS_GENERATION(_e_)  ((_e_) >> ECS_INDEX_BITS)
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	char* data;
+	int   count;
+} Chunk;
+
+typedef struct {
+	EcsMask mask;
+	int     capacity;                     // entities per chunk
+	int     chunk_size;                   // bytes
+	int     offset[ECS_MAX_COMPONENTS];   // offset of each component array in a chunk (entity ids at 0)
+	Chunk*  chunks;
+	int     num_chunks, max_chunks;
+} Archetype;
+
+typedef struct {
+	int      archetype;   // -1 if free
+	int      chunk;
+	int      row;         // next free record if free
+	unsigned generation;
+} EntityRecord;
+
+// Start of a saved image, followed by the sections at the given offsets
+typedef struct {
+	unsigned size;               // bytes
+	int      num_archetypes;
+	int      num_chunks;
+	int      num_records;
+	int      free_record;
+	unsigned archetypes_offset;  // Archetype[num_archetypes], chunks = offset of its chunk table
+	unsigned chunks_offset;      // Chunk[num_chunks], data = offset of the chunk
+	unsigned records_offset;     // EntityRecord[num_records]
+	int      comp_size[ECS_MAX_COMPONENTS];
+	EcsStats stats;
+} ImageHeader;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static int  Get_Archetype(EcsMask mask);
+static bool Add_Row(int archetype, int* chunk, int* row);
+static void Remove_Row(int archetype, int chunk, int row);
+static void Move_Entity(EcsEntity entity, EcsMask mask);
+static bool Check_Image(char* image, unsigned size);
+static bool In_Image(size_t offset, size_t count, size_t item_size, unsigned size);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static Arena         ecs_arena;
+static int           comp_size[ECS_MAX_COMPONENTS];
+static Archetype     archetypes[ECS_MAX_ARCHETYPES];
+static int           num_archetypes;
+static EntityRecord* records;
+static int           num_records, max_records;
+static int           free_record;  // head of the free list, -1 if empty
+static char*         free_chunk;   // free list of ECS_CHUNK_SIZE chunks, linked through their first bytes
+static EcsStats      stats;
+
+#define COLUMN(_a_,_c_,_comp_,_row_)  (archetypes[_a_].chunks[_c_].data + archetypes[_a_].offset[_comp_] + (_row_) * comp_size[_comp_])
+#define ENTITIES(_a_,_c_)             ((EcsEntity*)archetypes[_a_].chunks[_c_].data)
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Init
+|
+| Input: Called from Program_Run()
+| Output: Initializes the entity store, allocating from arena (NULL
+|   for the heap).
+|___________________________________________________________________*/
+
+void Ecs_Init(Arena arena)
+{
+	ecs_arena = arena;
+	free_chunk = NULL;
+	memset(comp_size, 0, sizeof(comp_size));
+	memset(archetypes, 0, sizeof(archetypes));
+	num_archetypes = 0;
+	records = NULL;
+	num_records = 0;
+	max_records = 0;
+	free_record = -1;
+	memset(&stats, 0, sizeof(stats));
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Free
+|
+| Input: Called from Program_Run()
+| Output: Frees all entities.  Arena memory is released by resetting
+|   the arena.
+|___________________________________________________________________*/
+
+void Ecs_Free()
+{
+	int i, j;
+	char* next;
+
+	for (i = 0; i < num_archetypes; i++) {
+		for (j = 0; j < archetypes[i].num_chunks; j++)
+			Arena_Dealloc(ecs_arena, archetypes[i].chunks[j].data);
+		Arena_Dealloc(ecs_arena, archetypes[i].chunks);
+	}
+	for (; free_chunk; free_chunk = next) {
+		next = *(char**)free_chunk;
+		Arena_Dealloc(ecs_arena, free_chunk);
+	}
+	Arena_Dealloc(ecs_arena, records);
+	Ecs_Init(NULL);
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Define_Component
+|
+| Input: Called from Program_Run()
+| Output: Sets the size of a component (0 for a tag).  Must be called
+|   before any entity uses the component.
+|___________________________________________________________________*/
+
+void Ecs_Define_Component(int comp, int size)
+{
+	comp_size[comp] = size;
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Create_Entity
+|
+| Input: Called from Program_Run()
+| Output: Creates an entity with the components in mask, zeroed.
+|   Returns the entity or ECS_INVALID_ENTITY.
+|___________________________________________________________________*/
+
+EcsEntity Ecs_Create_Entity(EcsMask mask)
+{
+	int a, index, chunk, row;
+	EntityRecord* rec;
+	EcsEntity entity;
+
+	a = Get_Archetype(mask);
+	if (a == -1)
+		return (ECS_INVALID_ENTITY);
+
+	// Get a record
+	if (free_record != -1) {
+		index = free_record;
+		free_record = records[index].row;
+	}
+	else {
+		if (num_records == max_records) {
+			int new_max = max_records ? max_records * 2 : ECS_INITIAL_SIZE;
+			if (new_max > (int)ECS_INDEX_MASK)
+				new_max = ECS_INDEX_MASK;
+			if (num_records == new_max)
+				return (ECS_INVALID_ENTITY);
+			EntityRecord* r = (EntityRecord*)Arena_Realloc(ecs_arena, records, max_records * sizeof(EntityRecord), new_max * sizeof(EntityRecord));
+			if (r == NULL)
+				return (ECS_INVALID_ENTITY);
+			records = r;
+			max_records = new_max;
+		}
+		index = num_records++;
+		records[index].generation = 0;
+	}
+
+	if (NOT Add_Row(a, &chunk, &row)) {
+		records[index].archetype = -1;
+		records[index].row = free_record;
+		free_record = index;
+		return (ECS_INVALID_ENTITY);
+	}
+
+	rec = &records[index];
+	rec->archetype = a;
+	rec->chunk = chunk;
+	rec->row = row;
+	entity = (rec->generation << ECS_INDEX_BITS) | index;
+
+	ENTITIES(a, chunk)[row] = entity;
+	for (int c = 0; c < ECS_MAX_COMPONENTS; c++)
+		if (mask & ECS_MASK(c))
+			memset(COLUMN(a, chunk, c, row), 0, comp_size[c]);
+
+	stats.entities++;
+	stats.creates++;
+
+	return (entity);
+}
+
+/*____________________________________________________________________
+|
+| Function: Get_Archetype
+|
+| Input: Called from Ecs_Create_Entity(), Move_Entity()
+| Output: Returns the archetype for a component mask, creating it if
+|   needed, or -1 if there are too many archetypes.
+|___________________________________________________________________*/
+
+static int Get_Archetype(EcsMask mask)
+{
+	int i, c, bytes, padding, offset;
+	Archetype* arch;
+
+	for (i = 0; i < num_archetypes; i++)
+		if (archetypes[i].mask == mask)
+			return (i);
+	if (num_archetypes == ECS_MAX_ARCHETYPES)
+		return (-1);
+
+	arch = &archetypes[num_archetypes];
+	memset(arch, 0, sizeof(Archetype));
+	arch->mask = mask;
+
+	// Fit as many entities in a chunk as the arrays and their padding allow
+	bytes = sizeof(EcsEntity);
+	padding = ECS_ALIGN;
+	for (c = 0; c < ECS_MAX_COMPONENTS; c++)
+		if (mask & ECS_MASK(c)) {
+			bytes += comp_size[c];
+			padding += ECS_ALIGN;
+		}
+	arch->capacity = (ECS_CHUNK_SIZE - padding) / bytes;
+	if (arch->capacity < 1)
+		arch->capacity = 1;
+
+	offset = (arch->capacity * sizeof(EcsEntity) + ECS_ALIGN - 1) & ~(ECS_ALIGN - 1);
+	for (c = 0; c < ECS_MAX_COMPONENTS; c++)
+		if (mask & ECS_MASK(c)) {
+			arch->offset[c] = offset;
+			offset += (arch->capacity * comp_size[c] + ECS_ALIGN - 1) & ~(ECS_ALIGN - 1);
+		}
+	arch->chunk_size = offset > ECS_CHUNK_SIZE ? offset : ECS_CHUNK_SIZE;
+
+	stats.archetypes++;
+
+	return (num_archetypes++);
+}
+
+/*____________________________________________________________________
+|
+| Function: Add_Row
+|
+| Input: Called from Ecs_Create_Entity(), Move_Entity()
+| Output: Appends a row to an archetype, adding a chunk if the last is
+|   full.  Returns true on success.
+|___________________________________________________________________*/
+
+static bool Add_Row(int a, int* chunk, int* row)
+{
+	Archetype* arch = &archetypes[a];
+	Chunk* last;
+
+	if (arch->num_chunks == 0 || arch->chunks[arch->num_chunks - 1].count == arch->capacity) {
+		if (arch->num_chunks == arch->max_chunks) {
+			int new_max = arch->max_chunks ? arch->max_chunks * 2 : 4;
+			Chunk* chunks = (Chunk*)Arena_Realloc(ecs_arena, arch->chunks, arch->max_chunks * sizeof(Chunk), new_max * sizeof(Chunk));
+			if (chunks == NULL)
+				return (false);
+			arch->chunks = chunks;
+			arch->max_chunks = new_max;
+		}
+		last = &arch->chunks[arch->num_chunks];
+		if (free_chunk && arch->chunk_size == ECS_CHUNK_SIZE) {
+			last->data = free_chunk;
+			free_chunk = *(char**)free_chunk;
+		}
+		else {
+			last->data = (char*)Arena_Alloc(ecs_arena, arch->chunk_size);
+			if (last->data == NULL)
+				return (false);
+		}
+		last->count = 0;
+		arch->num_chunks++;
+		stats.chunks++;
+	}
+
+	last = &arch->chunks[arch->num_chunks - 1];
+	*chunk = arch->num_chunks - 1;
+	*row = last->count++;
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: Remove_Row
+|
+| Input: Called from Ecs_Destroy_Entity(), Move_Entity()
+| Output: Removes a row from an archetype by moving the archetype's
+|   last entity into it.  Frees the last chunk if it becomes empty.
+|___________________________________________________________________*/
+
+static void Remove_Row(int a, int chunk, int row)
+{
+	Archetype* arch = &archetypes[a];
+	int last_chunk = arch->num_chunks - 1;
+	int last_row = arch->chunks[last_chunk].count - 1;
+
+	if (chunk != last_chunk || row != last_row) {
+		EcsEntity moved = ENTITIES(a, last_chunk)[last_row];
+		ENTITIES(a, chunk)[row] = moved;
+		for (int c = 0; c < ECS_MAX_COMPONENTS; c++)
+			if (arch->mask & ECS_MASK(c))
+				memcpy(COLUMN(a, chunk, c, row), COLUMN(a, last_chunk, c, last_row), comp_size[c]);
+		records[ECS_INDEX(moved)].chunk = chunk;
+		records[ECS_INDEX(moved)].row = row;
+	}
+
+	if (--arch->chunks[last_chunk].count == 0) {
+		char* data = arch->chunks[last_chunk].data;
+		if (arch->chunk_size == ECS_CHUNK_SIZE) {
+			*(char**)data = free_chunk;
+			free_chunk = data;
+		}
+		else
+			Arena_Dealloc(ecs_arena, data);
+		arch->num_chunks--;
+		stats.chunks--;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Destroy_Entity
+|
+| Input: Called from Program_Run()
+| Output: Destroys an entity.  Component pointers into its archetype
+|   are invalid afterwards.
+|___________________________________________________________________*/
+
+void Ecs_Destroy_Entity(EcsEntity entity)
+{
+	EntityRecord* rec;
+	int index = ECS_INDEX(entity);
+
+	if (NOT Ecs_Is_Alive(entity))
+		return;
+
+	rec = &records[index];
+	Remove_Row(rec->archetype, rec->chunk, rec->row);
+	rec->archetype = -1;
+	rec->generation = (rec->generation + 1) & ECS_GENERATION_MASK;
+	rec->row = free_record;
+	free_record = index;
+
+	stats.entities--;
+	stats.destroys++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Is_Alive
+|
+| Input: Called from Program_Run()
+| Output: Returns true if an entity exists.
+|___________________________________________________________________*/
+
+int Ecs_Is_Alive(EcsEntity entity)
+{
+	int index = ECS_INDEX(entity);
+
+	return (entity != ECS_INVALID_ENTITY && index < num_records &&
+		records[index].archetype != -1 && records[index].generation == ECS_GENERATION(entity));
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Add_Component
+|
+| Input: Called from Program_Run()
+| Output: Adds a zeroed component to an entity, moving it to another
+|   archetype.
+|___________________________________________________________________*/
+
+void Ecs_Add_Component(EcsEntity entity, int comp)
+{
+	if (Ecs_Is_Alive(entity) && NOT Ecs_Has_Component(entity, comp))
+		Move_Entity(entity, archetypes[records[ECS_INDEX(entity)].archetype].mask | ECS_MASK(comp));
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Remove_Component
+|
+| Input: Called from Program_Run()
+| Output: Removes a component from an entity, moving it to another
+|   archetype.
+|___________________________________________________________________*/
+
+void Ecs_Remove_Component(EcsEntity entity, int comp)
+{
+	if (Ecs_Has_Component(entity, comp))
+		Move_Entity(entity, archetypes[records[ECS_INDEX(entity)].archetype].mask & ~ECS_MASK(comp));
+}
+
+/*____________________________________________________________________
+|
+| Function: Move_Entity
+|
+| Input: Called from Ecs_Add_Component(), Ecs_Remove_Component()
+| Output: Moves an entity to the archetype for mask, keeping the
+|   components both archetypes have and zeroing new ones.
+|___________________________________________________________________*/
+
+static void Move_Entity(EcsEntity entity, EcsMask mask)
+{
+	EntityRecord* rec = &records[ECS_INDEX(entity)];
+	int src, dst, chunk, row;
+
+	src = rec->archetype;
+	dst = Get_Archetype(mask);
+	if (dst == -1 || NOT Add_Row(dst, &chunk, &row))
+		return;
+
+	ENTITIES(dst, chunk)[row] = entity;
+	for (int c = 0; c < ECS_MAX_COMPONENTS; c++) {
+		if (NOT(mask & ECS_MASK(c)))
+			continue;
+		if (archetypes[src].mask & ECS_MASK(c))
+			memcpy(COLUMN(dst, chunk, c, row), COLUMN(src, rec->chunk, c, rec->row), comp_size[c]);
+		else
+			memset(COLUMN(dst, chunk, c, row), 0, comp_size[c]);
+	}
+	Remove_Row(src, rec->chunk, rec->row);
+
+	rec->archetype = dst;
+	rec->chunk = chunk;
+	rec->row = row;
+
+	stats.moves++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Has_Component
+|
+| Input: Called from Program_Run()
+| Output: Returns true if an entity has a component.
+|___________________________________________________________________*/
+
+int Ecs_Has_Component(EcsEntity entity, int comp)
+{
+	return (Ecs_Is_Alive(entity) && (archetypes[records[ECS_INDEX(entity)].archetype].mask & ECS_MASK(comp)));
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Get_Component
+|
+| Input: Called from Program_Run()
+| Output: Returns a pointer to a component of an entity, or NULL if it
+|   doesn't have it.  The pointer is valid until an entity of the same
+|   archetype is created or destroyed.
+|___________________________________________________________________*/
+
+void* Ecs_Get_Component(EcsEntity entity, int comp)
+{
+	EntityRecord* rec;
+
+	if (NOT Ecs_Has_Component(entity, comp))
+		return (NULL);
+	rec = &records[ECS_INDEX(entity)];
+
+	return (COLUMN(rec->archetype, rec->chunk, comp, rec->row));
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Count
+|
+| Input: Called from Program_Run()
+| Output: Returns the # of entities having all components in mask.
+|___________________________________________________________________*/
+
+unsigned Ecs_Count(EcsMask mask)
+{
+	int i;
+	unsigned count;
+
+	count = 0;
+	for (i = 0; i < num_archetypes; i++)
+		if ((archetypes[i].mask & mask) == mask && archetypes[i].num_chunks)
+			count += (archetypes[i].num_chunks - 1) * archetypes[i].capacity + archetypes[i].chunks[archetypes[i].num_chunks - 1].count;
+
+	return (count);
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Query_Begin
+|
+| Input: Called from Program_Run()
+| Output: Starts a query over the entities having all components in
+|   mask.  Entities must not be created or destroyed during the query.
+|___________________________________________________________________*/
+
+void Ecs_Query_Begin(EcsQuery* query, EcsMask mask)
+{
+	query->mask = mask;
+	query->archetype = 0;
+	query->chunk = -1;
+	query->count = 0;
+	query->entities = NULL;
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Query_Next
+|
+| Input: Called from Program_Run()
+| Output: Advances a query to its next chunk, setting the count,
+|   entities and component columns.  Returns false when done.
+|___________________________________________________________________*/
+
+int Ecs_Query_Next(EcsQuery* query)
+{
+	Archetype* arch;
+
+	query->chunk++;
+	while (query->archetype < num_archetypes) {
+		arch = &archetypes[query->archetype];
+		if ((arch->mask & query->mask) == query->mask && query->chunk < arch->num_chunks)
+			break;
+		query->archetype++;
+		query->chunk = 0;
+	}
+	if (query->archetype == num_archetypes)
+		return (FALSE);
+
+	Chunk* chunk = &arch->chunks[query->chunk];
+	query->count = chunk->count;
+	query->entities = (EcsEntity*)chunk->data;
+	for (int c = 0; c < ECS_MAX_COMPONENTS; c++)
+		query->columns[c] = (arch->mask & ECS_MASK(c)) ? chunk->data + arch->offset[c] : NULL;
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Get_Image_Size
+|
+| Input: Called from Snapshot_Capture(), Snapshot_Save()
+| Output: Returns the # of bytes Ecs_Save_Image() will write.
+|___________________________________________________________________*/
+
+unsigned Ecs_Get_Image_Size()
+{
+	int a, num_chunks;
+	unsigned size;
+
+	num_chunks = 0;
+	size = 0;
+	for (a = 0; a < num_archetypes; a++) {
+		num_chunks += archetypes[a].num_chunks;
+		size += archetypes[a].num_chunks * archetypes[a].chunk_size;
+	}
+	size += ECS_IMAGE_ALIGN(sizeof(ImageHeader));
+	size += ECS_IMAGE_ALIGN(num_archetypes * sizeof(Archetype));
+	size += ECS_IMAGE_ALIGN(num_chunks * sizeof(Chunk));
+	size += ECS_IMAGE_ALIGN(num_records * sizeof(EntityRecord));
+
+	return (size);
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Save_Image
+|
+| Input: Called from Snapshot_Capture(), Snapshot_Save()
+| Output: Copies the store into image, which must be 16 byte aligned
+|   and at least Ecs_Get_Image_Size() bytes.
+|___________________________________________________________________*/
+
+void Ecs_Save_Image(char* image)
+{
+	int a, c, n;
+	unsigned offset;
+	ImageHeader* header = (ImageHeader*)image;
+	Archetype* arch_image;
+	Chunk* chunk_image;
+
+	header->num_archetypes = num_archetypes;
+	header->num_chunks = 0;
+	for (a = 0; a < num_archetypes; a++)
+		header->num_chunks += archetypes[a].num_chunks;
+	header->num_records = num_records;
+	header->free_record = free_record;
+	memcpy(header->comp_size, comp_size, sizeof(comp_size));
+	header->stats = stats;
+
+	offset = ECS_IMAGE_ALIGN(sizeof(ImageHeader));
+	header->archetypes_offset = offset;
+	arch_image = (Archetype*)(image + offset);
+	offset += ECS_IMAGE_ALIGN(num_archetypes * sizeof(Archetype));
+	header->chunks_offset = offset;
+	chunk_image = (Chunk*)(image + offset);
+	offset += ECS_IMAGE_ALIGN(header->num_chunks * sizeof(Chunk));
+	header->records_offset = offset;
+	memcpy(image + offset, records, num_records * sizeof(EntityRecord));
+	offset += ECS_IMAGE_ALIGN(num_records * sizeof(EntityRecord));
+
+	for (a = n = 0; a < num_archetypes; a++) {
+		arch_image[a] = archetypes[a];
+		arch_image[a].chunks = (Chunk*)(size_t)((char*)&chunk_image[n] - image);
+		arch_image[a].max_chunks = archetypes[a].num_chunks;
+		for (c = 0; c < archetypes[a].num_chunks; c++, n++) {
+			chunk_image[n].data = (char*)(size_t)offset;
+			chunk_image[n].count = archetypes[a].chunks[c].count;
+			memcpy(image + offset, archetypes[a].chunks[c].data, archetypes[a].chunk_size);
+			offset += archetypes[a].chunk_size;
+		}
+	}
+
+	header->size = offset;
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Load_Image
+|
+| Input: Called from Snapshot_Rewind(), Snapshot_Load()
+| Output: Replaces the store with an image saved by Ecs_Save_Image().
+|   The image is used in place and modified, so it must stay valid and
+|   writable until the store is initialized again or loads another
+|   image.  Requires an arena.  Returns true on success.
+|___________________________________________________________________*/
+
+int Ecs_Load_Image(char* image, unsigned size)
+{
+	int a, c;
+	ImageHeader* header = (ImageHeader*)image;
+
+	if (ecs_arena == NULL || NOT Check_Image(image, size))
+		return (FALSE);
+
+	memcpy(comp_size, header->comp_size, sizeof(comp_size));
+	num_archetypes = header->num_archetypes;
+	memcpy(archetypes, image + header->archetypes_offset, num_archetypes * sizeof(Archetype));
+	for (a = 0; a < num_archetypes; a++) {
+		archetypes[a].chunks = (Chunk*)(image + (size_t)archetypes[a].chunks);
+		archetypes[a].max_chunks = archetypes[a].num_chunks;
+		for (c = 0; c < archetypes[a].num_chunks; c++)
+			archetypes[a].chunks[c].data = image + (size_t)archetypes[a].chunks[c].data;
+	}
+	records = (EntityRecord*)(image + header->records_offset);
+	num_records = max_records = header->num_records;
+	free_record = header->free_record;
+	free_chunk = NULL;
+	stats = header->stats;
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Check_Image
+|
+| Input: Called from Ecs_Load_Image()
+| Output: Returns true if an image of size bytes is one
+|   Ecs_Save_Image() could have written: every section, chunk table
+|   and chunk inside it, chunk layouts inside their chunks and every
+|   entity record pointing at a row in use.
+|___________________________________________________________________*/
+
+static bool Check_Image(char* image, unsigned size)
+{
+	int a, c, n, total_chunks;
+	ImageHeader* header = (ImageHeader*)image;
+	Archetype* arch;
+	Chunk* chunks;
+	EntityRecord* record;
+
+	if (size < sizeof(ImageHeader) || header->size > size)
+		return (false);
+	size = header->size;
+	if (header->num_archetypes < 0 || header->num_archetypes > ECS_MAX_ARCHETYPES ||
+		header->num_chunks < 0 || header->num_chunks > (int)(size / sizeof(Chunk)) ||
+		header->num_records < 0 || header->num_records > (int)ECS_INDEX_MASK + 1 ||
+		header->free_record < -1 || header->free_record >= header->num_records)
+		return (false);
+	if (NOT In_Image(header->archetypes_offset, header->num_archetypes, sizeof(Archetype), size) ||
+		NOT In_Image(header->chunks_offset, header->num_chunks, sizeof(Chunk), size) ||
+		NOT In_Image(header->records_offset, header->num_records, sizeof(EntityRecord), size))
+		return (false);
+	for (c = 0; c < ECS_MAX_COMPONENTS; c++)
+		if (header->comp_size[c] < 0)
+			return (false);
+
+	// Archetypes, their chunk tables and the chunks
+	total_chunks = 0;
+	for (a = 0; a < header->num_archetypes; a++) {
+		arch = (Archetype*)(image + header->archetypes_offset) + a;
+		if (arch->capacity < 1 || arch->chunk_size < ECS_CHUNK_SIZE ||
+			arch->num_chunks < 0 || arch->num_chunks > header->num_chunks - total_chunks)
+			return (false);
+		total_chunks += arch->num_chunks;
+		if ((size_t)arch->capacity * sizeof(EcsEntity) > (size_t)arch->chunk_size)
+			return (false);
+		for (c = 0; c < ECS_MAX_COMPONENTS; c++)
+			if ((arch->mask & ECS_MASK(c)) && (arch->offset[c] < 0 ||
+				(size_t)arch->offset[c] + (size_t)arch->capacity * header->comp_size[c] > (size_t)arch->chunk_size))
+				return (false);
+		if (NOT In_Image((size_t)arch->chunks, arch->num_chunks, sizeof(Chunk), size))
+			return (false);
+		chunks = (Chunk*)(image + (size_t)arch->chunks);
+		for (n = 0; n < arch->num_chunks; n++)
+			if (NOT In_Image((size_t)chunks[n].data, 1, arch->chunk_size, size) ||
+				chunks[n].count < 0 || chunks[n].count > arch->capacity)
+				return (false);
+	}
+
+	// Entity records, live ones at a row in use and free ones linked to free ones
+	record = (EntityRecord*)(image + header->records_offset);
+	if (header->free_record != -1 && record[header->free_record].archetype != -1)
+		return (false);
+	for (n = 0; n < header->num_records; n++, record++) {
+		if (record->archetype == -1) {
+			if (record->row < -1 || record->row >= header->num_records ||
+				(record->row != -1 && ((EntityRecord*)(image + header->records_offset))[record->row].archetype != -1))
+				return (false);
+			continue;
+		}
+		if (record->archetype < 0 || record->archetype >= header->num_archetypes)
+			return (false);
+		arch = (Archetype*)(image + header->archetypes_offset) + record->archetype;
+		if (record->chunk < 0 || record->chunk >= arch->num_chunks || record->row < 0 ||
+			record->row >= ((Chunk*)(image + (size_t)arch->chunks))[record->chunk].count)
+			return (false);
+	}
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: In_Image
+|
+| Input: Called from Check_Image()
+| Output: Returns true if count items of item_size bytes at offset are
+|   inside an image of size bytes.
+|___________________________________________________________________*/
+
+static bool In_Image(size_t offset, size_t count, size_t item_size, unsigned size)
+{
+	return (offset <= size && (item_size == 0 || count <= (size - offset) / item_size));
+}
+
+/*____________________________________________________________________
+|
+| Function: Ecs_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns entity store statistics.
+|___________________________________________________________________*/
+
+void Ecs_Get_Stats(EcsStats* out)
+{
+	*out = stats;
+}
@@ -0,0 +1,77 @@
+/*____________________________________________________________________
+|
+| File: ecs.h
+|
+| Description: Archetype based entity-component store.
+|___________________________________________________________________*/
+
+#ifndef _ECS_H_
+#define _ECS_H_
+
+#include "arena.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define ECS_MAX_COMPONENTS  32
+#define ECS_INVALID_ENTITY  0xFFFFFFFFu
+
+// Mask bit for a component
+#define ECS_MASK(_comp_)    (1u << (_comp_))
+
+// Column of a component in the current chunk of a query
+#define ECS_COLUMN(_query_,_type_,_comp_)  ((_type_ *)((_query_)->columns[_comp_]))
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef unsigned EcsEntity;
+typedef unsigned EcsMask;
+
+// Iterates the chunks of every archetype having all components in mask
+typedef struct {
+	EcsMask    mask;
+	int        archetype;
+	int        chunk;
+	int        count;                          // # of entities in the current chunk
+	EcsEntity *entities;                       // entities in the current chunk
+	void      *columns[ECS_MAX_COMPONENTS];    // component arrays in the current chunk
+} EcsQuery;
+
+typedef struct {
+	unsigned entities;
+	unsigned archetypes;
+	unsigned chunks;
+	unsigned creates;
+	unsigned destroys;
+	unsigned moves;     // entities moved between archetypes
+} EcsStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+void      Ecs_Init (Arena arena);
+void      Ecs_Free ();
+void      Ecs_Define_Component (int comp, int size);
+EcsEntity Ecs_Create_Entity (EcsMask mask);
+void      Ecs_Destroy_Entity (EcsEntity entity);
+int       Ecs_Is_Alive (EcsEntity entity);
+void      Ecs_Add_Component (EcsEntity entity, int comp);
+void      Ecs_Remove_Component (EcsEntity entity, int comp);
+int       Ecs_Has_Component (EcsEntity entity, int comp);
+void     *Ecs_Get_Component (EcsEntity entity, int comp);
+unsigned  Ecs_Count (EcsMask mask);
+void      Ecs_Query_Begin (EcsQuery *query, EcsMask mask);
+int       Ecs_Query_Next (EcsQuery *query);
+unsigned  Ecs_Get_Image_Size ();
+void      Ecs_Save_Image (char *image);
+int       Ecs_Load_Image (char *image, unsigned size);
+void      Ecs_Get_Stats (EcsStats *stats);
+
+#endif
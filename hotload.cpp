@@ -0,0 +1,582 @@
+/*____________________________________________________________________
+|
+| File: hotload.cpp
+|
+| Description: Reloads textures, meshes and particle scripts when
+|   their files change on disk.
+|
+|   A worker thread watches the current directory tree with
+|   ReadDirectoryChangesW().  A change to a watched file marks its
+|   asset; once the file has gone HOTLOAD_SETTLE_TIME without further
+|   changes and can be opened without a writer, the worker reads it
+|   through (so the decode hits the file cache) and flags the asset
+|   ready.  HotLoad_Update(), called at a frame boundary, loads each
+|   ready asset and swaps it into the caller's handle variable, freeing
+|   the old one.  Loading stays on the main thread since the toolkit
+|   creates Direct3D resources as it decodes.  A failed load keeps the
+|   old asset.  Textures owned by the texture manager are invalidated
+|   instead, and the manager loads them again.  A change to an image in
+|   the atlas rebuilds the atlas, and objects mapped to an atlas entry
+|   are mapped again when reloaded.
+|
+| Functions:  HotLoad_Init
+|             HotLoad_Free
+|             HotLoad_Watch_Texture
+|             HotLoad_Watch_Managed_Texture
+|             HotLoad_Watch_Atlas
+|             HotLoad_Watch_Object
+|             HotLoad_Watch_Atlas_Object
+|             HotLoad_Watch_Particles
+|							 Add_Asset
+|             HotLoad_Update
+|							 Reload_Asset
+|							 Watch_Thread
+|							 Note_Change
+|							 Same_File
+|							 Check_Settled
+|							 File_Is_Settled
+|             HotLoad_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "texmgr.h"
+#include "atlas.h"
+#include "meshopt.h"
+#include "hotload.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define HOTLOAD_MAX_ASSETS   64
+#define HOTLOAD_SETTLE_TIME  250    // ms without changes before a file is reloaded
+#define HOTLOAD_POLL_TIME    50     // ms between checks for settled files
+#define HOTLOAD_BUFFER_SIZE  16384  // bytes of change notifications per read
+#define HOTLOAD_READ_SIZE    65536
+
+#define HOTLOAD_TEXTURE    0
+#define HOTLOAD_OBJECT     1
+#define HOTLOAD_PARTICLES  2
+#define HOTLOAD_MANAGED    3  // texture manager texture
+#define HOTLOAD_ATLAS      4  // image packed in the atlas
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	int   kind;
+	void* handle;                   // gx3dTexture *, gx3dObject ** or gx3dParticleSystem *
+	int   id;                       // texture manager id of a managed texture, else atlas id of an object
+	char  filename[MAX_PATH];
+	char  alpha_filename[MAX_PATH]; // textures only, empty if none
+	bool  changed;                  // change seen, waiting for the file to settle
+	DWORD change_time;
+	bool  ready;                    // reload at the next frame boundary
+} Asset;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Add_Asset(int kind, void* handle, int id, const char* filename, const char* alpha_filename);
+static bool Reload_Asset(Asset* asset);
+static DWORD WINAPI Watch_Thread(LPVOID param);
+static void Note_Change(const char* name);
+static bool Same_File(const char* name1, const char* name2);
+static void Check_Settled();
+static bool File_Is_Settled(const char* filename);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static Asset            assets[HOTLOAD_MAX_ASSETS];
+static int              num_assets;
+static CRITICAL_SECTION lock;          // guards assets[] and stats
+static HANDLE           watch_thread, stop_event;
+static HotLoadStats     stats;
+
+/*____________________________________________________________________
+|
+| Function: HotLoad_Init
+|
+| Input: Called from Program_Run()
+| Output: Starts watching the current directory tree.  Returns true on
+|   success.
+|___________________________________________________________________*/
+
+int HotLoad_Init()
+{
+	num_assets = 0;
+	memset(&stats, 0, sizeof(stats));
+	InitializeCriticalSection(&lock);
+
+	stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (stop_event)
+		watch_thread = CreateThread(NULL, 0, Watch_Thread, NULL, 0, NULL);
+
+	return (watch_thread != NULL);
+}
+
+/*____________________________________________________________________
+|
+| Function: HotLoad_Free
+|
+| Input: Called from Program_Run()
+| Output: Stops watching.  The assets themselves are left alone.
+|___________________________________________________________________*/
+
+void HotLoad_Free()
+{
+	if (watch_thread) {
+		SetEvent(stop_event);
+		WaitForSingleObject(watch_thread, INFINITE);
+		CloseHandle(watch_thread);
+		watch_thread = NULL;
+	}
+	if (stop_event) {
+		CloseHandle(stop_event);
+		stop_event = NULL;
+	}
+	DeleteCriticalSection(&lock);
+}
+
+/*____________________________________________________________________
+|
+| Function: HotLoad_Watch_Texture
+|
+| Input: Called from Program_Run()
+| Output: Reloads a texture into *texture when its image or alpha file
+|   (0 if none) changes.
+|___________________________________________________________________*/
+
+void HotLoad_Watch_Texture(gx3dTexture* texture, const char* filename, const char* alpha_filename)
+{
+	Add_Asset(HOTLOAD_TEXTURE, texture, TEXMGR_INVALID, filename, alpha_filename);
+}
+
+/*____________________________________________________________________
+|
+| Function: HotLoad_Watch_Managed_Texture
+|
+| Input: Called from Program_Run()
+| Output: Has the texture manager load a texture again when its image
+|   or alpha file (0 if none) changes.
+|___________________________________________________________________*/
+
+void HotLoad_Watch_Managed_Texture(TexId id, const char* filename, const char* alpha_filename)
+{
+	Add_Asset(HOTLOAD_MANAGED, NULL, id, filename, alpha_filename);
+}
+
+/*____________________________________________________________________
+|
+| Function: HotLoad_Watch_Atlas
+|
+| Input: Called from Program_Run()
+| Output: Rebuilds the atlas when the image or alpha file (0 if none)
+|   of one of its entries changes.
+|___________________________________________________________________*/
+
+void HotLoad_Watch_Atlas(const char* filename, const char* alpha_filename)
+{
+	Add_Asset(HOTLOAD_ATLAS, NULL, ATLAS_INVALID, filename, alpha_filename);
+}
+
+/*____________________________________________________________________
+|
+| Function: HotLoad_Watch_Object
+|
+| Input: Called from Program_Run()
+| Output: Reloads an object into *object when its file changes.  Don't
+|   watch objects whose pointer is also held elsewhere.
+|___________________________________________________________________*/
+
+void HotLoad_Watch_Object(gx3dObject** object, const char* filename)
+{
+	Add_Asset(HOTLOAD_OBJECT, object, ATLAS_INVALID, filename, 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: HotLoad_Watch_Atlas_Object
+|
+| Input: Called from Program_Run()
+| Output: Reloads an object into *object when its file changes, mapping
+|   it to an atlas entry.
+|___________________________________________________________________*/
+
+void HotLoad_Watch_Atlas_Object(gx3dObject** object, const char* filename, AtlasId id)
+{
+	Add_Asset(HOTLOAD_OBJECT, object, id, filename, 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: HotLoad_Watch_Particles
+|
+| Input: Called from Program_Run()
+| Output: Recreates a particle system into *psys when its script file
+|   changes.
+|___________________________________________________________________*/
+
+void HotLoad_Watch_Particles(gx3dParticleSystem* psys, const char* filename)
+{
+	Add_Asset(HOTLOAD_PARTICLES, psys, TEXMGR_INVALID, filename, 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Add_Asset
+|
+| Input: Called from HotLoad_Watch_Texture(),
+|   HotLoad_Watch_Managed_Texture(), HotLoad_Watch_Atlas(),
+|   HotLoad_Watch_Object(), HotLoad_Watch_Atlas_Object(),
+|   HotLoad_Watch_Particles()
+| Output: Adds an asset to the watch list.
+|___________________________________________________________________*/
+
+static void Add_Asset(int kind, void* handle, int id, const char* filename, const char* alpha_filename)
+{
+	EnterCriticalSection(&lock);
+	if (num_assets < HOTLOAD_MAX_ASSETS) {
+		Asset* asset = &assets[num_assets];
+		asset->kind = kind;
+		asset->handle = handle;
+		asset->id = id;
+		strncpy(asset->filename, filename, MAX_PATH - 1);
+		asset->filename[MAX_PATH - 1] = 0;
+		asset->alpha_filename[0] = 0;
+		if (alpha_filename) {
+			strncpy(asset->alpha_filename, alpha_filename, MAX_PATH - 1);
+			asset->alpha_filename[MAX_PATH - 1] = 0;
+		}
+		asset->changed = false;
+		asset->ready = false;
+		num_assets++;
+		stats.assets++;
+	}
+	LeaveCriticalSection(&lock);
+}
+
+/*____________________________________________________________________
+|
+| Function: HotLoad_Update
+|
+| Input: Called from Program_Run() at a frame boundary (outside of
+|   gx3d_BeginRender()/gx3d_EndRender())
+| Output: Reloads the assets whose files have settled since the last
+|   call.
+|___________________________________________________________________*/
+
+void HotLoad_Update()
+{
+	int i;
+	bool ready, ok;
+	LARGE_INTEGER freq, t0, t1;
+
+	for (i = 0; i < num_assets; i++) {
+		EnterCriticalSection(&lock);
+		ready = assets[i].ready;
+		assets[i].ready = false;
+		LeaveCriticalSection(&lock);
+		if (NOT ready)
+			continue;
+
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&t0);
+		ok = Reload_Asset(&assets[i]);
+		QueryPerformanceCounter(&t1);
+
+		EnterCriticalSection(&lock);
+		if (ok)
+			stats.reloads++;
+		else
+			stats.failures++;
+		stats.last_reload_time = (float)((t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart);
+		LeaveCriticalSection(&lock);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Reload_Asset
+|
+| Input: Called from HotLoad_Update()
+| Output: Loads an asset and swaps it into its handle, freeing the old
+|   one.  Returns true on success, else keeps the old asset.
+|___________________________________________________________________*/
+
+static bool Reload_Asset(Asset* asset)
+{
+	char str[MAX_PATH + 64];
+	bool ok = false;
+
+	switch (asset->kind) {
+		case HOTLOAD_TEXTURE: {
+			gx3dTexture texture = gx3d_InitTexture_File(asset->filename, asset->alpha_filename[0] ? asset->alpha_filename : 0, 0);
+			if (texture) {
+				gx3d_FreeTexture(*(gx3dTexture*)asset->handle);
+				*(gx3dTexture*)asset->handle = texture;
+				ok = true;
+			}
+			break;
+		}
+		case HOTLOAD_OBJECT: {
+			gx3dObject* object = NULL;
+			gx3d_ReadLWO2File(asset->filename, &object, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
+			if (object) {
+				MeshOpt_Optimize_Object(object);
+				if (asset->id != ATLAS_INVALID)
+					Atlas_Map_Object(asset->id, object);
+				gx3d_FreeObject(*(gx3dObject**)asset->handle);
+				*(gx3dObject**)asset->handle = object;
+				ok = true;
+			}
+			break;
+		}
+		case HOTLOAD_MANAGED:
+			TexMgr_Invalidate(asset->id);
+			ok = true;
+			break;
+		case HOTLOAD_ATLAS:
+			ok = Atlas_Build();
+			break;
+		case HOTLOAD_PARTICLES: {
+			gx3dParticleSystem psys = Script_ParticleSystem_Create(asset->filename);
+			if (psys) {
+				gx3d_FreeParticleSystem(*(gx3dParticleSystem*)asset->handle);
+				*(gx3dParticleSystem*)asset->handle = psys;
+				ok = true;
+			}
+			break;
+		}
+	}
+
+	sprintf(str, ok ? "Reloaded %s" : "Reload of %s failed, keeping the old asset", asset->filename);
+	debug_WriteFile(str);
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Watch_Thread
+|
+| Input: Started by HotLoad_Init()
+| Output: Watches the current directory tree for changes to watched
+|   files until the stop event is set.
+|___________________________________________________________________*/
+
+static DWORD WINAPI Watch_Thread(LPVOID param)
+{
+	static DWORD buffer[HOTLOAD_BUFFER_SIZE / sizeof(DWORD)];  // notifications must be DWORD aligned
+	HANDLE dir, events[2];
+	OVERLAPPED overlapped;
+	DWORD bytes, result;
+	bool pending = false;
+	char name[MAX_PATH];
+	int i, len;
+
+	dir = CreateFileA(".", FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (dir == INVALID_HANDLE_VALUE)
+		return (0);
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	events[0] = stop_event;
+	events[1] = overlapped.hEvent;
+
+	for (;;) {
+		if (NOT pending) {
+			ResetEvent(overlapped.hEvent);
+			pending = ReadDirectoryChangesW(dir, buffer, sizeof(buffer), TRUE,
+				FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE, NULL, &overlapped, NULL) ? true : false;
+			if (NOT pending)
+				break;
+		}
+
+		result = WaitForMultipleObjects(2, events, FALSE, HOTLOAD_POLL_TIME);
+		if (result == WAIT_OBJECT_0)
+			break;
+		if (result == WAIT_OBJECT_0 + 1) {
+			pending = false;
+			if (GetOverlappedResult(dir, &overlapped, &bytes, FALSE)) {
+				if (bytes == 0) {
+					// Notification buffer overflowed, assume everything changed
+					EnterCriticalSection(&lock);
+					for (i = 0; i < num_assets; i++) {
+						assets[i].changed = true;
+						assets[i].change_time = timeGetTime();
+					}
+					LeaveCriticalSection(&lock);
+				}
+				else {
+					FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*)buffer;
+					for (;;) {
+						len = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), name, MAX_PATH - 1, NULL, NULL);
+						name[len] = 0;
+						if (info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME)
+							Note_Change(name);
+						if (info->NextEntryOffset == 0)
+							break;
+						info = (FILE_NOTIFY_INFORMATION*)((char*)info + info->NextEntryOffset);
+					}
+				}
+			}
+		}
+
+		Check_Settled();
+	}
+
+	if (pending) {
+		CancelIo(dir);
+		GetOverlappedResult(dir, &overlapped, &bytes, TRUE);
+	}
+	CloseHandle(overlapped.hEvent);
+	CloseHandle(dir);
+
+	return (0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Note_Change
+|
+| Input: Called from Watch_Thread()
+| Output: Marks the assets using a changed file (relative to the
+|   current directory).
+|___________________________________________________________________*/
+
+static void Note_Change(const char* name)
+{
+	int i;
+
+	EnterCriticalSection(&lock);
+	for (i = 0; i < num_assets; i++)
+		if (Same_File(name, assets[i].filename) || (assets[i].alpha_filename[0] && Same_File(name, assets[i].alpha_filename))) {
+			assets[i].changed = true;
+			assets[i].change_time = timeGetTime();
+			stats.changes++;
+		}
+	LeaveCriticalSection(&lock);
+}
+
+/*____________________________________________________________________
+|
+| Function: Same_File
+|
+| Input: Called from Note_Change()
+| Output: Returns true if two relative filenames name the same file,
+|   ignoring case, slash direction and a leading ".\".
+|___________________________________________________________________*/
+
+static bool Same_File(const char* name1, const char* name2)
+{
+	if ((name1[0] == '.') && (name1[1] == '\\' || name1[1] == '/'))
+		name1 += 2;
+	if ((name2[0] == '.') && (name2[1] == '\\' || name2[1] == '/'))
+		name2 += 2;
+
+	for (; *name1 && *name2; name1++, name2++) {
+		char c1 = *name1 == '/' ? '\\' : (char)tolower(*name1);
+		char c2 = *name2 == '/' ? '\\' : (char)tolower(*name2);
+		if (c1 != c2)
+			return (false);
+	}
+
+	return (*name1 == *name2);
+}
+
+/*____________________________________________________________________
+|
+| Function: Check_Settled
+|
+| Input: Called from Watch_Thread()
+| Output: Flags changed assets ready once their files have settled.
+|___________________________________________________________________*/
+
+static void Check_Settled()
+{
+	int i;
+	DWORD change_time;
+	char filename[MAX_PATH], alpha_filename[MAX_PATH];
+	bool settled;
+
+	for (i = 0; i < num_assets; i++) {
+		EnterCriticalSection(&lock);
+		settled = assets[i].changed && timeGetTime() - assets[i].change_time >= HOTLOAD_SETTLE_TIME;
+		change_time = assets[i].change_time;
+		strcpy(filename, assets[i].filename);
+		strcpy(alpha_filename, assets[i].alpha_filename);
+		LeaveCriticalSection(&lock);
+		if (NOT settled)
+			continue;
+
+		// Read the files outside the lock, they may be large
+		settled = File_Is_Settled(filename) && (alpha_filename[0] == 0 || File_Is_Settled(alpha_filename));
+
+		EnterCriticalSection(&lock);
+		if (assets[i].changed && assets[i].change_time == change_time) {
+			if (settled) {
+				assets[i].changed = false;
+				assets[i].ready = true;
+			}
+			else
+				assets[i].change_time = timeGetTime();  // still being written, try again later
+		}
+		LeaveCriticalSection(&lock);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: File_Is_Settled
+|
+| Input: Called from Check_Settled()
+| Output: Returns true if a file can be opened with no writer, reading
+|   it through to bring it into the file cache.
+|___________________________________________________________________*/
+
+static bool File_Is_Settled(const char* filename)
+{
+	static char buffer[HOTLOAD_READ_SIZE];
+	HANDLE file;
+	DWORD bytes;
+
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return (false);
+	while (ReadFile(file, buffer, sizeof(buffer), &bytes, NULL) && bytes)
+		;
+	CloseHandle(file);
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: HotLoad_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns hot reload statistics.
+|___________________________________________________________________*/
+
+void HotLoad_Get_Stats(HotLoadStats* out)
+{
+	EnterCriticalSection(&lock);
+	*out = stats;
+	LeaveCriticalSection(&lock);
+}
@@ -0,0 +1,44 @@
+/*____________________________________________________________________
+|
+| File: hotload.h
+|
+| Description: Reloads textures, meshes and particle scripts when
+|   their files change on disk.
+|___________________________________________________________________*/
+
+#ifndef _HOTLOAD_H_
+#define _HOTLOAD_H_
+
+#include "texmgr.h"
+#include "atlas.h"
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	unsigned assets;         // # of assets watched
+	unsigned changes;        // file change notifications matching an asset
+	unsigned reloads;
+	unsigned failures;       // reloads that failed (old asset kept)
+	float    last_reload_time;  // ms spent on the main thread by the last reload
+} HotLoadStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int  HotLoad_Init ();
+void HotLoad_Free ();
+void HotLoad_Watch_Texture (gx3dTexture *texture, const char *filename, const char *alpha_filename);
+void HotLoad_Watch_Managed_Texture (TexId id, const char *filename, const char *alpha_filename);
+void HotLoad_Watch_Atlas (const char *filename, const char *alpha_filename);
+void HotLoad_Watch_Object (gx3dObject **object, const char *filename);
+void HotLoad_Watch_Atlas_Object (gx3dObject **object, const char *filename, AtlasId id);
+void HotLoad_Watch_Particles (gx3dParticleSystem *psys, const char *filename);
+void HotLoad_Update ();
+void HotLoad_Get_Stats (HotLoadStats *stats);
+
+#endif
@@ -0,0 +1,682 @@
+/*____________________________________________________________________
+|
+| File: lightmgr.cpp
+|
+| Description: Light manager for point lights.
+|
+|   Each frame LightMgr_Begin_Frame() transforms the enabled lights
+|   into view space and bins them into a CLUSTER_DX x CLUSTER_DY x
+|   CLUSTER_DZ grid of view space clusters (screen tiles split into
+|   exponentially spaced depth slices).  Before a draw, the caller
+|   passes the draw's bounding sphere to LightMgr_Select_For_Sphere(),
+|   which gathers the lights from the clusters the sphere touches,
+|   keeps the most relevant that fit in the driver's active light
+|   limit, and enables/disables driver lights only where the
+|   selection changed.  Light data is uploaded to the driver only when
+|   it has changed since the last upload.
+|
+|   Lights marked baked are also in the lightmap, so draws lit by it
+|   (LightMgr_Select_Dynamic_For_Sphere()) skip them.
+|
+| Functions:  LightMgr_Init
+|             LightMgr_Free
+|             LightMgr_Add_Point_Light
+|             LightMgr_Remove_Light
+|             LightMgr_Move_Light
+|             LightMgr_Set_Light_Data
+|             LightMgr_Enable_Light
+|             LightMgr_Set_Baked
+|             LightMgr_Reserve_Lights
+|             LightMgr_Set_Projection
+|             LightMgr_Begin_Frame
+|							 Transform_Point
+|							 Get_Cluster_Range
+|							 Get_Depth_Slice
+|             LightMgr_Select_For_Sphere
+|             LightMgr_Select_Dynamic_For_Sphere
+|							 Select_Lights
+|							 Score_Light
+|							 Apply_Selection
+|             LightMgr_Select_None
+|             LightMgr_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "lightmgr.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define MAX_MANAGED_LIGHTS  1024
+#define MAX_SELECTED_LIGHTS 8     // most lights enabled for one draw, regardless of driver limit
+
+#define CLUSTER_DX 16
+#define CLUSTER_DY 8
+#define CLUSTER_DZ 16
+#define NUM_CLUSTERS (CLUSTER_DX * CLUSTER_DY * CLUSTER_DZ)
+#define MAX_CLUSTER_REFS (MAX_MANAGED_LIGHTS * 32)
+
+#define DEG_TO_RAD(_deg_) ((_deg_) * 3.14159265f / 180)
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	gx3dLight     light;
+	gx3dLightData data;
+	bool          in_use;
+	bool          enabled;   // on, as set by the caller
+	bool          dirty;     // data changed since last upload
+	bool          active;    // currently enabled in the driver
+	bool          baked;     // in the lightmap
+	unsigned      stamp;     // selection this light was last considered for
+	gx3dVector    view_src;  // position in view space this frame
+} ManagedLight;
+
+typedef struct {
+	int x0, x1, y0, y1, z0, z1;
+} ClusterRange;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Transform_Point(gx3dVector* v, gx3dMatrix* m, gx3dVector* result);
+static bool Get_Cluster_Range(gx3dVector* center, float radius, ClusterRange* range);
+static int Get_Depth_Slice(float z);
+static void Select_Lights(gx3dSphere* bounds, bool dynamic_only);
+static float Score_Light(ManagedLight* light, gx3dSphere* bounds);
+static void Apply_Selection(LightId* selected, int num_selected);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static ManagedLight lights[MAX_MANAGED_LIGHTS];
+static int num_slots;      // high water mark of lights[]
+static LightId free_ids[MAX_MANAGED_LIGHTS];
+static int num_free;
+
+static int max_driver_lights;  // driver active light limit
+static int reserved_lights;    // slots used by lights outside the manager
+
+// Projection
+static float tan_half_fov_x, tan_half_fov_y, z_near, z_far, log_depth_scale;
+static gx3dMatrix view_matrix;
+
+// Cluster grid (light ids of cluster c are cluster_lights[cluster_start[c]..cluster_start[c+1]-1])
+static int cluster_start[NUM_CLUSTERS + 1];
+static LightId cluster_lights[MAX_CLUSTER_REFS];
+static ClusterRange light_range[MAX_MANAGED_LIGHTS];
+static bool light_visible[MAX_MANAGED_LIGHTS];
+
+// Lights currently enabled in the driver
+static LightId active_ids[MAX_SELECTED_LIGHTS];
+static int num_active;
+
+static unsigned selection_stamp;
+static LightMgrStats stats;
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Init
+|
+| Input: Called from Program_Run()
+| Output: Initializes the light manager.  max_active_lights is the
+|   driver limit (gx3dDriverInfo max_active_lights).
+|___________________________________________________________________*/
+
+void LightMgr_Init(int max_active_lights)
+{
+	num_slots = 0;
+	num_free = 0;
+	num_active = 0;
+	reserved_lights = 0;
+	selection_stamp = 0;
+	max_driver_lights = max_active_lights;
+	memset(&stats, 0, sizeof(stats));
+
+	LightMgr_Set_Projection(60, 4.0f / 3, 0.1f, 1000);
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Free
+|
+| Input: Called from Program_Run()
+| Output: Frees all managed lights.
+|___________________________________________________________________*/
+
+void LightMgr_Free()
+{
+	int i;
+
+	for (i = 0; i < num_slots; i++)
+		if (lights[i].in_use)
+			LightMgr_Remove_Light(i);
+	num_slots = 0;
+	num_free = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Add_Point_Light
+|
+| Input: Called from Program_Run()
+| Output: Adds an enabled point light.  Returns its id or
+|   LIGHTMGR_INVALID_ID if there is no room.
+|___________________________________________________________________*/
+
+LightId LightMgr_Add_Point_Light(gx3dLightData* data)
+{
+	LightId id;
+	ManagedLight* ml;
+
+	if (num_free)
+		id = free_ids[--num_free];
+	else if (num_slots < MAX_MANAGED_LIGHTS)
+		id = num_slots++;
+	else
+		return (LIGHTMGR_INVALID_ID);
+
+	ml = &lights[id];
+	ml->data = *data;
+	ml->light = gx3d_InitLight(&ml->data);
+	ml->in_use = true;
+	ml->enabled = true;
+	ml->dirty = false;
+	ml->active = false;
+	ml->baked = false;
+	ml->stamp = 0;
+	light_visible[id] = false;
+	stats.lights++;
+
+	return (id);
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Remove_Light
+|
+| Input: Called from Program_Run()
+| Output: Removes a light.
+|___________________________________________________________________*/
+
+void LightMgr_Remove_Light(LightId id)
+{
+	int i;
+	ManagedLight* ml = &lights[id];
+
+	if (ml->active) {
+		gx3d_DisableLight(ml->light);
+		for (i = 0; i < num_active; i++)
+			if (active_ids[i] == id) {
+				active_ids[i] = active_ids[--num_active];
+				break;
+			}
+	}
+	gx3d_FreeLight(ml->light);
+	ml->in_use = false;
+	ml->active = false;
+	light_visible[id] = false;
+	free_ids[num_free++] = id;
+	stats.lights--;
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Move_Light
+|
+| Input: Called from Program_Run()
+| Output: Sets the position of a point light.  The light is only
+|   uploaded again if its position actually changed.
+|___________________________________________________________________*/
+
+void LightMgr_Move_Light(LightId id, gx3dVector* src)
+{
+	ManagedLight* ml = &lights[id];
+
+	if (ml->data.point.src.x != src->x || ml->data.point.src.y != src->y || ml->data.point.src.z != src->z) {
+		ml->data.point.src = *src;
+		ml->dirty = true;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Set_Light_Data
+|
+| Input: Called from Program_Run()
+| Output: Replaces all data of a light.
+|___________________________________________________________________*/
+
+void LightMgr_Set_Light_Data(LightId id, gx3dLightData* data)
+{
+	lights[id].data = *data;
+	lights[id].dirty = true;
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Enable_Light
+|
+| Input: Called from Program_Run()
+| Output: Turns a light on or off.  A light turned off is never
+|   selected.
+|___________________________________________________________________*/
+
+void LightMgr_Enable_Light(LightId id, int enable)
+{
+	lights[id].enabled = (enable != 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Set_Baked
+|
+| Input: Called from Light_World()
+| Output: Marks a light as baked into the lightmap, or not.
+|___________________________________________________________________*/
+
+void LightMgr_Set_Baked(LightId id, int baked)
+{
+	lights[id].baked = (baked != 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Reserve_Lights
+|
+| Input: Called from Program_Run()
+| Output: Sets how many driver lights are in use outside the manager
+|   (directional lights, etc.) so they aren't selected over.
+|___________________________________________________________________*/
+
+void LightMgr_Reserve_Lights(int num_lights)
+{
+	reserved_lights = num_lights;
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Set_Projection
+|
+| Input: Called from Program_Run() with the values given to
+|   gx3d_SetProjectionMatrix() and the screen aspect ratio.
+| Output: Sets up the cluster grid for the projection.
+|___________________________________________________________________*/
+
+void LightMgr_Set_Projection(float fov, float aspect, float near_plane, float far_plane)
+{
+	tan_half_fov_y = tanf(DEG_TO_RAD(fov) / 2);
+	tan_half_fov_x = tan_half_fov_y * aspect;
+	z_near = near_plane;
+	z_far = far_plane;
+	log_depth_scale = CLUSTER_DZ / logf(far_plane / near_plane);
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Begin_Frame
+|
+| Input: Called from Program_Run() after the view matrix is set for
+|   the frame.
+| Output: Assigns all enabled lights to the cluster grid.
+|___________________________________________________________________*/
+
+void LightMgr_Begin_Frame()
+{
+	int i, x, y, z, c, num_refs;
+
+	gx3d_GetViewMatrix(&view_matrix);
+
+	// Turn off any driver lights the caller switched off
+	for (i = 0; i < num_active; )
+		if (NOT lights[active_ids[i]].enabled) {
+			gx3d_DisableLight(lights[active_ids[i]].light);
+			lights[active_ids[i]].active = false;
+			active_ids[i] = active_ids[--num_active];
+			stats.enable_changes++;
+		}
+		else
+			i++;
+
+	/*____________________________________________________________________
+	|
+	| Count the lights in each cluster
+	|___________________________________________________________________*/
+
+	memset(cluster_start, 0, sizeof(cluster_start));
+	stats.visible_lights = 0;
+	num_refs = 0;
+	for (i = 0; i < num_slots; i++) {
+		ManagedLight* ml = &lights[i];
+		light_visible[i] = false;
+		if (NOT ml->in_use || NOT ml->enabled)
+			continue;
+		Transform_Point(&ml->data.point.src, &view_matrix, &ml->view_src);
+		if (NOT Get_Cluster_Range(&ml->view_src, ml->data.point.range, &light_range[i]))
+			continue;
+		ClusterRange* r = &light_range[i];
+		int refs = (r->x1 - r->x0 + 1) * (r->y1 - r->y0 + 1) * (r->z1 - r->z0 + 1);
+		if (num_refs + refs > MAX_CLUSTER_REFS)
+			continue;
+		num_refs += refs;
+		light_visible[i] = true;
+		stats.visible_lights++;
+		for (z = r->z0; z <= r->z1; z++)
+			for (y = r->y0; y <= r->y1; y++)
+				for (x = r->x0; x <= r->x1; x++)
+					cluster_start[(z * CLUSTER_DY + y) * CLUSTER_DX + x + 1]++;
+	}
+
+	/*____________________________________________________________________
+	|
+	| Turn the counts into start offsets, then fill in the light ids
+	|___________________________________________________________________*/
+
+	for (c = 0; c < NUM_CLUSTERS; c++)
+		cluster_start[c + 1] += cluster_start[c];
+
+	static int cluster_fill[NUM_CLUSTERS];
+	memcpy(cluster_fill, cluster_start, sizeof(cluster_fill));
+	for (i = 0; i < num_slots; i++) {
+		if (NOT light_visible[i])
+			continue;
+		ClusterRange* r = &light_range[i];
+		for (z = r->z0; z <= r->z1; z++)
+			for (y = r->y0; y <= r->y1; y++)
+				for (x = r->x0; x <= r->x1; x++)
+					cluster_lights[cluster_fill[(z * CLUSTER_DY + y) * CLUSTER_DX + x]++] = i;
+	}
+
+	stats.cluster_refs = num_refs;
+	stats.frames++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Transform_Point
+|
+| Input: Called from LightMgr_Begin_Frame(), LightMgr_Select_For_Sphere()
+| Output: Transforms a point by a matrix.
+|___________________________________________________________________*/
+
+static void Transform_Point(gx3dVector* v, gx3dMatrix* m, gx3dVector* result)
+{
+	result->x = v->x * m->_00 + v->y * m->_10 + v->z * m->_20 + m->_30;
+	result->y = v->x * m->_01 + v->y * m->_11 + v->z * m->_21 + m->_31;
+	result->z = v->x * m->_02 + v->y * m->_12 + v->z * m->_22 + m->_32;
+}
+
+/*____________________________________________________________________
+|
+| Function: Get_Cluster_Range
+|
+| Input: Called from LightMgr_Begin_Frame(), LightMgr_Select_For_Sphere()
+| Output: Computes the range of clusters a view space sphere may touch.
+|   Returns false if the sphere is outside the depth range.  Spheres
+|   off the sides of the screen are clamped to the edge tiles, so the
+|   range is always conservative.
+|___________________________________________________________________*/
+
+static bool Get_Cluster_Range(gx3dVector* center, float radius, ClusterRange* range)
+{
+	float z0, z1, x0, x1, y0, y1, nx0, nx1, ny0, ny1;
+
+	z0 = center->z - radius;
+	z1 = center->z + radius;
+	if (z1 < z_near || z0 > z_far)
+		return (false);
+	if (z0 < z_near)
+		z0 = z_near;
+	if (z1 > z_far)
+		z1 = z_far;
+
+	// Project the box edges at both depths and keep the widest
+	x0 = center->x - radius;
+	x1 = center->x + radius;
+	y0 = center->y - radius;
+	y1 = center->y + radius;
+	nx0 = fminf(x0 / z0, x0 / z1) / tan_half_fov_x;
+	nx1 = fmaxf(x1 / z0, x1 / z1) / tan_half_fov_x;
+	ny0 = fminf(y0 / z0, y0 / z1) / tan_half_fov_y;
+	ny1 = fmaxf(y1 / z0, y1 / z1) / tan_half_fov_y;
+
+	// NDC (-1 to 1) to tiles, y tiles start at the top
+	range->x0 = (int)floorf((nx0 + 1) / 2 * CLUSTER_DX);
+	range->x1 = (int)floorf((nx1 + 1) / 2 * CLUSTER_DX);
+	range->y0 = (int)floorf((1 - ny1) / 2 * CLUSTER_DY);
+	range->y1 = (int)floorf((1 - ny0) / 2 * CLUSTER_DY);
+	range->x0 = range->x0 < 0 ? 0 : (range->x0 >= CLUSTER_DX ? CLUSTER_DX - 1 : range->x0);
+	range->x1 = range->x1 < 0 ? 0 : (range->x1 >= CLUSTER_DX ? CLUSTER_DX - 1 : range->x1);
+	range->y0 = range->y0 < 0 ? 0 : (range->y0 >= CLUSTER_DY ? CLUSTER_DY - 1 : range->y0);
+	range->y1 = range->y1 < 0 ? 0 : (range->y1 >= CLUSTER_DY ? CLUSTER_DY - 1 : range->y1);
+	range->z0 = Get_Depth_Slice(z0);
+	range->z1 = Get_Depth_Slice(z1);
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: Get_Depth_Slice
+|
+| Input: Called from Get_Cluster_Range()
+| Output: Returns the exponential depth slice containing view space z.
+|___________________________________________________________________*/
+
+static int Get_Depth_Slice(float z)
+{
+	int slice = (int)(logf(z / z_near) * log_depth_scale);
+
+	if (slice < 0)
+		slice = 0;
+	else if (slice >= CLUSTER_DZ)
+		slice = CLUSTER_DZ - 1;
+	return (slice);
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Select_For_Sphere
+|
+| Input: Called from Program_Run() before drawing something bounded by
+|   a world space sphere.
+| Output: Enables the most relevant lights for the draw.
+|___________________________________________________________________*/
+
+void LightMgr_Select_For_Sphere(gx3dSphere* bounds)
+{
+	Select_Lights(bounds, false);
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Select_Dynamic_For_Sphere
+|
+| Input: Called from RenderQ_Submit() before drawing something lit by
+|   the lightmap.
+| Output: Enables the most relevant lights for the draw that aren't
+|   baked.
+|___________________________________________________________________*/
+
+void LightMgr_Select_Dynamic_For_Sphere(gx3dSphere* bounds)
+{
+	Select_Lights(bounds, true);
+}
+
+/*____________________________________________________________________
+|
+| Function: Select_Lights
+|
+| Input: Called from LightMgr_Select_For_Sphere(),
+|   LightMgr_Select_Dynamic_For_Sphere()
+| Output: Enables the most relevant lights for a sphere, leaving out
+|   baked lights if dynamic_only.
+|___________________________________________________________________*/
+
+static void Select_Lights(gx3dSphere* bounds, bool dynamic_only)
+{
+	int x, y, z, c, i, j, max_select, num_selected;
+	gx3dVector view_center;
+	ClusterRange range;
+	LightId selected[MAX_SELECTED_LIGHTS];
+	float selected_score[MAX_SELECTED_LIGHTS], score;
+
+	max_select = max_driver_lights - reserved_lights;
+	if (max_select > MAX_SELECTED_LIGHTS)
+		max_select = MAX_SELECTED_LIGHTS;
+
+	num_selected = 0;
+	selection_stamp++;
+	Transform_Point(&bounds->center, &view_matrix, &view_center);
+
+	if (max_select > 0 && Get_Cluster_Range(&view_center, bounds->radius, &range)) {
+		for (z = range.z0; z <= range.z1; z++)
+			for (y = range.y0; y <= range.y1; y++)
+				for (x = range.x0; x <= range.x1; x++) {
+					c = (z * CLUSTER_DY + y) * CLUSTER_DX + x;
+					for (i = cluster_start[c]; i < cluster_start[c + 1]; i++) {
+						ManagedLight* ml = &lights[cluster_lights[i]];
+						if (ml->stamp == selection_stamp)
+							continue;
+						ml->stamp = selection_stamp;
+						if (dynamic_only && ml->baked)
+							continue;
+						score = Score_Light(ml, bounds);
+						if (score <= 0)
+							continue;
+						// Insert into the list of best lights, sorted by score
+						if (num_selected == max_select && score <= selected_score[num_selected - 1])
+							continue;
+						if (num_selected < max_select)
+							num_selected++;
+						for (j = num_selected - 1; j > 0 && selected_score[j - 1] < score; j--) {
+							selected[j] = selected[j - 1];
+							selected_score[j] = selected_score[j - 1];
+						}
+						selected[j] = cluster_lights[i];
+						selected_score[j] = score;
+					}
+				}
+	}
+
+	Apply_Selection(selected, num_selected);
+}
+
+/*____________________________________________________________________
+|
+| Function: Score_Light
+|
+| Input: Called from Select_Lights()
+| Output: Returns how much a light contributes to a sphere (0 = out of
+|   range).
+|___________________________________________________________________*/
+
+static float Score_Light(ManagedLight* light, gx3dSphere* bounds)
+{
+	gx3dPointLight* p = &light->data.point;
+	float dx, dy, dz, d, brightness;
+
+	dx = p->src.x - bounds->center.x;
+	dy = p->src.y - bounds->center.y;
+	dz = p->src.z - bounds->center.z;
+	d = sqrtf(dx * dx + dy * dy + dz * dz) - bounds->radius;
+	if (d < 0)
+		d = 0;
+	if (d > p->range)
+		return (0);
+
+	brightness = fmaxf(p->diffuse_color.r, fmaxf(p->diffuse_color.g, p->diffuse_color.b));
+	return (brightness / (1 + p->constant_attenuation + p->linear_attenuation * d + p->quadratic_attenuation * d * d));
+}
+
+/*____________________________________________________________________
+|
+| Function: Apply_Selection
+|
+| Input: Called from Select_Lights(), LightMgr_Select_None()
+| Output: Makes the driver's enabled lights match the selection,
+|   uploading light data only for lights that changed.
+|___________________________________________________________________*/
+
+static void Apply_Selection(LightId* selected, int num_selected)
+{
+	int i;
+	unsigned stamp;
+
+	stamp = ++selection_stamp;
+	for (i = 0; i < num_selected; i++)
+		lights[selected[i]].stamp = stamp;
+
+	// Disable lights no longer selected
+	for (i = 0; i < num_active; )
+		if (lights[active_ids[i]].stamp != stamp) {
+			gx3d_DisableLight(lights[active_ids[i]].light);
+			lights[active_ids[i]].active = false;
+			active_ids[i] = active_ids[--num_active];
+			stats.enable_changes++;
+		}
+		else
+			i++;
+
+	// Upload changed lights and enable new ones
+	for (i = 0; i < num_selected; i++) {
+		ManagedLight* ml = &lights[selected[i]];
+		if (ml->dirty) {
+			gx3d_UpdateLight(ml->light, &ml->data);
+			ml->dirty = false;
+			stats.uploads++;
+		}
+		if (NOT ml->active) {
+			gx3d_EnableLight(ml->light);
+			ml->active = true;
+			active_ids[num_active++] = selected[i];
+			stats.enable_changes++;
+		}
+	}
+
+	stats.selections++;
+	if ((unsigned)num_selected > stats.max_lights_per_draw)
+		stats.max_lights_per_draw = num_selected;
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Select_None
+|
+| Input: Called from Program_Run() before drawing something unlit.
+| Output: Disables all managed lights.
+|___________________________________________________________________*/
+
+void LightMgr_Select_None()
+{
+	Apply_Selection(NULL, 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: LightMgr_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns light manager statistics.
+|___________________________________________________________________*/
+
+void LightMgr_Get_Stats(LightMgrStats* s)
+{
+	*s = stats;
+}
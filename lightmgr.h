@@ -0,0 +1,59 @@
+/*____________________________________________________________________
+|
+| File: lightmgr.h
+|
+| Description: Light manager - holds any number of point lights,
+|   assigns them to a view space cluster grid each frame and enables
+|   the most relevant few for each draw.
+|___________________________________________________________________*/
+
+#ifndef _LIGHTMGR_H_
+#define _LIGHTMGR_H_
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef int LightId;
+
+typedef struct {
+	unsigned frames;
+	unsigned lights;              // # of managed lights
+	unsigned visible_lights;      // # assigned to at least one cluster last frame
+	unsigned cluster_refs;        // # of light references in the cluster grid last frame
+	unsigned uploads;             // total light uploads to the driver
+	unsigned enable_changes;      // total enable/disable calls
+	unsigned selections;          // total per-draw selections
+	unsigned max_lights_per_draw; // most lights enabled for any one draw
+} LightMgrStats;
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define LIGHTMGR_INVALID_ID (-1)
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+void    LightMgr_Init (int max_active_lights);
+void    LightMgr_Free ();
+LightId LightMgr_Add_Point_Light (gx3dLightData *data);
+void    LightMgr_Remove_Light (LightId id);
+void    LightMgr_Move_Light (LightId id, gx3dVector *src);
+void    LightMgr_Set_Light_Data (LightId id, gx3dLightData *data);
+void    LightMgr_Enable_Light (LightId id, int enable);
+void    LightMgr_Set_Baked (LightId id, int baked);
+void    LightMgr_Reserve_Lights (int num_lights);
+void    LightMgr_Set_Projection (float fov, float aspect, float near_plane, float far_plane);
+void    LightMgr_Begin_Frame ();
+void    LightMgr_Select_For_Sphere (gx3dSphere *bounds);
+void    LightMgr_Select_Dynamic_For_Sphere (gx3dSphere *bounds);
+void    LightMgr_Select_None ();
+void    LightMgr_Get_Stats (LightMgrStats *stats);
+
+#endif
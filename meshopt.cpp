@@ -0,0 +1,751 @@
+/*____________________________________________________________________
+|
+| File: meshopt.cpp
+|
+| Description: Mesh optimisation - vertex welding, triangle ordering
+|   for the post-transform vertex cache and for overdraw, and quantised
+|   vertex formats.
+|
+|   Welding merges vertices with identical position, normal and texture
+|   coordinates.  Triangles are put in vertex cache order with Tom
+|   Forsyth's linear-speed algorithm, which greedily emits the
+|   triangle whose vertices score highest: recently used and with few
+|   triangles left.  The overdraw pass then cuts that order into
+|   clusters where the cache restarts (a triangle with no vertex in the
+|   cache), so moving clusters costs little cache efficiency, and draws
+|   the clusters facing out from the mesh's center first, as they tend
+|   to hide the rest (Sander, Nehab and Barczak, "Fast triangle
+|   reordering for vertex locality and reduced overdraw").
+|
+|   Cache efficiency is reported as ACMR, the average cache miss ratio:
+|   vertices transformed per triangle, with a MESHOPT_CACHE_SIZE entry
+|   FIFO cache.  It ranges from 3 down to about 0.5 for a regular grid.
+|
+|   The toolkit loads models in its own float vertex format, so loaded
+|   objects only have their triangles reordered (MeshOpt_Optimize_Object).
+|   MeshOpt_Report_Models() runs every stage on copies of the models
+|   and reports what welding and quantisation would save.
+|
+| Functions:  MeshOpt_Weld
+|             MeshOpt_Optimize_Vertex_Cache
+|							 Vertex_Score
+|             MeshOpt_Optimize_Overdraw
+|							 Compare_Clusters
+|             MeshOpt_ACMR
+|             MeshOpt_Quantize
+|             MeshOpt_Dequantize
+|             MeshOpt_Optimize_Object
+|             MeshOpt_Report_Models
+|							 Report_Layer
+|             MeshOpt_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "meshopt.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define MESHOPT_CACHE_SIZE        16    // FIFO entries, for ACMR
+#define MESHOPT_SCORE_CACHE_SIZE  32    // LRU entries modelled when ordering
+#define MESHOPT_LAST_TRI_SCORE    0.75f
+#define MESHOPT_CACHE_DECAY       1.5f
+#define MESHOPT_VALENCE_SCALE     2.0f
+#define MESHOPT_VALENCE_POWER     0.5f
+
+// Bytes per vertex and index as loaded by the toolkit
+#define MESHOPT_FLOAT_VERTEX_SIZE  (2 * sizeof(gx3dVector) + sizeof(gx3dUV))
+#define MESHOPT_INDEX_SIZE         2
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	float    key;     // how far the cluster faces out from the mesh's center
+	unsigned first;   // triangle
+	unsigned count;
+} Cluster;
+
+typedef struct {
+	unsigned vertices, welded_vertices, triangles;
+	float    acmr_before, acmr_after;
+	unsigned bytes_before, bytes_after;
+	float    position_error, normal_error, uv_error;
+} Report;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static float Vertex_Score(int cache_position, unsigned remaining);
+static int Compare_Clusters(const void* c1, const void* c2);
+static bool Report_Layer(gx3dObjectLayer* layer, Report* report);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static MeshOptStats stats;
+static double       misses_before, misses_after;  // totals for the stats' ACMR
+
+/*____________________________________________________________________
+|
+| Function: MeshOpt_Weld
+|
+| Input: Called from Report_Layer()
+| Output: Merges identical vertices (normal and uv may be NULL),
+|   compacting the arrays and renumbering the triangles.  Returns the
+|   new # of vertices.
+|___________________________________________________________________*/
+
+unsigned MeshOpt_Weld(gx3dVector* vertex, gx3dVector* normal, gx3dUV* uv, unsigned num_vertices, gx3dPolygon* polygon, unsigned num_polygons)
+{
+	unsigned i, j, k, h, size, unique;
+	unsigned *table, *remap;
+
+	for (size = 1; size < num_vertices * 2; size *= 2)
+		;
+	table = (unsigned*)malloc(size * sizeof(unsigned));
+	remap = (unsigned*)malloc(num_vertices * sizeof(unsigned));
+	if (table == NULL || remap == NULL) {
+		free(table);
+		free(remap);
+		return (num_vertices);
+	}
+	memset(table, 0xFF, size * sizeof(unsigned));
+
+	// Hash the bits of each vertex, keeping the first of each kind
+	unique = 0;
+	for (i = 0; i < num_vertices; i++) {
+		h = 2166136261u;
+		for (k = 0; k < sizeof(gx3dVector); k++)
+			h = (h ^ ((unsigned char*)&vertex[i])[k]) * 16777619u;
+		if (normal)
+			for (k = 0; k < sizeof(gx3dVector); k++)
+				h = (h ^ ((unsigned char*)&normal[i])[k]) * 16777619u;
+		if (uv)
+			for (k = 0; k < sizeof(gx3dUV); k++)
+				h = (h ^ ((unsigned char*)&uv[i])[k]) * 16777619u;
+		for (h &= size - 1; table[h] != 0xFFFFFFFF; h = (h + 1) & (size - 1)) {
+			j = table[h];
+			if (memcmp(&vertex[j], &vertex[i], sizeof(gx3dVector)) == 0 &&
+			    (normal == NULL || memcmp(&normal[j], &normal[i], sizeof(gx3dVector)) == 0) &&
+			    (uv == NULL || memcmp(&uv[j], &uv[i], sizeof(gx3dUV)) == 0))
+				break;
+		}
+		if (table[h] != 0xFFFFFFFF)
+			remap[i] = remap[table[h]];
+		else {
+			table[h] = i;
+			remap[i] = unique;
+			vertex[unique] = vertex[i];
+			if (normal)
+				normal[unique] = normal[i];
+			if (uv)
+				uv[unique] = uv[i];
+			unique++;
+		}
+	}
+
+	for (i = 0; i < num_polygons; i++)
+		for (k = 0; k < 3; k++)
+			polygon[i].index[k] = remap[polygon[i].index[k]];
+
+	free(table);
+	free(remap);
+
+	return (unique);
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshOpt_Optimize_Vertex_Cache
+|
+| Input: Called from Build_Indices(), MeshOpt_Optimize_Object(),
+|   Report_Layer()
+| Output: Reorders triangles for the post-transform vertex cache.
+|   Returns false (leaving the order) if out of memory.
+|___________________________________________________________________*/
+
+int MeshOpt_Optimize_Vertex_Cache(gx3dPolygon* polygon, unsigned num_polygons, unsigned num_vertices)
+{
+	unsigned i, j, k, v, t, n, cache_count, new_count;
+	int best;
+	float score, best_score;
+	unsigned *offset, *remaining, *adjacent;
+	int* cache_position;
+	float *vertex_score, *triangle_score;
+	bool* emitted;
+	gx3dPolygon* order;
+	unsigned cache[MESHOPT_SCORE_CACHE_SIZE + 3], new_cache[MESHOPT_SCORE_CACHE_SIZE + 3];
+
+	if (num_polygons == 0)
+		return (TRUE);
+	offset = (unsigned*)calloc(num_vertices + 1, sizeof(unsigned));
+	remaining = (unsigned*)calloc(num_vertices, sizeof(unsigned));
+	adjacent = (unsigned*)malloc(num_polygons * 3 * sizeof(unsigned));
+	cache_position = (int*)malloc(num_vertices * sizeof(int));
+	vertex_score = (float*)malloc(num_vertices * sizeof(float));
+	triangle_score = (float*)malloc(num_polygons * sizeof(float));
+	emitted = (bool*)calloc(num_polygons, sizeof(bool));
+	order = (gx3dPolygon*)malloc(num_polygons * sizeof(gx3dPolygon));
+	if (offset == NULL || remaining == NULL || adjacent == NULL || cache_position == NULL || vertex_score == NULL ||
+	    triangle_score == NULL || emitted == NULL || order == NULL) {
+		free(offset); free(remaining); free(adjacent); free(cache_position);
+		free(vertex_score); free(triangle_score); free(emitted); free(order);
+		return (FALSE);
+	}
+
+	// Triangles using each vertex
+	for (t = 0; t < num_polygons; t++)
+		for (k = 0; k < 3; k++)
+			remaining[polygon[t].index[k]]++;
+	for (v = 0; v < num_vertices; v++)
+		offset[v + 1] = offset[v] + remaining[v];
+	for (v = 0; v < num_vertices; v++)
+		remaining[v] = 0;
+	for (t = 0; t < num_polygons; t++)
+		for (k = 0; k < 3; k++) {
+			v = polygon[t].index[k];
+			adjacent[offset[v] + remaining[v]++] = t;
+		}
+
+	for (v = 0; v < num_vertices; v++) {
+		cache_position[v] = -1;
+		vertex_score[v] = Vertex_Score(-1, remaining[v]);
+	}
+	best = 0;
+	for (t = 0; t < num_polygons; t++) {
+		triangle_score[t] = vertex_score[polygon[t].index[0]] + vertex_score[polygon[t].index[1]] + vertex_score[polygon[t].index[2]];
+		if (triangle_score[t] > triangle_score[best])
+			best = t;
+	}
+
+	cache_count = 0;
+	for (i = 0; i < num_polygons; i++) {
+		// Nothing in the cache left to draw, take the best triangle anywhere
+		if (best < 0) {
+			best_score = -1;
+			for (t = 0; t < num_polygons; t++)
+				if (NOT emitted[t] && triangle_score[t] > best_score) {
+					best = t;
+					best_score = triangle_score[t];
+				}
+		}
+		order[i] = polygon[best];
+		emitted[best] = true;
+
+		// Drop it from its vertices' lists and put them at the front of the cache
+		new_count = 0;
+		for (k = 0; k < 3; k++) {
+			v = polygon[best].index[k];
+			for (j = offset[v]; adjacent[j] != (unsigned)best; j++)
+				;
+			adjacent[j] = adjacent[offset[v] + --remaining[v]];
+			new_cache[new_count++] = v;
+		}
+		for (j = 0; j < cache_count; j++)
+			if (cache[j] != new_cache[0] && cache[j] != new_cache[1] && cache[j] != new_cache[2])
+				new_cache[new_count++] = cache[j];
+
+		// Rescore the cached vertices (and any just pushed out) and their triangles
+		for (j = 0; j < new_count; j++) {
+			v = new_cache[j];
+			cache_position[v] = j < MESHOPT_SCORE_CACHE_SIZE ? (int)j : -1;
+			vertex_score[v] = Vertex_Score(cache_position[v], remaining[v]);
+		}
+		best = -1;
+		best_score = -1;
+		for (j = 0; j < new_count; j++) {
+			v = new_cache[j];
+			for (n = offset[v]; n < offset[v] + remaining[v]; n++) {
+				t = adjacent[n];
+				score = vertex_score[polygon[t].index[0]] + vertex_score[polygon[t].index[1]] + vertex_score[polygon[t].index[2]];
+				triangle_score[t] = score;
+				if (score > best_score) {
+					best = t;
+					best_score = score;
+				}
+			}
+		}
+		cache_count = new_count < MESHOPT_SCORE_CACHE_SIZE ? new_count : MESHOPT_SCORE_CACHE_SIZE;
+		memcpy(cache, new_cache, cache_count * sizeof(unsigned));
+	}
+
+	memcpy(polygon, order, num_polygons * sizeof(gx3dPolygon));
+	free(offset); free(remaining); free(adjacent); free(cache_position);
+	free(vertex_score); free(triangle_score); free(emitted); free(order);
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Vertex_Score
+|
+| Input: Called from MeshOpt_Optimize_Vertex_Cache()
+| Output: Returns how much drawing a triangle using a vertex is worth:
+|   more the more recently it was used, and the fewer triangles it has
+|   left, so lone vertices don't get stranded.
+|___________________________________________________________________*/
+
+static float Vertex_Score(int cache_position, unsigned remaining)
+{
+	float score;
+
+	if (remaining == 0)
+		return (-1);
+
+	score = 0;
+	if (cache_position >= 0) {
+		if (cache_position < 3)
+			score = MESHOPT_LAST_TRI_SCORE;  // same whichever of the last triangle's vertices
+		else
+			score = powf(1 - (float)(cache_position - 3) / (MESHOPT_SCORE_CACHE_SIZE - 3), MESHOPT_CACHE_DECAY);
+	}
+
+	return (score + MESHOPT_VALENCE_SCALE * powf((float)remaining, -MESHOPT_VALENCE_POWER));
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshOpt_Optimize_Overdraw
+|
+| Input: Called from MeshOpt_Optimize_Object(), Report_Layer()
+| Output: Reorders clusters of a vertex cache ordered triangle list so
+|   those facing out from the mesh's center come first.  Triangles are
+|   clockwise.  Returns false (leaving the order) if out of memory.
+|___________________________________________________________________*/
+
+int MeshOpt_Optimize_Overdraw(gx3dPolygon* polygon, unsigned num_polygons, gx3dVector* vertex, unsigned num_vertices)
+{
+	unsigned i, k, v, misses, num_clusters;
+	int* stamp;
+	float area, total_area;
+	gx3dVector center, *c, *n, e1, e2, cross;
+	gx3dVector* centroid, * normal;
+	Cluster* clusters;
+	gx3dPolygon* order;
+
+	if (num_polygons == 0)
+		return (TRUE);
+	stamp = (int*)malloc(num_vertices * sizeof(int));
+	clusters = (Cluster*)malloc(num_polygons * sizeof(Cluster));
+	centroid = (gx3dVector*)calloc(num_polygons, sizeof(gx3dVector));
+	normal = (gx3dVector*)calloc(num_polygons, sizeof(gx3dVector));
+	order = (gx3dPolygon*)malloc(num_polygons * sizeof(gx3dPolygon));
+	if (stamp == NULL || clusters == NULL || centroid == NULL || normal == NULL || order == NULL) {
+		free(stamp); free(clusters); free(centroid); free(normal); free(order);
+		return (FALSE);
+	}
+
+	// Cut where the cache restarts
+	for (v = 0; v < num_vertices; v++)
+		stamp[v] = -MESHOPT_CACHE_SIZE - 1;
+	misses = 0;
+	num_clusters = 0;
+	for (i = 0; i < num_polygons; i++) {
+		int new_vertices = 0;
+		for (k = 0; k < 3; k++) {
+			v = polygon[i].index[k];
+			if ((int)misses - stamp[v] > MESHOPT_CACHE_SIZE) {
+				stamp[v] = misses++;
+				new_vertices++;
+			}
+		}
+		if (i == 0 || new_vertices == 3) {
+			clusters[num_clusters].first = i;
+			clusters[num_clusters].count = 0;
+			num_clusters++;
+		}
+		clusters[num_clusters - 1].count++;
+	}
+
+	// Area weighted center and normal of each cluster, and of the mesh
+	center.x = center.y = center.z = 0;
+	total_area = 0;
+	for (i = 0; i < num_clusters; i++) {
+		c = &centroid[i];
+		n = &normal[i];
+		area = 0;
+		for (k = clusters[i].first; k < clusters[i].first + clusters[i].count; k++) {
+			gx3dVector* a = &vertex[polygon[k].index[0]], * b = &vertex[polygon[k].index[1]], * d = &vertex[polygon[k].index[2]];
+			gx3d_SubtractVector(b, a, &e1);
+			gx3d_SubtractVector(d, a, &e2);
+			cross.x = e1.y * e2.z - e1.z * e2.y;
+			cross.y = e1.z * e2.x - e1.x * e2.z;
+			cross.z = e1.x * e2.y - e1.y * e2.x;
+			float w = sqrtf(cross.x * cross.x + cross.y * cross.y + cross.z * cross.z);
+			c->x += (a->x + b->x + d->x) / 3 * w;
+			c->y += (a->y + b->y + d->y) / 3 * w;
+			c->z += (a->z + b->z + d->z) / 3 * w;
+			n->x += cross.x;
+			n->y += cross.y;
+			n->z += cross.z;
+			area += w;
+		}
+		center.x += c->x;
+		center.y += c->y;
+		center.z += c->z;
+		total_area += area;
+		if (area > 0) {
+			c->x /= area;
+			c->y /= area;
+			c->z /= area;
+		}
+	}
+	if (total_area > 0) {
+		center.x /= total_area;
+		center.y /= total_area;
+		center.z /= total_area;
+	}
+	for (i = 0; i < num_clusters; i++) {
+		float length = sqrtf(normal[i].x * normal[i].x + normal[i].y * normal[i].y + normal[i].z * normal[i].z);
+		clusters[i].key = 0;
+		if (length > 0)
+			clusters[i].key = ((centroid[i].x - center.x) * normal[i].x + (centroid[i].y - center.y) * normal[i].y + (centroid[i].z - center.z) * normal[i].z) / length;
+	}
+
+	qsort(clusters, num_clusters, sizeof(Cluster), Compare_Clusters);
+	for (i = v = 0; i < num_clusters; i++)
+		for (k = 0; k < clusters[i].count; k++)
+			order[v++] = polygon[clusters[i].first + k];
+	memcpy(polygon, order, num_polygons * sizeof(gx3dPolygon));
+
+	free(stamp); free(clusters); free(centroid); free(normal); free(order);
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Compare_Clusters
+|
+| Input: Called from MeshOpt_Optimize_Overdraw() (qsort)
+| Output: Orders clusters by decreasing key, then by first triangle.
+|___________________________________________________________________*/
+
+static int Compare_Clusters(const void* c1, const void* c2)
+{
+	const Cluster* a = (const Cluster*)c1;
+	const Cluster* b = (const Cluster*)c2;
+
+	if (a->key != b->key)
+		return (a->key > b->key ? -1 : 1);
+
+	return (a->first < b->first ? -1 : 1);
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshOpt_ACMR
+|
+| Input: Called from Build_Indices(), MeshOpt_Optimize_Object(),
+|   Report_Layer()
+| Output: Returns the average # of vertices transformed per triangle
+|   with a FIFO post-transform cache, or 0 if out of memory.
+|___________________________________________________________________*/
+
+float MeshOpt_ACMR(gx3dPolygon* polygon, unsigned num_polygons, unsigned num_vertices)
+{
+	unsigned i, k, v, misses;
+	int* stamp;
+
+	if (num_polygons == 0)
+		return (0);
+	stamp = (int*)malloc(num_vertices * sizeof(int));
+	if (stamp == NULL)
+		return (0);
+
+	// A vertex is cached until MESHOPT_CACHE_SIZE others have been added after it
+	for (v = 0; v < num_vertices; v++)
+		stamp[v] = -MESHOPT_CACHE_SIZE - 1;
+	misses = 0;
+	for (i = 0; i < num_polygons; i++)
+		for (k = 0; k < 3; k++) {
+			v = polygon[i].index[k];
+			if ((int)misses - stamp[v] > MESHOPT_CACHE_SIZE)
+				stamp[v] = misses++;
+		}
+	free(stamp);
+
+	return ((float)misses / num_polygons);
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshOpt_Quantize
+|
+| Input: Called from Report_Layer()
+| Output: Packs vertices into 16 bytes each: positions and texture
+|   coordinates as 16-bit fractions of their range and normals as 8-bit
+|   signed fractions.  normal and uv may be NULL.
+|___________________________________________________________________*/
+
+void MeshOpt_Quantize(gx3dVector* vertex, gx3dVector* normal, gx3dUV* uv, unsigned num_vertices, MeshOptVertex* out, MeshOptBounds* bounds)
+{
+	unsigned i;
+	gx3dVector max;
+	gx3dUV uv_max;
+
+	memset(bounds, 0, sizeof(MeshOptBounds));
+	if (num_vertices == 0)
+		return;
+
+	bounds->min = max = vertex[0];
+	if (uv)
+		bounds->uv_min = uv_max = uv[0];
+	for (i = 1; i < num_vertices; i++) {
+		bounds->min.x = vertex[i].x < bounds->min.x ? vertex[i].x : bounds->min.x;
+		bounds->min.y = vertex[i].y < bounds->min.y ? vertex[i].y : bounds->min.y;
+		bounds->min.z = vertex[i].z < bounds->min.z ? vertex[i].z : bounds->min.z;
+		max.x = vertex[i].x > max.x ? vertex[i].x : max.x;
+		max.y = vertex[i].y > max.y ? vertex[i].y : max.y;
+		max.z = vertex[i].z > max.z ? vertex[i].z : max.z;
+		if (uv) {
+			bounds->uv_min.u = uv[i].u < bounds->uv_min.u ? uv[i].u : bounds->uv_min.u;
+			bounds->uv_min.v = uv[i].v < bounds->uv_min.v ? uv[i].v : bounds->uv_min.v;
+			uv_max.u = uv[i].u > uv_max.u ? uv[i].u : uv_max.u;
+			uv_max.v = uv[i].v > uv_max.v ? uv[i].v : uv_max.v;
+		}
+	}
+	bounds->scale.x = (max.x - bounds->min.x) / 65535;
+	bounds->scale.y = (max.y - bounds->min.y) / 65535;
+	bounds->scale.z = (max.z - bounds->min.z) / 65535;
+	if (uv) {
+		bounds->uv_scale.u = (uv_max.u - bounds->uv_min.u) / 65535;
+		bounds->uv_scale.v = (uv_max.v - bounds->uv_min.v) / 65535;
+	}
+
+#define QUANTIZE(_value_,_min_,_scale_)  ((unsigned short)((_scale_) > 0 ? ((_value_) - (_min_)) / (_scale_) + 0.5f : 0))
+	for (i = 0; i < num_vertices; i++) {
+		out[i].x = QUANTIZE(vertex[i].x, bounds->min.x, bounds->scale.x);
+		out[i].y = QUANTIZE(vertex[i].y, bounds->min.y, bounds->scale.y);
+		out[i].z = QUANTIZE(vertex[i].z, bounds->min.z, bounds->scale.z);
+		out[i].pad = 0;
+		out[i].nx = out[i].ny = out[i].nz = out[i].nw = 0;
+		if (normal) {
+			out[i].nx = (signed char)floorf(normal[i].x * 127 + 0.5f);
+			out[i].ny = (signed char)floorf(normal[i].y * 127 + 0.5f);
+			out[i].nz = (signed char)floorf(normal[i].z * 127 + 0.5f);
+		}
+		out[i].u = out[i].v = 0;
+		if (uv) {
+			out[i].u = QUANTIZE(uv[i].u, bounds->uv_min.u, bounds->uv_scale.u);
+			out[i].v = QUANTIZE(uv[i].v, bounds->uv_min.v, bounds->uv_scale.v);
+		}
+	}
+#undef QUANTIZE
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshOpt_Dequantize
+|
+| Input: Called from Report_Layer()
+| Output: Unpacks a vertex packed by MeshOpt_Quantize().
+|___________________________________________________________________*/
+
+void MeshOpt_Dequantize(MeshOptVertex* in, MeshOptBounds* bounds, gx3dVector* vertex, gx3dVector* normal, gx3dUV* uv)
+{
+	vertex->x = bounds->min.x + in->x * bounds->scale.x;
+	vertex->y = bounds->min.y + in->y * bounds->scale.y;
+	vertex->z = bounds->min.z + in->z * bounds->scale.z;
+	normal->x = in->nx / 127.0f;
+	normal->y = in->ny / 127.0f;
+	normal->z = in->nz / 127.0f;
+	uv->u = bounds->uv_min.u + in->u * bounds->uv_scale.u;
+	uv->v = bounds->uv_min.v + in->v * bounds->uv_scale.v;
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshOpt_Optimize_Object
+|
+| Input: Called from Program_Run(), Reload_Asset() before the object is
+|   first drawn
+| Output: Reorders the triangles of each of an object's layers for the
+|   vertex cache and overdraw.  The vertices are left as loaded.
+|___________________________________________________________________*/
+
+void MeshOpt_Optimize_Object(gx3dObject* object)
+{
+	gx3dObjectLayer* layer;
+
+	for (layer = object->layer; layer; layer = layer->next) {
+		if (layer->num_polygons == 0 || layer->polygon == NULL)
+			continue;
+		misses_before += MeshOpt_ACMR(layer->polygon, layer->num_polygons, layer->num_vertices) * layer->num_polygons;
+		MeshOpt_Optimize_Vertex_Cache(layer->polygon, layer->num_polygons, layer->num_vertices);
+		MeshOpt_Optimize_Overdraw(layer->polygon, layer->num_polygons, layer->vertex, layer->num_vertices);
+		misses_after += MeshOpt_ACMR(layer->polygon, layer->num_polygons, layer->num_vertices) * layer->num_polygons;
+		stats.triangles += layer->num_polygons;
+	}
+	stats.objects++;
+	if (stats.triangles) {
+		stats.acmr_before = (float)(misses_before / stats.triangles);
+		stats.acmr_after = (float)(misses_after / stats.triangles);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshOpt_Report_Models
+|
+| Input: Called from Program_Run()
+| Output: Runs every stage on copies of each model (.lwo) in a
+|   directory and writes vertex counts, ACMR, sizes and quantisation
+|   errors before and after to the debug file.  Returns the # of
+|   models reported.
+|___________________________________________________________________*/
+
+int MeshOpt_Report_Models(const char* directory)
+{
+	int count;
+	char filename[MAX_PATH], str[512];
+	HANDLE find;
+	WIN32_FIND_DATAA data;
+	gx3dObject* object;
+	gx3dObjectLayer* layer;
+	Report report, total;
+
+	memset(&total, 0, sizeof(total));
+	count = 0;
+	sprintf(filename, "%s\\*.lwo", directory);
+	find = FindFirstFileA(filename, &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return (0);
+
+	debug_WriteFile("_______________ Mesh Optimisation ________");
+	do {
+		sprintf(filename, "%s\\%s", directory, data.cFileName);
+		object = NULL;
+		gx3d_ReadLWO2File(filename, &object, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
+		if (object == NULL) {
+			sprintf(str, "%s: can't load", data.cFileName);
+			debug_WriteFile(str);
+			continue;
+		}
+		for (layer = object->layer; layer; layer = layer->next) {
+			if (NOT Report_Layer(layer, &report)) {
+				sprintf(str, "%s: out of memory", data.cFileName);
+				debug_WriteFile(str);
+				continue;
+			}
+			sprintf(str, "%s: %u triangles, vertices %u -> %u, ACMR %.3f -> %.3f, bytes %u -> %u, max error position %g normal %.4f uv %g",
+				data.cFileName, report.triangles, report.vertices, report.welded_vertices, report.acmr_before, report.acmr_after,
+				report.bytes_before, report.bytes_after, report.position_error, report.normal_error, report.uv_error);
+			debug_WriteFile(str);
+			total.triangles += report.triangles;
+			total.vertices += report.vertices;
+			total.welded_vertices += report.welded_vertices;
+			total.acmr_before += report.acmr_before * report.triangles;
+			total.acmr_after += report.acmr_after * report.triangles;
+			total.bytes_before += report.bytes_before;
+			total.bytes_after += report.bytes_after;
+		}
+		gx3d_FreeObject(object);
+		count++;
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+
+	if (total.triangles) {
+		sprintf(str, "total: %u triangles, vertices %u -> %u, ACMR %.3f -> %.3f, bytes %u -> %u",
+			total.triangles, total.vertices, total.welded_vertices, total.acmr_before / total.triangles, total.acmr_after / total.triangles,
+			total.bytes_before, total.bytes_after);
+		debug_WriteFile(str);
+	}
+	debug_WriteFile("__________________________________________");
+
+	return (count);
+}
+
+/*____________________________________________________________________
+|
+| Function: Report_Layer
+|
+| Input: Called from MeshOpt_Report_Models()
+| Output: Welds, reorders and quantises a copy of a layer, measuring it
+|   before and after.  Returns false if out of memory.
+|___________________________________________________________________*/
+
+static bool Report_Layer(gx3dObjectLayer* layer, Report* report)
+{
+	unsigned i, n, num_vertices;
+	gx3dVector *vertex, *normal, v, vn;
+	gx3dUV *uv, t;
+	gx3dPolygon* polygon;
+	MeshOptVertex* packed;
+	MeshOptBounds bounds;
+	bool has_uv;
+
+	memset(report, 0, sizeof(Report));
+	n = layer->num_vertices;
+	has_uv = (layer->num_tex_coords > 0 && layer->tex_coords[0]);
+	vertex = (gx3dVector*)malloc(n * sizeof(gx3dVector));
+	normal = (gx3dVector*)calloc(n, sizeof(gx3dVector));
+	uv = (gx3dUV*)calloc(n, sizeof(gx3dUV));
+	polygon = (gx3dPolygon*)malloc(layer->num_polygons * sizeof(gx3dPolygon));
+	packed = (MeshOptVertex*)malloc(n * sizeof(MeshOptVertex));
+	if (vertex == NULL || normal == NULL || uv == NULL || polygon == NULL || packed == NULL) {
+		free(vertex); free(normal); free(uv); free(polygon); free(packed);
+		return (false);
+	}
+	memcpy(vertex, layer->vertex, n * sizeof(gx3dVector));
+	if (layer->vertex_normal)
+		memcpy(normal, layer->vertex_normal, n * sizeof(gx3dVector));
+	if (has_uv)
+		memcpy(uv, layer->tex_coords[0], n * sizeof(gx3dUV));
+	memcpy(polygon, layer->polygon, layer->num_polygons * sizeof(gx3dPolygon));
+
+	report->vertices = n;
+	report->triangles = layer->num_polygons;
+	report->acmr_before = MeshOpt_ACMR(polygon, layer->num_polygons, n);
+	report->bytes_before = n * MESHOPT_FLOAT_VERTEX_SIZE + layer->num_polygons * 3 * MESHOPT_INDEX_SIZE;
+
+	num_vertices = MeshOpt_Weld(vertex, normal, uv, n, polygon, layer->num_polygons);
+	MeshOpt_Optimize_Vertex_Cache(polygon, layer->num_polygons, num_vertices);
+	MeshOpt_Optimize_Overdraw(polygon, layer->num_polygons, vertex, num_vertices);
+	MeshOpt_Quantize(vertex, normal, has_uv ? uv : NULL, num_vertices, packed, &bounds);
+
+	report->welded_vertices = num_vertices;
+	report->acmr_after = MeshOpt_ACMR(polygon, layer->num_polygons, num_vertices);
+	report->bytes_after = num_vertices * sizeof(MeshOptVertex) + layer->num_polygons * 3 * MESHOPT_INDEX_SIZE;
+	for (i = 0; i < num_vertices; i++) {
+		MeshOpt_Dequantize(&packed[i], &bounds, &v, &vn, &t);
+		report->position_error = fmaxf(report->position_error, fmaxf(fabsf(v.x - vertex[i].x), fmaxf(fabsf(v.y - vertex[i].y), fabsf(v.z - vertex[i].z))));
+		report->normal_error = fmaxf(report->normal_error, fmaxf(fabsf(vn.x - normal[i].x), fmaxf(fabsf(vn.y - normal[i].y), fabsf(vn.z - normal[i].z))));
+		if (has_uv)
+			report->uv_error = fmaxf(report->uv_error, fmaxf(fabsf(t.u - uv[i].u), fabsf(t.v - uv[i].v)));
+	}
+
+	free(vertex); free(normal); free(uv); free(polygon); free(packed);
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: MeshOpt_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns statistics on the objects optimised at load time.
+|___________________________________________________________________*/
+
+void MeshOpt_Get_Stats(MeshOptStats* out)
+{
+	*out = stats;
+}
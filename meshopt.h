@@ -0,0 +1,52 @@
+/*____________________________________________________________________
+|
+| File: meshopt.h
+|
+| Description: Mesh optimisation - vertex welding, triangle ordering
+|   for the post-transform vertex cache and for overdraw, and quantised
+|   vertex formats.
+|___________________________________________________________________*/
+
+#ifndef _MESHOPT_H_
+#define _MESHOPT_H_
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// 16 bytes, against 32 for float position, normal and texture coordinates
+typedef struct {
+	unsigned short x, y, z, pad;    // position, 0 to 65535 over the bounds
+	signed char    nx, ny, nz, nw;  // normal, -127 to 127
+	unsigned short u, v;            // texture coordinates, 0 to 65535 over their range
+} MeshOptVertex;
+
+typedef struct {
+	gx3dVector min, scale;          // position = min + x * scale
+	gx3dUV     uv_min, uv_scale;
+} MeshOptBounds;
+
+typedef struct {
+	unsigned objects;          // optimised at load time
+	unsigned triangles;
+	float    acmr_before;      // post-transform cache misses per triangle, as authored
+	float    acmr_after;
+} MeshOptStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+unsigned MeshOpt_Weld (gx3dVector *vertex, gx3dVector *normal, gx3dUV *uv, unsigned num_vertices, gx3dPolygon *polygon, unsigned num_polygons);
+int      MeshOpt_Optimize_Vertex_Cache (gx3dPolygon *polygon, unsigned num_polygons, unsigned num_vertices);
+int      MeshOpt_Optimize_Overdraw (gx3dPolygon *polygon, unsigned num_polygons, gx3dVector *vertex, unsigned num_vertices);
+float    MeshOpt_ACMR (gx3dPolygon *polygon, unsigned num_polygons, unsigned num_vertices);
+void     MeshOpt_Quantize (gx3dVector *vertex, gx3dVector *normal, gx3dUV *uv, unsigned num_vertices, MeshOptVertex *out, MeshOptBounds *bounds);
+void     MeshOpt_Dequantize (MeshOptVertex *in, MeshOptBounds *bounds, gx3dVector *vertex, gx3dVector *normal, gx3dUV *uv);
+void     MeshOpt_Optimize_Object (gx3dObject *object);
+int      MeshOpt_Report_Models (const char *directory);
+void     MeshOpt_Get_Stats (MeshOptStats *stats);
+
+#endif
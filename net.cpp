@@ -0,0 +1,792 @@
+/*____________________________________________________________________
+|
+| File: net.cpp
+|
+| Description: UDP sockets and the multiplayer wire format: bit
+|   packed messages and quantised, delta compressed world states.
+|
+|   Sockets are non-blocking, on Winsock under Windows (BSD sockets
+|   elsewhere).  Net_Now() and Net_Sleep() are the server's clock.
+|
+|   Messages are packed a bit at a time, least significant bit first.
+|   Positions are quantised to 1/NET_COORD_SCALE of a unit over
+|   +/- NET_COORD_RANGE (16 bits), a player's heading to 8 bits and its
+|   status, running and page count to NET_FLAGS_BITS.
+|
+|   A state is written as a delta against a baseline, an earlier state
+|   the client has acknowledged, or in full when there is none.  Only
+|   what changed since the baseline is sent:
+|
+|     round     1 bit, then the seed and page positions if it changed
+|     pages     1 bit, then a bit per page taken if any changed
+|     Slenders  count, then a delta per coordinate
+|     players   count, then each player's slot as a gap from the last
+|               one and, for a player also in the baseline, 1 bit if
+|               unchanged, else a delta per field; a player new to the
+|               baseline is written in full.  Players in the baseline
+|               but not the state have gone out of range.
+|
+|   A coordinate delta is 1 bit when unchanged, 10 bits within 127
+|   quanta (4 units) and 18 bits otherwise.
+|
+| Functions:  Net_Init
+|             Net_Free
+|             Net_Open
+|             Net_Close
+|             Net_Get_Port
+|             Net_Resolve
+|             Net_Send
+|             Net_Receive
+|             Net_Now
+|             Net_Sleep
+|             Net_Bits_Init
+|             Net_Bits_Size
+|             Net_Write_Bits
+|             Net_Read_Bits
+|             Net_Quantize
+|             Net_Dequantize
+|             Net_Write_Input
+|             Net_Read_Input
+|             Net_Write_State
+|							 Write_Coord
+|							 Write_Player
+|             Net_Read_State
+|							 Read_Coord
+|							 Read_Player
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#ifdef _WIN32
+#include <winsock.h>
+#pragma comment(lib, "wsock32.lib")
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include "net.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define NET_COORD_BITS       16
+#define NET_SMALL_DELTA_BITS 8      // a delta within +/- 127 quanta
+#define NET_SLOT_BITS        7      // NET_MAX_PLAYERS slots
+#define NET_SMALL_GAP_BITS   3      // a gap between slots under 8
+#define NET_COUNT_BITS       7      // up to NET_MAX_VISIBLE players
+#define NET_PAGE_COUNT_BITS  5      // up to NET_MAX_PAGES pages
+#define NET_SLENDER_COUNT_BITS 3    // up to NET_MAX_SLENDERS Slenders
+
+#ifdef _WIN32
+typedef SOCKET OsSocket;
+#define NET_INVALID_SOCKET   INVALID_SOCKET
+#define close_socket         closesocket
+#else
+typedef int OsSocket;
+#define NET_INVALID_SOCKET   (-1)
+#define close_socket         close
+#endif
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+struct NetSocketData {
+	OsSocket s;
+};
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Write_Coord(NetBits* bits, unsigned short value, unsigned short base, int has_base);
+static void Write_Player(NetBits* bits, NetPlayer* player, NetPlayer* base);
+static unsigned short Read_Coord(NetBits* bits, unsigned short base, int has_base);
+static void Read_Player(NetBits* bits, NetPlayer* player, NetPlayer* base);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static int initialized;
+
+/*____________________________________________________________________
+|
+| Function: Net_Init
+|
+| Input: Called from Server_Run(), Bench_Run()
+| Output: Starts the sockets library.  Returns true on success.
+|___________________________________________________________________*/
+
+int Net_Init()
+{
+#ifdef _WIN32
+	WSADATA wsa;
+
+	if (NOT initialized && WSAStartup(MAKEWORD(1, 1), &wsa) != 0)
+		return (FALSE);
+#endif
+	initialized = TRUE;
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Free
+|
+| Input: Called from Server_Run(), Bench_Run()
+| Output: Stops the sockets library, once every socket is closed.
+|___________________________________________________________________*/
+
+void Net_Free()
+{
+#ifdef _WIN32
+	if (initialized)
+		WSACleanup();
+#endif
+	initialized = FALSE;
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Open
+|
+| Input: Called from Server_Init(), Client_Create()
+| Output: Opens a non-blocking UDP socket on port (0 for any free
+|   port).  Returns the socket or NULL on failure.
+|___________________________________________________________________*/
+
+NetSocket Net_Open(unsigned short port)
+{
+	struct sockaddr_in addr;
+	NetSocket sock;
+	OsSocket s;
+
+	s = socket(AF_INET, SOCK_DGRAM, 0);
+	if (s == NET_INVALID_SOCKET)
+		return (NULL);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+#ifdef _WIN32
+	u_long non_blocking = 1;
+	int made_non_blocking = (ioctlsocket(s, FIONBIO, &non_blocking) == 0);
+#else
+	int made_non_blocking = (fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK) == 0);
+#endif
+	sock = (NetSocket)malloc(sizeof(struct NetSocketData));
+	if (NOT made_non_blocking || bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 || sock == NULL) {
+		close_socket(s);
+		free(sock);
+		return (NULL);
+	}
+	sock->s = s;
+
+	return (sock);
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Close
+|
+| Input: Called from Server_Free(), Client_Free()
+| Output: Closes a socket.
+|___________________________________________________________________*/
+
+void Net_Close(NetSocket sock)
+{
+	if (sock) {
+		close_socket(sock->s);
+		free(sock);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Get_Port
+|
+| Input: Called from Server_Get_Port()
+| Output: Returns the port a socket is bound to, 0 on failure.
+|___________________________________________________________________*/
+
+int Net_Get_Port(NetSocket sock)
+{
+	struct sockaddr_in addr;
+#ifdef _WIN32
+	int size = sizeof(addr);
+#else
+	socklen_t size = sizeof(addr);
+#endif
+
+	if (getsockname(sock->s, (struct sockaddr*)&addr, &size) != 0)
+		return (0);
+
+	return (ntohs(addr.sin_port));
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Resolve
+|
+| Input: Called from Server_Run(), Run_Net()
+| Output: Gets the address of host (a name or dotted address) and port.
+|   Returns true on success.
+|___________________________________________________________________*/
+
+int Net_Resolve(const char* host, unsigned short port, NetAddress* address)
+{
+	struct hostent* entry;
+	unsigned long ip;
+
+	ip = inet_addr(host);
+	if (ip == INADDR_NONE) {
+		entry = gethostbyname(host);
+		if (entry == NULL || entry->h_addrtype != AF_INET)
+			return (FALSE);
+		memcpy(&ip, entry->h_addr_list[0], 4);
+	}
+	address->ip = ntohl((unsigned)ip);
+	address->port = port;
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Send
+|
+| Input: Called from Send_Snapshot(), Send_Input(), Connect_Player()
+| Output: Sends a datagram to address.  Returns true if it was sent
+|   (UDP doesn't say whether it arrives).
+|___________________________________________________________________*/
+
+int Net_Send(NetSocket sock, NetAddress* address, void* data, int size)
+{
+	struct sockaddr_in addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(address->ip);
+	addr.sin_port = htons(address->port);
+
+	return (sendto(sock->s, (const char*)data, size, 0, (struct sockaddr*)&addr, sizeof(addr)) == size);
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Receive
+|
+| Input: Called from Server_Tick(), Client_Update()
+| Output: Reads the next datagram waiting on a socket and who sent it,
+|   without blocking.  Returns its size, or 0 if none is waiting.
+|___________________________________________________________________*/
+
+int Net_Receive(NetSocket sock, NetAddress* address, void* data, int max_size)
+{
+	struct sockaddr_in addr;
+	int size;
+#ifdef _WIN32
+	int addr_size;
+#else
+	socklen_t addr_size;
+#endif
+
+	for (;;) {
+		addr_size = sizeof(addr);
+		size = recvfrom(sock->s, (char*)data, max_size, 0, (struct sockaddr*)&addr, &addr_size);
+		if (size > 0)
+			break;
+#ifdef _WIN32
+		// An earlier send to a closed port is reported here, skip it
+		int error = WSAGetLastError();
+		if (size == 0 || (error != WSAECONNRESET && error != WSAEMSGSIZE))
+			return (0);
+#else
+		if (size == 0 || (errno != ECONNREFUSED && errno != EINTR))
+			return (0);
+#endif
+	}
+	address->ip = ntohl(addr.sin_addr.s_addr);
+	address->port = ntohs(addr.sin_port);
+
+	return (size);
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Now
+|
+| Input: Called from Server_Tick(), Server_Run(), Receive_Input()
+| Output: Returns a monotonic time in milliseconds.
+|___________________________________________________________________*/
+
+double Net_Now()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER t;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+
+	return ((double)t.QuadPart * 1000.0 / freq.QuadPart);
+#else
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return (t.tv_sec * 1000.0 + t.tv_nsec / 1e6);
+#endif
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Sleep
+|
+| Input: Called from Server_Run()
+| Output: Sleeps for ms milliseconds.
+|___________________________________________________________________*/
+
+void Net_Sleep(unsigned ms)
+{
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	usleep(ms * 1000);
+#endif
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Bits_Init
+|
+| Input: Called from Send_Snapshot(), Send_Input(), Server_Tick()
+| Output: Starts writing or reading a message of size bytes at data.
+|   Writing clears it.
+|___________________________________________________________________*/
+
+void Net_Bits_Init(NetBits* bits, void* data, int size)
+{
+	bits->data = (unsigned char*)data;
+	bits->size = size;
+	bits->bit = 0;
+	bits->overflow = FALSE;
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Bits_Size
+|
+| Input: Called from Send_Snapshot(), Send_Input(), Connect_Player()
+| Output: Returns the bytes written or read so far.
+|___________________________________________________________________*/
+
+int Net_Bits_Size(NetBits* bits)
+{
+	return ((bits->bit + 7) >> 3);
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Write_Bits
+|
+| Input: Called from Net_Write_State(), Send_Snapshot(), Send_Input()
+| Output: Writes the low num_bits (up to 32) of value.  Sets overflow
+|   instead if they don't fit.
+|___________________________________________________________________*/
+
+void Net_Write_Bits(NetBits* bits, unsigned value, int num_bits)
+{
+	int i, byte;
+
+	if (bits->bit + num_bits > bits->size * 8) {
+		bits->overflow = TRUE;
+		return;
+	}
+	for (i = 0; i < num_bits; i++, bits->bit++) {
+		byte = bits->bit >> 3;
+		if ((bits->bit & 7) == 0)
+			bits->data[byte] = 0;
+		if (value & (1u << i))
+			bits->data[byte] |= 1 << (bits->bit & 7);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Read_Bits
+|
+| Input: Called from Net_Read_State(), Server_Tick(), Client_Update()
+| Output: Returns the next num_bits (up to 32), or 0 and sets overflow
+|   past the end of the message.
+|___________________________________________________________________*/
+
+unsigned Net_Read_Bits(NetBits* bits, int num_bits)
+{
+	int i;
+	unsigned value = 0;
+
+	if (bits->bit + num_bits > bits->size * 8) {
+		bits->overflow = TRUE;
+		return (0);
+	}
+	for (i = 0; i < num_bits; i++, bits->bit++)
+		if (bits->data[bits->bit >> 3] & (1 << (bits->bit & 7)))
+			value |= 1u << i;
+
+	return (value);
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Quantize
+|
+| Input: Called from Start_Round(), Server_Tick()
+| Output: Returns a world coordinate quantised to 16 bits, clamped to
+|   +/- NET_COORD_RANGE.
+|___________________________________________________________________*/
+
+unsigned short Net_Quantize(float coord)
+{
+	float q = (coord + NET_COORD_RANGE) * NET_COORD_SCALE + 0.5f;
+
+	if (q < 0)
+		q = 0;
+	else if (q > 65535)
+		q = 65535;
+
+	return ((unsigned short)q);
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Dequantize
+|
+| Input: Called from Client_Bot_Update()
+| Output: Returns the world coordinate of a quantised one.
+|___________________________________________________________________*/
+
+float Net_Dequantize(unsigned short coord)
+{
+	return (coord / NET_COORD_SCALE - NET_COORD_RANGE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Write_Input
+|
+| Input: Called from Send_Input()
+| Output: Writes an input, without its sequence # (the message gives
+|   the newest and the rest follow on from it).
+|___________________________________________________________________*/
+
+void Net_Write_Input(NetBits* bits, NetInput* input)
+{
+	Net_Write_Bits(bits, input->buttons, NET_BUTTON_BITS);
+	Net_Write_Bits(bits, input->elapsed, 8);
+	Net_Write_Bits(bits, input->yaw, 16);
+	Net_Write_Bits(bits, input->pitch, 16);
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Read_Input
+|
+| Input: Called from Receive_Input()
+| Output: Reads an input written by Net_Write_Input().
+|___________________________________________________________________*/
+
+void Net_Read_Input(NetBits* bits, NetInput* input)
+{
+	input->buttons = (unsigned char)Net_Read_Bits(bits, NET_BUTTON_BITS);
+	input->elapsed = (unsigned char)Net_Read_Bits(bits, 8);
+	input->yaw = (unsigned short)Net_Read_Bits(bits, 16);
+	input->pitch = (unsigned short)Net_Read_Bits(bits, 16);
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Write_State
+|
+| Input: Called from Send_Snapshot()
+| Output: Writes state as a delta against baseline, or in full if
+|   baseline is NULL.  Players must be in increasing slot order.
+|___________________________________________________________________*/
+
+void Net_Write_State(NetBits* bits, NetState* state, NetState* baseline)
+{
+	int i, b, prev_slot, gap, same_round;
+
+	Net_Write_Bits(bits, state->input_ack, 16);
+
+	// The round's forest
+	same_round = (baseline && baseline->round == state->round);
+	Net_Write_Bits(bits, NOT same_round, 1);
+	if (NOT same_round) {
+		Net_Write_Bits(bits, state->round, 8);
+		Net_Write_Bits(bits, state->seed, 32);
+		Net_Write_Bits(bits, state->num_pages, NET_PAGE_COUNT_BITS);
+		for (i = 0; i < state->num_pages; i++) {
+			Net_Write_Bits(bits, state->pages[i].x, NET_COORD_BITS);
+			Net_Write_Bits(bits, state->pages[i].y, NET_COORD_BITS);
+			Net_Write_Bits(bits, state->pages[i].z, NET_COORD_BITS);
+		}
+	}
+	if (same_round && baseline->pages_taken == state->pages_taken)
+		Net_Write_Bits(bits, 0, 1);
+	else {
+		Net_Write_Bits(bits, 1, 1);
+		Net_Write_Bits(bits, state->pages_taken, NET_MAX_PAGES);
+	}
+
+	// Slenders
+	Net_Write_Bits(bits, state->num_slenders, NET_SLENDER_COUNT_BITS);
+	for (i = 0; i < state->num_slenders; i++) {
+		int has_base = (same_round && i < baseline->num_slenders);
+		Write_Coord(bits, state->slenders[i].x, has_base ? baseline->slenders[i].x : 0, has_base);
+		Write_Coord(bits, state->slenders[i].z, has_base ? baseline->slenders[i].z : 0, has_base);
+	}
+
+	// Players in range, matched up with the baseline's by slot
+	Net_Write_Bits(bits, state->num_players, NET_COUNT_BITS);
+	prev_slot = -1;
+	b = 0;
+	for (i = 0; i < state->num_players; i++) {
+		gap = state->slots[i] - prev_slot - 1;
+		prev_slot = state->slots[i];
+		if (gap < (1 << NET_SMALL_GAP_BITS)) {
+			Net_Write_Bits(bits, 0, 1);
+			Net_Write_Bits(bits, gap, NET_SMALL_GAP_BITS);
+		}
+		else {
+			Net_Write_Bits(bits, 1, 1);
+			Net_Write_Bits(bits, gap, NET_SLOT_BITS);
+		}
+		if (baseline)
+			while (b < baseline->num_players && baseline->slots[b] < state->slots[i])
+				b++;
+		if (baseline && b < baseline->num_players && baseline->slots[b] == state->slots[i])
+			Write_Player(bits, &state->players[i], &baseline->players[b]);
+		else
+			Write_Player(bits, &state->players[i], NULL);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Write_Coord
+|
+| Input: Called from Net_Write_State(), Write_Player()
+| Output: Writes a quantised coordinate, as a delta from base if
+|   has_base.
+|___________________________________________________________________*/
+
+static void Write_Coord(NetBits* bits, unsigned short value, unsigned short base, int has_base)
+{
+	int delta;
+
+	if (NOT has_base) {
+		Net_Write_Bits(bits, value, NET_COORD_BITS);
+		return;
+	}
+
+	delta = (int)value - (int)base;
+	if (delta == 0)
+		Net_Write_Bits(bits, 0, 1);
+	else if (delta >= -127 && delta <= 127) {
+		Net_Write_Bits(bits, 1, 2);  // bits 1, 0
+		Net_Write_Bits(bits, delta + 128, NET_SMALL_DELTA_BITS);
+	}
+	else {
+		Net_Write_Bits(bits, 3, 2);  // bits 1, 1
+		Net_Write_Bits(bits, value, NET_COORD_BITS);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Write_Player
+|
+| Input: Called from Net_Write_State()
+| Output: Writes a player, as a delta from base if not NULL.
+|___________________________________________________________________*/
+
+static void Write_Player(NetBits* bits, NetPlayer* player, NetPlayer* base)
+{
+	if (base == NULL) {
+		Net_Write_Bits(bits, player->x, NET_COORD_BITS);
+		Net_Write_Bits(bits, player->z, NET_COORD_BITS);
+		Net_Write_Bits(bits, player->yaw, 8);
+		Net_Write_Bits(bits, player->flags, NET_FLAGS_BITS);
+	}
+	else if (player->x == base->x && player->z == base->z && player->yaw == base->yaw && player->flags == base->flags)
+		Net_Write_Bits(bits, 0, 1);
+	else {
+		Net_Write_Bits(bits, 1, 1);
+		Write_Coord(bits, player->x, base->x, TRUE);
+		Write_Coord(bits, player->z, base->z, TRUE);
+		if (player->yaw == base->yaw)
+			Net_Write_Bits(bits, 0, 1);
+		else {
+			Net_Write_Bits(bits, 1, 1);
+			Net_Write_Bits(bits, player->yaw, 8);
+		}
+		if (player->flags == base->flags)
+			Net_Write_Bits(bits, 0, 1);
+		else {
+			Net_Write_Bits(bits, 1, 1);
+			Net_Write_Bits(bits, player->flags, NET_FLAGS_BITS);
+		}
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Net_Read_State
+|
+| Input: Called from Receive_Snapshot()
+| Output: Reads a state written by Net_Write_State() against the same
+|   baseline (NULL if it was written in full), leaving the tick for
+|   the caller.  Returns true on success, false if the message is
+|   malformed.
+|___________________________________________________________________*/
+
+int Net_Read_State(NetBits* bits, NetState* state, NetState* baseline)
+{
+	int i, b, prev_slot, gap, same_round;
+
+	state->input_ack = (unsigned short)Net_Read_Bits(bits, 16);
+
+	// The round's forest
+	same_round = NOT Net_Read_Bits(bits, 1);
+	if (same_round) {
+		if (baseline == NULL)
+			return (FALSE);
+		state->round = baseline->round;
+		state->seed = baseline->seed;
+		state->num_pages = baseline->num_pages;
+		memcpy(state->pages, baseline->pages, sizeof(state->pages));
+	}
+	else {
+		state->round = (unsigned char)Net_Read_Bits(bits, 8);
+		state->seed = Net_Read_Bits(bits, 32);
+		state->num_pages = Net_Read_Bits(bits, NET_PAGE_COUNT_BITS);
+		if (state->num_pages > NET_MAX_PAGES)
+			return (FALSE);
+		for (i = 0; i < state->num_pages; i++) {
+			state->pages[i].x = (unsigned short)Net_Read_Bits(bits, NET_COORD_BITS);
+			state->pages[i].y = (unsigned short)Net_Read_Bits(bits, NET_COORD_BITS);
+			state->pages[i].z = (unsigned short)Net_Read_Bits(bits, NET_COORD_BITS);
+		}
+	}
+	if (Net_Read_Bits(bits, 1))
+		state->pages_taken = (unsigned short)Net_Read_Bits(bits, NET_MAX_PAGES);
+	else if (same_round)
+		state->pages_taken = baseline->pages_taken;
+	else
+		return (FALSE);
+
+	// Slenders
+	state->num_slenders = Net_Read_Bits(bits, NET_SLENDER_COUNT_BITS);
+	if (state->num_slenders > NET_MAX_SLENDERS)
+		return (FALSE);
+	for (i = 0; i < state->num_slenders; i++) {
+		int has_base = (same_round && i < baseline->num_slenders);
+		state->slenders[i].x = Read_Coord(bits, has_base ? baseline->slenders[i].x : 0, has_base);
+		state->slenders[i].y = 0;
+		state->slenders[i].z = Read_Coord(bits, has_base ? baseline->slenders[i].z : 0, has_base);
+	}
+
+	// Players in range
+	state->num_players = Net_Read_Bits(bits, NET_COUNT_BITS);
+	if (state->num_players > NET_MAX_VISIBLE)
+		return (FALSE);
+	prev_slot = -1;
+	b = 0;
+	for (i = 0; i < state->num_players; i++) {
+		if (Net_Read_Bits(bits, 1))
+			gap = Net_Read_Bits(bits, NET_SLOT_BITS);
+		else
+			gap = Net_Read_Bits(bits, NET_SMALL_GAP_BITS);
+		prev_slot += gap + 1;
+		if (prev_slot >= NET_MAX_PLAYERS)
+			return (FALSE);
+		state->slots[i] = (unsigned char)prev_slot;
+		if (baseline)
+			while (b < baseline->num_players && baseline->slots[b] < state->slots[i])
+				b++;
+		if (baseline && b < baseline->num_players && baseline->slots[b] == state->slots[i])
+			Read_Player(bits, &state->players[i], &baseline->players[b]);
+		else
+			Read_Player(bits, &state->players[i], NULL);
+	}
+
+	return (NOT bits->overflow);
+}
+
+/*____________________________________________________________________
+|
+| Function: Read_Coord
+|
+| Input: Called from Net_Read_State(), Read_Player()
+| Output: Returns a coordinate written by Write_Coord().
+|___________________________________________________________________*/
+
+static unsigned short Read_Coord(NetBits* bits, unsigned short base, int has_base)
+{
+	if (NOT has_base || NOT Net_Read_Bits(bits, 1))
+		return (has_base ? base : (unsigned short)Net_Read_Bits(bits, NET_COORD_BITS));
+	else if (NOT Net_Read_Bits(bits, 1))
+		return ((unsigned short)(base + (int)Net_Read_Bits(bits, NET_SMALL_DELTA_BITS) - 128));
+	else
+		return ((unsigned short)Net_Read_Bits(bits, NET_COORD_BITS));
+}
+
+/*____________________________________________________________________
+|
+| Function: Read_Player
+|
+| Input: Called from Net_Read_State()
+| Output: Reads a player written by Write_Player().
+|___________________________________________________________________*/
+
+static void Read_Player(NetBits* bits, NetPlayer* player, NetPlayer* base)
+{
+	if (base == NULL) {
+		player->x = (unsigned short)Net_Read_Bits(bits, NET_COORD_BITS);
+		player->z = (unsigned short)Net_Read_Bits(bits, NET_COORD_BITS);
+		player->yaw = (unsigned char)Net_Read_Bits(bits, 8);
+		player->flags = (unsigned char)Net_Read_Bits(bits, NET_FLAGS_BITS);
+	}
+	else if (NOT Net_Read_Bits(bits, 1))
+		*player = *base;
+	else {
+		player->x = Read_Coord(bits, base->x, TRUE);
+		player->z = Read_Coord(bits, base->z, TRUE);
+		player->yaw = Net_Read_Bits(bits, 1) ? (unsigned char)Net_Read_Bits(bits, 8) : base->yaw;
+		player->flags = Net_Read_Bits(bits, 1) ? (unsigned char)Net_Read_Bits(bits, NET_FLAGS_BITS) : base->flags;
+	}
+}
@@ -0,0 +1,146 @@
+/*____________________________________________________________________
+|
+| File: net.h
+|
+| Description: UDP sockets and the multiplayer wire format: bit
+|   packed messages and quantised, delta compressed world states.
+|___________________________________________________________________*/
+
+#ifndef _NET_H_
+#define _NET_H_
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define NET_PROTOCOL        0x534C  // sent with a connect, so stray packets are ignored
+#define NET_MAX_PACKET      1200    // bytes, under the usual path MTU
+#define NET_DEFAULT_PORT    27015
+
+// Message types
+#define NET_MSG_CONNECT     1       // client: protocol
+#define NET_MSG_WELCOME     2       // server: protocol, slot, tick rate
+#define NET_MSG_REJECT      3       // server: full
+#define NET_MSG_INPUT       4       // client: newest state received, recent inputs
+#define NET_MSG_SNAPSHOT    5       // server: tick, baseline, state
+#define NET_MSG_DISCONNECT  6
+
+// World state limits
+#define NET_MAX_PAGES       16
+#define NET_MAX_SLENDERS    4
+#define NET_MAX_PLAYERS     128     // slots on a server
+#define NET_MAX_VISIBLE     64      // players in a state, the nearest if more are in range
+#define NET_INPUT_REDUNDANCY 4      // inputs resent in each input message, to ride out lost packets
+#define NET_HISTORY         32      // states kept at both ends as baselines for deltas
+
+// Positions are quantised to 1/32 of a unit over +/- NET_COORD_RANGE
+#define NET_COORD_RANGE     1024.0f
+#define NET_COORD_SCALE     32.0f
+
+// Players' eyes are this high, as in the game
+#define NET_EYE_HEIGHT      5.0f
+
+// Input buttons
+#define NET_BUTTON_FORWARD  0x01
+#define NET_BUTTON_BACK     0x02
+#define NET_BUTTON_LEFT     0x04
+#define NET_BUTTON_RIGHT    0x08
+#define NET_BUTTON_RUN      0x10
+#define NET_BUTTON_PICK     0x20
+#define NET_BUTTON_BITS     6
+
+// Player status
+#define NET_STATUS_PLAYING  0
+#define NET_STATUS_CAUGHT   1
+#define NET_STATUS_WON      2
+
+// Player flags: status, running and pages
+#define NET_FLAGS(_status_,_running_,_pages_)  ((_status_) | ((_running_) << 2) | ((_pages_) << 3))
+#define NET_FLAGS_STATUS(_flags_)              ((_flags_) & 3)
+#define NET_FLAGS_RUNNING(_flags_)             (((_flags_) >> 2) & 1)
+#define NET_FLAGS_PAGES(_flags_)               ((_flags_) >> 3)
+#define NET_FLAGS_BITS      6
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct NetSocketData* NetSocket;
+
+typedef struct {
+	unsigned       ip;      // host byte order
+	unsigned short port;
+} NetAddress;
+
+// Bit packed message being written or read
+typedef struct {
+	unsigned char* data;
+	int            size;      // bytes
+	int            bit;       // next bit written or read
+	int            overflow;  // true if a write didn't fit or a read ran past the end
+} NetBits;
+
+// One input of a client, for elapsed ms of its movement
+typedef struct {
+	unsigned short sequence;
+	unsigned char  buttons;
+	unsigned char  elapsed;
+	unsigned short yaw;       // 0 to 65535 for a full turn, 0 looking along +z
+	unsigned short pitch;     // 0 to 65535 for straight down to straight up
+} NetInput;
+
+typedef struct {
+	unsigned short x, y, z;   // quantised
+} NetPoint;
+
+typedef struct {
+	unsigned short x, z;      // quantised, on the ground
+	unsigned char  yaw;       // 0 to 255 for a full turn
+	unsigned char  flags;     // NET_FLAGS()
+} NetPlayer;
+
+// The world as one client sees it on a tick
+typedef struct {
+	unsigned       tick;
+	unsigned short input_ack;                 // sequence of the client's last input applied
+	unsigned char  round;
+	unsigned       seed;                      // the round's forest
+	int            num_pages;
+	NetPoint       pages[NET_MAX_PAGES];
+	unsigned short pages_taken;               // bit per page
+	int            num_slenders;
+	NetPoint       slenders[NET_MAX_SLENDERS];  // on the ground, y isn't sent
+	int            num_players;
+	unsigned char  slots[NET_MAX_VISIBLE];    // in increasing order, the client's own included
+	NetPlayer      players[NET_MAX_VISIBLE];
+} NetState;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int            Net_Init ();
+void           Net_Free ();
+NetSocket      Net_Open (unsigned short port);
+void           Net_Close (NetSocket sock);
+int            Net_Get_Port (NetSocket sock);
+int            Net_Resolve (const char *host, unsigned short port, NetAddress *address);
+int            Net_Send (NetSocket sock, NetAddress *address, void *data, int size);
+int            Net_Receive (NetSocket sock, NetAddress *address, void *data, int max_size);
+double         Net_Now ();
+void           Net_Sleep (unsigned ms);
+void           Net_Bits_Init (NetBits *bits, void *data, int size);
+int            Net_Bits_Size (NetBits *bits);
+void           Net_Write_Bits (NetBits *bits, unsigned value, int num_bits);
+unsigned       Net_Read_Bits (NetBits *bits, int num_bits);
+unsigned short Net_Quantize (float coord);
+float          Net_Dequantize (unsigned short coord);
+void           Net_Write_Input (NetBits *bits, NetInput *input);
+void           Net_Read_Input (NetBits *bits, NetInput *input);
+void           Net_Write_State (NetBits *bits, NetState *state, NetState *baseline);
+int            Net_Read_State (NetBits *bits, NetState *state, NetState *baseline);
+
+#endif
@@ -0,0 +1,351 @@
+/*____________________________________________________________________
+|
+| File: pacer.cpp
+|
+| Description: Frame pacing.  Holds the game loop to a target frame
+|   rate using a hybrid of sleeping and spinning against the high
+|   resolution performance counter.  Most of the wait is spent asleep;
+|   the last spin_margin ms are spun so the frame starts on time.  The
+|   spin margin adapts to how much the OS actually oversleeps.
+|
+| Functions:  Pacer_Init
+|             Pacer_Free
+|             Pacer_Set_Target_Rate
+|             Pacer_Get_Target_Rate
+|             Pacer_Begin_Frame
+|							 Now
+|							 Record_Frame
+|             Pacer_Get_Work_Time
+|             Pacer_Reset
+|             Pacer_Get_Stats
+|             Pacer_Reset_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "pacer.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define MIN_SPIN_MARGIN     0.25 // ms
+#define MAX_SPIN_MARGIN     4.0  // ms
+#define INITIAL_SPIN_MARGIN 2.0  // ms
+#define SPIN_MARGIN_DECAY   0.05 // how fast the margin shrinks back when the OS sleeps accurately
+#define SLEEP_HEADROOM      0.25 // ms added to the worst observed oversleep
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static double Now();
+static void Record_Frame(double frame_time, double frame_work_time, double schedule_error, int paced);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static double counter_period;   // ms per performance counter tick
+static double target_period;    // ms per frame (0 = uncapped)
+static double spin_margin;      // ms
+static double frame_start;      // ms, ideal start time of the current frame
+static double last_frame_begin; // ms, actual start time of the current frame
+static double elapsed_carry;    // fractional ms not yet returned to the caller
+static double work_time;        // ms from the start of the last frame until it finished
+static int    started;
+
+// Frame time statistics (Welford's running variance)
+static unsigned stat_frames;
+static unsigned stat_paced_frames;
+static double   stat_mean, stat_m2, stat_min, stat_max;
+static double   stat_error_sum, stat_error_max;
+static double   stat_work_sum;
+
+/*____________________________________________________________________
+|
+| Function: Pacer_Init
+|
+| Input: Called from Program_Run()
+| Output: Initializes frame pacing to target_fps frames per second
+|   (0 = uncapped).
+|___________________________________________________________________*/
+
+void Pacer_Init(float target_fps)
+{
+	LARGE_INTEGER freq;
+
+	QueryPerformanceFrequency(&freq);
+	counter_period = 1000.0 / (double)freq.QuadPart;
+
+	// Ask for 1 ms scheduler granularity so short sleeps are accurate
+	timeBeginPeriod(1);
+
+	spin_margin = INITIAL_SPIN_MARGIN;
+	Pacer_Set_Target_Rate(target_fps);
+	Pacer_Reset();
+	Pacer_Reset_Stats();
+}
+
+/*____________________________________________________________________
+|
+| Function: Pacer_Free
+|
+| Input: Called from Program_Run()
+| Output: Restores the scheduler granularity.
+|___________________________________________________________________*/
+
+void Pacer_Free()
+{
+	timeEndPeriod(1);
+}
+
+/*____________________________________________________________________
+|
+| Function: Pacer_Set_Target_Rate
+|
+| Input: Called from Program_Run()
+| Output: Sets the target frame rate (0 = uncapped).
+|___________________________________________________________________*/
+
+void Pacer_Set_Target_Rate(float target_fps)
+{
+	if (target_fps > 0)
+		target_period = 1000.0 / target_fps;
+	else
+		target_period = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pacer_Get_Target_Rate
+|
+| Input: Called from Program_Run()
+| Output: Returns the target frame rate (0 = uncapped).
+|___________________________________________________________________*/
+
+float Pacer_Get_Target_Rate()
+{
+	if (target_period > 0)
+		return ((float)(1000.0 / target_period));
+	else
+		return (0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Pacer_Begin_Frame
+|
+| Input: Called from Program_Run() at the top of each loop.
+| Output: Waits until the next frame is due and returns the elapsed
+|   time (in milliseconds) to simulate for this frame.  While frames
+|   are on schedule the elapsed time is the fixed target period, so
+|   scheduling jitter doesn't reach the simulation.  Returns 0 on the
+|   first frame after Pacer_Init() or Pacer_Reset().
+|___________________________________________________________________*/
+
+unsigned Pacer_Begin_Frame()
+{
+	double now, deadline, remaining, before, overslept, error, elapsed, last_start;
+	unsigned sleep_time, elapsed_ms;
+
+	now = Now();
+
+	if (NOT started) {
+		started = TRUE;
+		frame_start = now;
+		last_frame_begin = now;
+		elapsed_carry = 0;
+		work_time = 0;
+		return (0);
+	}
+
+	// The caller did its work between the last call and this one
+	work_time = now - last_frame_begin;
+
+	last_start = frame_start;
+
+	if (target_period > 0) {
+		deadline = frame_start + target_period;
+		remaining = deadline - now;
+
+		// Sleep through most of the wait
+		if (remaining > spin_margin) {
+			sleep_time = (unsigned)(remaining - spin_margin);
+			if (sleep_time) {
+				before = Now();
+				Sleep(sleep_time);
+				overslept = (Now() - before) - sleep_time;
+				// Widen the margin right away if the OS overslept, else shrink it slowly
+				if (overslept + SLEEP_HEADROOM > spin_margin)
+					spin_margin = overslept + SLEEP_HEADROOM;
+				else
+					spin_margin -= (spin_margin - (overslept + SLEEP_HEADROOM)) * SPIN_MARGIN_DECAY;
+				if (spin_margin < MIN_SPIN_MARGIN)
+					spin_margin = MIN_SPIN_MARGIN;
+				else if (spin_margin > MAX_SPIN_MARGIN)
+					spin_margin = MAX_SPIN_MARGIN;
+			}
+		}
+		// Spin the rest of the way
+		while ((now = Now()) < deadline);
+
+		error = now - deadline;
+		// Stay on the ideal schedule unless more than a whole frame behind, then resync
+		if (error > target_period)
+			frame_start = now;
+		else
+			frame_start = deadline;
+
+		Record_Frame(now - last_frame_begin, work_time, error, TRUE);
+	}
+	else {
+		frame_start = now;
+		Record_Frame(now - last_frame_begin, work_time, 0, FALSE);
+	}
+	last_frame_begin = now;
+
+	// Return whole ms, carrying the fraction into the next frame
+	elapsed = (frame_start - last_start) + elapsed_carry;
+	elapsed_ms = (unsigned)elapsed;
+	elapsed_carry = elapsed - elapsed_ms;
+
+	return (elapsed_ms);
+}
+
+/*____________________________________________________________________
+|
+| Function: Pacer_Get_Work_Time
+|
+| Input: Called from Program_Run()
+| Output: Returns the time (in ms) the last frame spent working before
+|   it called Pacer_Begin_Frame() again, which excludes the time spent
+|   waiting for the frame to be due.
+|___________________________________________________________________*/
+
+float Pacer_Get_Work_Time()
+{
+	return ((float)work_time);
+}
+
+/*____________________________________________________________________
+|
+| Function: Now
+|
+| Input: Called from Pacer_Begin_Frame()
+| Output: Returns the performance counter time in ms.
+|___________________________________________________________________*/
+
+static double Now()
+{
+	LARGE_INTEGER counter;
+
+	QueryPerformanceCounter(&counter);
+	return ((double)counter.QuadPart * counter_period);
+}
+
+/*____________________________________________________________________
+|
+| Function: Record_Frame
+|
+| Input: Called from Pacer_Begin_Frame()
+| Output: Adds a frame to the statistics.
+|___________________________________________________________________*/
+
+static void Record_Frame(double frame_time, double frame_work_time, double schedule_error, int paced)
+{
+	double delta;
+
+	stat_frames++;
+	stat_work_sum += frame_work_time;
+	delta = frame_time - stat_mean;
+	stat_mean += delta / stat_frames;
+	stat_m2 += delta * (frame_time - stat_mean);
+	if (stat_frames == 1 || frame_time < stat_min)
+		stat_min = frame_time;
+	if (stat_frames == 1 || frame_time > stat_max)
+		stat_max = frame_time;
+
+	if (paced) {
+		stat_paced_frames++;
+		stat_error_sum += schedule_error;
+		if (stat_paced_frames == 1 || schedule_error > stat_error_max)
+			stat_error_max = schedule_error;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Pacer_Reset
+|
+| Input: Called from Program_Run()
+| Output: Restarts the frame clock, so time spent outside the paced
+|   loop (menus, loading) isn't counted as a frame.
+|___________________________________________________________________*/
+
+void Pacer_Reset()
+{
+	started = FALSE;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pacer_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns frame time statistics since the last reset.
+|___________________________________________________________________*/
+
+void Pacer_Get_Stats(PacerStats* stats)
+{
+	stats->frames = stat_frames;
+	stats->target_frame_time = (float)target_period;
+	stats->mean_frame_time = (float)stat_mean;
+	stats->min_frame_time = (float)stat_min;
+	stats->max_frame_time = (float)stat_max;
+	if (stat_frames > 1)
+		stats->frame_time_variance = (float)(stat_m2 / (stat_frames - 1));
+	else
+		stats->frame_time_variance = 0;
+	stats->frame_time_std_dev = sqrtf(stats->frame_time_variance);
+	if (stat_paced_frames)
+		stats->mean_schedule_error = (float)(stat_error_sum / stat_paced_frames);
+	else
+		stats->mean_schedule_error = 0;
+	stats->max_schedule_error = (float)stat_error_max;
+	stats->spin_margin = (float)spin_margin;
+	if (stat_frames)
+		stats->mean_work_time = (float)(stat_work_sum / stat_frames);
+	else
+		stats->mean_work_time = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pacer_Reset_Stats
+|
+| Input: Called from Program_Run()
+| Output: Clears the frame time statistics.
+|___________________________________________________________________*/
+
+void Pacer_Reset_Stats()
+{
+	stat_frames = 0;
+	stat_paced_frames = 0;
+	stat_mean = 0;
+	stat_m2 = 0;
+	stat_min = 0;
+	stat_max = 0;
+	stat_error_sum = 0;
+	stat_error_max = 0;
+	stat_work_sum = 0;
+}
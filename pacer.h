@@ -0,0 +1,46 @@
+/*____________________________________________________________________
+|
+| File: pacer.h
+|
+| Description: Frame pacing - caps the frame rate to a target and
+|   measures frame time stability.
+|___________________________________________________________________*/
+
+#ifndef _PACER_H_
+#define _PACER_H_
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	unsigned frames;            // # of paced frames measured
+	float    target_frame_time; // ms (0 = uncapped)
+	float    mean_frame_time;   // ms
+	float    min_frame_time;    // ms
+	float    max_frame_time;    // ms
+	float    frame_time_variance;   // ms^2
+	float    frame_time_std_dev;    // ms
+	float    mean_schedule_error;   // ms late (negative = early) waking for a frame
+	float    max_schedule_error;    // ms
+	float    spin_margin;           // ms currently spun instead of slept
+	float    mean_work_time;        // ms of each frame spent working (not waiting)
+} PacerStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+void     Pacer_Init (float target_fps);
+void     Pacer_Free ();
+void     Pacer_Set_Target_Rate (float target_fps);
+float    Pacer_Get_Target_Rate ();
+unsigned Pacer_Begin_Frame ();
+float    Pacer_Get_Work_Time ();
+void     Pacer_Reset ();
+void     Pacer_Get_Stats (PacerStats *stats);
+void     Pacer_Reset_Stats ();
+
+#endif
@@ -0,0 +1,527 @@
+/*____________________________________________________________________
+|
+| File: pipeline.cpp
+|
+| Description: Frame pipeline - simulates the next frame on a thread of
+|   its own while the main thread draws the one before.
+|
+|   A frame is simulated into one of two snapshots: the Slenders are
+|   steered, the trees, pages and Slenders in view are culled for the
+|   camera, and each one's transform is stored, along with the camera
+|   and lantern it was simulated for.  The snapshot isn't changed again
+|   until it has been drawn, so the main thread draws it without
+|   touching the world.
+|
+|   Each frame the main thread gathers input and calls
+|   Pipeline_Begin_Frame(), which hands the input to the simulation
+|   thread and returns the snapshot simulated last frame to draw.  After
+|   presenting it, Pipeline_End_Frame() waits for the new simulation,
+|   which becomes the next frame's snapshot.  The main thread owns the
+|   world (entities, BVH, colliders) between Pipeline_End_Frame() and
+|   the next Pipeline_Begin_Frame(), the simulation thread in between,
+|   so neither the snapshots nor the world need a lock.  The handoff is
+|   an event to start and an interlocked frame number to finish, spun
+|   on briefly before sleeping on an event.  A simulation's own stats
+|   go in its snapshot too, and are added to the pipeline's by the main
+|   thread once it has finished, so only the main thread writes them.
+|
+|   A frame then costs the longer of simulating and drawing instead of
+|   both, for a frame of latency: what's on screen was simulated from
+|   input gathered the frame before.  The time from gathering input to
+|   presenting it is measured every frame.  Without the thread (or
+|   after Pipeline_Reset(), when there's nothing to draw yet) the frame
+|   is simulated on the main thread and drawn straight away.
+|
+|   Culling is done against the projection given to
+|   Pipeline_Set_Projection() rather than the toolkit's frustum, which
+|   belongs to the main thread.  Particles and lights are left to the
+|   main thread, the toolkit owns them; the snapshot carries the time
+|   and lantern they're updated with.
+|
+| Functions:  Pipeline_Init
+|             Pipeline_Free
+|             Pipeline_Set_Projection
+|             Pipeline_Reset
+|             Pipeline_Begin_Frame
+|             Pipeline_End_Frame
+|               Sim_Thread
+|               Simulate
+|               Add_Draw
+|               In_View
+|               Now
+|             Pipeline_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "ecs.h"
+#include "world.h"
+#include "pipeline.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define PIPELINE_SPIN  4000   // checks of the finished frame before sleeping on it
+
+#define DEG_TO_RAD(_deg_) ((_deg_) * 3.14159265f / 180)
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// Camera basis a frame is culled with
+typedef struct {
+	gx3dVector position, right, up, forward;
+} View;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static DWORD WINAPI Sim_Thread(LPVOID param);
+static void Simulate(PipelineSnapshot* snapshot);
+static void Add_Draw(PipelineSnapshot* snapshot, int type, gx3dMatrix* matrix, gx3dSphere* bounds, gx3dColor* light);
+static bool In_View(View* view, gx3dSphere* bounds);
+static double Now();
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static PipelineSnapshot  snapshots[2];
+static int               front;         // snapshot being drawn, -1 for none
+static int               pending;       // the other one is being simulated
+static int               max_draws;
+static unsigned          frame;
+static volatile LONG     finished;      // last frame the simulation thread finished
+static HANDLE            start_event, done_event, stop_event, sim_thread;
+static LARGE_INTEGER     freq;
+static PipelineStats     stats;
+
+// Projection
+static float tan_half_fov_x, tan_half_fov_y;
+static float z_near, z_far;
+
+/*____________________________________________________________________
+|
+| Function: Pipeline_Init
+|
+| Input: Called from Program_Run()
+| Output: Starts the pipeline, with snapshots of up to max_draws draws
+|   each.  Simulates on its own thread if threaded.  Returns false if
+|   the snapshots can't be allocated, when the pipeline can't be used;
+|   if the thread can't be started every frame is simulated on the
+|   main thread.
+|___________________________________________________________________*/
+
+int Pipeline_Init(int threaded, int max_draws_per_frame)
+{
+	int i;
+
+	memset(&stats, 0, sizeof(stats));
+	QueryPerformanceFrequency(&freq);
+	max_draws = max_draws_per_frame;
+	for (i = 0; i < 2; i++) {
+		memset(&snapshots[i], 0, sizeof(PipelineSnapshot));
+		snapshots[i].draws = (PipelineDraw*)malloc(max_draws * sizeof(PipelineDraw));
+		if (snapshots[i].draws == NULL) {
+			Pipeline_Free();
+			return (FALSE);
+		}
+	}
+	front = -1;
+	pending = FALSE;
+	frame = 0;
+	finished = 0;
+	Pipeline_Set_Projection(60, 4.0f / 3, 0.1f, 1000);
+
+	// Without the thread, frames are simulated on the main thread
+	if (threaded) {
+		start_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		done_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (start_event && done_event && stop_event)
+			sim_thread = CreateThread(NULL, 0, Sim_Thread, NULL, 0, NULL);
+		if (sim_thread == NULL) {
+			if (start_event)
+				CloseHandle(start_event);
+			if (done_event)
+				CloseHandle(done_event);
+			if (stop_event)
+				CloseHandle(stop_event);
+			start_event = done_event = stop_event = NULL;
+			debug_WriteFile("Pipeline_Init(): can't start the simulation thread, simulating on the main thread");
+		}
+	}
+	stats.threaded = (sim_thread != NULL);
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Pipeline_Free
+|
+| Input: Called from Program_Run(), Pipeline_Init()
+| Output: Stops the simulation thread and frees the snapshots.
+|___________________________________________________________________*/
+
+void Pipeline_Free()
+{
+	int i;
+
+	if (stop_event) {
+		SetEvent(stop_event);
+		if (sim_thread) {
+			WaitForSingleObject(sim_thread, INFINITE);
+			CloseHandle(sim_thread);
+			sim_thread = NULL;
+		}
+		CloseHandle(stop_event);
+		stop_event = NULL;
+	}
+	if (start_event) {
+		CloseHandle(start_event);
+		start_event = NULL;
+	}
+	if (done_event) {
+		CloseHandle(done_event);
+		done_event = NULL;
+	}
+
+	for (i = 0; i < 2; i++) {
+		free(snapshots[i].draws);
+		snapshots[i].draws = NULL;
+	}
+	front = -1;
+	pending = FALSE;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pipeline_Set_Projection
+|
+| Input: Called from Program_Run(), Pipeline_Init()
+| Output: Sets the projection frames are culled for, as passed to
+|   gx3d_SetProjectionMatrix() with the screen's aspect ratio.
+|___________________________________________________________________*/
+
+void Pipeline_Set_Projection(float fov, float aspect, float near_plane, float far_plane)
+{
+	tan_half_fov_y = tanf(DEG_TO_RAD(fov) / 2);
+	tan_half_fov_x = tan_half_fov_y * aspect;
+	z_near = near_plane;
+	z_far = far_plane;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pipeline_Reset
+|
+| Input: Called from Program_Run()
+| Output: Drops the snapshot to draw, after the world has changed
+|   under it (a new round, a restored snapshot), so the next frame is
+|   simulated and drawn straight away.  Call between
+|   Pipeline_End_Frame() and Pipeline_Begin_Frame().
+|___________________________________________________________________*/
+
+void Pipeline_Reset()
+{
+	front = -1;
+}
+
+/*____________________________________________________________________
+|
+| Function: Pipeline_Begin_Frame
+|
+| Input: Called from Program_Run()
+| Output: Starts simulating a frame from input and returns the snapshot
+|   to draw this frame: the one simulated last frame, or if there isn't
+|   one (or no thread), this frame's, simulated now.  The world belongs
+|   to the simulation until Pipeline_End_Frame().
+|___________________________________________________________________*/
+
+PipelineSnapshot* Pipeline_Begin_Frame(PipelineInput* input)
+{
+	PipelineSnapshot* snapshot = &snapshots[front < 0 ? 0 : 1 - front];
+
+	snapshot->frame = ++frame;
+	snapshot->input_time = Now();
+	snapshot->input = *input;
+
+	// Simulate it while the last one is drawn
+	if (sim_thread && front >= 0) {
+		pending = TRUE;
+		SetEvent(start_event);
+		return (&snapshots[front]);
+	}
+
+	Simulate(snapshot);
+	stats.sim_time += snapshot->sim_time;
+	stats.dropped += snapshot->dropped;
+	front = (int)(snapshot - snapshots);
+
+	return (snapshot);
+}
+
+/*____________________________________________________________________
+|
+| Function: Pipeline_End_Frame
+|
+| Input: Called from Program_Run() after presenting the snapshot from
+|   Pipeline_Begin_Frame()
+| Output: Records the latency of the snapshot presented and waits for
+|   the frame being simulated.  Returns the snapshot to draw next
+|   frame, with the results of its simulation (caught).
+|___________________________________________________________________*/
+
+PipelineSnapshot* Pipeline_End_Frame()
+{
+	int i;
+	double start = Now();
+	float latency;
+
+	if (front < 0)
+		return (NULL);
+
+	latency = (float)(start - snapshots[front].input_time);
+	stats.frames++;
+	stats.latency += latency;
+	stats.last_latency = latency;
+	if (latency > stats.max_latency)
+		stats.max_latency = latency;
+
+	if (pending) {
+		for (i = 0; i < PIPELINE_SPIN && (unsigned)finished != frame; i++)
+			YieldProcessor();
+		while ((unsigned)finished != frame)
+			WaitForSingleObject(done_event, INFINITE);
+		pending = FALSE;
+		front = 1 - front;
+		stats.sim_time += snapshots[front].sim_time;
+		stats.dropped += snapshots[front].dropped;
+		stats.wait_time += Now() - start;
+	}
+
+	return (&snapshots[front]);
+}
+
+/*____________________________________________________________________
+|
+| Function: Sim_Thread
+|
+| Input: Called from Pipeline_Init() (thread start)
+| Output: Simulates each frame it's handed into the snapshot not being
+|   drawn, until the pipeline is freed.
+|___________________________________________________________________*/
+
+static DWORD WINAPI Sim_Thread(LPVOID param)
+{
+	HANDLE events[2] = { stop_event, start_event };
+
+	// The Slenders wander with rand(), whose state is per thread: seed this one's once
+	srand((unsigned)time(0));
+
+	while (WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1) {
+		// The main thread doesn't touch the back snapshot until this frame is finished
+		PipelineSnapshot* snapshot = &snapshots[1 - front];
+		Simulate(snapshot);
+		InterlockedExchange(&finished, (LONG)snapshot->frame);
+		SetEvent(done_event);
+	}
+
+	return (0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Simulate
+|
+| Input: Called from Pipeline_Begin_Frame(), Sim_Thread()
+| Output: Steers the Slenders towards the camera and stores the
+|   transform of everything in view in the snapshot.  Marks which pages
+|   are in view for picking.
+|___________________________________________________________________*/
+
+static void Simulate(PipelineSnapshot* snapshot)
+{
+	static gx3dVector billboard_normal = { 0, 0, 1 };
+	int i;
+	float len;
+	double start = Now();
+	View view;
+	gx3dMatrix m, m1, m2, m3;
+	EcsQuery query;
+	PipelineInput* input = &snapshot->input;
+
+	snapshot->num_draws = 0;
+
+	snapshot->dropped = 0;
+
+	// Move position of slender
+	snapshot->caught = FALSE;
+	World_Steer_Slenders(input->bvh, &input->position, 1, &snapshot->caught);
+
+	// Camera basis, heading forward and right level with the ground
+	view.position = input->position;
+	gx3d_NormalizeVector(&input->heading, &view.forward);
+	len = sqrtf(view.forward.x * view.forward.x + view.forward.z * view.forward.z);
+	if (len > 0) {
+		view.right.x = view.forward.z / len;
+		view.right.y = 0;
+		view.right.z = -view.forward.x / len;
+	}
+	else {
+		view.right.x = 1;
+		view.right.y = view.right.z = 0;
+	}
+	view.up.x = view.forward.y * view.right.z - view.forward.z * view.right.y;
+	view.up.y = view.forward.z * view.right.x - view.forward.x * view.right.z;
+	view.up.z = view.forward.x * view.right.y - view.forward.y * view.right.x;
+
+	// The trees in view
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_TREE) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS) | ECS_MASK(COMP_BAKED_LIGHT));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+		gx3dColor* baked_light = ECS_COLUMN(&query, gx3dColor, COMP_BAKED_LIGHT);
+		for (i = 0; i < query.count; i++)
+			if (In_View(&view, &bounds[i])) {
+				gx3d_GetTranslateMatrix(&m, pos[i].x, pos[i].y, pos[i].z);
+				Add_Draw(snapshot, ENTITY_TREE, &m, &bounds[i], &baked_light[i]);
+			}
+	}
+
+	// The papers still in the game, facing the camera
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_PAGE) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS) | ECS_MASK(COMP_ON_SCREEN));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+		bool* on_screen = ECS_COLUMN(&query, bool, COMP_ON_SCREEN);
+		for (i = 0; i < query.count; i++) {
+			on_screen[i] = In_View(&view, &bounds[i]);
+			if (on_screen[i]) {
+				gx3d_GetScaleMatrix(&m1, 1, 1, 1);
+				gx3d_GetBillboardRotateYMatrix(&m2, &billboard_normal, &input->heading);
+				gx3d_GetTranslateMatrix(&m3, pos[i].x, pos[i].y, pos[i].z);
+				gx3d_MultiplyMatrix(&m1, &m2, &m);
+				gx3d_MultiplyMatrix(&m, &m3, &m);
+				Add_Draw(snapshot, ENTITY_PAPER, &m, &bounds[i], NULL);
+			}
+		}
+	}
+
+	// SlenderMan
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_SLENDER) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+		for (i = 0; i < query.count; i++)
+			if (In_View(&view, &bounds[i])) {
+				gx3d_GetScaleMatrix(&m1, 6, 6, 6);
+				gx3d_GetBillboardRotateYMatrix(&m2, &billboard_normal, &input->heading);
+				gx3d_GetTranslateMatrix(&m3, pos[i].x, pos[i].y, pos[i].z);
+				gx3d_MultiplyMatrix(&m1, &m2, &m);
+				gx3d_MultiplyMatrix(&m, &m3, &m);
+				Add_Draw(snapshot, ENTITY_SLENDER, &m, &bounds[i], NULL);
+			}
+	}
+
+	snapshot->sim_time = Now() - start;
+}
+
+/*____________________________________________________________________
+|
+| Function: Add_Draw
+|
+| Input: Called from Simulate()
+| Output: Adds a draw to the snapshot, if there's room.
+|___________________________________________________________________*/
+
+static void Add_Draw(PipelineSnapshot* snapshot, int type, gx3dMatrix* matrix, gx3dSphere* bounds, gx3dColor* light)
+{
+	static gx3dColor no_light = { 0, 0, 0, 0 };
+	PipelineDraw* d;
+
+	if (snapshot->num_draws == max_draws) {
+		snapshot->dropped++;
+		return;
+	}
+	d = &snapshot->draws[snapshot->num_draws++];
+	d->matrix = *matrix;
+	d->bounds = *bounds;
+	d->light = light ? *light : no_light;
+	d->type = type;
+}
+
+/*____________________________________________________________________
+|
+| Function: In_View
+|
+| Input: Called from Simulate()
+| Output: Returns true if a sphere may be inside the view frustum.
+|___________________________________________________________________*/
+
+static bool In_View(View* view, gx3dSphere* bounds)
+{
+	gx3dVector d;
+	float x, y, z;
+
+	gx3d_SubtractVector(&bounds->center, &view->position, &d);
+	z = d.x * view->forward.x + d.y * view->forward.y + d.z * view->forward.z;
+	if (z + bounds->radius < z_near || z - bounds->radius > z_far)
+		return (false);
+
+	// Distance outside each side plane, x/z = tan_half_fov_x at the plane
+	x = fabsf(d.x * view->right.x + d.y * view->right.y + d.z * view->right.z);
+	y = fabsf(d.x * view->up.x + d.y * view->up.y + d.z * view->up.z);
+	if ((x - z * tan_half_fov_x) / sqrtf(1 + tan_half_fov_x * tan_half_fov_x) > bounds->radius)
+		return (false);
+	if ((y - z * tan_half_fov_y) / sqrtf(1 + tan_half_fov_y * tan_half_fov_y) > bounds->radius)
+		return (false);
+
+	return (true);
+}
+
+/*____________________________________________________________________
+|
+| Function: Now
+|
+| Input: Called from Pipeline_Begin_Frame(), Pipeline_End_Frame(),
+|   Simulate()
+| Output: Returns the time in milliseconds.
+|___________________________________________________________________*/
+
+static double Now()
+{
+	LARGE_INTEGER t;
+
+	QueryPerformanceCounter(&t);
+
+	return ((double)t.QuadPart * 1000 / freq.QuadPart);
+}
+
+/*____________________________________________________________________
+|
+| Function: Pipeline_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns the pipeline's stats, as of the last frame finished
+|   (the main thread keeps them, so they can be read at any time).
+|___________________________________________________________________*/
+
+void Pipeline_Get_Stats(PipelineStats* s)
+{
+	*s = stats;
+}
@@ -0,0 +1,82 @@
+/*____________________________________________________________________
+|
+| File: pipeline.h
+|
+| Description: Frame pipeline - simulates the next frame on a thread of
+|   its own while the main thread draws the one before.
+|___________________________________________________________________*/
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include "bvh.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+// Entity components only the game draws with, besides the world's
+#define COMP_ON_SCREEN   3  // bool, set for pages in view when a frame is simulated
+#define COMP_BAKED_LIGHT 7  // gx3dColor
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// What a frame is simulated from, gathered by the main thread
+typedef struct {
+	Bvh        bvh;              // scene BVH
+	gx3dVector position;         // camera
+	gx3dVector heading;
+	unsigned   elapsed_time;     // ms to simulate
+	gx3dVector lantern_position;
+	int        lantern_on;
+} PipelineInput;
+
+// A draw in view, with its transform
+typedef struct {
+	gx3dMatrix matrix;
+	gx3dSphere bounds;
+	gx3dColor  light;    // baked light, trees only
+	int        type;     // ENTITY_TREE, ENTITY_PAPER or ENTITY_SLENDER
+} PipelineDraw;
+
+// A simulated frame, not changed again until it has been drawn
+typedef struct {
+	unsigned      frame;
+	double        input_time;    // when its input was gathered (ms)
+	PipelineInput input;         // camera the draws were culled for, etc.
+	int           caught;        // a Slender caught the player
+	PipelineDraw *draws;
+	int           num_draws;
+	unsigned      dropped;       // draws past max_draws
+	double        sim_time;      // ms simulating it
+} PipelineSnapshot;
+
+typedef struct {
+	int      threaded;        // else simulated on the main thread before each draw
+	unsigned frames;
+	unsigned dropped;         // draws past max_draws
+	double   sim_time;        // ms simulating, over every frame
+	double   wait_time;       // ms the main thread waited for a simulation to finish
+	double   latency;         // ms from gathering input to presenting it, over every frame
+	float    last_latency;
+	float    max_latency;
+} PipelineStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int               Pipeline_Init (int threaded, int max_draws);
+void              Pipeline_Free ();
+void              Pipeline_Set_Projection (float fov, float aspect, float near_plane, float far_plane);
+void              Pipeline_Reset ();
+PipelineSnapshot *Pipeline_Begin_Frame (PipelineInput *input);
+PipelineSnapshot *Pipeline_End_Frame ();
+void              Pipeline_Get_Stats (PipelineStats *stats);
+
+#endif
@@ -0,0 +1,502 @@
+/*____________________________________________________________________
+|
+| File: renderq.cpp
+|
+| Description: Render queue - sorts a frame's draws by a 64-bit key and
+|   submits them with as few state changes as possible.
+|
+|   Each draw gets a key of, from the top bits down: layer, pass,
+|   depth, texture and mesh.  Opaque and cutout depth is the distance
+|   to the camera in RENDERQ_DEPTH_BUCKET steps, nearest first, so the
+|   Z test rejects hidden pixels while draws at similar depth are
+|   grouped by texture.  Blended depth is finer and farthest first.
+|   The sky pass follows the opaque passes, so only the sky left
+|   uncovered is shaded.
+|
+|   RenderQ_Submit() sorts the keys once and draws in key order,
+|   setting texture, ambient light and blend/alpha test state only when
+|   they change.  It also counts what the same draws would have cost in
+|   the order they were queued, for comparison.
+|
+|   Baked draws (RenderQ_Add_Baked()) are lit by a lightmap and/or their
+|   own ambient light holding the static lights, plus the lights that
+|   aren't baked.  With a lightmap, stage 0 adds the lightmap (second
+|   texture coordinates) to the lit color and stage 1 modulates that by
+|   the texture.
+|
+| Functions:  RenderQ_Init
+|             RenderQ_Free
+|             RenderQ_Begin
+|             RenderQ_Add
+|             RenderQ_Add_Baked
+|							 Add_Draw
+|							 Get_Id
+|             RenderQ_Submit
+|							 Set_Lightmap_Stages
+|							 Draw_Ambient
+|							 Compare_Keys
+|							 Count_Costs
+|             RenderQ_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "lightmgr.h"
+#include "renderq.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define RENDERQ_MAX_IDS       256    // textures or meshes told apart by the key
+#define RENDERQ_DEPTH_BUCKET  8.0f   // world units, opaque depth resolution
+#define RENDERQ_BLEND_SCALE   64.0f  // blended depth steps per world unit
+#define RENDERQ_MAX_DEPTH     0xFFFFFF
+
+#define KEY(_layer_,_pass_,_depth_,_texture_,_mesh_)  \
+	(((unsigned long long)(_layer_) << 60) | ((unsigned long long)(_pass_) << 56) | \
+	 ((unsigned long long)(_depth_) << 32) | ((unsigned long long)(_texture_) << 16) | (unsigned long long)(_mesh_))
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	gx3dObject* object;
+	gx3dMatrix  matrix;
+	gx3dTexture texture;
+	gx3dTexture lightmap;    // NULL for none
+	gx3dSphere  bounds;
+	bool        lit;         // select lights for the bounds, else full bright
+	bool        baked;       // ambient holds the static lights
+	gx3dColor   ambient;
+	int         pass;
+	float       depth;       // distance to the camera
+} Draw;
+
+typedef struct {
+	unsigned long long key;
+	int                draw;
+} SortKey;
+
+// Render state, -1 for unknown
+typedef struct {
+	void*     texture;
+	void*     lightmap;
+	gx3dColor ambient;
+	int       blend;
+	int       test;
+} State;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static Draw* Add_Draw(int layer, int pass, gx3dObject* object, gx3dMatrix* matrix, gx3dTexture texture, gx3dTexture lightmap, gx3dSphere* bounds);
+static unsigned Get_Id(void** ids, int* num_ids, void* handle);
+static void Set_Lightmap_Stages(bool on);
+static gx3dColor* Draw_Ambient(Draw* d);
+static int Compare_Keys(const void* key1, const void* key2);
+static void Count_Costs(int sorted, unsigned* state_changes, unsigned* depth_inversions, unsigned* sky_overdraws);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static Draw*        draws;
+static SortKey*     keys;
+static int          num_draws, max_draws;
+static gx3dVector   camera;
+static gx3dColor    ambient;
+static gx3dColor    white = { 1, 1, 1, 0 };
+static void*        texture_ids[RENDERQ_MAX_IDS];
+static void*        mesh_ids[RENDERQ_MAX_IDS];
+static int          num_texture_ids, num_mesh_ids;
+static RenderQStats stats;
+
+/*____________________________________________________________________
+|
+| Function: RenderQ_Init
+|
+| Input: Called from Program_Run()
+| Output: Initializes the render queue.
+|___________________________________________________________________*/
+
+void RenderQ_Init()
+{
+	draws = NULL;
+	keys = NULL;
+	num_draws = 0;
+	max_draws = 0;
+	num_texture_ids = 0;
+	num_mesh_ids = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+/*____________________________________________________________________
+|
+| Function: RenderQ_Free
+|
+| Input: Called from Program_Run()
+| Output: Frees the render queue.  Its storage belongs to the arena
+|   passed to RenderQ_Begin().
+|___________________________________________________________________*/
+
+void RenderQ_Free()
+{
+	draws = NULL;
+	keys = NULL;
+	num_draws = 0;
+	max_draws = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: RenderQ_Begin
+|
+| Input: Called from Program_Run()
+| Output: Starts a frame's queue of up to max draws, allocated from
+|   arena.  Lit draws use the given ambient light, unlit ones full
+|   white.
+|___________________________________________________________________*/
+
+void RenderQ_Begin(Arena arena, int max, gx3dVector* camera_position, gx3dColor ambient_color)
+{
+	draws = (Draw*)Arena_Alloc(arena, max * sizeof(Draw));
+	keys = (SortKey*)Arena_Alloc(arena, max * sizeof(SortKey));
+	max_draws = (draws && keys) ? max : 0;
+	num_draws = 0;
+	camera = *camera_position;
+	ambient = ambient_color;
+}
+
+/*____________________________________________________________________
+|
+| Function: RenderQ_Add
+|
+| Input: Called from Program_Run(), Terrain_Queue()
+| Output: Queues a draw of an object.  bounds is used for depth and,
+|   if lit, for light selection.
+|___________________________________________________________________*/
+
+void RenderQ_Add(int layer, int pass, gx3dObject* object, gx3dMatrix* matrix, gx3dTexture texture, gx3dSphere* bounds, int lit)
+{
+	Draw* d = Add_Draw(layer, pass, object, matrix, texture, NULL, bounds);
+
+	if (d) {
+		d->lit = lit ? true : false;
+		d->baked = false;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: RenderQ_Add_Baked
+|
+| Input: Called from Program_Run(), Terrain_Queue()
+| Output: Queues a draw of an object whose static lights are baked:
+|   into a lightmap (or NULL) and/or light, its ambient light.  Only
+|   lights that aren't baked are selected for it.
+|___________________________________________________________________*/
+
+void RenderQ_Add_Baked(int layer, int pass, gx3dObject* object, gx3dMatrix* matrix, gx3dTexture texture, gx3dTexture lightmap, gx3dSphere* bounds, gx3dColor* light)
+{
+	Draw* d = Add_Draw(layer, pass, object, matrix, texture, lightmap, bounds);
+
+	if (d) {
+		d->lit = true;
+		d->baked = true;
+		d->ambient = *light;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Add_Draw
+|
+| Input: Called from RenderQ_Add(), RenderQ_Add_Baked()
+| Output: Queues a draw and its sort key.  Returns the draw for the
+|   caller to set its lighting, or NULL if the queue is full.
+|___________________________________________________________________*/
+
+static Draw* Add_Draw(int layer, int pass, gx3dObject* object, gx3dMatrix* matrix, gx3dTexture texture, gx3dTexture lightmap, gx3dSphere* bounds)
+{
+	unsigned depth;
+	gx3dVector v;
+	Draw* d;
+
+	if (num_draws == max_draws) {
+		stats.dropped++;
+		return (NULL);
+	}
+
+	d = &draws[num_draws];
+	d->object = object;
+	d->matrix = *matrix;
+	d->texture = texture;
+	d->lightmap = lightmap;
+	d->bounds = *bounds;
+	d->pass = pass;
+	gx3d_SubtractVector(&bounds->center, &camera, &v);
+	d->depth = gx3d_VectorMagnitude(&v);
+
+	if (pass == RENDERQ_PASS_BLEND)
+		depth = RENDERQ_MAX_DEPTH - (unsigned)fminf(d->depth * RENDERQ_BLEND_SCALE, RENDERQ_MAX_DEPTH);
+	else if (pass == RENDERQ_PASS_SKY)
+		depth = 0;
+	else
+		depth = (unsigned)fminf(d->depth / RENDERQ_DEPTH_BUCKET, RENDERQ_MAX_DEPTH);
+
+	keys[num_draws].key = KEY(layer, pass, depth,
+		Get_Id(texture_ids, &num_texture_ids, texture), Get_Id(mesh_ids, &num_mesh_ids, object));
+	keys[num_draws].draw = num_draws;
+	num_draws++;
+
+	return (d);
+}
+
+/*____________________________________________________________________
+|
+| Function: Get_Id
+|
+| Input: Called from Add_Draw()
+| Output: Returns a small id for a texture or mesh handle.  The table
+|   starts over when full (handles change when assets are reloaded).
+|___________________________________________________________________*/
+
+static unsigned Get_Id(void** ids, int* num_ids, void* handle)
+{
+	int i;
+
+	for (i = 0; i < *num_ids; i++)
+		if (ids[i] == handle)
+			return (i);
+	if (*num_ids == RENDERQ_MAX_IDS)
+		*num_ids = 0;
+	ids[*num_ids] = handle;
+
+	return ((*num_ids)++);
+}
+
+/*____________________________________________________________________
+|
+| Function: RenderQ_Submit
+|
+| Input: Called from Program_Run()
+| Output: Sorts and draws the queue, then leaves alpha blending and
+|   testing disabled and the texture stages as Init_Render_State() sets
+|   them.
+|___________________________________________________________________*/
+
+void RenderQ_Submit()
+{
+	int i, blend, test;
+	unsigned changes, inversions, sky;
+	State state = { (void*)-1, (void*)-1, { -1, -1, -1, -1 }, -1, -1 };
+	gx3dColor* color;
+	Draw* d;
+
+	// Costs in the order queued
+	Count_Costs(FALSE, &changes, &inversions, &sky);
+	stats.unsorted_state_changes += changes;
+	stats.unsorted_depth_inversions += inversions;
+	stats.unsorted_sky_overdraws += sky;
+
+	qsort(keys, num_draws, sizeof(SortKey), Compare_Keys);
+
+	for (i = 0; i < num_draws; i++) {
+		d = &draws[keys[i].draw];
+		blend = (d->pass == RENDERQ_PASS_BLEND);
+		test = (d->pass == RENDERQ_PASS_CUTOUT || d->pass == RENDERQ_PASS_BLEND);
+		if (blend != state.blend) {
+			if (blend)
+				gx3d_EnableAlphaBlending();
+			else
+				gx3d_DisableAlphaBlending();
+			state.blend = blend;
+		}
+		if (test != state.test) {
+			if (test)
+				gx3d_EnableAlphaTesting(128);
+			else
+				gx3d_DisableAlphaTesting();
+			state.test = test;
+		}
+		color = Draw_Ambient(d);
+		if (color->r != state.ambient.r || color->g != state.ambient.g || color->b != state.ambient.b) {
+			gx3d_SetAmbientLight(*color);
+			state.ambient = *color;
+		}
+		if (d->lightmap != state.lightmap) {
+			if (state.lightmap == (void*)-1 || (d->lightmap == NULL) != (state.lightmap == NULL))
+				Set_Lightmap_Stages(d->lightmap != NULL);
+			if (d->lightmap)
+				gx3d_SetTexture(0, d->lightmap);
+			state.lightmap = d->lightmap;
+			state.texture = (void*)-1;
+		}
+		if (d->texture != state.texture) {
+			gx3d_SetTexture(d->lightmap ? 1 : 0, d->texture);
+			state.texture = d->texture;
+		}
+		gx3d_SetObjectMatrix(d->object, &d->matrix);
+		if (d->baked)
+			LightMgr_Select_Dynamic_For_Sphere(&d->bounds);
+		else if (d->lit)
+			LightMgr_Select_For_Sphere(&d->bounds);
+		else
+			LightMgr_Select_None();
+		gx3d_DrawObject(d->object, 0);
+	}
+	if (state.blend == TRUE)
+		gx3d_DisableAlphaBlending();
+	if (state.test == TRUE)
+		gx3d_DisableAlphaTesting();
+	if (state.lightmap != NULL && state.lightmap != (void*)-1)
+		Set_Lightmap_Stages(false);
+
+	// Costs in key order
+	Count_Costs(TRUE, &changes, &inversions, &sky);
+	stats.state_changes += changes;
+	stats.depth_inversions += inversions;
+	stats.sky_overdraws += sky;
+
+	stats.frames++;
+	stats.draws += num_draws;
+	if ((unsigned)num_draws > stats.max_draws)
+		stats.max_draws = num_draws;
+	num_draws = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Set_Lightmap_Stages
+|
+| Input: Called from RenderQ_Submit()
+| Output: Sets the texture stages for lightmapped draws (the lightmap
+|   in stage 0, the texture in stage 1), or back to a single texture.
+|___________________________________________________________________*/
+
+static void Set_Lightmap_Stages(bool on)
+{
+	if (on) {
+		gx3d_SetTextureCoordinates(0, gx3d_TEXCOORD_SET1);
+		gx3d_SetTextureAddressingMode(0, gx3d_TEXTURE_DIMENSION_U | gx3d_TEXTURE_DIMENSION_V, gx3d_TEXTURE_ADDRESSMODE_CLAMP);
+		gx3d_SetTextureColorOp(0, gx3d_TEXTURE_COLOROP_ADD, gx3d_TEXTURE_ARG_TEXTURE, gx3d_TEXTURE_ARG_CURRENT);
+		gx3d_SetTextureCoordinates(1, gx3d_TEXCOORD_SET0);
+		gx3d_SetTextureColorOp(1, gx3d_TEXTURE_COLOROP_MODULATE, gx3d_TEXTURE_ARG_TEXTURE, gx3d_TEXTURE_ARG_CURRENT);
+	}
+	else {
+		gx3d_SetTextureCoordinates(0, gx3d_TEXCOORD_SET0);
+		gx3d_SetTextureAddressingMode(0, gx3d_TEXTURE_DIMENSION_U | gx3d_TEXTURE_DIMENSION_V, gx3d_TEXTURE_ADDRESSMODE_WRAP);
+		gx3d_SetTextureColorOp(0, gx3d_TEXTURE_COLOROP_MODULATE, gx3d_TEXTURE_ARG_TEXTURE, gx3d_TEXTURE_ARG_CURRENT);
+		gx3d_SetTexture(1, NULL);
+		gx3d_SetTextureCoordinates(1, gx3d_TEXCOORD_SET1);
+		gx3d_SetTextureColorOp(1, gx3d_TEXTURE_COLOROP_DISABLE, 0, 0);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Draw_Ambient
+|
+| Input: Called from RenderQ_Submit(), Count_Costs()
+| Output: Returns the ambient light to draw with.
+|___________________________________________________________________*/
+
+static gx3dColor* Draw_Ambient(Draw* d)
+{
+	if (d->baked)
+		return (&d->ambient);
+
+	return (d->lit ? &ambient : &white);
+}
+
+/*____________________________________________________________________
+|
+| Function: Compare_Keys
+|
+| Input: Called from RenderQ_Submit() (qsort)
+| Output: Orders sort keys ascending.
+|___________________________________________________________________*/
+
+static int Compare_Keys(const void* key1, const void* key2)
+{
+	unsigned long long k1 = ((SortKey*)key1)->key, k2 = ((SortKey*)key2)->key;
+
+	return ((k1 > k2) - (k1 < k2));
+}
+
+/*____________________________________________________________________
+|
+| Function: Count_Costs
+|
+| Input: Called from RenderQ_Submit()
+| Output: Counts the state changes, opaque depth inversions and opaque
+|   draws after the sky for the queue in key order (sorted) or in the
+|   order queued.  Call before sorting for the order queued.
+|___________________________________________________________________*/
+
+static void Count_Costs(int sorted, unsigned* state_changes, unsigned* depth_inversions, unsigned* sky_overdraws)
+{
+	int i, blend, test, opaque, sky_drawn, have_depth;
+	float last_depth;
+	State state = { (void*)-1, (void*)-1, { -1, -1, -1, -1 }, -1, -1 };
+	gx3dColor* color;
+	Draw* d;
+
+	*state_changes = 0;
+	*depth_inversions = 0;
+	*sky_overdraws = 0;
+	last_depth = 0;
+	have_depth = FALSE;
+	sky_drawn = FALSE;
+	for (i = 0; i < num_draws; i++) {
+		d = sorted ? &draws[keys[i].draw] : &draws[i];
+		blend = (d->pass == RENDERQ_PASS_BLEND);
+		test = (d->pass == RENDERQ_PASS_CUTOUT || d->pass == RENDERQ_PASS_BLEND);
+		color = Draw_Ambient(d);
+		*state_changes += (blend != state.blend) + (test != state.test) + (d->texture != state.texture) + (d->lightmap != state.lightmap) +
+			(color->r != state.ambient.r || color->g != state.ambient.g || color->b != state.ambient.b);
+		state.blend = blend;
+		state.test = test;
+		state.ambient = *color;
+		state.texture = d->texture;
+		state.lightmap = d->lightmap;
+
+		opaque = (d->pass == RENDERQ_PASS_OPAQUE || d->pass == RENDERQ_PASS_CUTOUT);
+		if (opaque) {
+			if (have_depth && d->depth < last_depth)
+				(*depth_inversions)++;
+			last_depth = d->depth;
+			have_depth = TRUE;
+			if (sky_drawn)
+				(*sky_overdraws)++;
+		}
+		else if (d->pass == RENDERQ_PASS_SKY)
+			sky_drawn = TRUE;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: RenderQ_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns render queue statistics.
+|___________________________________________________________________*/
+
+void RenderQ_Get_Stats(RenderQStats* out)
+{
+	*out = stats;
+}
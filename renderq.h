@@ -0,0 +1,59 @@
+/*____________________________________________________________________
+|
+| File: renderq.h
+|
+| Description: Render queue - sorts a frame's draws by a 64-bit key and
+|   submits them with as few state changes as possible.
+|___________________________________________________________________*/
+
+#ifndef _RENDERQ_H_
+#define _RENDERQ_H_
+
+#include "arena.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+// Layers, drawn in order
+#define RENDERQ_LAYER_SCENE  0
+
+// Passes within a layer, drawn in order
+#define RENDERQ_PASS_OPAQUE  0  // front to back
+#define RENDERQ_PASS_CUTOUT  1  // alpha tested, front to back
+#define RENDERQ_PASS_SKY     2  // after everything opaque, so hidden sky fails the Z test
+#define RENDERQ_PASS_BLEND   3  // alpha blended, back to front
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	unsigned frames;
+	unsigned draws;
+	unsigned state_changes;          // texture, lightmap, ambient, blend and alpha test changes
+	unsigned unsorted_state_changes; // changes the same draws would have needed in the order queued
+	unsigned depth_inversions;       // opaque draws nearer than the one before (overdraw risk)
+	unsigned unsorted_depth_inversions;
+	unsigned sky_overdraws;          // opaque draws after the sky, drawing over shaded sky
+	unsigned unsorted_sky_overdraws;
+	unsigned max_draws;              // most draws in a frame
+	unsigned dropped;                // draws that didn't fit in the queue
+} RenderQStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+void RenderQ_Init ();
+void RenderQ_Free ();
+void RenderQ_Begin (Arena arena, int max_draws, gx3dVector *camera, gx3dColor ambient);
+void RenderQ_Add (int layer, int pass, gx3dObject *object, gx3dMatrix *matrix, gx3dTexture texture, gx3dSphere *bounds, int lit);
+void RenderQ_Add_Baked (int layer, int pass, gx3dObject *object, gx3dMatrix *matrix, gx3dTexture texture, gx3dTexture lightmap, gx3dSphere *bounds, gx3dColor *light);
+void RenderQ_Submit ();
+void RenderQ_Get_Stats (RenderQStats *stats);
+
+#endif
@@ -0,0 +1,813 @@
+/*____________________________________________________________________
+|
+| File: server.cpp
+|
+| Description: Authoritative multiplayer server - runs the forest for
+|   every player and sends each the part of the world near them.
+|
+|   Run the game with "-server" to host a game in place of playing:
+|
+|     -server [-port n] [-bots n] [-ticks n]
+|
+|   with n bots of its own joining over loopback, for n ticks (forever
+|   if not given).  Stats go to the debug file every
+|   SERVER_STATS_INTERVAL ms.
+|
+|   The server runs in the game's process but before it starts
+|   graphics mode (see Run_Server()), so it needs no display or
+|   Direct3D device: it uses the terrain's heights alone
+|   (Terrain_Init_Heights()) and the toolkit's vector math.  It still
+|   needs Windows, for its sockets and threads.
+|
+|   The server owns the round: it spawns the forest with the world
+|   module and applies its rules, so nothing a client says decides
+|   what happens.  Clients send inputs (buttons and view direction for
+|   some ms of movement) with sequence #s, each message repeating the
+|   last few so a lost packet loses nothing.  The server moves the
+|   player by each input it hasn't applied yet, against the trunk
+|   colliders, picks up pages with the same ray as the game and
+|   steers the Slenders at SERVER_TICK_RATE.  A client can't move for
+|   longer than the server has run, its inputs spend a time budget
+|   topped up each tick.
+|
+|   Every tick each client is sent a snapshot: the pages taken, the
+|   Slenders and the players within SERVER_INTEREST_RADIUS of it (in a
+|   smaller range if more than NET_MAX_VISIBLE are), quantised and delta compressed against
+|   the newest snapshot the client has acknowledged, which the server
+|   keeps NET_HISTORY ticks of.  Trees are never sent, clients
+|   generate them from the round's seed, as the game does.
+|
+|   A round ends when every page is taken or nobody connected is still
+|   playing, and the next starts with everyone back at the start.
+|
+| Functions:  Server_Init
+|               Start_Round
+|               Reset_Player
+|             Server_Free
+|             Server_Tick
+|               Find_Player
+|               Connect_Player
+|               Receive_Input
+|               Apply_Input
+|               Send_Snapshot
+|               In_Range
+|             Server_Get_Port
+|             Server_Run
+|               Report_Stats
+|             Server_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "position.h"
+#include "collide.h"
+#include "terrain.h"
+#include "world.h"
+#include "net.h"
+#include "client.h"
+#include "server.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define SERVER_TICK_TIME        (1000 / SERVER_TICK_RATE)  // ms
+#define SERVER_ARENA_SIZE       (1024 * 1024)
+#define SERVER_INTEREST_RADIUS  50.0f   // other players farther away than this aren't sent
+#define SERVER_TIMEOUT          5000    // ms without hearing from a client before it's dropped
+#define SERVER_MAX_BUDGET       (4 * SERVER_TICK_TIME)  // ms of movement a client can bank
+#define SERVER_STEER_STEPS      (60 / SERVER_TICK_RATE)  // Slender steps per tick, the game steers once a frame at 60 fps
+#define SERVER_STATS_INTERVAL   10000   // ms
+
+// Players start in rows this far apart, behind where the game starts its player
+#define SERVER_START_Z          -100.0f
+#define SERVER_START_SPACING    2.0f
+#define SERVER_START_ROW        16
+
+#define SERVER_RUN_MULTIPLIER   2.5f
+
+// Sizes of the game's models, which the server doesn't load (ptree6.lwo, billboard_paper.lwo, billboard_slender.lwo)
+#define SERVER_TREE_HEIGHT      18.288f
+#define SERVER_TREE_RADIUS      11.32f
+#define SERVER_BILLBOARD_RADIUS 0.431f
+
+#define SERVER_PI               3.14159265f
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	int            active;
+	NetAddress     address;
+	double         last_heard;      // ms
+	int            status;          // NET_STATUS_...
+	int            pages;
+	int            running;
+	gx3dVector     position;
+	gx3dVector     heading;
+	unsigned char  yaw;
+	int            has_input;
+	unsigned short last_input;      // sequence of the last input applied
+	float          budget;          // ms of movement its inputs may still use
+	unsigned       acked_tick;      // newest snapshot it has, 0 for none
+	NetState*      history;         // NET_HISTORY snapshots sent, by tick
+} Player;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Start_Round(unsigned seed);
+static void Reset_Player(Player* player, int slot);
+static int Find_Player(NetAddress* address);
+static void Connect_Player(NetAddress* address, NetBits* bits, int slot);
+static void Receive_Input(Player* player, NetBits* bits);
+static void Apply_Input(Player* player, NetInput* input);
+static void Send_Snapshot(int slot);
+static bool In_Range(Player* other, Player* player, float range);
+static void Report_Stats();
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static NetSocket      sock;
+static Player*        players;
+static int            max_players;
+static Arena          level_arena;
+static Bvh            bvh;
+static unsigned       tick;
+static unsigned char  round_number;
+static unsigned       round_seed;
+static int            num_pages;
+static EcsEntity      page_entity[NUM_PAPER];
+static NetPoint       page_points[NUM_PAPER];
+static unsigned short pages_taken;
+static int            num_slenders;
+static NetPoint       slender_points[NET_MAX_SLENDERS];  // this tick
+static NetPlayer      player_states[NET_MAX_PLAYERS];    // this tick
+static ServerStats    stats;
+
+/*____________________________________________________________________
+|
+| Function: Server_Init
+|
+| Input: Called from Server_Run(), Run_Net()
+| Output: Starts a server for up to max_clients on port (0 for any
+|   free port, see Server_Get_Port()), with the first round's forest
+|   from seed.  Needs the sockets library and the terrain initialized
+|   and owns the entity store and colliders while running.  Returns
+|   true on success.
+|___________________________________________________________________*/
+
+int Server_Init(unsigned short port, int max_clients, unsigned seed)
+{
+	int i;
+
+	memset(&stats, 0, sizeof(stats));
+	tick = 0;
+	round_number = 0;
+	bvh = NULL;
+
+	max_players = max_clients < NET_MAX_PLAYERS ? max_clients : NET_MAX_PLAYERS;
+	sock = Net_Open(port);
+	level_arena = Arena_Create(SERVER_ARENA_SIZE);
+	players = (Player*)calloc(max_players, sizeof(Player));
+	if (sock == NULL || level_arena == NULL || players == NULL) {
+		Server_Free();
+		return (FALSE);
+	}
+	for (i = 0; i < max_players; i++) {
+		players[i].history = (NetState*)calloc(NET_HISTORY, sizeof(NetState));
+		if (players[i].history == NULL) {
+			Server_Free();
+			return (FALSE);
+		}
+	}
+
+	Start_Round(seed);
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Start_Round
+|
+| Input: Called from Server_Init(), Server_Tick()
+| Output: Spawns a forest from seed and puts every player back at the
+|   start.
+|___________________________________________________________________*/
+
+static void Start_Round(unsigned seed)
+{
+	int i;
+	EcsQuery query;
+	WorldShapes shapes = { SERVER_TREE_HEIGHT, SERVER_TREE_RADIUS, SERVER_BILLBOARD_RADIUS, SERVER_BILLBOARD_RADIUS };
+
+	// Release the previous round
+	if (bvh)
+		Bvh_Free(bvh);
+	Arena_Reset(level_arena);
+
+	Ecs_Init(level_arena);
+	World_Define_Components();
+	bvh = World_Spawn(level_arena, seed, &shapes, 0, 0);
+	round_number++;
+	round_seed = seed;
+	stats.rounds++;
+
+	// Number the pages for the clients
+	num_pages = 0;
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_PAGE) | ECS_MASK(COMP_POSITION));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		for (i = 0; i < query.count && num_pages < NUM_PAPER; i++, num_pages++) {
+			page_entity[num_pages] = query.entities[i];
+			page_points[num_pages].x = Net_Quantize(pos[i].x);
+			page_points[num_pages].y = Net_Quantize(pos[i].y);
+			page_points[num_pages].z = Net_Quantize(pos[i].z);
+		}
+	}
+	pages_taken = 0;
+
+	for (i = 0; i < max_players; i++)
+		if (players[i].active)
+			Reset_Player(&players[i], i);
+}
+
+/*____________________________________________________________________
+|
+| Function: Reset_Player
+|
+| Input: Called from Start_Round(), Connect_Player()
+| Output: Puts a player at its place at the start, with no pages.
+|___________________________________________________________________*/
+
+static void Reset_Player(Player* player, int slot)
+{
+	player->status = NET_STATUS_PLAYING;
+	player->pages = 0;
+	player->running = FALSE;
+	player->position.x = ((slot % SERVER_START_ROW) - (SERVER_START_ROW - 1) / 2.0f) * SERVER_START_SPACING;
+	player->position.z = SERVER_START_Z - (slot / SERVER_START_ROW) * SERVER_START_SPACING;
+	player->position.y = Terrain_Get_Height(player->position.x, player->position.z) + NET_EYE_HEIGHT;
+	player->heading.x = 0;
+	player->heading.y = 0;
+	player->heading.z = 1;
+	player->yaw = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Server_Free
+|
+| Input: Called from Server_Run(), Run_Net()
+| Output: Stops the server, releasing the world.
+|___________________________________________________________________*/
+
+void Server_Free()
+{
+	int i;
+
+	if (players) {
+		for (i = 0; i < max_players; i++)
+			free(players[i].history);
+		free(players);
+		players = NULL;
+	}
+	if (bvh) {
+		Collide_Free();
+		Ecs_Free();
+		Bvh_Free(bvh);
+		bvh = NULL;
+	}
+	Arena_Free(level_arena);
+	level_arena = NULL;
+	Net_Close(sock);
+	sock = NULL;
+}
+
+/*____________________________________________________________________
+|
+| Function: Server_Tick
+|
+| Input: Called from Server_Run(), Run_Net()
+| Output: Runs a tick: applies the inputs that have arrived, steers the
+|   Slenders, starts a new round if this one is over and sends every
+|   client its snapshot.  Call SERVER_TICK_RATE times a second.
+|___________________________________________________________________*/
+
+void Server_Tick()
+{
+	int i, n, size, slot, type, playing;
+	unsigned char packet[NET_MAX_PACKET];
+	double start, now;
+	NetAddress from;
+	NetBits bits;
+	gx3dVector positions[NET_MAX_PLAYERS];
+	int caught[NET_MAX_PLAYERS], index[NET_MAX_PLAYERS];
+	EcsQuery query;
+
+	start = Net_Now();
+	tick++;
+
+	/*____________________________________________________________________
+	|
+	| Take in connects and inputs
+	|___________________________________________________________________*/
+
+	for (i = 0; i < max_players; i++)
+		if (players[i].active) {
+			players[i].budget += SERVER_TICK_TIME;
+			if (players[i].budget > SERVER_MAX_BUDGET)
+				players[i].budget = SERVER_MAX_BUDGET;
+		}
+
+	while ((size = Net_Receive(sock, &from, packet, sizeof(packet))) > 0) {
+		stats.bytes_received += size;
+		Net_Bits_Init(&bits, packet, size);
+		type = Net_Read_Bits(&bits, 8);
+		slot = Find_Player(&from);
+		if (type == NET_MSG_CONNECT)
+			Connect_Player(&from, &bits, slot);
+		else if (slot == -1)
+			continue;
+		else if (type == NET_MSG_INPUT)
+			Receive_Input(&players[slot], &bits);
+		else if (type == NET_MSG_DISCONNECT) {
+			players[slot].active = FALSE;
+			stats.clients--;
+		}
+	}
+
+	// Drop the clients that have gone quiet
+	now = Net_Now();
+	for (i = 0; i < max_players; i++)
+		if (players[i].active && now - players[i].last_heard > SERVER_TIMEOUT) {
+			players[i].active = FALSE;
+			stats.clients--;
+			stats.timeouts++;
+		}
+
+	/*____________________________________________________________________
+	|
+	| Simulate
+	|___________________________________________________________________*/
+
+	// The Slenders go after the players still in the game
+	n = 0;
+	for (i = 0; i < max_players; i++)
+		if (players[i].active && players[i].status == NET_STATUS_PLAYING) {
+			positions[n] = players[i].position;
+			caught[n] = FALSE;
+			index[n++] = i;
+		}
+	playing = n;
+	if (n)
+		for (int step = 0; step < SERVER_STEER_STEPS; step++)
+			World_Steer_Slenders(bvh, positions, n, caught);
+	for (i = 0; i < n; i++)
+		if (caught[i]) {
+			players[index[i]].status = NET_STATUS_CAUGHT;
+			stats.catches++;
+			playing--;
+		}
+
+	// Round over?
+	if ((stats.clients && playing == 0) || pages_taken == (1 << num_pages) - 1)
+		Start_Round(round_seed * 1664525 + 1013904223);
+
+	/*____________________________________________________________________
+	|
+	| Send snapshots
+	|___________________________________________________________________*/
+
+	// Quantise what's sent once for every client
+	num_slenders = 0;
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_SLENDER) | ECS_MASK(COMP_POSITION));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		for (i = 0; i < query.count && num_slenders < NET_MAX_SLENDERS; i++, num_slenders++) {
+			slender_points[num_slenders].x = Net_Quantize(pos[i].x);
+			slender_points[num_slenders].y = 0;
+			slender_points[num_slenders].z = Net_Quantize(pos[i].z);
+		}
+	}
+	for (i = 0; i < max_players; i++)
+		if (players[i].active) {
+			player_states[i].x = Net_Quantize(players[i].position.x);
+			player_states[i].z = Net_Quantize(players[i].position.z);
+			player_states[i].yaw = players[i].yaw;
+			player_states[i].flags = NET_FLAGS(players[i].status, players[i].running, players[i].pages);
+		}
+
+	for (i = 0; i < max_players; i++)
+		if (players[i].active)
+			Send_Snapshot(i);
+
+	stats.ticks++;
+	stats.last_tick_time = (float)(Net_Now() - start);
+	stats.tick_time += stats.last_tick_time;
+	if (stats.last_tick_time > stats.max_tick_time)
+		stats.max_tick_time = stats.last_tick_time;
+}
+
+/*____________________________________________________________________
+|
+| Function: Find_Player
+|
+| Input: Called from Server_Tick()
+| Output: Returns the slot of the client at address, -1 if none.
+|___________________________________________________________________*/
+
+static int Find_Player(NetAddress* address)
+{
+	int i;
+
+	for (i = 0; i < max_players; i++)
+		if (players[i].active && players[i].address.ip == address->ip && players[i].address.port == address->port)
+			return (i);
+
+	return (-1);
+}
+
+/*____________________________________________________________________
+|
+| Function: Connect_Player
+|
+| Input: Called from Server_Tick()
+| Output: Gives a client connecting from address a slot (keeping the
+|   one it has if it's connecting again because the welcome was lost)
+|   and welcomes it, or turns it away if the server is full.
+|___________________________________________________________________*/
+
+static void Connect_Player(NetAddress* address, NetBits* bits, int slot)
+{
+	int i;
+	unsigned char packet[8];
+	NetBits out;
+
+	if (Net_Read_Bits(bits, 16) != NET_PROTOCOL)
+		return;
+
+	Net_Bits_Init(&out, packet, sizeof(packet));
+	if (slot == -1) {
+		for (i = 0; i < max_players && players[i].active; i++)
+			;
+		if (i == max_players) {
+			Net_Write_Bits(&out, NET_MSG_REJECT, 8);
+			Net_Send(sock, address, packet, Net_Bits_Size(&out));
+			return;
+		}
+		slot = i;
+		Player* player = &players[slot];
+		player->active = TRUE;
+		player->address = *address;
+		player->has_input = FALSE;
+		player->budget = 0;
+		player->acked_tick = 0;
+		for (i = 0; i < NET_HISTORY; i++)
+			player->history[i].tick = 0;
+		Reset_Player(player, slot);
+		stats.connects++;
+		stats.clients++;
+	}
+	players[slot].last_heard = Net_Now();
+
+	Net_Write_Bits(&out, NET_MSG_WELCOME, 8);
+	Net_Write_Bits(&out, NET_PROTOCOL, 16);
+	Net_Write_Bits(&out, slot, 8);
+	Net_Write_Bits(&out, SERVER_TICK_RATE, 8);
+	if (Net_Send(sock, address, packet, Net_Bits_Size(&out)))
+		stats.bytes_sent += Net_Bits_Size(&out);
+}
+
+/*____________________________________________________________________
+|
+| Function: Receive_Input
+|
+| Input: Called from Server_Tick()
+| Output: Applies the inputs of an input message the player hasn't had
+|   yet, in order, and notes the newest snapshot it has.
+|___________________________________________________________________*/
+
+static void Receive_Input(Player* player, NetBits* bits)
+{
+	int i, count;
+	unsigned ack;
+	unsigned short newest;
+	NetInput input;
+
+	ack = Net_Read_Bits(bits, 32);
+	count = Net_Read_Bits(bits, 3);
+	newest = (unsigned short)Net_Read_Bits(bits, 16);
+	if (bits->overflow || count > NET_INPUT_REDUNDANCY)
+		return;
+
+	player->last_heard = Net_Now();
+	if (ack > player->acked_tick && ack <= tick)
+		player->acked_tick = ack;
+
+	for (i = 0; i < count; i++) {
+		Net_Read_Input(bits, &input);
+		if (bits->overflow)
+			break;
+		input.sequence = (unsigned short)(newest - (count - 1 - i));
+		// Sequence #s wrap, an input is new if it's less than half the range after the last one
+		if (player->has_input && (short)(input.sequence - player->last_input) <= 0)
+			continue;
+		Apply_Input(player, &input);
+		player->last_input = input.sequence;
+		player->has_input = TRUE;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Apply_Input
+|
+| Input: Called from Receive_Input()
+| Output: Turns and moves a player by an input, sliding along any
+|   trunk in the way, and picks up the page it's looking at if asked.
+|___________________________________________________________________*/
+
+static void Apply_Input(Player* player, NetInput* input)
+{
+	float yaw, pitch, elapsed, speed, forward, right;
+	gx3dVector move, resolved;
+	gx3dSphere sphere;
+	BvhHit hit;
+
+	stats.inputs++;
+	if (player->status != NET_STATUS_PLAYING)
+		return;
+
+	yaw = input->yaw * (2 * SERVER_PI / 65536);
+	pitch = (input->pitch / 65535.0f - 0.5f) * SERVER_PI;
+	player->heading.x = sinf(yaw) * cosf(pitch);
+	player->heading.y = sinf(pitch);
+	player->heading.z = cosf(yaw) * cosf(pitch);
+	player->yaw = (unsigned char)(input->yaw >> 8);
+
+	// Move for no longer than the server has run
+	elapsed = input->elapsed < player->budget ? input->elapsed : player->budget;
+	player->budget -= elapsed;
+	forward = (float)((input->buttons & NET_BUTTON_FORWARD) != 0) - ((input->buttons & NET_BUTTON_BACK) != 0);
+	right = (float)((input->buttons & NET_BUTTON_RIGHT) != 0) - ((input->buttons & NET_BUTTON_LEFT) != 0);
+	player->running = (forward || right) && (input->buttons & NET_BUTTON_RUN);
+	if ((forward || right) && elapsed > 0) {
+		speed = RUN_SPEED * elapsed * (player->running ? SERVER_RUN_MULTIPLIER : 1);
+		move.x = (sinf(yaw) * forward + cosf(yaw) * right) * speed;
+		move.y = 0;
+		move.z = (cosf(yaw) * forward - sinf(yaw) * right) * speed;
+		sphere.center = player->position;
+		sphere.radius = PLAYER_RADIUS;
+		if (Collide_Move_Sphere(&sphere, &move, &resolved))
+			player->position = resolved;
+		else {
+			player->position.x += move.x;
+			player->position.z += move.z;
+		}
+		player->position.y = Terrain_Get_Height(player->position.x, player->position.z) + NET_EYE_HEIGHT;
+	}
+
+	if ((input->buttons & NET_BUTTON_PICK) && World_Pick_Page(bvh, &player->position, &player->heading, &hit)) {
+		for (int i = 0; i < num_pages; i++)
+			if (page_entity[i] == (EcsEntity)hit.user)
+				pages_taken |= 1 << i;
+		stats.pages_taken++;
+		if (World_Take_Page(bvh, &hit, &player->pages) == WORLD_PAGE_WON) {
+			player->status = NET_STATUS_WON;
+			stats.wins++;
+		}
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Send_Snapshot
+|
+| Input: Called from Server_Tick()
+| Output: Sends a client this tick's snapshot of the world near it, as
+|   a delta against the newest one it has if that's still kept.
+|___________________________________________________________________*/
+
+static void Send_Snapshot(int slot)
+{
+	int i, n, others, room;
+	unsigned char packet[NET_MAX_PACKET];
+	float range;
+	Player* player = &players[slot];
+	NetState* state, * baseline;
+	NetBits bits;
+
+	state = &player->history[tick % NET_HISTORY];
+	state->tick = tick;
+	state->input_ack = player->last_input;
+	state->round = round_number;
+	state->seed = round_seed;
+	state->num_pages = num_pages;
+	memcpy(state->pages, page_points, num_pages * sizeof(NetPoint));
+	state->pages_taken = pages_taken;
+	state->num_slenders = num_slenders;
+	memcpy(state->slenders, slender_points, num_slenders * sizeof(NetPoint));
+
+	// Narrow the range until the players in it fit beside the client itself
+	for (range = SERVER_INTEREST_RADIUS; range >= 1; range /= 2) {
+		others = 0;
+		for (i = 0; i < max_players; i++)
+			if (i != slot && In_Range(&players[i], player, range))
+				others++;
+		if (others < NET_MAX_VISIBLE)
+			break;
+	}
+
+	// The client always, then as many in range as fit, in slot order as the state needs
+	n = 0;
+	room = NET_MAX_VISIBLE - 1;
+	for (i = 0; i < max_players; i++) {
+		if (i != slot) {
+			if (room == 0 || NOT In_Range(&players[i], player, range))
+				continue;
+			room--;
+		}
+		state->slots[n] = (unsigned char)i;
+		state->players[n++] = player_states[i];
+	}
+	state->num_players = n;
+	stats.players_sent += n;
+
+	baseline = NULL;
+	if (player->acked_tick && tick - player->acked_tick < NET_HISTORY && player->history[player->acked_tick % NET_HISTORY].tick == player->acked_tick)
+		baseline = &player->history[player->acked_tick % NET_HISTORY];
+
+	Net_Bits_Init(&bits, packet, sizeof(packet));
+	Net_Write_Bits(&bits, NET_MSG_SNAPSHOT, 8);
+	Net_Write_Bits(&bits, tick, 32);
+	Net_Write_Bits(&bits, baseline ? tick - baseline->tick : 0, 8);
+	Net_Write_State(&bits, state, baseline);
+	if (bits.overflow)
+		return;
+	if (baseline)
+		stats.delta_snapshots++;
+	else
+		stats.full_snapshots++;
+	if (Net_Send(sock, &player->address, packet, Net_Bits_Size(&bits)))
+		stats.bytes_sent += Net_Bits_Size(&bits);
+}
+
+/*____________________________________________________________________
+|
+| Function: In_Range
+|
+| Input: Called from Send_Snapshot()
+| Output: Returns true if other is an active player within range of
+|   player on the ground.
+|___________________________________________________________________*/
+
+static bool In_Range(Player* other, Player* player, float range)
+{
+	float dx, dz;
+
+	dx = other->position.x - player->position.x;
+	dz = other->position.z - player->position.z;
+
+	return (other->active && dx * dx + dz * dz <= range * range);
+}
+
+/*____________________________________________________________________
+|
+| Function: Server_Get_Port
+|
+| Input: Called from Server_Run(), Run_Net()
+| Output: Returns the port the server is on.
+|___________________________________________________________________*/
+
+int Server_Get_Port()
+{
+	return (sock ? Net_Get_Port(sock) : 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Server_Run
+|
+| Input: Called from Run_Server()
+| Output: Hosts a game with the given command line options, until the
+|   number of ticks asked for have run.  Returns true if the server
+|   started.
+|___________________________________________________________________*/
+
+int Server_Run(char* options)
+{
+	int i, port = NET_DEFAULT_PORT, num_bots = 0, ticks = 0;
+	char* option;
+	double next, last_report, wait;
+	NetAddress address;
+	Client* bots;
+
+	if ((option = strstr(options, "-port ")) != NULL)
+		sscanf(option + 6, "%d", &port);
+	if ((option = strstr(options, "-bots ")) != NULL)
+		sscanf(option + 6, "%d", &num_bots);
+	if ((option = strstr(options, "-ticks ")) != NULL)
+		sscanf(option + 7, "%d", &ticks);
+	if (num_bots > NET_MAX_PLAYERS)
+		num_bots = NET_MAX_PLAYERS;
+
+	if (NOT Net_Init() || NOT Server_Init((unsigned short)port, NET_MAX_PLAYERS, (unsigned)time(0))) {
+		debug_WriteFile("Server_Run(): can't start the server");
+		Net_Free();
+		return (FALSE);
+	}
+
+	// Bots join over loopback
+	bots = (Client*)calloc(num_bots ? num_bots : 1, sizeof(Client));
+	if (bots && Net_Resolve("127.0.0.1", (unsigned short)Server_Get_Port(), &address))
+		for (i = 0; i < num_bots; i++)
+			bots[i] = Client_Create(&address);
+
+	next = last_report = Net_Now();
+	for (int t = 0; ticks == 0 || t < ticks; t++) {
+		Server_Tick();
+		for (i = 0; bots && i < num_bots; i++)
+			if (bots[i])
+				Client_Bot_Update(bots[i], SERVER_TICK_TIME);
+
+		// Sleep until the next tick is due, giving up on catching up if far behind
+		next += SERVER_TICK_TIME;
+		wait = next - Net_Now();
+		if (wait > 0)
+			Net_Sleep((unsigned)wait);
+		else if (wait < -SERVER_TIMEOUT)
+			next = Net_Now();
+		if (Net_Now() - last_report >= SERVER_STATS_INTERVAL) {
+			Report_Stats();
+			last_report = Net_Now();
+		}
+	}
+	Report_Stats();
+
+	for (i = 0; bots && i < num_bots; i++)
+		Client_Free(bots[i]);
+	free(bots);
+	Server_Free();
+	Net_Free();
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Report_Stats
+|
+| Input: Called from Server_Run()
+| Output: Writes the server's stats so far to the debug file.
+|___________________________________________________________________*/
+
+static void Report_Stats()
+{
+	char str[256];
+	double seconds = (double)stats.ticks / SERVER_TICK_RATE;
+	unsigned snapshots = stats.full_snapshots + stats.delta_snapshots;
+
+	debug_WriteFile("_______________ Server ___________________");
+	sprintf(str, "port: %d, tick: %u, clients: %u (%u connects, %u timeouts)", Server_Get_Port(), stats.ticks, stats.clients, stats.connects, stats.timeouts);
+	debug_WriteFile(str);
+	sprintf(str, "rounds: %u, pages taken: %u, catches: %u, wins: %u", stats.rounds, stats.pages_taken, stats.catches, stats.wins);
+	debug_WriteFile(str);
+	sprintf(str, "tick time: %.3f ms mean, %.3f ms max", stats.ticks ? stats.tick_time / stats.ticks : 0, stats.max_tick_time);
+	debug_WriteFile(str);
+	sprintf(str, "sent: %.1f KB/s, %.0f bytes per snapshot, %u full, %u delta, %.1f players each",
+	        seconds ? stats.bytes_sent / 1024.0 / seconds : 0, snapshots ? (double)stats.bytes_sent / snapshots : 0,
+	        stats.full_snapshots, stats.delta_snapshots, snapshots ? (double)stats.players_sent / snapshots : 0);
+	debug_WriteFile(str);
+	sprintf(str, "received: %.1f KB/s, %u inputs", seconds ? stats.bytes_received / 1024.0 / seconds : 0, stats.inputs);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+}
+
+/*____________________________________________________________________
+|
+| Function: Server_Get_Stats
+|
+| Input: Called from Run_Net()
+| Output: Returns the server's stats.
+|___________________________________________________________________*/
+
+void Server_Get_Stats(ServerStats* out)
+{
+	*out = stats;
+}
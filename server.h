@@ -0,0 +1,56 @@
+/*____________________________________________________________________
+|
+| File: server.h
+|
+| Description: Authoritative multiplayer server - runs the forest for
+|   every player and sends each the part of the world near them.
+|___________________________________________________________________*/
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define SERVER_TICK_RATE  20  // ticks per second
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	unsigned           ticks;
+	unsigned           clients;             // connected now
+	unsigned           connects;
+	unsigned           timeouts;
+	unsigned           rounds;
+	unsigned           pages_taken;
+	unsigned           catches;
+	unsigned           wins;
+	unsigned           inputs;              // applied
+	unsigned           full_snapshots;      // sent with no baseline
+	unsigned           delta_snapshots;
+	unsigned           players_sent;        // in range of a client, summed over snapshots
+	unsigned long long bytes_sent;          // UDP payload
+	unsigned long long bytes_received;
+	double             tick_time;           // ms spent in Server_Tick() over every tick
+	float              last_tick_time;      // ms
+	float              max_tick_time;
+} ServerStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int  Server_Init (unsigned short port, int max_clients, unsigned seed);
+void Server_Free ();
+void Server_Tick ();
+int  Server_Get_Port ();
+int  Server_Run (char *options);
+void Server_Get_Stats (ServerStats *stats);
+
+#endif
@@ -0,0 +1,139 @@
+/*____________________________________________________________________
+|
+| File: simlod.cpp
+|
+| Description: Simulation level of detail - updates things less often
+|   the further they are from the player.
+|
+|   Each thing is put in a tier by its distance from the nearest viewer:
+|   near things are updated every tick, ones past SIMLOD_MID_DISTANCE
+|   every 4th and ones past SIMLOD_FAR_DISTANCE every 16th.  When one is
+|   updated it's given all the time elapsed since its last update, so
+|   it moves (or burns, etc.) as far as it would have every tick.
+|
+|   So the updates of a tier don't all land on the same tick, each
+|   thing is given a phase when it's added, in turn, and is due on the
+|   ticks that match its phase.  A tier of n things with a period of p
+|   is then updated n/p at a time.  Ticks count on a clock, one per
+|   simulation (the Slenders have their own, for instance), with the
+|   number of updates and skips per tier.
+|
+| Functions:  SimLod_Init
+|             SimLod_Tick
+|             SimLod_Add
+|             SimLod_Tier
+|             SimLod_Due
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "simlod.h"
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+// Ticks between updates, by tier (powers of 2)
+static unsigned tier_period[SIMLOD_TIERS] = { 1, 4, 16 };
+
+/*____________________________________________________________________
+|
+| Function: SimLod_Init
+|
+| Input: Called from World_Build(), Program_Run()
+| Output: Starts a clock at tick 0.
+|___________________________________________________________________*/
+
+void SimLod_Init(SimLodClock* clock)
+{
+	memset(clock, 0, sizeof(SimLodClock));
+}
+
+/*____________________________________________________________________
+|
+| Function: SimLod_Tick
+|
+| Input: Called from World_Steer_Slenders(), Program_Run()
+| Output: Advances a clock a tick, of elapsed_time.
+|___________________________________________________________________*/
+
+void SimLod_Tick(SimLodClock* clock, unsigned elapsed_time)
+{
+	clock->tick++;
+	clock->time += elapsed_time;
+}
+
+/*____________________________________________________________________
+|
+| Function: SimLod_Add
+|
+| Input: Called from World_Build(), Program_Run()
+| Output: Starts updating something on a clock, from now.
+|___________________________________________________________________*/
+
+void SimLod_Add(SimLodClock* clock, SimLod* lod)
+{
+	lod->last_time = clock->time;
+	lod->phase = clock->next_phase++;
+}
+
+/*____________________________________________________________________
+|
+| Function: SimLod_Tier
+|
+| Input: Called from World_Steer_Slenders(), Program_Run()
+| Output: Returns the tier of something at position, by its distance
+|   (on x and z) from the nearest of the viewers.
+|___________________________________________________________________*/
+
+int SimLod_Tier(gx3dVector* position, gx3dVector* viewers, int num_viewers)
+{
+	int i;
+	float dx, dz, d, nearest_d = -1;
+
+	for (i = 0; i < num_viewers; i++) {
+		dx = viewers[i].x - position->x;
+		dz = viewers[i].z - position->z;
+		d = dx * dx + dz * dz;
+		if (nearest_d < 0 || d < nearest_d)
+			nearest_d = d;
+	}
+
+	if (nearest_d < SIMLOD_MID_DISTANCE * SIMLOD_MID_DISTANCE)
+		return (SIMLOD_NEAR);
+	else if (nearest_d < SIMLOD_FAR_DISTANCE * SIMLOD_FAR_DISTANCE)
+		return (SIMLOD_MID);
+	else
+		return (SIMLOD_FAR);
+}
+
+/*____________________________________________________________________
+|
+| Function: SimLod_Due
+|
+| Input: Called from World_Steer_Slenders(), Program_Run()
+| Output: Returns true if something in tier is due an update this
+|   tick, with the time elapsed since its last one, which it's now
+|   marked as having had.
+|___________________________________________________________________*/
+
+int SimLod_Due(SimLodClock* clock, SimLod* lod, int tier, unsigned* elapsed_time)
+{
+	if ((clock->tick + lod->phase) & (tier_period[tier] - 1)) {
+		clock->skipped[tier]++;
+		return (FALSE);
+	}
+
+	*elapsed_time = clock->time - lod->last_time;
+	lod->last_time = clock->time;
+	clock->updates[tier]++;
+
+	return (TRUE);
+}
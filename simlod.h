@@ -0,0 +1,58 @@
+/*____________________________________________________________________
+|
+| File: simlod.h
+|
+| Description: Simulation level of detail - updates things less often
+|   the further they are from the player.
+|___________________________________________________________________*/
+
+#ifndef _SIMLOD_H_
+#define _SIMLOD_H_
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+// Tiers, by distance from the nearest viewer
+#define SIMLOD_NEAR   0   // updated every tick
+#define SIMLOD_MID    1   // every 4th
+#define SIMLOD_FAR    2   // every 16th
+#define SIMLOD_TIERS  3
+
+// Distances (world units) past which things drop to the next tier
+#define SIMLOD_MID_DISTANCE  40.0f
+#define SIMLOD_FAR_DISTANCE  100.0f
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// Ticks of one simulation, e.g. the Slenders' or the game's effects
+typedef struct {
+	unsigned tick;
+	unsigned time;                       // elapsed time summed over the ticks
+	unsigned next_phase;
+	unsigned updates[SIMLOD_TIERS];      // due, over every tick
+	unsigned skipped[SIMLOD_TIERS];      // not due, so left for a later tick
+} SimLodClock;
+
+// Something updated on a clock
+typedef struct {
+	unsigned last_time;   // clock time at its last update
+	unsigned phase;       // spreads a tier's updates over the ticks
+} SimLod;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+void SimLod_Init (SimLodClock *clock);
+void SimLod_Tick (SimLodClock *clock, unsigned elapsed_time);
+void SimLod_Add (SimLodClock *clock, SimLod *lod);
+int  SimLod_Tier (gx3dVector *position, gx3dVector *viewers, int num_viewers);
+int  SimLod_Due (SimLodClock *clock, SimLod *lod, int tier, unsigned *elapsed_time);
+
+#endif
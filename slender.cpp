@@ -0,0 +1,76 @@
+/*____________________________________________________________________
+|
+| File: slender.cpp
+|
+| Description: Slender's movement towards the player.
+|
+| Functions:  Slender_Steer
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "terrain.h"
+#include "slender.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define SLENDER_SPEED           0.005f
+#define SLENDER_JITTER          0.1f    // random variation of the direction
+#define SLENDER_WRAP            150     // past this on x or z he reappears on the other side
+
+/*____________________________________________________________________
+|
+| Function: Slender_Steer
+|
+| Input: Called from World_Steer_Slenders(), Bench_Run()
+| Output: Moves each Slender steps ticks' worth towards target and
+|   onto the ground.  Returns true if any is within catching distance
+|   of target.
+|___________________________________________________________________*/
+
+int Slender_Steer(gx3dVector* positions, int count, gx3dVector* target, float steps)
+{
+	int i, caught = FALSE;
+	gx3dVector* pos, dir, diff;
+
+	for (i = 0; i < count; i++) {
+		pos = &positions[i];
+
+		// Get direction vector from Slender to target with random variation
+		dir.x = target->x - pos->x + (float(rand()) / RAND_MAX - 0.5f) * SLENDER_JITTER;
+		dir.y = target->y;
+		dir.z = target->z - pos->z + (float(rand()) / RAND_MAX - 0.5f) * SLENDER_JITTER;
+
+		// Move Slender towards target
+		pos->x += dir.x * SLENDER_SPEED * steps;
+		pos->z += dir.z * SLENDER_SPEED * steps;
+
+		if (pos->x > SLENDER_WRAP)
+			pos->x *= -1;
+		else if (pos->x < -SLENDER_WRAP)
+			pos->x *= -1;
+		else if (pos->z > SLENDER_WRAP)
+			pos->z *= -1;
+		else if (pos->z < -SLENDER_WRAP)
+			pos->z *= -1;
+
+		// Stand him on the ground where he ended up
+		pos->y = Terrain_Get_Height(pos->x, pos->z);
+
+		// Close enough to catch the target?
+		gx3d_SubtractVector(target, pos, &diff);
+		if (gx3d_VectorMagnitude(&diff) <= SLENDER_CATCH_DISTANCE)
+			caught = TRUE;
+	}
+
+	return (caught);
+}
@@ -0,0 +1,26 @@
+/*____________________________________________________________________
+|
+| File: slender.h
+|
+| Description: Slender's movement towards the player.
+|___________________________________________________________________*/
+
+#ifndef _SLENDER_H_
+#define _SLENDER_H_
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+// Slender catches anyone this close (world units)
+#define SLENDER_CATCH_DISTANCE  10
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int Slender_Steer (gx3dVector *positions, int count, gx3dVector *target, float steps);
+
+#endif
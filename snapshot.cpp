@@ -0,0 +1,537 @@
+/*____________________________________________________________________
+|
+| File: snapshot.cpp
+|
+| Description: Binary snapshots of the world for save, load and rewind.
+|
+|   A snapshot is a fixed header, a block of caller state and an image
+|   of the entity store (see Ecs_Save_Image()), each section 16 byte
+|   aligned.  The layout is the in-memory one, so a snapshot is only
+|   valid for the build that wrote it; the header version and pointer
+|   size reject anything else.
+|
+|   The ring's buffers are sized from the entity store's image when the
+|   level is loaded (Snapshot_Init()) and grown with it when a new round
+|   spawns a bigger world (Snapshot_Reserve()), so a capture never
+|   outgrows them.  Snapshot_Capture() writes into the next buffer of a
+|   ring kept in memory; Snapshot_Rewind() hands one of those buffers to the entity
+|   store, which uses it in place, and puts a spare buffer in its slot.
+|   Snapshot_Save() builds a snapshot in the spare buffer and writes it
+|   with a single call.  Snapshot_Load() maps the file copy-on-write and
+|   the entity store adopts the view, so nothing is read or copied up
+|   front and changes to the world never reach the file.  Both restores
+|   cost the same for any # of entities.
+|
+| Functions:  Snapshot_Init
+|             Snapshot_Reserve
+|             Snapshot_Free
+|             Snapshot_Capture
+|               Write_Snapshot
+|             Snapshot_Count
+|             Snapshot_Clear
+|             Snapshot_Rewind
+|               Adopt_Snapshot
+|               Release_Adopted
+|             Snapshot_Save
+|             Snapshot_Load
+|             Snapshot_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "ecs.h"
+#include "snapshot.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define SNAPSHOT_MAGIC    "SSNP"
+#define SNAPSHOT_VERSION  1
+
+#define SNAPSHOT_ALIGN(_n_)  (((_n_) + 15) & ~15u)
+#define SNAPSHOT_HEADROOM    8   // buffers are sized an eighth past the entity store's image
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	char     magic[4];
+	unsigned version;
+	unsigned pointer_size;
+	unsigned size;         // bytes, whole snapshot
+	unsigned frame;
+	unsigned user_offset;
+	unsigned user_size;
+	unsigned ecs_offset;
+	unsigned ecs_size;
+} SnapshotHeader;
+
+typedef struct {
+	char*    buffer;
+	unsigned frame;
+} Slot;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static unsigned Write_Snapshot(char* buffer, void* user, unsigned user_size, unsigned frame);
+static int Adopt_Snapshot(char* buffer, unsigned size, void** user, unsigned* user_size);
+static void Release_Adopted();
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static Slot*         slots;
+static int           num_slots;
+static int           newest;          // slot of the newest snapshot
+static int           count;           // # of snapshots in the ring
+static unsigned      buffer_size;
+static char*         spare_buffer;    // scratch for saves, swapped into the ring on rewind
+static char*         adopted_buffer;  // ring buffer in use by the entity store
+static unsigned      adopted_size;
+static void*         adopted_view;    // mapped file in use by the entity store
+static SnapshotStats stats;
+
+/*____________________________________________________________________
+|
+| Function: Snapshot_Init
+|
+| Input: Called from Program_Run()
+| Output: Allocates a ring of ring_size snapshots, each big enough for
+|   the entity store as it is now and user_size bytes of the caller's
+|   state.  Call once the level is loaded.  Returns true on success.
+|___________________________________________________________________*/
+
+int Snapshot_Init(int ring_size, unsigned user_size)
+{
+	num_slots = ring_size;
+	newest = -1;
+	count = 0;
+	buffer_size = 0;
+	spare_buffer = NULL;
+	adopted_buffer = NULL;
+	adopted_view = NULL;
+	memset(&stats, 0, sizeof(stats));
+
+	slots = (Slot*)calloc(num_slots, sizeof(Slot));
+	if (slots == NULL) {
+		num_slots = 0;
+		return (FALSE);
+	}
+
+	return (Snapshot_Reserve(user_size));
+}
+
+/*____________________________________________________________________
+|
+| Function: Snapshot_Reserve
+|
+| Input: Called from Snapshot_Init(), Program_Run()
+| Output: Grows the ring's buffers if a snapshot of the entity store as
+|   it is now, with user_size bytes of the caller's state, wouldn't fit
+|   them.  Call after spawning a new world.  Returns true if a snapshot
+|   fits.
+|___________________________________________________________________*/
+
+int Snapshot_Reserve(unsigned user_size)
+{
+	int i;
+	unsigned image_size, size;
+	char* buffer;
+
+	if (slots == NULL)
+		return (FALSE);
+
+	image_size = Ecs_Get_Image_Size();
+	size = SNAPSHOT_ALIGN(SNAPSHOT_ALIGN(sizeof(SnapshotHeader)) + SNAPSHOT_ALIGN(user_size) + image_size + image_size / SNAPSHOT_HEADROOM);
+	if (size <= buffer_size)
+		return (TRUE);
+
+	// The snapshots in the ring are kept, a buffer that can't grow leaves the size as it was
+	for (i = 0; i < num_slots; i++) {
+		buffer = (char*)realloc(slots[i].buffer, size);
+		if (buffer == NULL)
+			return (FALSE);
+		slots[i].buffer = buffer;
+	}
+	buffer = (char*)realloc(spare_buffer, size);
+	if (buffer == NULL)
+		return (FALSE);
+	spare_buffer = buffer;
+	buffer_size = size;
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Snapshot_Free
+|
+| Input: Called from Program_Run()
+| Output: Frees the ring.  Call once the entity store is no longer in
+|   use, since it may be using a restored snapshot.
+|___________________________________________________________________*/
+
+void Snapshot_Free()
+{
+	int i;
+
+	if (slots) {
+		for (i = 0; i < num_slots; i++)
+			free(slots[i].buffer);
+		free(slots);
+		slots = NULL;
+	}
+	free(spare_buffer);
+	spare_buffer = NULL;
+	free(adopted_buffer);
+	adopted_buffer = NULL;
+	adopted_size = 0;
+	if (adopted_view) {
+		UnmapViewOfFile(adopted_view);
+		adopted_view = NULL;
+	}
+	num_slots = 0;
+	count = 0;
+	buffer_size = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Snapshot_Capture
+|
+| Input: Called from Program_Run()
+| Output: Adds a snapshot of the entity store and the caller's state to
+|   the ring, replacing the oldest if full.  Returns true on success.
+|___________________________________________________________________*/
+
+int Snapshot_Capture(void* user, unsigned user_size, unsigned frame)
+{
+	int slot;
+	LARGE_INTEGER freq, t0, t1;
+
+	if (num_slots == 0)
+		return (FALSE);
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	slot = (newest + 1) % num_slots;
+	if (NOT Write_Snapshot(slots[slot].buffer, user, user_size, frame)) {
+		stats.failures++;
+		return (FALSE);
+	}
+	slots[slot].frame = frame;
+	newest = slot;
+	if (count < num_slots)
+		count++;
+	QueryPerformanceCounter(&t1);
+
+	stats.captures++;
+	stats.last_capture_time = (float)((t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart);
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Write_Snapshot
+|
+| Input: Called from Snapshot_Capture(), Snapshot_Save()
+| Output: Writes a snapshot into buffer.  Returns its size or 0 if it
+|   doesn't fit (see Snapshot_Reserve()).
+|___________________________________________________________________*/
+
+static unsigned Write_Snapshot(char* buffer, void* user, unsigned user_size, unsigned frame)
+{
+	SnapshotHeader* header = (SnapshotHeader*)buffer;
+	unsigned user_offset = SNAPSHOT_ALIGN(sizeof(SnapshotHeader));
+	unsigned ecs_offset = user_offset + SNAPSHOT_ALIGN(user_size);
+	unsigned ecs_size = Ecs_Get_Image_Size();
+
+	if (buffer == NULL || ecs_offset + ecs_size > buffer_size)
+		return (0);
+
+	header->user_offset = user_offset;
+	header->user_size = user_size;
+	header->ecs_offset = ecs_offset;
+	header->ecs_size = ecs_size;
+	header->size = ecs_offset + ecs_size;
+	memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+	header->version = SNAPSHOT_VERSION;
+	header->pointer_size = sizeof(void*);
+	header->frame = frame;
+	memcpy(buffer + header->user_offset, user, user_size);
+	Ecs_Save_Image(buffer + header->ecs_offset);
+	stats.size = header->size;
+
+	return (header->size);
+}
+
+/*____________________________________________________________________
+|
+| Function: Snapshot_Count
+|
+| Input: Called from Program_Run()
+| Output: Returns the # of snapshots available to rewind to.
+|___________________________________________________________________*/
+
+int Snapshot_Count()
+{
+	return (count);
+}
+
+/*____________________________________________________________________
+|
+| Function: Snapshot_Clear
+|
+| Input: Called from Program_Run()
+| Output: Drops every snapshot in the ring, so there's nothing to
+|   rewind to, and releases any restored one.  Call after the entity
+|   store has been initialized again (a new round), since it may be
+|   using a restored snapshot.
+|___________________________________________________________________*/
+
+void Snapshot_Clear()
+{
+	newest = -1;
+	count = 0;
+	Release_Adopted();
+}
+
+/*____________________________________________________________________
+|
+| Function: Snapshot_Rewind
+|
+| Input: Called from Program_Run()
+| Output: Restores the entity store from the snapshot steps back in the
+|   ring (1 for the newest), dropping it and any newer ones.  Returns
+|   true on success, with the caller's state and the frame it was
+|   captured on.  The state is only valid until the next restore.
+|___________________________________________________________________*/
+
+int Snapshot_Rewind(int steps, void** user, unsigned* user_size, unsigned* frame)
+{
+	int slot;
+	char* buffer;
+	LARGE_INTEGER freq, t0, t1;
+
+	if (steps < 1 || steps > count)
+		return (FALSE);
+
+	// Keep a spare to put in the slot the entity store takes over
+	if (spare_buffer == NULL) {
+		spare_buffer = (char*)malloc(buffer_size);
+		if (spare_buffer == NULL) {
+			stats.failures++;
+			return (FALSE);
+		}
+	}
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	slot = (newest - (steps - 1) + num_slots) % num_slots;
+	buffer = slots[slot].buffer;
+	if (NOT Adopt_Snapshot(buffer, buffer_size, user, user_size)) {
+		stats.failures++;
+		return (FALSE);
+	}
+	*frame = slots[slot].frame;
+	slots[slot].buffer = spare_buffer;
+	spare_buffer = NULL;
+	Release_Adopted();
+	adopted_buffer = buffer;
+	adopted_size = buffer_size;
+	newest = (slot - 1 + num_slots) % num_slots;
+	count -= steps;
+	QueryPerformanceCounter(&t1);
+
+	stats.rewinds++;
+	stats.last_restore_time = (float)((t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart);
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Adopt_Snapshot
+|
+| Input: Called from Snapshot_Rewind(), Snapshot_Load()
+| Output: Checks a snapshot and has the entity store use its image in
+|   place.  Returns true on success.
+|___________________________________________________________________*/
+
+static int Adopt_Snapshot(char* buffer, unsigned size, void** user, unsigned* user_size)
+{
+	SnapshotHeader* header = (SnapshotHeader*)buffer;
+
+	if (size < sizeof(SnapshotHeader) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+		header->version != SNAPSHOT_VERSION || header->pointer_size != sizeof(void*) || header->size > size ||
+		header->ecs_offset > header->size || header->ecs_size > header->size - header->ecs_offset ||
+		header->user_offset > header->size || header->user_size > header->size - header->user_offset)
+		return (FALSE);
+	if (NOT Ecs_Load_Image(buffer + header->ecs_offset, header->ecs_size))
+		return (FALSE);
+
+	*user = buffer + header->user_offset;
+	*user_size = header->user_size;
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Release_Adopted
+|
+| Input: Called from Snapshot_Rewind(), Snapshot_Load(),
+|   Snapshot_Clear()
+| Output: Releases the snapshot the entity store was using before the
+|   last restore, keeping a ring buffer as the spare unless the ring
+|   has grown past it since.
+|___________________________________________________________________*/
+
+static void Release_Adopted()
+{
+	if (adopted_buffer) {
+		if (spare_buffer == NULL && adopted_size == buffer_size)
+			spare_buffer = adopted_buffer;
+		else
+			free(adopted_buffer);
+		adopted_buffer = NULL;
+	}
+	if (adopted_view) {
+		UnmapViewOfFile(adopted_view);
+		adopted_view = NULL;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Snapshot_Save
+|
+| Input: Called from Program_Run()
+| Output: Writes a snapshot of the entity store and the caller's state
+|   to a file.  Returns true on success.
+|___________________________________________________________________*/
+
+int Snapshot_Save(const char* filename, void* user, unsigned user_size)
+{
+	unsigned size;
+	int ok;
+	HANDLE file;
+	DWORD written;
+	LARGE_INTEGER freq, t0, t1;
+
+	if (spare_buffer == NULL) {
+		spare_buffer = (char*)malloc(buffer_size);
+		if (spare_buffer == NULL) {
+			stats.failures++;
+			return (FALSE);
+		}
+	}
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	ok = FALSE;
+	size = Write_Snapshot(spare_buffer, user, user_size, 0);
+	if (size) {
+		file = CreateFileA(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file != INVALID_HANDLE_VALUE) {
+			ok = WriteFile(file, spare_buffer, size, &written, NULL) && written == size;
+			CloseHandle(file);
+		}
+	}
+	QueryPerformanceCounter(&t1);
+
+	if (ok) {
+		stats.saves++;
+		stats.last_save_time = (float)((t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart);
+	}
+	else
+		stats.failures++;
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Snapshot_Load
+|
+| Input: Called from Program_Run()
+| Output: Restores the entity store from a file written by
+|   Snapshot_Save().  Returns true on success, with the caller's state.
+|   The state is only valid until the next restore.
+|___________________________________________________________________*/
+
+int Snapshot_Load(const char* filename, void** user, unsigned* user_size)
+{
+	int ok;
+	HANDLE file, mapping;
+	DWORD size;
+	void* view;
+	LARGE_INTEGER freq, t0, t1;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		stats.failures++;
+		return (FALSE);
+	}
+	size = GetFileSize(file, NULL);
+	// Copy-on-write, so the fixups made in place stay private
+	view = NULL;
+	mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (mapping) {
+		view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+
+	ok = FALSE;
+	if (view) {
+		ok = Adopt_Snapshot((char*)view, size, user, user_size);
+		if (ok) {
+			Release_Adopted();
+			adopted_view = view;
+		}
+		else
+			UnmapViewOfFile(view);
+	}
+	QueryPerformanceCounter(&t1);
+
+	if (ok) {
+		stats.loads++;
+		stats.last_restore_time = (float)((t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart);
+	}
+	else
+		stats.failures++;
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Snapshot_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns snapshot statistics.
+|___________________________________________________________________*/
+
+void Snapshot_Get_Stats(SnapshotStats* out)
+{
+	*out = stats;
+}
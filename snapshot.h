@@ -0,0 +1,44 @@
+/*____________________________________________________________________
+|
+| File: snapshot.h
+|
+| Description: Binary snapshots of the world for save, load and rewind.
+|___________________________________________________________________*/
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	unsigned captures;
+	unsigned rewinds;
+	unsigned saves;
+	unsigned loads;
+	unsigned failures;
+	unsigned size;               // bytes in the last snapshot written
+	float    last_capture_time;  // ms
+	float    last_restore_time;  // ms, rewind or load
+	float    last_save_time;     // ms, including the file write
+} SnapshotStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int  Snapshot_Init (int ring_size, unsigned user_size);
+int  Snapshot_Reserve (unsigned user_size);
+void Snapshot_Free ();
+int  Snapshot_Capture (void *user, unsigned user_size, unsigned frame);
+int  Snapshot_Count ();
+void Snapshot_Clear ();
+int  Snapshot_Rewind (int steps, void **user, unsigned *user_size, unsigned *frame);
+int  Snapshot_Save (const char *filename, void *user, unsigned user_size);
+int  Snapshot_Load (const char *filename, void **user, unsigned *user_size);
+void Snapshot_Get_Stats (SnapshotStats *stats);
+
+#endif
@@ -0,0 +1,665 @@
+/*____________________________________________________________________
+|
+| File: sprite.cpp
+|
+| Description: Screen space sprite and text batcher - draws the HUD,
+|   the full screen screens and debug text as textured quads, one
+|   draw per texture.
+|
+|   Quads are queued in screen pixels (0,0 at the top left) and drawn
+|   by Sprite_Flush() in one 2D pass: the camera is set up, the Z
+|   buffer turned off and alpha blending on once for everything queued,
+|   rather than per element.  Quads are grouped by texture, each group
+|   drawn with one object (one vertex buffer), in the order its texture
+|   was first queued, so queue what goes underneath first.  Quads of
+|   the same texture draw in the order queued.
+|
+|   The 2D pass draws on the plane the screen billboard (obj_quad)
+|   covers the screen in, at the same scale, so the mapping from
+|   pixels to that plane is taken from the billboard's corners: its
+|   texel 0,0 is the top left of the screen.
+|
+|   The toolkit uploads an object's vertices when it's first drawn, so
+|   a group's object is kept while its quads stay the same and rebuilt
+|   only when they change.  A static HUD or screen costs one draw per
+|   texture and no building, however many elements it has.
+|
+|   Text is drawn from a sheet of 8x8 glyphs (the IBM PC BIOS font,
+|   printable ASCII), written once as an image and alpha file pair so
+|   the atlas can pack it with the HUD images.
+|
+| Functions:  Sprite_Init
+|             Sprite_Free
+|             Sprite_Write_Glyphs
+|             Sprite_Set_Glyphs
+|             Sprite_Add
+|             Sprite_Text
+|             Sprite_Flush
+|							 Find_Batch
+|							 Build_Batch
+|             Sprite_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "bmp.h"
+#include "sprite.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define SPRITE_MAX_QUADS    2048    // queued between flushes
+#define SPRITE_MAX_GROUPS   16      // textures between flushes
+#define SPRITE_MAX_BATCHES  32      // objects kept for reuse
+
+// Glyph sheet: printable ASCII in rows of 16, each glyph centered in a cell so filtering doesn't reach its neighbours
+#define SPRITE_FIRST_GLYPH    32
+#define SPRITE_NUM_GLYPHS     96
+#define SPRITE_GLYPH_COLUMNS  16
+#define SPRITE_GLYPH_CELL     16
+#define SPRITE_SHEET_WIDTH    256
+#define SPRITE_SHEET_HEIGHT   128
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	float x0, y0, x1, y1;   // screen pixels
+	float u0, v0, u1, v1;
+} Quad;
+
+// An object built from a group's quads, kept while they don't change
+typedef struct {
+	TexId       texture;
+	int         num_quads;
+	Quad*       quads;        // the quads it was built from
+	gx3dObject* object;
+	unsigned    last_used;    // frame
+} Batch;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static Batch* Find_Batch(TexId texture, Quad* quads, int num_quads);
+static gx3dObject* Build_Batch(Quad* quads, int num_quads);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static gx3dObject*   screen_quad;
+static gx3dMatrix    quad_matrix;           // as the screen billboard is drawn
+static gx3dVector    plane_origin;          // top left of the screen, on the billboard's plane
+static float         plane_dx, plane_dy;    // per pixel
+static gx3dVector    plane_normal;
+static int           clockwise;             // true if the billboard's front faces are clockwise on screen
+static Quad          queue[SPRITE_MAX_QUADS];
+static unsigned char queue_group[SPRITE_MAX_QUADS];
+static Quad          sorted[SPRITE_MAX_QUADS];
+static int           num_queued;
+static TexId         groups[SPRITE_MAX_GROUPS];
+static int           group_size[SPRITE_MAX_GROUPS];
+static int           num_groups;
+static Batch         batches[SPRITE_MAX_BATCHES];
+static unsigned      frame;
+static TexId         glyph_texture = TEXMGR_INVALID;
+static AtlasRect     glyph_rect;
+static SpriteStats   stats;
+
+// IBM PC BIOS 8x8 font, ASCII 32 to 127, a byte per row from the top, bit 0 the leftmost texel
+static const unsigned char glyph_bits[SPRITE_NUM_GLYPHS][8] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // space
+	{ 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 },  // !
+	{ 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // "
+	{ 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 },  // #
+	{ 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 },  // $
+	{ 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 },  // %
+	{ 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 },  // &
+	{ 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '
+	{ 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 },  // (
+	{ 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 },  // )
+	{ 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 },  // *
+	{ 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 },  // +
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 },  // ,
+	{ 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 },  // -
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 },  // .
+	{ 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 },  // /
+	{ 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 },  // 0
+	{ 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 },  // 1
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 },  // 2
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 },  // 3
+	{ 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 },  // 4
+	{ 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 },  // 5
+	{ 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 },  // 6
+	{ 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 },  // 7
+	{ 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 },  // 8
+	{ 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 },  // 9
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 },  // :
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 },  // ;
+	{ 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 },  // <
+	{ 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 },  // =
+	{ 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 },  // >
+	{ 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 },  // ?
+	{ 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 },  // @
+	{ 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 },  // A
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 },  // B
+	{ 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 },  // C
+	{ 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 },  // D
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 },  // E
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 },  // F
+	{ 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 },  // G
+	{ 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 },  // H
+	{ 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // I
+	{ 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 },  // J
+	{ 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 },  // K
+	{ 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 },  // L
+	{ 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 },  // M
+	{ 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 },  // N
+	{ 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 },  // O
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 },  // P
+	{ 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 },  // Q
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 },  // R
+	{ 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 },  // S
+	{ 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // T
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 },  // U
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },  // V
+	{ 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 },  // W
+	{ 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 },  // X
+	{ 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 },  // Y
+	{ 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 },  // Z
+	{ 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 },  // [
+	{ 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 },  // backslash
+	{ 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 },  // ]
+	{ 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 },  // ^
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF },  // _
+	{ 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },  // `
+	{ 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 },  // a
+	{ 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 },  // b
+	{ 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 },  // c
+	{ 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 },  // d
+	{ 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 },  // e
+	{ 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 },  // f
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F },  // g
+	{ 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 },  // h
+	{ 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // i
+	{ 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E },  // j
+	{ 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 },  // k
+	{ 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // l
+	{ 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 },  // m
+	{ 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 },  // n
+	{ 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 },  // o
+	{ 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F },  // p
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 },  // q
+	{ 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 },  // r
+	{ 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 },  // s
+	{ 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 },  // t
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 },  // u
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },  // v
+	{ 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 },  // w
+	{ 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 },  // x
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F },  // y
+	{ 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 },  // z
+	{ 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 },  // {
+	{ 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 },  // |
+	{ 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 },  // }
+	{ 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // ~
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }   // delete
+};
+
+/*____________________________________________________________________
+|
+| Function: Sprite_Init
+|
+| Input: Called from Program_Run()
+| Output: Starts the batcher.  obj_quad is the screen billboard, which
+|   covers the screen when scaled by quad_scale (as drawn for the
+|   screens).  Returns true on success, false if the billboard has no
+|   texture coordinates to find its corners by.
+|___________________________________________________________________*/
+
+int Sprite_Init(gx3dObject* obj_quad, float quad_scale)
+{
+	int i, top_left, bottom_right;
+	float area, sx[3], sy[3];
+	gx3dMatrix m1, m2;
+	gx3dObjectLayer* layer;
+
+	memset(&stats, 0, sizeof(stats));
+	memset(batches, 0, sizeof(batches));
+	num_queued = 0;
+	num_groups = 0;
+	frame = 0;
+	glyph_texture = TEXMGR_INVALID;
+
+	layer = obj_quad ? obj_quad->layer : NULL;
+	if (layer == NULL || layer->num_tex_coords == 0 || layer->tex_coords[0] == NULL || layer->num_polygons == 0)
+		return (FALSE);
+
+	// The corners with texel 0,0 and 1,1 are the top left and bottom right of the screen
+	top_left = bottom_right = 0;
+	for (i = 1; i < layer->num_vertices; i++) {
+		if (layer->tex_coords[0][i].u + layer->tex_coords[0][i].v < layer->tex_coords[0][top_left].u + layer->tex_coords[0][top_left].v)
+			top_left = i;
+		if (layer->tex_coords[0][i].u + layer->tex_coords[0][i].v > layer->tex_coords[0][bottom_right].u + layer->tex_coords[0][bottom_right].v)
+			bottom_right = i;
+	}
+	plane_origin = layer->vertex[top_left];
+	plane_dx = (layer->vertex[bottom_right].x - plane_origin.x) / gxGetScreenWidth();
+	plane_dy = (layer->vertex[bottom_right].y - plane_origin.y) / gxGetScreenHeight();
+	if (plane_dx == 0 || plane_dy == 0)
+		return (FALSE);
+	if (layer->vertex_normal)
+		plane_normal = layer->vertex_normal[top_left];
+	else {
+		plane_normal.x = 0;
+		plane_normal.y = 0;
+		plane_normal.z = -1;
+	}
+
+	// Face the quads the way the billboard's first triangle faces, in screen pixels
+	for (i = 0; i < 3; i++) {
+		sx[i] = (layer->vertex[layer->polygon[0].index[i]].x - plane_origin.x) / plane_dx;
+		sy[i] = (layer->vertex[layer->polygon[0].index[i]].y - plane_origin.y) / plane_dy;
+	}
+	area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+	clockwise = (area > 0);
+
+	gx3d_GetTranslateMatrix(&m1, 0, 0, .5);
+	gx3d_GetScaleMatrix(&m2, quad_scale, quad_scale, quad_scale);
+	gx3d_MultiplyMatrix(&m1, &m2, &quad_matrix);
+	screen_quad = obj_quad;
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Sprite_Free
+|
+| Input: Called from Program_Run()
+| Output: Frees the batches kept for reuse.
+|___________________________________________________________________*/
+
+void Sprite_Free()
+{
+	int i;
+
+	for (i = 0; i < SPRITE_MAX_BATCHES; i++) {
+		if (batches[i].object)
+			gx3d_FreeObject(batches[i].object);
+		free(batches[i].quads);
+	}
+	memset(batches, 0, sizeof(batches));
+	num_queued = 0;
+	num_groups = 0;
+	screen_quad = NULL;
+}
+
+/*____________________________________________________________________
+|
+| Function: Sprite_Write_Glyphs
+|
+| Input: Called from Program_Run() before the atlas is built
+| Output: Writes the glyph sheet to an image and alpha file pair (white
+|   glyphs, alpha 255 where set), unless they're already there.
+|   Returns true if the files are ready.
+|___________________________________________________________________*/
+
+int Sprite_Write_Glyphs(const char* filename, const char* alpha_filename)
+{
+	int g, x, y, width, height, ok;
+	unsigned char *texels, *alpha, *t;
+	BmpImage image, alpha_image;
+
+	if (Bmp_Get_Size(filename, &width, &height) && width == SPRITE_SHEET_WIDTH && height == SPRITE_SHEET_HEIGHT &&
+	    Bmp_Get_Size(alpha_filename, &width, &height) && width == SPRITE_SHEET_WIDTH && height == SPRITE_SHEET_HEIGHT)
+		return (TRUE);
+
+	texels = (unsigned char*)calloc(SPRITE_SHEET_WIDTH * SPRITE_SHEET_HEIGHT, 4);
+	alpha = (unsigned char*)calloc(SPRITE_SHEET_WIDTH * SPRITE_SHEET_HEIGHT, 4);
+	ok = (texels && alpha);
+	if (ok) {
+		for (g = 0; g < SPRITE_NUM_GLYPHS; g++)
+			for (y = 0; y < SPRITE_GLYPH_SIZE; y++)
+				for (x = 0; x < SPRITE_GLYPH_SIZE; x++)
+					if (glyph_bits[g][y] & (1 << x)) {
+						int tx = (g % SPRITE_GLYPH_COLUMNS) * SPRITE_GLYPH_CELL + (SPRITE_GLYPH_CELL - SPRITE_GLYPH_SIZE) / 2 + x;
+						int ty = (g / SPRITE_GLYPH_COLUMNS) * SPRITE_GLYPH_CELL + (SPRITE_GLYPH_CELL - SPRITE_GLYPH_SIZE) / 2 + y;
+						t = texels + (ty * SPRITE_SHEET_WIDTH + tx) * 4;
+						t[0] = t[1] = t[2] = t[3] = 255;
+						t = alpha + (ty * SPRITE_SHEET_WIDTH + tx) * 4;
+						t[0] = t[1] = t[2] = t[3] = 255;
+					}
+		image.width = alpha_image.width = SPRITE_SHEET_WIDTH;
+		image.height = alpha_image.height = SPRITE_SHEET_HEIGHT;
+		image.texels = texels;
+		alpha_image.texels = alpha;
+		image.owned = alpha_image.owned = FALSE;
+		ok = Bmp_Save(filename, &image) && Bmp_Save(alpha_filename, &alpha_image);
+	}
+	free(texels);
+	free(alpha);
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Sprite_Set_Glyphs
+|
+| Input: Called from Program_Run()
+| Output: Sets the texture holding the glyph sheet, and the sheet's
+|   rect in it (NULL for the whole texture).  Text isn't drawn until
+|   this is called.
+|___________________________________________________________________*/
+
+void Sprite_Set_Glyphs(TexId texture, AtlasRect* rect)
+{
+	AtlasRect whole = { 0, 0, 1, 1 };
+
+	glyph_texture = texture;
+	glyph_rect = rect ? *rect : whole;
+}
+
+/*____________________________________________________________________
+|
+| Function: Sprite_Add
+|
+| Input: Called from Program_Run(), Sprite_Text()
+| Output: Queues a texture, or its rect (NULL for the whole texture),
+|   to be drawn over dx by dy pixels with its top left at x,y.
+|___________________________________________________________________*/
+
+void Sprite_Add(TexId texture, AtlasRect* rect, float x, float y, float dx, float dy)
+{
+	int g;
+	Quad* q;
+
+	for (g = 0; g < num_groups && groups[g] != texture; g++)
+		;
+	if (num_queued == SPRITE_MAX_QUADS || g == SPRITE_MAX_GROUPS) {
+		stats.dropped++;
+		return;
+	}
+	if (g == num_groups) {
+		groups[g] = texture;
+		group_size[g] = 0;
+		num_groups++;
+	}
+	group_size[g]++;
+
+	q = &queue[num_queued];
+	q->x0 = x;
+	q->y0 = y;
+	q->x1 = x + dx;
+	q->y1 = y + dy;
+	if (rect) {
+		q->u0 = rect->u0;
+		q->v0 = rect->v0;
+		q->u1 = rect->u1;
+		q->v1 = rect->v1;
+	}
+	else {
+		q->u0 = q->v0 = 0;
+		q->u1 = q->v1 = 1;
+	}
+	queue_group[num_queued++] = (unsigned char)g;
+}
+
+/*____________________________________________________________________
+|
+| Function: Sprite_Text
+|
+| Input: Called from Program_Run()
+| Output: Queues a line of text (or lines, split at '\n') with its top
+|   left at x,y, each glyph size pixels on a side.  Characters outside
+|   printable ASCII are drawn as '?'.
+|___________________________________________________________________*/
+
+void Sprite_Text(float x, float y, float size, const char* text)
+{
+	int c, tx, ty;
+	float left = x, su, sv;
+	AtlasRect r;
+
+	if (glyph_texture == TEXMGR_INVALID)
+		return;
+
+	su = (glyph_rect.u1 - glyph_rect.u0) / SPRITE_SHEET_WIDTH;
+	sv = (glyph_rect.v1 - glyph_rect.v0) / SPRITE_SHEET_HEIGHT;
+	for (; *text; text++) {
+		c = (unsigned char)*text;
+		if (c == '\n') {
+			x = left;
+			y += size;
+			continue;
+		}
+		if (c < SPRITE_FIRST_GLYPH || c >= SPRITE_FIRST_GLYPH + SPRITE_NUM_GLYPHS)
+			c = '?';
+		if (c != ' ') {
+			tx = ((c - SPRITE_FIRST_GLYPH) % SPRITE_GLYPH_COLUMNS) * SPRITE_GLYPH_CELL + (SPRITE_GLYPH_CELL - SPRITE_GLYPH_SIZE) / 2;
+			ty = ((c - SPRITE_FIRST_GLYPH) / SPRITE_GLYPH_COLUMNS) * SPRITE_GLYPH_CELL + (SPRITE_GLYPH_CELL - SPRITE_GLYPH_SIZE) / 2;
+			r.u0 = glyph_rect.u0 + tx * su;
+			r.v0 = glyph_rect.v0 + ty * sv;
+			r.u1 = r.u0 + SPRITE_GLYPH_SIZE * su;
+			r.v1 = r.v0 + SPRITE_GLYPH_SIZE * sv;
+			Sprite_Add(glyph_texture, &r, x, y, size, size);
+		}
+		x += size;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Sprite_Flush
+|
+| Input: Called from Program_Run() between gx3d_BeginRender() and
+|   gx3d_EndRender()
+| Output: Draws everything queued on top of the screen, a draw per
+|   texture, and empties the queue.  Restores the view matrix, Z buffer
+|   and alpha blending it changes.
+|___________________________________________________________________*/
+
+void Sprite_Flush()
+{
+	int i, g, start[SPRITE_MAX_GROUPS];
+	gx3dTexture texture;
+	gx3dMatrix view_save;
+	Batch* batch;
+
+	if (num_queued == 0 || screen_quad == NULL) {
+		num_queued = 0;
+		num_groups = 0;
+		return;
+	}
+	frame++;
+	stats.frames++;
+	stats.quads += num_queued;
+	if ((unsigned)num_queued > stats.max_quads)
+		stats.max_quads = num_queued;
+	if ((unsigned)num_groups > stats.max_batches)
+		stats.max_batches = num_groups;
+
+	// Gather each texture's quads, keeping their order
+	for (g = 0, i = 0; g < num_groups; i += group_size[g], g++)
+		start[g] = i;
+	for (i = 0; i < num_queued; i++)
+		sorted[start[queue_group[i]]++] = queue[i];
+
+	gx3d_GetViewMatrix(&view_save);
+	gx3dVector tfrom = { 0,0,-1 }, tto = { 0,0,0 }, twup = { 0,1,0 };
+	gx3d_CameraSetPosition(&tfrom, &tto, &twup, gx3d_CAMERA_ORIENTATION_LOOKTO_FIXED);
+	gx3d_CameraSetViewMatrix();
+	gx3d_DisableZBuffer();
+	gx3d_EnableAlphaBlending();
+
+	for (g = 0, i = 0; g < num_groups; i += group_size[g], g++) {
+		batch = Find_Batch(groups[g], &sorted[i], group_size[g]);
+		texture = TexMgr_Use(groups[g]);
+		if (batch && texture) {
+			gx3d_SetObjectMatrix(batch->object, &quad_matrix);
+			gx3d_SetTexture(0, texture);
+			gx3d_DrawObject(batch->object, 0);
+			stats.draws++;
+		}
+	}
+
+	gx3d_DisableAlphaBlending();
+	gx3d_EnableZBuffer();
+	gx3d_SetViewMatrix(&view_save);
+
+	num_queued = 0;
+	num_groups = 0;
+}
+
+/*____________________________________________________________________
+|
+| Function: Find_Batch
+|
+| Input: Called from Sprite_Flush()
+| Output: Returns the kept batch built from the same quads, else builds
+|   one in place of the least recently used.  Returns NULL if out of
+|   memory.
+|___________________________________________________________________*/
+
+static Batch* Find_Batch(TexId texture, Quad* quads, int num_quads)
+{
+	int i;
+	Batch *batch, *oldest = NULL;
+
+	for (i = 0; i < SPRITE_MAX_BATCHES; i++) {
+		batch = &batches[i];
+		if (batch->object && batch->texture == texture && batch->num_quads == num_quads && memcmp(batch->quads, quads, num_quads * sizeof(Quad)) == 0) {
+			batch->last_used = frame;
+			return (batch);
+		}
+		if (batch->last_used != frame && (oldest == NULL || batch->object == NULL || (oldest->object && batch->last_used < oldest->last_used)))
+			oldest = batch;
+	}
+	if (oldest == NULL)
+		return (NULL);
+
+	// Replace the least recently used
+	batch = oldest;
+	if (batch->object)
+		gx3d_FreeObject(batch->object);
+	free(batch->quads);
+	memset(batch, 0, sizeof(Batch));
+	batch->quads = (Quad*)malloc(num_quads * sizeof(Quad));
+	batch->object = batch->quads ? Build_Batch(quads, num_quads) : NULL;
+	if (batch->object == NULL) {
+		free(batch->quads);
+		batch->quads = NULL;
+		return (NULL);
+	}
+	memcpy(batch->quads, quads, num_quads * sizeof(Quad));
+	batch->texture = texture;
+	batch->num_quads = num_quads;
+	batch->last_used = frame;
+	stats.builds++;
+
+	return (batch);
+}
+
+/*____________________________________________________________________
+|
+| Function: Build_Batch
+|
+| Input: Called from Find_Batch()
+| Output: Returns an object with a textured quad for each of quads, on
+|   the screen billboard's plane, or NULL if out of memory.  The object
+|   takes over its arrays.
+|___________________________________________________________________*/
+
+static gx3dObject* Build_Batch(Quad* quads, int num_quads)
+{
+	// Corners of a quad (top left, top right, bottom right, bottom left) and its triangles either way round
+	static const unsigned short cw[6] = { 0, 1, 2, 0, 2, 3 }, ccw[6] = { 0, 2, 1, 0, 3, 2 };
+	int i, k, v;
+	const unsigned short* order = clockwise ? cw : ccw;
+	float px[4], py[4], u[4], w[4];
+	gx3dObject* object;
+	gx3dObjectLayer* layer;
+	gx3dVector *vertex, *normal;
+	gx3dUV* uv;
+	gx3dPolygon* polygon;
+
+	vertex = (gx3dVector*)malloc(num_quads * 4 * sizeof(gx3dVector));
+	normal = (gx3dVector*)malloc(num_quads * 4 * sizeof(gx3dVector));
+	uv = (gx3dUV*)malloc(num_quads * 4 * sizeof(gx3dUV));
+	polygon = (gx3dPolygon*)malloc(num_quads * 2 * sizeof(gx3dPolygon));
+	object = (vertex && normal && uv && polygon) ? gx3d_CreateObject() : NULL;
+	layer = object ? gx3d_CreateObjectLayer(object) : NULL;
+	if (layer == NULL) {
+		if (object)
+			gx3d_FreeObject(object);
+		free(vertex);
+		free(normal);
+		free(uv);
+		free(polygon);
+		return (NULL);
+	}
+
+	for (i = v = 0; i < num_quads; i++, v += 4) {
+		px[0] = px[3] = quads[i].x0;
+		px[1] = px[2] = quads[i].x1;
+		py[0] = py[1] = quads[i].y0;
+		py[2] = py[3] = quads[i].y1;
+		u[0] = u[3] = quads[i].u0;
+		u[1] = u[2] = quads[i].u1;
+		w[0] = w[1] = quads[i].v0;
+		w[2] = w[3] = quads[i].v1;
+		for (k = 0; k < 4; k++) {
+			vertex[v + k].x = plane_origin.x + px[k] * plane_dx;
+			vertex[v + k].y = plane_origin.y + py[k] * plane_dy;
+			vertex[v + k].z = plane_origin.z;
+			normal[v + k] = plane_normal;
+			uv[v + k].u = u[k];
+			uv[v + k].v = w[k];
+		}
+		for (k = 0; k < 3; k++) {
+			polygon[i * 2].index[k] = (unsigned short)(v + order[k]);
+			polygon[i * 2 + 1].index[k] = (unsigned short)(v + order[3 + k]);
+		}
+	}
+
+	layer->num_vertices = num_quads * 4;
+	layer->vertex = vertex;
+	layer->vertex_normal = normal;
+	layer->num_tex_coords = 1;
+	layer->tex_coords[0] = uv;
+	layer->num_polygons = num_quads * 2;
+	layer->polygon = polygon;
+
+	// Everything drawn lies within the screen billboard
+	object->bound_sphere = screen_quad->bound_sphere;
+	object->bound_box = screen_quad->bound_box;
+
+	return (object);
+}
+
+/*____________________________________________________________________
+|
+| Function: Sprite_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns batcher statistics.
+|___________________________________________________________________*/
+
+void Sprite_Get_Stats(SpriteStats* out)
+{
+	*out = stats;
+}
@@ -0,0 +1,52 @@
+/*____________________________________________________________________
+|
+| File: sprite.h
+|
+| Description: Screen space sprite and text batcher - draws the HUD,
+|   the full screen screens and debug text as textured quads, one
+|   draw per texture.
+|___________________________________________________________________*/
+
+#ifndef _SPRITE_H_
+#define _SPRITE_H_
+
+#include "texmgr.h"
+#include "atlas.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define SPRITE_GLYPH_SIZE  8   // texels on a side of a glyph, drawn at any multiple of this
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	unsigned frames;         // flushes with anything queued
+	unsigned quads;          // queued over every frame
+	unsigned draws;
+	unsigned builds;         // batches whose quads changed and were rebuilt
+	unsigned dropped;        // quads that didn't fit in the queue
+	unsigned max_quads;      // in a frame
+	unsigned max_batches;
+} SpriteStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int  Sprite_Init (gx3dObject *obj_quad, float quad_scale);
+void Sprite_Free ();
+int  Sprite_Write_Glyphs (const char *filename, const char *alpha_filename);
+void Sprite_Set_Glyphs (TexId texture, AtlasRect *rect);
+void Sprite_Add (TexId texture, AtlasRect *rect, float x, float y, float dx, float dy);
+void Sprite_Text (float x, float y, float size, const char *text);
+void Sprite_Flush ();
+void Sprite_Get_Stats (SpriteStats *stats);
+
+#endif
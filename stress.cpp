@@ -0,0 +1,812 @@
+/*____________________________________________________________________
+|
+| File: stress.cpp
+|
+| Description: Stress test - sweeps the size of the forest and reports
+|   how the frame time scales.
+|
+|   Run the game with "-stress" to run the sweeps in place of the game:
+|
+|     -stress [-out name] [-steps n] [-seconds s]
+|             [-trees first last] [-slenders first last] [-range first last]
+|
+|   Each step of a sweep spawns a forest with World_Spawn(), then walks
+|   a scripted camera path around it for a fixed time (a loop every
+|   -seconds, STRESS_SECONDS by default), simulating and drawing every
+|   frame as the game does, as fast as it can.  The # of trees,
+|   Slenders and the range they spawn within grow geometrically from
+|   the first value to the last over the steps.  By default two sweeps
+|   run: trees from 100 to 1M with the range growing to keep the
+|   game's density, then Slenders from 1 to 10k in the game's forest.
+|   Giving any of -trees, -slenders or -range runs one sweep of those
+|   instead, the rest kept at the game's values.
+|
+|   Each step reports its mean, 95th percentile and worst frame time,
+|   the mean time of each phase of a frame (simulate, cull and queue,
+|   draw, present), the draws queued, how long the world took to spawn
+|   and the memory it took, to name.csv and name.json ("stress" by
+|   default).  The scaling exponent of a step is how its frame time
+|   grew against the # of entities since the step before (1 is linear).
+|   The knee of a sweep is its first step over the frame budget or
+|   growing faster than linear, also written to the debug file.
+|
+| Functions:  Stress_Run
+|							 Parse_Options
+|							 Step_Value
+|							 Now
+|							 Lap
+|							 Get_Memory
+|							 Load_Assets
+|							 Free_Assets
+|							 Run_Step
+|							 Walk_Position
+|							 Compare_Doubles
+|							 Find_Knee
+|							 Write_CSV
+|							 Write_JSON
+|							 Report
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include <psapi.h>
+
+#include "ecs.h"
+#include "bvh.h"
+#include "collide.h"
+#include "lightmgr.h"
+#include "terrain.h"
+#include "renderq.h"
+#include "world.h"
+#include "stress.h"
+
+#pragma comment(lib, "psapi.lib")
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define STRESS_RESULTS_NAME     "stress"
+#define STRESS_STEPS            5
+#define STRESS_MAX_STEPS        16
+#define STRESS_MAX_SWEEPS       2
+#define STRESS_SECONDS          10      // walking each step
+#define STRESS_SEED             1
+
+#define STRESS_MIN_FRAMES       10      // per step, however long they take
+#define STRESS_MAX_FRAMES       100000
+#define STRESS_GIVE_UP          500.0   // ms, mean frame time past which a sweep stops
+#define STRESS_FRAME_BUDGET     (1000.0 / 60)
+#define STRESS_KNEE_EXPONENT    1.0     // scaling exponent past which a step is the knee
+
+// Default sweeps
+#define STRESS_MAX_TREES        1000000
+#define STRESS_MAX_SLENDERS     10000
+
+#define STRESS_FRAME_ARENA_SIZE (4 * 1024 * 1024)
+#define STRESS_MAX_DRAWS        16384
+#define STRESS_FRAME_TIME       16      // milliseconds of particle update per frame
+#define STRESS_EYE_HEIGHT       5.0f
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// Counts at the first and last step of a sweep
+typedef struct {
+	char name[16];
+	int  trees[2];
+	int  slenders[2];
+	int  range[2];
+} Sweep;
+
+typedef struct {
+	int      sweep;
+	int      trees, slenders, range;            // asked for
+	unsigned entities;                          // spawned, trees, pages and Slenders
+	double   spawn_time;                        // ms to spawn the world and build its BVH
+	int      frames;
+	double   frame_mean, frame_p95, frame_max;  // ms
+	double   simulate, cull, draw, present;     // mean ms per frame
+	double   draws;                             // mean per frame
+	unsigned dropped;                           // draws that didn't fit the queue
+	double   world_mb;                          // private memory the world took
+	double   peak_mb;                           // process working set peak so far
+	double   exponent;                          // 0 for a sweep's first step
+} Step;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static int Parse_Options(char* options, char* results_name, int* steps, double* seconds, Sweep* sweeps);
+static int Step_Value(int* ends, int step, int steps);
+static double Now();
+static double Lap(double* t);
+static void Get_Memory(double* private_mb, double* peak_mb);
+static int Load_Assets();
+static void Free_Assets();
+static int Run_Step(Sweep* sweep, int step, int steps, double seconds, double* frame_times, Step* result);
+static void Walk_Position(float fraction, float scale, gx3dVector* position, gx3dVector* heading);
+static int Compare_Doubles(const void* d1, const void* d2);
+static int Find_Knee(int sweep);
+static int Write_CSV(char* filename, Sweep* sweeps);
+static int Write_JSON(char* filename, Sweep* sweeps, int num_sweeps, double seconds);
+static void Report(char* results_name, Sweep* sweeps, int num_sweeps);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static LARGE_INTEGER      freq;
+static Step               results[STRESS_MAX_SWEEPS * STRESS_MAX_STEPS];
+static int                num_results;
+static Arena              frame_arena;
+static unsigned           hits;  // pages picked, so the work isn't skipped
+static gx3dObject*        obj_tree, * obj_skydome, * obj_paper, * obj_slender;
+static gx3dTexture        tex_tree, tex_skydome, tex_ground, tex_paper, tex_slender;
+static gx3dParticleSystem psys_fire;
+
+// Scripted walk, a loop around the fire in a forest of WORLD_SPAWN_RANGE (scaled with the range)
+static const float walk_path[][2] = {
+	{ 0, -100 }, { 60, -40 }, { 40, 60 }, { -50, 70 }, { -70, -30 }, { 0, -100 }
+};
+
+/*____________________________________________________________________
+|
+| Function: Stress_Run
+|
+| Input: Called from Program_Run()
+| Output: Runs the sweeps with the given command line options and
+|   writes the report.  Needs graphics and the terrain initialized and
+|   owns the entity store and collision world while running.  Returns
+|   true if every step ran.
+|___________________________________________________________________*/
+
+int Stress_Run(char* options)
+{
+	char results_name[MAX_PATH], filename[MAX_PATH + 8], str[128];
+	int i, s, steps, num_sweeps, completed = TRUE;
+	double seconds, *frame_times;
+	Sweep sweeps[STRESS_MAX_SWEEPS];
+
+	num_sweeps = Parse_Options(options, results_name, &steps, &seconds, sweeps);
+	QueryPerformanceFrequency(&freq);
+	num_results = 0;
+	hits = 0;
+
+	frame_arena = Arena_Create(STRESS_FRAME_ARENA_SIZE);
+	frame_times = (double*)malloc(STRESS_MAX_FRAMES * sizeof(double));
+	if (frame_arena == NULL || frame_times == NULL || NOT Load_Assets()) {
+		debug_WriteFile("Stress_Run(): can't create the frame arena or load the assets");
+		Free_Assets();
+		Arena_Free(frame_arena);
+		free(frame_times);
+		return (FALSE);
+	}
+
+	RenderQ_Init();
+	for (i = 0; i < num_sweeps; i++)
+		for (s = 0; s < steps; s++) {
+			if (NOT Run_Step(&sweeps[i], s, steps, seconds, frame_times, &results[num_results])) {
+				sprintf(str, "Stress_Run(): out of memory at step %d of the %s sweep, stopping it", s, sweeps[i].name);
+				debug_WriteFile(str);
+				completed = FALSE;
+				break;
+			}
+			results[num_results].sweep = i;
+			num_results++;
+			if (results[num_results - 1].frame_mean > STRESS_GIVE_UP) {
+				sprintf(str, "Stress_Run(): %.0f ms frames at step %d of the %s sweep, stopping it", results[num_results - 1].frame_mean, s, sweeps[i].name);
+				debug_WriteFile(str);
+				completed = FALSE;
+				break;
+			}
+		}
+	RenderQ_Free();
+
+	sprintf(filename, "%s.csv", results_name);
+	if (NOT Write_CSV(filename, sweeps))
+		debug_WriteFile("Stress_Run(): can't write the CSV report");
+	sprintf(filename, "%s.json", results_name);
+	if (NOT Write_JSON(filename, sweeps, num_sweeps, seconds))
+		debug_WriteFile("Stress_Run(): can't write the JSON report");
+	Report(results_name, sweeps, num_sweeps);
+
+	// Leave the world at the game's size
+	World_Set_Size(NUM_TREES, NUM_SLENDER, WORLD_SPAWN_RANGE);
+	Free_Assets();
+	Arena_Free(frame_arena);
+	free(frame_times);
+
+	return (completed);
+}
+
+/*____________________________________________________________________
+|
+| Function: Parse_Options
+|
+| Input: Called from Stress_Run()
+| Output: Gets the report name, # of steps, seconds per step and the
+|   sweeps to run from the command line options.  Returns the # of
+|   sweeps.
+|___________________________________________________________________*/
+
+static int Parse_Options(char* options, char* results_name, int* steps, double* seconds, Sweep* sweeps)
+{
+	char* option;
+	Sweep* sweep;
+
+	strcpy(results_name, STRESS_RESULTS_NAME);
+	*steps = STRESS_STEPS;
+	*seconds = STRESS_SECONDS;
+	if ((option = strstr(options, "-out ")) != NULL)
+		sscanf(option + 5, "%259s", results_name);
+	if ((option = strstr(options, "-steps ")) != NULL)
+		sscanf(option + 7, "%d", steps);
+	if ((option = strstr(options, "-seconds ")) != NULL)
+		sscanf(option + 9, "%lf", seconds);
+	*steps = *steps < 1 ? 1 : *steps > STRESS_MAX_STEPS ? STRESS_MAX_STEPS : *steps;
+	if (*seconds <= 0)
+		*seconds = STRESS_SECONDS;
+
+	// Asked for a sweep of their own?
+	if (strstr(options, "-trees ") || strstr(options, "-slenders ") || strstr(options, "-range ")) {
+		sweep = &sweeps[0];
+		strcpy(sweep->name, "custom");
+		sweep->trees[0] = sweep->trees[1] = NUM_TREES;
+		sweep->slenders[0] = sweep->slenders[1] = NUM_SLENDER;
+		sweep->range[0] = sweep->range[1] = WORLD_SPAWN_RANGE;
+		if ((option = strstr(options, "-trees ")) != NULL)
+			sscanf(option + 7, "%d %d", &sweep->trees[0], &sweep->trees[1]);
+		if ((option = strstr(options, "-slenders ")) != NULL)
+			sscanf(option + 10, "%d %d", &sweep->slenders[0], &sweep->slenders[1]);
+		if ((option = strstr(options, "-range ")) != NULL)
+			sscanf(option + 7, "%d %d", &sweep->range[0], &sweep->range[1]);
+		return (1);
+	}
+
+	// Trees at the game's density, keeping the range in step with the square root of the count
+	sweep = &sweeps[0];
+	strcpy(sweep->name, "trees");
+	sweep->trees[0] = NUM_TREES;
+	sweep->trees[1] = STRESS_MAX_TREES;
+	sweep->slenders[0] = sweep->slenders[1] = NUM_SLENDER;
+	sweep->range[0] = WORLD_SPAWN_RANGE;
+	sweep->range[1] = (int)(WORLD_SPAWN_RANGE * sqrt((double)STRESS_MAX_TREES / NUM_TREES));
+
+	// Slenders in the game's forest
+	sweep = &sweeps[1];
+	strcpy(sweep->name, "slenders");
+	sweep->trees[0] = sweep->trees[1] = NUM_TREES;
+	sweep->slenders[0] = NUM_SLENDER;
+	sweep->slenders[1] = STRESS_MAX_SLENDERS;
+	sweep->range[0] = sweep->range[1] = WORLD_SPAWN_RANGE;
+
+	return (2);
+}
+
+/*____________________________________________________________________
+|
+| Function: Step_Value
+|
+| Input: Called from Run_Step()
+| Output: Returns a count at a step of a sweep, growing geometrically
+|   between the first and last values (linearly if either is 0).
+|___________________________________________________________________*/
+
+static int Step_Value(int* ends, int step, int steps)
+{
+	double t = steps > 1 ? (double)step / (steps - 1) : 1;
+
+	if (ends[0] <= 0 || ends[1] <= 0)
+		return ((int)(ends[0] + (ends[1] - ends[0]) * t + 0.5));
+	else
+		return ((int)(ends[0] * pow((double)ends[1] / ends[0], t) + 0.5));
+}
+
+/*____________________________________________________________________
+|
+| Function: Now
+|
+| Input: Called from Lap(), Run_Step()
+| Output: Returns the time in milliseconds.
+|___________________________________________________________________*/
+
+static double Now()
+{
+	LARGE_INTEGER t;
+
+	QueryPerformanceCounter(&t);
+
+	return ((double)t.QuadPart * 1000 / freq.QuadPart);
+}
+
+/*____________________________________________________________________
+|
+| Function: Lap
+|
+| Input: Called from Run_Step()
+| Output: Returns the ms since t and sets t to now.
+|___________________________________________________________________*/
+
+static double Lap(double* t)
+{
+	double now = Now(), ms = now - *t;
+
+	*t = now;
+
+	return (ms);
+}
+
+/*____________________________________________________________________
+|
+| Function: Get_Memory
+|
+| Input: Called from Run_Step()
+| Output: Gets the process's private memory and its working set peak
+|   so far, in MB.
+|___________________________________________________________________*/
+
+static void Get_Memory(double* private_mb, double* peak_mb)
+{
+	PROCESS_MEMORY_COUNTERS_EX counters;
+
+	*private_mb = *peak_mb = 0;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&counters, sizeof(counters))) {
+		*private_mb = counters.PrivateUsage / 1e6;
+		*peak_mb = counters.PeakWorkingSetSize / 1e6;
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Load_Assets
+|
+| Input: Called from Stress_Run()
+| Output: Loads the models, textures and particle system the scene
+|   uses.  Returns true on success.
+|___________________________________________________________________*/
+
+static int Load_Assets()
+{
+	obj_tree = obj_skydome = obj_paper = obj_slender = NULL;
+	gx3d_ReadLWO2File("Objects\\ptree6.lwo", &obj_tree, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
+	gx3d_ReadLWO2File("Objects\\skydome.lwo", &obj_skydome, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
+	gx3d_ReadLWO2File("Objects\\billboard_paper.lwo", &obj_paper, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
+	gx3d_ReadLWO2File("Objects\\billboard_slender.lwo", &obj_slender, gx3d_VERTEXFORMAT_DEFAULT, gx3d_DONT_LOAD_TEXTURES);
+	tex_tree = gx3d_InitTexture_File("Objects\\Images\\ptree_d512.bmp", "Objects\\Images\\ptree_d512_fa.bmp", 0);
+	tex_skydome = gx3d_InitTexture_File("Objects\\Images\\Night.bmp", 0, 0);
+	tex_ground = gx3d_InitTexture_File("Objects\\Images\\Ground.bmp", 0, 0);
+	tex_paper = gx3d_InitTexture_File("Objects\\Images\\Paper.bmp", "Objects\\Images\\Paper_FA.bmp", 0);
+	tex_slender = gx3d_InitTexture_File("Objects\\Images\\Slender.bmp", "Objects\\Images\\Slender_FA.bmp", 0);
+	psys_fire = Script_ParticleSystem_Create("fire.gxps");
+
+	return (obj_tree && obj_skydome && obj_paper && obj_slender && tex_tree && tex_skydome && tex_ground && tex_paper && tex_slender && psys_fire);
+}
+
+/*____________________________________________________________________
+|
+| Function: Free_Assets
+|
+| Input: Called from Stress_Run()
+| Output: Frees whatever Load_Assets() loaded.
+|___________________________________________________________________*/
+
+static void Free_Assets()
+{
+	if (obj_tree)
+		gx3d_FreeObject(obj_tree);
+	if (obj_skydome)
+		gx3d_FreeObject(obj_skydome);
+	if (obj_paper)
+		gx3d_FreeObject(obj_paper);
+	if (obj_slender)
+		gx3d_FreeObject(obj_slender);
+	if (tex_tree)
+		gx3d_FreeTexture(tex_tree);
+	if (tex_skydome)
+		gx3d_FreeTexture(tex_skydome);
+	if (tex_ground)
+		gx3d_FreeTexture(tex_ground);
+	if (tex_paper)
+		gx3d_FreeTexture(tex_paper);
+	if (tex_slender)
+		gx3d_FreeTexture(tex_slender);
+	if (psys_fire)
+		gx3d_FreeParticleSystem(psys_fire);
+	obj_tree = obj_skydome = obj_paper = obj_slender = NULL;
+	tex_tree = tex_skydome = tex_ground = tex_paper = tex_slender = NULL;
+	psys_fire = NULL;
+}
+
+/*____________________________________________________________________
+|
+| Function: Run_Step
+|
+| Input: Called from Stress_Run()
+| Output: Spawns the forest for a step of a sweep on the heap and walks
+|   the scripted path through it for the given seconds, timing each
+|   phase of every frame.  Returns false if the world couldn't be
+|   spawned whole.
+|___________________________________________________________________*/
+
+static int Run_Step(Sweep* sweep, int step, int steps, double seconds, double* frame_times, Step* result)
+{
+	static gx3dVector billboard_normal = { 0, 0, 1 };
+	static gx3dColor color3d_white = { 1, 1, 1, 0 };
+	static gx3dColor color3d_dim = { 0.1f, 0.1f, 0.1f };
+	static gx3dMaterialData material_default = {
+	  { 1, 1, 1, 1 }, { 1, 1, 1, 1 }, { 1, 1, 1, 1 }, { 0, 0, 0, 0 }, 10
+	};
+	int f, i, caught;
+	unsigned asked;
+	double t, start, frame_start, before_mb, after_mb, duration = seconds * 1000;
+	float scale;
+	gx3dVector position, heading, to, up = { 0, 1, 0 };
+	gx3dMatrix m, m1, m2, m3;
+	gxColor black = { 0, 0, 0, 0 };
+	WorldShapes shapes;
+	RenderQStats queue_before, queue_after;
+	BvhHit hit;
+	EcsQuery query;
+	Bvh bvh;
+
+	memset(result, 0, sizeof(Step));
+	result->trees = Step_Value(sweep->trees, step, steps);
+	result->slenders = Step_Value(sweep->slenders, step, steps);
+	result->range = Step_Value(sweep->range, step, steps);
+	asked = result->trees + result->slenders + NUM_PAPER;
+
+	// Spawn the world on the heap, it can be far bigger than the game's level arena
+	shapes.tree_height = obj_tree->bound_box.max.y;
+	shapes.tree_radius = obj_tree->bound_sphere.radius;
+	shapes.paper_radius = obj_paper->bound_sphere.radius;
+	shapes.slender_radius = obj_slender->bound_sphere.radius;
+	World_Set_Size(result->trees, result->slenders, result->range);
+	Get_Memory(&before_mb, &result->peak_mb);
+	t = Now();
+	Ecs_Init(NULL);
+	World_Define_Components();
+	bvh = World_Spawn(NULL, STRESS_SEED, &shapes, 0, 0);
+	result->spawn_time = Lap(&t);
+	result->entities = Ecs_Count(ECS_MASK(COMP_POSITION));
+	Get_Memory(&after_mb, &result->peak_mb);
+	result->world_mb = after_mb - before_mb;
+	if (bvh == NULL || result->entities < asked) {
+		Ecs_Free();
+		Bvh_Free(bvh);
+		Collide_Free();
+		return (FALSE);
+	}
+
+	// Walk the loop once in the time given, however many frames that takes
+	scale = (float)result->range / WORLD_SPAWN_RANGE;
+	RenderQ_Get_Stats(&queue_before);
+	srand(STRESS_SEED);
+	start = Now();
+	for (f = 0; f < STRESS_MAX_FRAMES && (f < STRESS_MIN_FRAMES || Now() - start < duration); f++) {
+		frame_start = t = Now();
+
+		// Simulate: move along the path, the Slenders chase the camera and a page pick is tried
+		Walk_Position((float)((Now() - start) / duration), scale, &position, &heading);
+		to.x = position.x + heading.x;
+		to.y = position.y + heading.y;
+		to.z = position.z + heading.z;
+		gx3d_CameraSetPosition(&position, &to, &up, gx3d_CAMERA_ORIENTATION_LOOKTO_FIXED);
+		gx3d_CameraSetViewMatrix();
+		Terrain_Update(&position);
+		caught = FALSE;
+		World_Steer_Slenders(bvh, &position, 1, &caught);
+		if (World_Pick_Page(bvh, &position, &heading, &hit))
+			hits++;
+		result->simulate += Lap(&t);
+
+		gx3d_SetFogColor(0, 0, 0);
+		gx3d_SetLinearPixelFog(15, 150);
+		gx3d_ClearViewport(gx3d_CLEAR_SURFACE | gx3d_CLEAR_ZBUFFER, black, gx3d_MAX_ZBUFFER_VALUE, 0);
+		if (gx3d_BeginRender()) {
+			gx3d_SetMaterial(&material_default);
+			LightMgr_Reserve_Lights(0);
+			LightMgr_Begin_Frame();
+			gx3d_EnableFog();
+			result->draw += Lap(&t);
+
+			// Cull and queue
+			RenderQ_Begin(frame_arena, STRESS_MAX_DRAWS, &position, color3d_dim);
+			Terrain_Queue(tex_ground, NULL);
+			gx3d_GetScaleMatrix(&m1, 200, 100, 200);
+			gx3d_GetTranslateMatrix(&m2, 0, 0, 0);
+			gx3d_MultiplyMatrix(&m1, &m2, &m);
+			gx3dSphere sky_bounds = { { 0, 0, 0 }, 200 };
+			RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_SKY, obj_skydome, &m, tex_skydome, &sky_bounds, FALSE);
+			Ecs_Query_Begin(&query, ECS_MASK(COMP_TREE) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS));
+			while (Ecs_Query_Next(&query)) {
+				gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+				gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+				for (i = 0; i < query.count; i++)
+					if (gx3d_Relation_Sphere_Frustum(&bounds[i]) != gxRELATION_OUTSIDE) {
+						gx3d_GetTranslateMatrix(&m, pos[i].x, pos[i].y, pos[i].z);
+						RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_CUTOUT, obj_tree, &m, tex_tree, &bounds[i], TRUE);
+					}
+			}
+			Ecs_Query_Begin(&query, ECS_MASK(COMP_PAGE) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS));
+			while (Ecs_Query_Next(&query)) {
+				gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+				gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+				for (i = 0; i < query.count; i++)
+					if (gx3d_Relation_Sphere_Frustum(&bounds[i]) != gxRELATION_OUTSIDE) {
+						gx3d_GetBillboardRotateYMatrix(&m2, &billboard_normal, &heading);
+						gx3d_GetTranslateMatrix(&m3, pos[i].x, pos[i].y, pos[i].z);
+						gx3d_MultiplyMatrix(&m2, &m3, &m);
+						RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_BLEND, obj_paper, &m, tex_paper, &bounds[i], TRUE);
+					}
+			}
+			Ecs_Query_Begin(&query, ECS_MASK(COMP_SLENDER) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS));
+			while (Ecs_Query_Next(&query)) {
+				gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+				gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+				for (i = 0; i < query.count; i++)
+					if (gx3d_Relation_Sphere_Frustum(&bounds[i]) != gxRELATION_OUTSIDE) {
+						gx3d_GetScaleMatrix(&m1, 6, 6, 6);
+						gx3d_GetBillboardRotateYMatrix(&m2, &billboard_normal, &heading);
+						gx3d_GetTranslateMatrix(&m3, pos[i].x, pos[i].y, pos[i].z);
+						gx3d_MultiplyMatrix(&m1, &m2, &m);
+						gx3d_MultiplyMatrix(&m, &m3, &m);
+						RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_BLEND, obj_slender, &m, tex_slender, &bounds[i], TRUE);
+					}
+			}
+			result->cull += Lap(&t);
+
+			// Draw
+			RenderQ_Submit();
+			gx3d_DisableFog();
+			gx3d_SetAmbientLight(color3d_white);
+			gx3d_EnableAlphaBlending();
+			gx3d_GetTranslateMatrix(&m, 0, -0.5, 0);
+			gx3d_SetParticleSystemMatrix(psys_fire, &m);
+			gx3d_UpdateParticleSystem(psys_fire, STRESS_FRAME_TIME);
+			gx3d_DrawParticleSystem(psys_fire, &heading, FALSE);
+			gx3d_DisableAlphaBlending();
+			gx3d_EndRender();
+			result->draw += Lap(&t);
+
+			gxFlipVisualActivePages(FALSE);
+			result->present += Lap(&t);
+		}
+		Arena_Reset(frame_arena);
+
+		frame_times[f] = Now() - frame_start;
+	}
+	result->frames = f;
+	RenderQ_Get_Stats(&queue_after);
+	result->draws = (double)(queue_after.draws - queue_before.draws) / f;
+	result->dropped = queue_after.dropped - queue_before.dropped;
+	result->simulate /= f;
+	result->cull /= f;
+	result->draw /= f;
+	result->present /= f;
+
+	for (i = 0; i < f; i++)
+		result->frame_mean += frame_times[i];
+	result->frame_mean /= f;
+	qsort(frame_times, f, sizeof(double), Compare_Doubles);
+	result->frame_p95 = frame_times[(int)(0.95f * (f - 1))];
+	result->frame_max = frame_times[f - 1];
+
+	Get_Memory(&after_mb, &result->peak_mb);
+
+	// Against the step before in the same sweep
+	if (step > 0) {
+		Step* prev = result - 1;
+		if (prev->frame_mean > 0 && result->entities != prev->entities)
+			result->exponent = log(result->frame_mean / prev->frame_mean) / log((double)result->entities / prev->entities);
+	}
+
+	Ecs_Free();
+	Bvh_Free(bvh);
+	Collide_Free();
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Walk_Position
+|
+| Input: Called from Run_Step()
+| Output: Returns the eye position and heading a fraction of the way
+|   around the scripted path, scaled by scale, which loops.
+|___________________________________________________________________*/
+
+static void Walk_Position(float fraction, float scale, gx3dVector* position, gx3dVector* heading)
+{
+	int i, num_segments = sizeof(walk_path) / sizeof(walk_path[0]) - 1;
+	float dx, dz, length, distance, total = 0;
+
+	for (i = 0; i < num_segments; i++) {
+		dx = walk_path[i + 1][0] - walk_path[i][0];
+		dz = walk_path[i + 1][1] - walk_path[i][1];
+		total += sqrtf(dx * dx + dz * dz);
+	}
+	distance = (fraction - floorf(fraction)) * total;
+
+	for (i = 0; i < num_segments; i++) {
+		dx = walk_path[i + 1][0] - walk_path[i][0];
+		dz = walk_path[i + 1][1] - walk_path[i][1];
+		length = sqrtf(dx * dx + dz * dz);
+		if (distance <= length || i == num_segments - 1)
+			break;
+		distance -= length;
+	}
+	heading->x = dx / length;
+	heading->y = 0;
+	heading->z = dz / length;
+	position->x = (walk_path[i][0] + heading->x * distance) * scale;
+	position->z = (walk_path[i][1] + heading->z * distance) * scale;
+	position->y = Terrain_Get_Height(position->x, position->z) + STRESS_EYE_HEIGHT;
+}
+
+/*____________________________________________________________________
+|
+| Function: Compare_Doubles
+|
+| Input: Called from Run_Step()
+| Output: qsort() comparison, ascending.
+|___________________________________________________________________*/
+
+static int Compare_Doubles(const void* d1, const void* d2)
+{
+	double a = *(double*)d1, b = *(double*)d2;
+
+	return (a < b ? -1 : a > b ? 1 : 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Find_Knee
+|
+| Input: Called from Write_JSON(), Report()
+| Output: Returns the index in results of the first step of a sweep
+|   whose 95th percentile frame time is over the frame budget or whose
+|   frame time grew faster than linearly, else -1.
+|___________________________________________________________________*/
+
+static int Find_Knee(int sweep)
+{
+	int i;
+
+	for (i = 0; i < num_results; i++)
+		if (results[i].sweep == sweep && (results[i].frame_p95 > STRESS_FRAME_BUDGET || results[i].exponent > STRESS_KNEE_EXPONENT))
+			return (i);
+
+	return (-1);
+}
+
+/*____________________________________________________________________
+|
+| Function: Write_CSV
+|
+| Input: Called from Stress_Run()
+| Output: Writes a row per step.  Returns true on success.
+|___________________________________________________________________*/
+
+static int Write_CSV(char* filename, Sweep* sweeps)
+{
+	int i;
+	Step* r;
+	FILE* fp;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL)
+		return (FALSE);
+
+	fprintf(fp, "sweep,trees,slenders,range,entities,spawn_ms,frames,frame_ms,frame_p95_ms,frame_max_ms,");
+	fprintf(fp, "simulate_ms,cull_ms,draw_ms,present_ms,draws,dropped,world_mb,peak_mb,exponent\n");
+	for (i = 0; i < num_results; i++) {
+		r = &results[i];
+		fprintf(fp, "%s,%d,%d,%d,%u,%.3f,%d,%.4f,%.4f,%.4f,", sweeps[r->sweep].name, r->trees, r->slenders, r->range, r->entities,
+			r->spawn_time, r->frames, r->frame_mean, r->frame_p95, r->frame_max);
+		fprintf(fp, "%.4f,%.4f,%.4f,%.4f,%.1f,%u,%.2f,%.2f,%.3f\n", r->simulate, r->cull, r->draw, r->present, r->draws, r->dropped,
+			r->world_mb, r->peak_mb, r->exponent);
+	}
+
+	return (fclose(fp) == 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Write_JSON
+|
+| Input: Called from Stress_Run()
+| Output: Writes the steps of each sweep and its knee as JSON.  Returns
+|   true on success.
+|___________________________________________________________________*/
+
+static int Write_JSON(char* filename, Sweep* sweeps, int num_sweeps, double seconds)
+{
+	int i, s, first, knee;
+	Step* r;
+	FILE* fp;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL)
+		return (FALSE);
+
+	fprintf(fp, "{\n  \"seconds\": %.1f,\n  \"frame_budget\": %.4f,\n  \"sweeps\": [\n", seconds, STRESS_FRAME_BUDGET);
+	for (s = 0; s < num_sweeps; s++) {
+		knee = Find_Knee(s);
+		fprintf(fp, "    {\n      \"name\": \"%s\",\n      \"knee\": ", sweeps[s].name);
+		if (knee >= 0)
+			fprintf(fp, "{ \"trees\": %d, \"slenders\": %d, \"range\": %d }", results[knee].trees, results[knee].slenders, results[knee].range);
+		else
+			fprintf(fp, "null");
+		fprintf(fp, ",\n      \"steps\": [\n");
+		for (i = 0, first = TRUE; i < num_results; i++) {
+			r = &results[i];
+			if (r->sweep != s)
+				continue;
+			fprintf(fp, "%s        { \"trees\": %d, \"slenders\": %d, \"range\": %d, \"entities\": %u, \"spawn_ms\": %.3f, \"frames\": %d, ",
+				first ? "" : ",\n", r->trees, r->slenders, r->range, r->entities, r->spawn_time, r->frames);
+			fprintf(fp, "\"frame_ms\": %.4f, \"frame_p95_ms\": %.4f, \"frame_max_ms\": %.4f, ", r->frame_mean, r->frame_p95, r->frame_max);
+			fprintf(fp, "\"phases_ms\": { \"simulate\": %.4f, \"cull\": %.4f, \"draw\": %.4f, \"present\": %.4f }, ", r->simulate, r->cull, r->draw, r->present);
+			fprintf(fp, "\"draws\": %.1f, \"dropped\": %u, \"world_mb\": %.2f, \"peak_mb\": %.2f, \"exponent\": %.3f }",
+				r->draws, r->dropped, r->world_mb, r->peak_mb, r->exponent);
+			first = FALSE;
+		}
+		fprintf(fp, "\n      ]\n    }%s\n", s < num_sweeps - 1 ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+
+	return (fclose(fp) == 0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Report
+|
+| Input: Called from Stress_Run()
+| Output: Writes a summary of each sweep and its knee to the debug
+|   file.
+|___________________________________________________________________*/
+
+static void Report(char* results_name, Sweep* sweeps, int num_sweeps)
+{
+	int i, s, knee;
+	char str[256];
+	Step* r;
+
+	debug_WriteFile("_______________ Stress Test ______________");
+	for (s = 0; s < num_sweeps; s++) {
+		sprintf(str, "%s sweep: trees, Slenders, range -> frame ms (p95), simulate/cull/draw/present ms, MB", sweeps[s].name);
+		debug_WriteFile(str);
+		for (i = 0; i < num_results; i++) {
+			r = &results[i];
+			if (r->sweep != s)
+				continue;
+			sprintf(str, "  %7d %5d %5d -> %8.2f (%8.2f), %.2f/%.2f/%.2f/%.2f, %.1f", r->trees, r->slenders, r->range, r->frame_mean, r->frame_p95,
+				r->simulate, r->cull, r->draw, r->present, r->world_mb);
+			debug_WriteFile(str);
+		}
+		knee = Find_Knee(s);
+		if (knee >= 0)
+			sprintf(str, "  knee: %d trees, %d Slenders, range %d (%.2f ms p95, exponent %.2f)", results[knee].trees, results[knee].slenders,
+				results[knee].range, results[knee].frame_p95, results[knee].exponent);
+		else
+			sprintf(str, "  knee: none, within the frame budget throughout");
+		debug_WriteFile(str);
+	}
+	sprintf(str, "pages picked: %u, report: %s.csv and %s.json", hits, results_name, results_name);
+	debug_WriteFile(str);
+	debug_WriteFile("__________________________________________");
+}
@@ -0,0 +1,19 @@
+/*____________________________________________________________________
+|
+| File: stress.h
+|
+| Description: Stress test - sweeps the size of the forest and reports
+|   how the frame time scales.
+|___________________________________________________________________*/
+
+#ifndef _STRESS_H_
+#define _STRESS_H_
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int Stress_Run (char *options);
+
+#endif
@@ -0,0 +1,883 @@
+/*____________________________________________________________________
+|
+| File: terrain.cpp
+|
+| Description: Heightmap terrain drawn as a quadtree of chunks with
+|   distance based level of detail.
+|
+|   The heightfield is generated from fractal value noise.  Every node
+|   of the quadtree is a chunk of TERRAIN_CHUNK_QUADS x
+|   TERRAIN_CHUNK_QUADS quads: the root spans the whole map with the
+|   widest sample spacing and each level halves the spacing, down to
+|   leaves at full resolution.  Terrain_Update() walks the tree from
+|   the root, splitting a node when the camera is within
+|   TERRAIN_LOD_RANGE times its size, so the # of chunks drawn depends
+|   on the LOD ranges rather than the size of the map.
+|
+|   Chunk meshes are built on worker threads and uploaded a few per
+|   frame on the main thread, since the toolkit creates Direct3D
+|   resources.  A node is only split once all 4 children have meshes;
+|   until then the node itself is drawn, so there are never holes.  The
+|   root is built up front and always resident.  Chunks unused for
+|   TERRAIN_EVICT_FRAMES frames are freed.
+|
+|   Neighbouring chunks at different levels don't share edge vertices.
+|   Each chunk has a skirt hanging from its edges to below its lowest
+|   point, which covers any gap between its edge and a coarser or finer
+|   neighbour's.
+|
+|   Every chunk has the same triangles, so their index order is built
+|   once and put in vertex cache order.
+|
+|   Chunks have a second set of texture coordinates for the lightmap,
+|   spanning the area given to Terrain_Set_Lightmap_Area().
+|
+|   Terrain_Init_Heights() generates only the heightfield, for
+|   Terrain_Get_Height() without graphics (the server).
+|
+| Functions:  Terrain_Set_Lightmap_Area
+|             Terrain_Init
+|             Terrain_Init_Heights
+|							 Generate_Heights
+|							 Noise
+|							 Hash
+|							 Init_Node
+|							 Build_Indices
+|             Terrain_Free
+|             Terrain_Get_Height
+|             Terrain_Update
+|							 Select_Node
+|							 Request_Node
+|							 Upload_Node
+|							 Build_Thread
+|							 Build_Mesh
+|							 Free_Mesh
+|             Terrain_Queue
+|             Terrain_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "renderq.h"
+#include "meshopt.h"
+#include "terrain.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define TERRAIN_CHUNK_QUADS        16      // quads per chunk side, at every level
+#define TERRAIN_WORKERS            2
+#define TERRAIN_LOD_RANGE          1.0f    // split a node closer than this times its size
+#define TERRAIN_UPLOADS_PER_FRAME  4
+#define TERRAIN_EVICT_FRAMES       300
+#define TERRAIN_TEXTURE_REPEAT     8.0f    // world units per repeat of the ground texture
+#define TERRAIN_NOISE_WAVELENGTH   128.0f  // world units, of the first octave
+#define TERRAIN_NOISE_OCTAVES      5
+
+#define TERRAIN_CHUNK_TRIANGLES  (TERRAIN_CHUNK_QUADS * TERRAIN_CHUNK_QUADS * 2 + 4 * TERRAIN_CHUNK_QUADS * 2)
+
+// Node states
+#define CHUNK_EMPTY     0
+#define CHUNK_QUEUED    1  // waiting for or being built by a worker
+#define CHUNK_BUILT     2  // mesh waiting for upload
+#define CHUNK_RESIDENT  3
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	int          num_vertices;
+	gx3dVector*  vertex;
+	gx3dVector*  normal;
+	gx3dUV*      uv;
+	gx3dUV*      lightmap_uv;
+	int          num_polygons;
+	gx3dPolygon* polygon;
+} ChunkMesh;
+
+typedef struct {
+	int         x, z;         // first heightfield sample
+	int         step;         // samples between vertices
+	int         level;        // 0 = root
+	int         children;     // first of 4, -1 for leaves
+	float       min_y, max_y;
+	gx3dSphere  bounds;
+	int         state;        // guarded by lock
+	ChunkMesh*  mesh;         // built, waiting for upload
+	gx3dObject* object;
+	unsigned    last_used;    // frame the node was last visited
+} Node;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Generate_Heights(unsigned seed, float max_height);
+static float Noise(float x, float z, unsigned seed);
+static float Hash(int x, int z, unsigned seed);
+static void Init_Node(int n, int x, int z, int step, int level);
+static void Build_Indices();
+static int Select_Node(int n, gx3dVector* camera);
+static void Request_Node(int n);
+static void Upload_Node(int n);
+static DWORD WINAPI Build_Thread(LPVOID param);
+static ChunkMesh* Build_Mesh(Node* node);
+static void Free_Mesh(ChunkMesh* mesh);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static float*           heights;
+static int              samples;        // per side
+static float            spacing;        // world units between samples
+static float            half_size;
+static Node*            nodes;
+static int              num_nodes, next_node;
+static int*             selected;       // nodes to draw this frame
+static int              num_selected;
+static int*             jobs;           // ring of nodes to build
+static int              job_head, job_tail;
+static int*             built;          // nodes with a mesh to upload
+static int              num_built;
+static unsigned         frame;
+static CRITICAL_SECTION lock;           // guards node states, jobs, built and stats.builds
+static HANDLE           job_semaphore, stop_event;
+static HANDLE           workers[TERRAIN_WORKERS];
+static TerrainStats     stats;
+static gx3dPolygon      chunk_polygon[TERRAIN_CHUNK_TRIANGLES];  // shared by every chunk
+static float            lightmap_x, lightmap_z, lightmap_scale;  // lightmap uv = (x - lightmap_x) * lightmap_scale
+
+/*____________________________________________________________________
+|
+| Function: Terrain_Set_Lightmap_Area
+|
+| Input: Called from Program_Run() before Terrain_Init()
+| Output: Sets the area of the ground a lightmap covers, a size x size
+|   square from (min_x, min_z).
+|___________________________________________________________________*/
+
+void Terrain_Set_Lightmap_Area(float min_x, float min_z, float size)
+{
+	lightmap_x = min_x;
+	lightmap_z = min_z;
+	lightmap_scale = 1 / size;
+}
+
+/*____________________________________________________________________
+|
+| Function: Terrain_Init
+|
+| Input: Called from Program_Run()
+| Output: Generates a size x size terrain centered on the origin with
+|   resolution quads per side (a power of 2 multiple of
+|   TERRAIN_CHUNK_QUADS) and starts the chunk builders.  Returns true
+|   on success.
+|___________________________________________________________________*/
+
+int Terrain_Init(float size, int resolution, float max_height, unsigned seed)
+{
+	int i, leaves;
+
+	if (NOT Terrain_Init_Heights(size, resolution, max_height, seed))
+		return (FALSE);
+	leaves = resolution / TERRAIN_CHUNK_QUADS;
+	Build_Indices();
+
+	// Build the quadtree, a level per halving of the leaves per side
+	for (stats.levels = 1; (1 << (stats.levels - 1)) < leaves; stats.levels++)
+		;
+	num_nodes = ((1 << (2 * stats.levels)) - 1) / 3;
+	nodes = (Node*)calloc(num_nodes, sizeof(Node));
+	selected = (int*)malloc(num_nodes * sizeof(int));
+	jobs = (int*)malloc(num_nodes * sizeof(int));
+	built = (int*)malloc(num_nodes * sizeof(int));
+	if (nodes == NULL || selected == NULL || jobs == NULL || built == NULL) {
+		Terrain_Free();
+		return (FALSE);
+	}
+	next_node = 1;
+	Init_Node(0, 0, 0, leaves, 0);
+	stats.nodes = num_nodes;
+	num_selected = 0;
+	job_head = job_tail = 0;
+	num_built = 0;
+
+	// The root is always resident, so there is always something to draw
+	nodes[0].mesh = Build_Mesh(&nodes[0]);
+	if (nodes[0].mesh)
+		Upload_Node(0);
+
+	// Start the chunk builders
+	job_semaphore = CreateSemaphore(NULL, 0, num_nodes, NULL);
+	stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (nodes[0].object == NULL || job_semaphore == NULL || stop_event == NULL) {
+		Terrain_Free();
+		return (FALSE);
+	}
+	for (i = 0; i < TERRAIN_WORKERS; i++)
+		workers[i] = CreateThread(NULL, 0, Build_Thread, NULL, 0, NULL);
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Terrain_Init_Heights
+|
+| Input: Called from Terrain_Init(), Run_Server()
+| Output: Generates the heightfield of a terrain as Terrain_Init()
+|   does, without the chunks, so it needs no graphics.  Returns true
+|   on success.  Call Terrain_Free() when done.
+|___________________________________________________________________*/
+
+int Terrain_Init_Heights(float size, int resolution, float max_height, unsigned seed)
+{
+	int leaves;
+
+	memset(&stats, 0, sizeof(stats));
+	frame = 0;
+	InitializeCriticalSection(&lock);
+
+	leaves = resolution / TERRAIN_CHUNK_QUADS;
+	if (leaves < 1 || leaves * TERRAIN_CHUNK_QUADS != resolution || (leaves & (leaves - 1)))
+		return (FALSE);
+
+	samples = resolution + 1;
+	spacing = size / resolution;
+	half_size = size / 2;
+	heights = (float*)malloc(samples * samples * sizeof(float));
+	if (heights == NULL) {
+		Terrain_Free();
+		return (FALSE);
+	}
+	Generate_Heights(seed, max_height);
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Generate_Heights
+|
+| Input: Called from Terrain_Init_Heights()
+| Output: Fills the heightfield with fractal noise from 0 to max_height.
+|___________________________________________________________________*/
+
+static void Generate_Heights(unsigned seed, float max_height)
+{
+	int x, z, octave;
+	float h, amplitude, frequency, total;
+
+	for (z = 0; z < samples; z++)
+		for (x = 0; x < samples; x++) {
+			h = 0;
+			total = 0;
+			amplitude = 1;
+			frequency = spacing / TERRAIN_NOISE_WAVELENGTH;
+			for (octave = 0; octave < TERRAIN_NOISE_OCTAVES; octave++) {
+				h += Noise(x * frequency, z * frequency, seed + octave) * amplitude;
+				total += amplitude;
+				amplitude *= 0.5f;
+				frequency *= 2;
+			}
+			heights[z * samples + x] = h / total * max_height;
+		}
+}
+
+/*____________________________________________________________________
+|
+| Function: Noise
+|
+| Input: Called from Generate_Heights()
+| Output: Returns smoothly interpolated value noise from 0 to 1.
+|___________________________________________________________________*/
+
+static float Noise(float x, float z, unsigned seed)
+{
+	int ix, iz;
+	float fx, fz, a, b;
+
+	ix = (int)floorf(x);
+	iz = (int)floorf(z);
+	fx = x - ix;
+	fz = z - iz;
+	fx = fx * fx * (3 - 2 * fx);
+	fz = fz * fz * (3 - 2 * fz);
+
+	a = Hash(ix, iz, seed) + (Hash(ix + 1, iz, seed) - Hash(ix, iz, seed)) * fx;
+	b = Hash(ix, iz + 1, seed) + (Hash(ix + 1, iz + 1, seed) - Hash(ix, iz + 1, seed)) * fx;
+
+	return (a + (b - a) * fz);
+}
+
+/*____________________________________________________________________
+|
+| Function: Hash
+|
+| Input: Called from Noise()
+| Output: Returns a pseudo random value from 0 to 1 for a lattice point.
+|___________________________________________________________________*/
+
+static float Hash(int x, int z, unsigned seed)
+{
+	unsigned h;
+
+	h = (unsigned)x * 374761393u + (unsigned)z * 668265263u + seed * 2246822519u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	h ^= h >> 16;
+
+	return ((h & 0xFFFFFF) / 16777216.0f);
+}
+
+/*____________________________________________________________________
+|
+| Function: Init_Node
+|
+| Input: Called from Terrain_Init(), Init_Node()
+| Output: Sets up node n and its subtree, with the height range and
+|   bounds of each node.
+|___________________________________________________________________*/
+
+static void Init_Node(int n, int x, int z, int step, int level)
+{
+	int c, i, j, size;
+	float h, extent, height;
+	Node* node = &nodes[n];
+
+	node->x = x;
+	node->z = z;
+	node->step = step;
+	node->level = level;
+	node->state = CHUNK_EMPTY;
+	size = TERRAIN_CHUNK_QUADS * step;
+
+	if (step > 1) {
+		node->children = next_node;
+		next_node += 4;
+		node->min_y = 1e30f;
+		node->max_y = -1e30f;
+		for (c = 0; c < 4; c++) {
+			Init_Node(node->children + c, x + (c & 1) * size / 2, z + (c >> 1) * size / 2, step / 2, level + 1);
+			node->min_y = fminf(node->min_y, nodes[node->children + c].min_y);
+			node->max_y = fmaxf(node->max_y, nodes[node->children + c].max_y);
+		}
+	}
+	else {
+		node->children = -1;
+		node->min_y = node->max_y = heights[z * samples + x];
+		for (j = 0; j <= size; j++)
+			for (i = 0; i <= size; i++) {
+				h = heights[(z + j) * samples + x + i];
+				node->min_y = fminf(node->min_y, h);
+				node->max_y = fmaxf(node->max_y, h);
+			}
+	}
+
+	extent = size * spacing / 2;
+	height = (node->max_y - node->min_y) / 2;
+	node->bounds.center.x = x * spacing - half_size + extent;
+	node->bounds.center.y = node->min_y + height;
+	node->bounds.center.z = z * spacing - half_size + extent;
+	node->bounds.radius = sqrtf(2 * extent * extent + height * height);
+}
+
+/*____________________________________________________________________
+|
+| Function: Build_Indices
+|
+| Input: Called from Terrain_Init()
+| Output: Builds the triangles every chunk shares (indices into the
+|   vertices made by Build_Mesh()) in vertex cache order.
+|___________________________________________________________________*/
+
+static void Build_Indices()
+{
+	// Skirt edges: first grid vertex, stride along the edge and winding so they face out
+	static const int edge_start[4][2] = { { 0, 0 }, { 0, TERRAIN_CHUNK_QUADS }, { 0, 0 }, { TERRAIN_CHUNK_QUADS, 0 } };
+	static const int edge_stride[4] = { 1, 1, TERRAIN_CHUNK_QUADS + 1, TERRAIN_CHUNK_QUADS + 1 };
+	static const bool edge_flip[4] = { false, true, true, false };  // south, north, west, east
+	const int q1 = TERRAIN_CHUNK_QUADS + 1;
+	int i, j, e, k, v, top, bottom;
+	gx3dPolygon* p;
+
+	// Grid triangles, clockwise seen from above
+	p = chunk_polygon;
+	for (j = 0; j < TERRAIN_CHUNK_QUADS; j++)
+		for (i = 0; i < TERRAIN_CHUNK_QUADS; i++) {
+			v = j * q1 + i;
+			p->index[0] = v;
+			p->index[1] = v + q1;
+			p->index[2] = v + 1;
+			p++;
+			p->index[0] = v + q1;
+			p->index[1] = v + q1 + 1;
+			p->index[2] = v + 1;
+			p++;
+		}
+
+	// Skirt triangles, clockwise seen from outside the chunk
+	for (e = 0; e < 4; e++)
+		for (k = 0; k < TERRAIN_CHUNK_QUADS; k++) {
+			top = edge_start[e][1] * q1 + edge_start[e][0] + k * edge_stride[e];
+			bottom = q1 * q1 + e * q1 + k;
+			p->index[0] = top;
+			p->index[1] = edge_flip[e] ? bottom : top + edge_stride[e];
+			p->index[2] = edge_flip[e] ? top + edge_stride[e] : bottom;
+			p++;
+			p->index[0] = bottom;
+			p->index[1] = edge_flip[e] ? bottom + 1 : top + edge_stride[e];
+			p->index[2] = edge_flip[e] ? top + edge_stride[e] : bottom + 1;
+			p++;
+		}
+
+	stats.acmr_unoptimized = MeshOpt_ACMR(chunk_polygon, TERRAIN_CHUNK_TRIANGLES, q1 * q1 + 4 * q1);
+	MeshOpt_Optimize_Vertex_Cache(chunk_polygon, TERRAIN_CHUNK_TRIANGLES, q1 * q1 + 4 * q1);
+	stats.acmr = MeshOpt_ACMR(chunk_polygon, TERRAIN_CHUNK_TRIANGLES, q1 * q1 + 4 * q1);
+}
+
+/*____________________________________________________________________
+|
+| Function: Terrain_Free
+|
+| Input: Called from Program_Run()
+| Output: Stops the chunk builders and frees the terrain.
+|___________________________________________________________________*/
+
+void Terrain_Free()
+{
+	int i;
+
+	if (stop_event) {
+		SetEvent(stop_event);
+		for (i = 0; i < TERRAIN_WORKERS; i++)
+			if (workers[i]) {
+				WaitForSingleObject(workers[i], INFINITE);
+				CloseHandle(workers[i]);
+				workers[i] = NULL;
+			}
+		CloseHandle(stop_event);
+		stop_event = NULL;
+	}
+	if (job_semaphore) {
+		CloseHandle(job_semaphore);
+		job_semaphore = NULL;
+	}
+
+	if (nodes) {
+		for (i = 0; i < num_nodes; i++) {
+			if (nodes[i].object)
+				gx3d_FreeObject(nodes[i].object);
+			if (nodes[i].mesh)
+				Free_Mesh(nodes[i].mesh);
+		}
+		free(nodes);
+		nodes = NULL;
+	}
+	free(selected);
+	free(jobs);
+	free(built);
+	free(heights);
+	selected = jobs = built = NULL;
+	heights = NULL;
+	num_nodes = 0;
+	num_selected = 0;
+	DeleteCriticalSection(&lock);
+}
+
+/*____________________________________________________________________
+|
+| Function: Terrain_Get_Height
+|
+| Input: Called from Program_Run(), Spawn_World()
+| Output: Returns the height of the terrain at x,z, interpolated between
+|   samples.  Points off the map get the height of the nearest edge.
+|___________________________________________________________________*/
+
+float Terrain_Get_Height(float x, float z)
+{
+	int ix, iz;
+	float fx, fz, a, b;
+	float* h;
+
+	if (heights == NULL)
+		return (0);
+
+	fx = (x + half_size) / spacing;
+	fz = (z + half_size) / spacing;
+	fx = fminf(fmaxf(fx, 0), (float)(samples - 1));
+	fz = fminf(fmaxf(fz, 0), (float)(samples - 1));
+	ix = (int)fx < samples - 2 ? (int)fx : samples - 2;
+	iz = (int)fz < samples - 2 ? (int)fz : samples - 2;
+	fx -= ix;
+	fz -= iz;
+
+	h = &heights[iz * samples + ix];
+	a = h[0] + (h[1] - h[0]) * fx;
+	b = h[samples] + (h[samples + 1] - h[samples]) * fx;
+
+	return (a + (b - a) * fz);
+}
+
+/*____________________________________________________________________
+|
+| Function: Terrain_Update
+|
+| Input: Called from Program_Run()
+| Output: Uploads chunks the workers have built, selects the chunks to
+|   draw for the camera position and evicts chunks no longer used.
+|___________________________________________________________________*/
+
+void Terrain_Update(gx3dVector* camera)
+{
+	int i, n, num_uploads;
+	int uploads[TERRAIN_UPLOADS_PER_FRAME];
+
+	if (nodes == NULL)
+		return;
+	frame++;
+
+	// Upload a few built chunks
+	EnterCriticalSection(&lock);
+	for (num_uploads = 0; num_uploads < TERRAIN_UPLOADS_PER_FRAME && num_built > 0; num_uploads++)
+		uploads[num_uploads] = built[--num_built];
+	LeaveCriticalSection(&lock);
+	for (i = 0; i < num_uploads; i++)
+		Upload_Node(uploads[i]);
+
+	// Select the chunks to draw
+	num_selected = 0;
+	Select_Node(0, camera);
+
+	// Free chunks that haven't been needed for a while
+	for (n = 1; n < num_nodes; n++)
+		if (nodes[n].object && frame - nodes[n].last_used > TERRAIN_EVICT_FRAMES) {
+			gx3d_FreeObject(nodes[n].object);
+			nodes[n].object = NULL;
+			EnterCriticalSection(&lock);
+			nodes[n].state = CHUNK_EMPTY;
+			LeaveCriticalSection(&lock);
+			stats.resident--;
+			stats.evictions++;
+		}
+}
+
+/*____________________________________________________________________
+|
+| Function: Select_Node
+|
+| Input: Called from Terrain_Update(), Select_Node()
+| Output: Adds the chunks covering node n to the selection, refining
+|   where the camera is close enough and the children are resident.
+|   Requests missing chunks.  Returns true if node n is covered.
+|___________________________________________________________________*/
+
+static int Select_Node(int n, gx3dVector* camera)
+{
+	int c, mark, covered;
+	float distance;
+	gx3dVector v;
+	Node* node = &nodes[n];
+
+	node->last_used = frame;
+	if (node->object == NULL) {
+		Request_Node(n);
+		return (FALSE);
+	}
+
+	if (node->children >= 0) {
+		gx3d_SubtractVector(&node->bounds.center, camera, &v);
+		distance = gx3d_VectorMagnitude(&v) - node->bounds.radius;
+		if (distance < TERRAIN_CHUNK_QUADS * node->step * spacing * TERRAIN_LOD_RANGE) {
+			// Use the children if they can cover the whole node, otherwise this node
+			mark = num_selected;
+			covered = TRUE;
+			for (c = 0; c < 4; c++)
+				if (NOT Select_Node(node->children + c, camera))
+					covered = FALSE;
+			if (covered)
+				return (TRUE);
+			num_selected = mark;
+		}
+	}
+
+	selected[num_selected++] = n;
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: Request_Node
+|
+| Input: Called from Select_Node()
+| Output: Queues a node's mesh to be built, if it isn't already.
+|___________________________________________________________________*/
+
+static void Request_Node(int n)
+{
+	bool queued = false;
+
+	EnterCriticalSection(&lock);
+	if (nodes[n].state == CHUNK_EMPTY) {
+		nodes[n].state = CHUNK_QUEUED;
+		jobs[job_tail] = n;
+		job_tail = (job_tail + 1) % num_nodes;
+		queued = true;
+	}
+	LeaveCriticalSection(&lock);
+
+	if (queued)
+		ReleaseSemaphore(job_semaphore, 1, NULL);
+}
+
+/*____________________________________________________________________
+|
+| Function: Upload_Node
+|
+| Input: Called from Terrain_Init(), Terrain_Update()
+| Output: Creates the object for a node's built mesh.  The object takes
+|   over the mesh arrays.
+|___________________________________________________________________*/
+
+static void Upload_Node(int n)
+{
+	float extent, skirt;
+	gx3dObject* object;
+	gx3dObjectLayer* layer;
+	Node* node = &nodes[n];
+	ChunkMesh* mesh = node->mesh;
+
+	node->mesh = NULL;
+	object = gx3d_CreateObject();
+	layer = object ? gx3d_CreateObjectLayer(object) : NULL;
+	if (layer == NULL) {
+		if (object)
+			gx3d_FreeObject(object);
+		Free_Mesh(mesh);
+		node->state = CHUNK_EMPTY;
+		return;
+	}
+
+	layer->num_vertices = mesh->num_vertices;
+	layer->vertex = mesh->vertex;
+	layer->vertex_normal = mesh->normal;
+	layer->num_tex_coords = 2;
+	layer->tex_coords[0] = mesh->uv;
+	layer->tex_coords[1] = mesh->lightmap_uv;
+	layer->num_polygons = mesh->num_polygons;
+	layer->polygon = mesh->polygon;
+	free(mesh);
+
+	extent = TERRAIN_CHUNK_QUADS * node->step * spacing / 2;
+	skirt = node->step * spacing;
+	object->bound_sphere = node->bounds;
+	object->bound_box.min.x = node->bounds.center.x - extent;
+	object->bound_box.min.y = node->min_y - skirt;
+	object->bound_box.min.z = node->bounds.center.z - extent;
+	object->bound_box.max.x = node->bounds.center.x + extent;
+	object->bound_box.max.y = node->max_y;
+	object->bound_box.max.z = node->bounds.center.z + extent;
+
+	node->object = object;
+	node->state = CHUNK_RESIDENT;
+	stats.resident++;
+	stats.uploads++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Build_Thread
+|
+| Input: Called from Terrain_Init() (thread start)
+| Output: Builds queued chunk meshes until the terrain is freed.
+|___________________________________________________________________*/
+
+static DWORD WINAPI Build_Thread(LPVOID param)
+{
+	int n;
+	ChunkMesh* mesh;
+	HANDLE events[2] = { stop_event, job_semaphore };
+
+	while (WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1) {
+		EnterCriticalSection(&lock);
+		n = jobs[job_head];
+		job_head = (job_head + 1) % num_nodes;
+		LeaveCriticalSection(&lock);
+
+		// Only reads the heightfield and the node's fixed fields
+		mesh = Build_Mesh(&nodes[n]);
+
+		EnterCriticalSection(&lock);
+		if (mesh) {
+			nodes[n].mesh = mesh;
+			nodes[n].state = CHUNK_BUILT;
+			built[num_built++] = n;
+			stats.builds++;
+		}
+		else
+			nodes[n].state = CHUNK_EMPTY;
+		LeaveCriticalSection(&lock);
+	}
+
+	return (0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Build_Mesh
+|
+| Input: Called from Terrain_Init(), Build_Thread()
+| Output: Returns the mesh for a node in world coordinates: a grid of
+|   TERRAIN_CHUNK_QUADS quads per side and a skirt around its edges,
+|   with the triangles from Build_Indices().  Returns NULL if out of
+|   memory.
+|___________________________________________________________________*/
+
+static ChunkMesh* Build_Mesh(Node* node)
+{
+	// Skirt edges: first grid vertex and stride along the edge
+	static const int edge_start[4][2] = { { 0, 0 }, { 0, TERRAIN_CHUNK_QUADS }, { 0, 0 }, { TERRAIN_CHUNK_QUADS, 0 } };
+	static const int edge_stride[4] = { 1, 1, TERRAIN_CHUNK_QUADS + 1, TERRAIN_CHUNK_QUADS + 1 };
+	const int q1 = TERRAIN_CHUNK_QUADS + 1;
+	int i, j, e, k, v, sx, sz, xl, xr, zd, zu, top;
+	float skirt_y;
+	ChunkMesh* mesh;
+
+	mesh = (ChunkMesh*)malloc(sizeof(ChunkMesh));
+	if (mesh == NULL)
+		return (NULL);
+	mesh->num_vertices = q1 * q1 + 4 * q1;
+	mesh->num_polygons = TERRAIN_CHUNK_TRIANGLES;
+	mesh->vertex = (gx3dVector*)malloc(mesh->num_vertices * sizeof(gx3dVector));
+	mesh->normal = (gx3dVector*)malloc(mesh->num_vertices * sizeof(gx3dVector));
+	mesh->uv = (gx3dUV*)malloc(mesh->num_vertices * sizeof(gx3dUV));
+	mesh->lightmap_uv = (gx3dUV*)malloc(mesh->num_vertices * sizeof(gx3dUV));
+	mesh->polygon = (gx3dPolygon*)malloc(mesh->num_polygons * sizeof(gx3dPolygon));
+	if (mesh->vertex == NULL || mesh->normal == NULL || mesh->uv == NULL || mesh->lightmap_uv == NULL || mesh->polygon == NULL) {
+		Free_Mesh(mesh);
+		return (NULL);
+	}
+
+	// Grid vertices, with normals from the full resolution heightfield
+	for (j = v = 0; j < q1; j++)
+		for (i = 0; i < q1; i++, v++) {
+			sx = node->x + i * node->step;
+			sz = node->z + j * node->step;
+			mesh->vertex[v].x = sx * spacing - half_size;
+			mesh->vertex[v].y = heights[sz * samples + sx];
+			mesh->vertex[v].z = sz * spacing - half_size;
+			xl = sx > 0 ? sx - 1 : sx;
+			xr = sx < samples - 1 ? sx + 1 : sx;
+			zd = sz > 0 ? sz - 1 : sz;
+			zu = sz < samples - 1 ? sz + 1 : sz;
+			gx3dVector n = {
+				(heights[sz * samples + xl] - heights[sz * samples + xr]) / ((xr - xl) * spacing),
+				1,
+				(heights[zd * samples + sx] - heights[zu * samples + sx]) / ((zu - zd) * spacing)
+			};
+			gx3d_NormalizeVector(&n, &mesh->normal[v]);
+			mesh->uv[v].u = mesh->vertex[v].x / TERRAIN_TEXTURE_REPEAT;
+			mesh->uv[v].v = mesh->vertex[v].z / TERRAIN_TEXTURE_REPEAT;
+			mesh->lightmap_uv[v].u = (mesh->vertex[v].x - lightmap_x) * lightmap_scale;
+			mesh->lightmap_uv[v].v = (mesh->vertex[v].z - lightmap_z) * lightmap_scale;
+		}
+
+	// Skirt vertices, below the node's lowest point
+	skirt_y = node->min_y - node->step * spacing;
+	for (e = 0; e < 4; e++)
+		for (k = 0; k < q1; k++, v++) {
+			top = edge_start[e][1] * q1 + edge_start[e][0] + k * edge_stride[e];
+			mesh->vertex[v] = mesh->vertex[top];
+			mesh->vertex[v].y = skirt_y;
+			mesh->normal[v] = mesh->normal[top];
+			mesh->uv[v] = mesh->uv[top];
+			mesh->lightmap_uv[v] = mesh->lightmap_uv[top];
+		}
+
+	// Triangles, the same for every chunk
+	memcpy(mesh->polygon, chunk_polygon, sizeof(chunk_polygon));
+
+	return (mesh);
+}
+
+/*____________________________________________________________________
+|
+| Function: Free_Mesh
+|
+| Input: Called from Terrain_Free(), Upload_Node(), Build_Mesh()
+| Output: Frees a mesh that was never uploaded.
+|___________________________________________________________________*/
+
+static void Free_Mesh(ChunkMesh* mesh)
+{
+	free(mesh->vertex);
+	free(mesh->normal);
+	free(mesh->uv);
+	free(mesh->lightmap_uv);
+	free(mesh->polygon);
+	free(mesh);
+}
+
+/*____________________________________________________________________
+|
+| Function: Terrain_Queue
+|
+| Input: Called from Program_Run()
+| Output: Queues the selected chunks inside the view frustum as opaque
+|   draws with a texture, and a lightmap holding the static lights (or
+|   NULL to light them all at run time).
+|___________________________________________________________________*/
+
+void Terrain_Queue(gx3dTexture texture, gx3dTexture lightmap)
+{
+	static gx3dColor black = { 0, 0, 0, 0 };
+	int i;
+	gx3dMatrix m;
+	Node* node;
+
+	gx3d_GetTranslateMatrix(&m, 0, 0, 0);
+	stats.drawn = 0;
+	stats.culled = 0;
+	for (i = 0; i < num_selected; i++) {
+		node = &nodes[selected[i]];
+		if (gx3d_Relation_Sphere_Frustum(&node->bounds) == gxRELATION_OUTSIDE) {
+			stats.culled++;
+			continue;
+		}
+		if (lightmap)
+			RenderQ_Add_Baked(RENDERQ_LAYER_SCENE, RENDERQ_PASS_OPAQUE, node->object, &m, texture, lightmap, &node->bounds, &black);
+		else
+			RenderQ_Add(RENDERQ_LAYER_SCENE, RENDERQ_PASS_OPAQUE, node->object, &m, texture, &node->bounds, TRUE);
+		stats.drawn++;
+	}
+	stats.triangles = stats.drawn * TERRAIN_CHUNK_TRIANGLES;
+	if (stats.triangles > stats.max_triangles)
+		stats.max_triangles = stats.triangles;
+}
+
+/*____________________________________________________________________
+|
+| Function: Terrain_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns terrain statistics.  Call before Terrain_Free().
+|___________________________________________________________________*/
+
+void Terrain_Get_Stats(TerrainStats* out)
+{
+	EnterCriticalSection(&lock);
+	*out = stats;
+	LeaveCriticalSection(&lock);
+}
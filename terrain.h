@@ -0,0 +1,46 @@
+/*____________________________________________________________________
+|
+| File: terrain.h
+|
+| Description: Heightmap terrain drawn as a quadtree of chunks with
+|   distance based level of detail.
+|___________________________________________________________________*/
+
+#ifndef _TERRAIN_H_
+#define _TERRAIN_H_
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	unsigned nodes;          // chunks in the quadtree
+	unsigned levels;
+	unsigned resident;       // chunks with a mesh
+	unsigned builds;         // meshes built by the workers
+	unsigned uploads;
+	unsigned evictions;
+	unsigned drawn;          // chunks queued last frame
+	unsigned culled;         // chunks outside the frustum last frame
+	unsigned triangles;      // triangles drawn last frame
+	unsigned max_triangles;  // most triangles drawn in a frame
+	float    acmr;           // post-transform cache misses per triangle of a chunk
+	float    acmr_unoptimized;
+} TerrainStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+void  Terrain_Set_Lightmap_Area (float min_x, float min_z, float size);
+int   Terrain_Init (float size, int resolution, float max_height, unsigned seed);
+int   Terrain_Init_Heights (float size, int resolution, float max_height, unsigned seed);
+void  Terrain_Free ();
+float Terrain_Get_Height (float x, float z);
+void  Terrain_Update (gx3dVector *camera);
+void  Terrain_Queue (gx3dTexture texture, gx3dTexture lightmap);
+void  Terrain_Get_Stats (TerrainStats *stats);
+
+#endif
@@ -0,0 +1,565 @@
+/*____________________________________________________________________
+|
+| File: texmgr.cpp
+|
+| Description: Texture residency manager - keeps textures loaded on
+|   demand within a memory budget, evicting the least recently used.
+|
+|   Textures are registered by file and loaded when first used or
+|   prefetched.  A worker thread reads the files through (so the decode
+|   hits the file cache) and TexMgr_Update(), called at a frame
+|   boundary, creates up to TEXMGR_LOADS_PER_FRAME of them, the most
+|   recently wanted first.  Creation stays on the main thread since the
+|   toolkit creates Direct3D resources as it decodes.  Until a texture
+|   is loaded, TexMgr_Use() returns its low resolution stand in, if it
+|   was registered with one, else NULL.
+|
+|   Each use records the frame.  While the estimated memory of the
+|   loaded textures is over budget, TexMgr_Update() frees the least
+|   recently used full resolution texture not used in the last
+|   TEXMGR_KEEP_FRAMES frames.  A texture with a low resolution stand
+|   in (a smaller mip level shipped as its own file) drops back to it.
+|
+| Functions:  TexMgr_Init
+|             TexMgr_Free
+|             TexMgr_Add
+|             TexMgr_Use
+|             TexMgr_Prefetch
+|             TexMgr_Is_Resident
+|             TexMgr_Invalidate
+|             TexMgr_Update
+|							 Request_Texture
+|							 Load_Texture
+|							 Evict_Texture
+|							 Load_Thread
+|							 Read_File
+|							 Texture_Bytes
+|             TexMgr_Get_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "texmgr.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define TEXMGR_MAX_TEXTURES     64
+#define TEXMGR_LOADS_PER_FRAME  1
+#define TEXMGR_KEEP_FRAMES      2      // textures used this recently aren't evicted
+#define TEXMGR_READ_SIZE        65536
+
+// Texture states
+#define TEX_UNLOADED  0
+#define TEX_QUEUED    1  // waiting for the worker to read the files
+#define TEX_READ      2  // files read, waiting to be created
+#define TEX_RESIDENT  3
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef struct {
+	char        filename[MAX_PATH];
+	char        alpha_filename[MAX_PATH];  // empty if none
+	gx3dTexture texture;                   // full resolution, NULL unless resident
+	gx3dTexture low;                       // low resolution stand in, NULL if none
+	unsigned    bytes;                     // estimated memory of texture
+	unsigned    last_use;                  // frame
+	int         state;
+	bool        failed;                    // don't try to load again until invalidated
+} Texture;
+
+/*___________________
+|
+| Function Prototypes
+|__________________*/
+
+static void Request_Texture(TexId id);
+static void Load_Texture(TexId id);
+static void Evict_Texture(TexId id);
+static DWORD WINAPI Load_Thread(LPVOID param);
+static bool Read_File(const char* filename, unsigned* bytes);
+static unsigned Texture_Bytes(int width, int height);
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static Texture          textures[TEXMGR_MAX_TEXTURES];
+static int              num_textures;
+static unsigned         frame;
+static TexId            jobs[TEXMGR_MAX_TEXTURES];  // each texture is queued at most once
+static int              job_head, job_tail;
+static CRITICAL_SECTION lock;                       // guards states, bytes and jobs
+static HANDLE           job_semaphore, stop_event, worker;
+static TexMgrStats      stats;
+
+/*____________________________________________________________________
+|
+| Function: TexMgr_Init
+|
+| Input: Called from Program_Run()
+| Output: Starts the texture manager with a memory budget in bytes.
+|   Returns false if the worker can't be started, in which case the
+|   manager still works but reads files on the main thread.
+|___________________________________________________________________*/
+
+int TexMgr_Init(unsigned budget)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.budget = budget;
+	num_textures = 0;
+	frame = 0;
+	job_head = job_tail = 0;
+	InitializeCriticalSection(&lock);
+
+	// Without the worker, files are read on the main thread
+	job_semaphore = CreateSemaphore(NULL, 0, TEXMGR_MAX_TEXTURES, NULL);
+	stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (job_semaphore && stop_event)
+		worker = CreateThread(NULL, 0, Load_Thread, NULL, 0, NULL);
+	if (worker == NULL) {
+		if (job_semaphore)
+			CloseHandle(job_semaphore);
+		if (stop_event)
+			CloseHandle(stop_event);
+		job_semaphore = stop_event = NULL;
+		return (FALSE);
+	}
+
+	return (TRUE);
+}
+
+/*____________________________________________________________________
+|
+| Function: TexMgr_Free
+|
+| Input: Called from Program_Run()
+| Output: Stops the worker and frees all textures.
+|___________________________________________________________________*/
+
+void TexMgr_Free()
+{
+	int i;
+
+	if (stop_event) {
+		SetEvent(stop_event);
+		if (worker) {
+			WaitForSingleObject(worker, INFINITE);
+			CloseHandle(worker);
+			worker = NULL;
+		}
+		CloseHandle(stop_event);
+		stop_event = NULL;
+	}
+	if (job_semaphore) {
+		CloseHandle(job_semaphore);
+		job_semaphore = NULL;
+	}
+
+	for (i = 0; i < num_textures; i++) {
+		if (textures[i].texture)
+			gx3d_FreeTexture(textures[i].texture);
+		if (textures[i].low)
+			gx3d_FreeTexture(textures[i].low);
+	}
+	num_textures = 0;
+	stats.resident = 0;
+	stats.resident_bytes = 0;
+	DeleteCriticalSection(&lock);
+}
+
+/*____________________________________________________________________
+|
+| Function: TexMgr_Add
+|
+| Input: Called from Program_Run()
+| Output: Registers a texture file, with an optional alpha file and an
+|   optional low resolution stand in (and its alpha file), which is
+|   loaded now and kept.  The texture itself is loaded on demand.
+|   Returns its id, or TEXMGR_INVALID if there is no room.
+|___________________________________________________________________*/
+
+TexId TexMgr_Add(const char* filename, const char* alpha_filename, const char* low_filename, const char* low_alpha_filename)
+{
+	Texture* t;
+	unsigned bytes;
+
+	if (num_textures == TEXMGR_MAX_TEXTURES)
+		return (TEXMGR_INVALID);
+
+	t = &textures[num_textures];
+	memset(t, 0, sizeof(Texture));
+	strncpy(t->filename, filename, MAX_PATH - 1);
+	if (alpha_filename)
+		strncpy(t->alpha_filename, alpha_filename, MAX_PATH - 1);
+	t->state = TEX_UNLOADED;
+	if (low_filename) {
+		t->low = gx3d_InitTexture_File((char*)low_filename, (char*)low_alpha_filename, 0);
+		if (t->low && Read_File(low_filename, &bytes)) {
+			stats.resident_bytes += bytes;
+			if (stats.resident_bytes > stats.peak_bytes)
+				stats.peak_bytes = stats.resident_bytes;
+		}
+	}
+	stats.textures++;
+
+	return (num_textures++);
+}
+
+/*____________________________________________________________________
+|
+| Function: TexMgr_Use
+|
+| Input: Called from Program_Run()
+| Output: Returns a texture to draw with this frame: the full
+|   resolution texture if loaded, else its low resolution stand in (or
+|   NULL) while it loads.
+|___________________________________________________________________*/
+
+gx3dTexture TexMgr_Use(TexId id)
+{
+	Texture* t;
+
+	if (id < 0 || id >= num_textures)
+		return (NULL);
+	t = &textures[id];
+	t->last_use = frame;
+	if (t->state == TEX_RESIDENT)
+		return (t->texture);
+
+	Request_Texture(id);
+	stats.placeholder_uses++;
+
+	return (t->low);
+}
+
+/*____________________________________________________________________
+|
+| Function: TexMgr_Prefetch
+|
+| Input: Called from Program_Run()
+| Output: Counts as a use of a texture, loading it if needed, without
+|   drawing with it.
+|___________________________________________________________________*/
+
+void TexMgr_Prefetch(TexId id)
+{
+	if (id < 0 || id >= num_textures)
+		return;
+	textures[id].last_use = frame;
+	if (textures[id].state != TEX_RESIDENT)
+		Request_Texture(id);
+}
+
+/*____________________________________________________________________
+|
+| Function: TexMgr_Is_Resident
+|
+| Input: Called from Program_Run()
+| Output: Returns true if a texture's full resolution is loaded.
+|___________________________________________________________________*/
+
+int TexMgr_Is_Resident(TexId id)
+{
+	return (id >= 0 && id < num_textures && textures[id].state == TEX_RESIDENT);
+}
+
+/*____________________________________________________________________
+|
+| Function: TexMgr_Invalidate
+|
+| Input: Called from Reload_Asset()
+| Output: Frees a texture whose file has changed.  It is loaded again
+|   from the file when next used, right away if in recent use.
+|___________________________________________________________________*/
+
+void TexMgr_Invalidate(TexId id)
+{
+	Texture* t;
+
+	if (id < 0 || id >= num_textures)
+		return;
+	t = &textures[id];
+	if (t->state == TEX_RESIDENT) {
+		gx3d_FreeTexture(t->texture);
+		t->texture = NULL;
+		stats.resident--;
+		stats.resident_bytes -= t->bytes;
+		EnterCriticalSection(&lock);
+		t->state = TEX_UNLOADED;
+		LeaveCriticalSection(&lock);
+	}
+	t->failed = false;
+	if (t->last_use + TEXMGR_KEEP_FRAMES > frame)
+		Request_Texture(id);
+}
+
+/*____________________________________________________________________
+|
+| Function: TexMgr_Update
+|
+| Input: Called from Program_Run() at a frame boundary (outside of
+|   gx3d_BeginRender()/gx3d_EndRender())
+| Output: Starts a new frame: creates the textures whose files have
+|   been read and evicts the least recently used while over budget.
+|___________________________________________________________________*/
+
+void TexMgr_Update()
+{
+	int i, n, best;
+	unsigned oldest;
+
+	frame++;
+
+	// Create the most recently wanted textures that are ready
+	for (n = 0; n < TEXMGR_LOADS_PER_FRAME; n++) {
+		best = -1;
+		EnterCriticalSection(&lock);
+		for (i = 0; i < num_textures; i++)
+			if (textures[i].state == TEX_READ && (best < 0 || textures[i].last_use > textures[best].last_use))
+				best = i;
+		LeaveCriticalSection(&lock);
+		if (best < 0)
+			break;
+		Load_Texture(best);
+	}
+
+	// Stay in budget
+	while (stats.resident_bytes > stats.budget) {
+		best = -1;
+		oldest = frame;
+		for (i = 0; i < num_textures; i++)
+			if (textures[i].state == TEX_RESIDENT && textures[i].last_use + TEXMGR_KEEP_FRAMES <= frame && textures[i].last_use < oldest) {
+				best = i;
+				oldest = textures[i].last_use;
+			}
+		if (best < 0)
+			break;  // everything loaded is in use
+		Evict_Texture(best);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Request_Texture
+|
+| Input: Called from TexMgr_Use(), TexMgr_Prefetch(),
+|   TexMgr_Invalidate()
+| Output: Queues a texture's files to be read, if not already.
+|___________________________________________________________________*/
+
+static void Request_Texture(TexId id)
+{
+	bool queued = false;
+	unsigned bytes;
+
+	if (textures[id].failed)
+		return;
+	if (worker == NULL) {
+		if (textures[id].state == TEX_UNLOADED) {
+			if (Read_File(textures[id].filename, &bytes)) {
+				textures[id].bytes = bytes;
+				textures[id].state = TEX_READ;
+			}
+			else
+				textures[id].failed = true;
+		}
+		return;
+	}
+
+	EnterCriticalSection(&lock);
+	if (textures[id].state == TEX_UNLOADED) {
+		textures[id].state = TEX_QUEUED;
+		jobs[job_tail] = id;
+		job_tail = (job_tail + 1) % TEXMGR_MAX_TEXTURES;
+		queued = true;
+	}
+	LeaveCriticalSection(&lock);
+
+	if (queued)
+		ReleaseSemaphore(job_semaphore, 1, NULL);
+}
+
+/*____________________________________________________________________
+|
+| Function: Load_Texture
+|
+| Input: Called from TexMgr_Update()
+| Output: Creates a texture whose files have been read.
+|___________________________________________________________________*/
+
+static void Load_Texture(TexId id)
+{
+	Texture* t = &textures[id];
+	LARGE_INTEGER freq, t0, t1;
+	char str[MAX_PATH + 64];
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	t->texture = gx3d_InitTexture_File(t->filename, t->alpha_filename[0] ? t->alpha_filename : 0, 0);
+	QueryPerformanceCounter(&t1);
+	stats.last_load_time = (float)((t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart);
+
+	EnterCriticalSection(&lock);
+	if (t->texture) {
+		t->state = TEX_RESIDENT;
+		stats.loads++;
+		stats.resident++;
+		stats.resident_bytes += t->bytes;
+		if (stats.resident_bytes > stats.peak_bytes)
+			stats.peak_bytes = stats.resident_bytes;
+	}
+	else {
+		t->state = TEX_UNLOADED;
+		t->failed = true;
+		stats.failures++;
+	}
+	LeaveCriticalSection(&lock);
+
+	if (NOT t->texture) {
+		sprintf(str, "Can't load texture %s", t->filename);
+		debug_WriteFile(str);
+	}
+}
+
+/*____________________________________________________________________
+|
+| Function: Evict_Texture
+|
+| Input: Called from TexMgr_Update()
+| Output: Frees a texture's full resolution, leaving its stand in.
+|___________________________________________________________________*/
+
+static void Evict_Texture(TexId id)
+{
+	Texture* t = &textures[id];
+
+	gx3d_FreeTexture(t->texture);
+	t->texture = NULL;
+	EnterCriticalSection(&lock);
+	t->state = TEX_UNLOADED;
+	LeaveCriticalSection(&lock);
+
+	stats.resident--;
+	stats.resident_bytes -= t->bytes;
+	stats.evictions++;
+	if (t->low)
+		stats.mip_drops++;
+}
+
+/*____________________________________________________________________
+|
+| Function: Load_Thread
+|
+| Input: Called from TexMgr_Init() (thread start)
+| Output: Reads queued textures' files until the manager is freed.
+|___________________________________________________________________*/
+
+static DWORD WINAPI Load_Thread(LPVOID param)
+{
+	TexId id;
+	Texture* t;
+	unsigned bytes, alpha_bytes;
+	bool ok;
+	HANDLE events[2] = { stop_event, job_semaphore };
+
+	while (WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1) {
+		EnterCriticalSection(&lock);
+		id = jobs[job_head];
+		job_head = (job_head + 1) % TEXMGR_MAX_TEXTURES;
+		LeaveCriticalSection(&lock);
+
+		// Only reads the file names, which don't change
+		t = &textures[id];
+		ok = Read_File(t->filename, &bytes);
+		if (ok && t->alpha_filename[0])
+			ok = Read_File(t->alpha_filename, &alpha_bytes);
+
+		EnterCriticalSection(&lock);
+		if (ok) {
+			t->bytes = bytes;
+			t->state = TEX_READ;
+		}
+		else {
+			t->state = TEX_UNLOADED;
+			t->failed = true;
+			stats.failures++;
+		}
+		LeaveCriticalSection(&lock);
+	}
+
+	return (0);
+}
+
+/*____________________________________________________________________
+|
+| Function: Read_File
+|
+| Input: Called from TexMgr_Add(), Request_Texture(), Load_Thread()
+| Output: Reads a BMP file through and returns the estimated memory
+|   of a texture made from it.  Returns true on success.
+|___________________________________________________________________*/
+
+static bool Read_File(const char* filename, unsigned* bytes)
+{
+	char buffer[TEXMGR_READ_SIZE];
+	HANDLE file;
+	DWORD n;
+	bool ok;
+
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return (false);
+
+	// The header gives the size
+	ok = (ReadFile(file, buffer, sizeof(buffer), &n, NULL) && n >= 26 && buffer[0] == 'B' && buffer[1] == 'M');
+	if (ok) {
+		*bytes = Texture_Bytes(*(int*)(buffer + 18), abs(*(int*)(buffer + 22)));
+		while (ReadFile(file, buffer, sizeof(buffer), &n, NULL) && n)
+			;
+	}
+	CloseHandle(file);
+
+	return (ok);
+}
+
+/*____________________________________________________________________
+|
+| Function: Texture_Bytes
+|
+| Input: Called from Read_File()
+| Output: Returns the estimated memory of a 32-bit texture with a full
+|   mip chain.
+|___________________________________________________________________*/
+
+static unsigned Texture_Bytes(int width, int height)
+{
+	return ((unsigned)width * height * 4 * 4 / 3);
+}
+
+/*____________________________________________________________________
+|
+| Function: TexMgr_Get_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns texture manager statistics.
+|___________________________________________________________________*/
+
+void TexMgr_Get_Stats(TexMgrStats* out)
+{
+	EnterCriticalSection(&lock);
+	*out = stats;
+	LeaveCriticalSection(&lock);
+}
@@ -0,0 +1,55 @@
+/*____________________________________________________________________
+|
+| File: texmgr.h
+|
+| Description: Texture residency manager - keeps textures loaded on
+|   demand within a memory budget, evicting the least recently used.
+|___________________________________________________________________*/
+
+#ifndef _TEXMGR_H_
+#define _TEXMGR_H_
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define TEXMGR_INVALID  (-1)
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+typedef int TexId;
+
+typedef struct {
+	unsigned textures;          // # registered
+	unsigned resident;          // full resolution textures loaded now
+	unsigned resident_bytes;    // estimated, including low resolution stand ins
+	unsigned peak_bytes;
+	unsigned budget;
+	unsigned loads;
+	unsigned evictions;         // full resolution textures freed to stay in budget
+	unsigned mip_drops;         // evictions that left a low resolution stand in
+	unsigned placeholder_uses;  // uses while the full texture wasn't loaded
+	unsigned failures;
+	float    last_load_time;    // ms spent on the main thread by the last load
+} TexMgrStats;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+int         TexMgr_Init (unsigned budget);
+void        TexMgr_Free ();
+TexId       TexMgr_Add (const char *filename, const char *alpha_filename, const char *low_filename, const char *low_alpha_filename);
+gx3dTexture TexMgr_Use (TexId id);
+void        TexMgr_Prefetch (TexId id);
+int         TexMgr_Is_Resident (TexId id);
+void        TexMgr_Invalidate (TexId id);
+void        TexMgr_Update ();
+void        TexMgr_Get_Stats (TexMgrStats *stats);
+
+#endif
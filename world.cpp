@@ -0,0 +1,361 @@
+/*____________________________________________________________________
+|
+| File: world.cpp
+|
+| Description: The forest of a round and its rules, without any
+|   drawing, shared by the game and the multiplayer server.
+|
+|   A round spawns the trees, pages and Slenders as entities, with the
+|   trunk colliders and a scene BVH built from them.  The rules are
+|   the ones the game was written with: a page is picked up by a ray
+|   from the player's eye that reaches it within PICK_DISTANCE without
+|   a trunk in the way, WORLD_PAGES_TO_WIN pages win, and anyone
+|   Slender gets within SLENDER_CATCH_DISTANCE of is caught.  With
+|   several players, each Slender goes after the nearest one still in
+|   the game.
+|
+|   The Slenders are steered at a rate set by how far they are from
+|   the nearest player (see simlod.cpp), so only the ones close by
+|   cost anything every tick.
+|
+|   Nothing here draws or needs a model loaded, the caller gives the
+|   sizes of the models instead.  The number of trees and Slenders and
+|   the spread of the forest can be changed at run time, for stress
+|   testing.
+|
+| Functions:  World_Define_Components
+|             World_Set_Size
+|             World_Spawn
+|             World_Build
+|             World_Pick_Page
+|             World_Take_Page
+|             World_Steer_Slenders
+|             World_Get_Sim_Stats
+|___________________________________________________________________*/
+
+/*___________________
+|
+| Include Files
+|__________________*/
+
+#include <first_header.h>
+#include "dp.h"
+
+#include "collide.h"
+#include "terrain.h"
+#include "slender.h"
+#include "world.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+#define WORLD_MODEL_SCALE  6.0f   // the billboards and tree bounds are drawn this much larger than modeled
+
+/*___________________
+|
+| Global variables
+|__________________*/
+
+static int num_trees = NUM_TREES;
+static int num_slenders = NUM_SLENDER;
+static int spawn_range = WORLD_SPAWN_RANGE;
+static SimLodClock slender_clock;   // ticks once a step of the Slenders
+
+/*____________________________________________________________________
+|
+| Function: World_Define_Components
+|
+| Input: Called from Spawn_World(), Server_Init()
+| Output: Defines the world's components in the entity store.  Call
+|   after Ecs_Init() and before World_Spawn().
+|___________________________________________________________________*/
+
+void World_Define_Components()
+{
+	Ecs_Define_Component(COMP_POSITION, sizeof(gx3dVector));
+	Ecs_Define_Component(COMP_BOUNDS, sizeof(gx3dSphere));
+	Ecs_Define_Component(COMP_BVH_ENTRY, sizeof(BvhEntry));
+	Ecs_Define_Component(COMP_TREE, 0);
+	Ecs_Define_Component(COMP_PAGE, 0);
+	Ecs_Define_Component(COMP_SLENDER, 0);
+	Ecs_Define_Component(COMP_SIM_LOD, sizeof(SimLod));
+}
+
+/*____________________________________________________________________
+|
+| Function: World_Set_Size
+|
+| Input: Called from Stress_Run()
+| Output: Sets how many trees and Slenders World_Spawn() generates and
+|   how far from the origin (world units) it spreads them.  The range
+|   is limited to what rand() can reach.
+|___________________________________________________________________*/
+
+void World_Set_Size(int trees, int slenders, int range)
+{
+	num_trees = trees > 0 ? trees : 0;
+	num_slenders = slenders > 0 ? slenders : 0;
+	spawn_range = range < 1 ? 1 : range > RAND_MAX / 2 ? RAND_MAX / 2 : range;
+}
+
+/*____________________________________________________________________
+|
+| Function: World_Spawn
+|
+| Input: Called from Spawn_World(), Server_Init(), Server_Tick()
+| Output: Generates a round from seed into the entity store and level
+|   arena, with the caller's own components (zeroed) added to every
+|   tree and page: the entities, trunk colliders and scene BVH.  Stops
+|   short if the entity store runs out of memory.  Returns the scene
+|   BVH.
+|___________________________________________________________________*/
+
+Bvh World_Spawn(Arena level_arena, unsigned seed, WorldShapes* shapes, EcsMask tree_components, EcsMask page_components)
+{
+	srand(seed);
+	for (int i = 0; i < num_slenders; i++)
+	{
+		EcsEntity e = Ecs_Create_Entity(ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS) | ECS_MASK(COMP_BVH_ENTRY) | ECS_MASK(COMP_SLENDER) | ECS_MASK(COMP_SIM_LOD));
+		if (e == ECS_INVALID_ENTITY)
+			break;
+		gx3dVector* pos = (gx3dVector*)Ecs_Get_Component(e, COMP_POSITION);
+		pos->x = (rand() % (2 * spawn_range + 1)) - spawn_range;
+		pos->z = (rand() % (2 * spawn_range + 1)) - spawn_range;
+		if (pos->x == 0)
+			pos->x += 2;
+		else if (pos->z == 0)
+			pos->z += 2;
+		pos->y = Terrain_Get_Height(pos->x, pos->z);
+
+		gx3dSphere* bounds = (gx3dSphere*)Ecs_Get_Component(e, COMP_BOUNDS);
+		bounds->center = *pos;
+		bounds->radius = 6;
+	}
+	for (int i = 0; i < NUM_PAPER; i++)
+	{
+		EcsEntity e = Ecs_Create_Entity(ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS) | ECS_MASK(COMP_BVH_ENTRY) | ECS_MASK(COMP_PAGE) | page_components);
+		if (e == ECS_INVALID_ENTITY)
+			break;
+		gx3dVector* pos = (gx3dVector*)Ecs_Get_Component(e, COMP_POSITION);
+		pos->x = (rand() % (2 * spawn_range + 1)) - spawn_range;
+		pos->z = (rand() % (2 * spawn_range + 1)) - spawn_range;
+		if (pos->x == 0)
+			pos->x += 2;
+		else if (pos->z == 0)
+			pos->z += 2;
+		pos->y = Terrain_Get_Height(pos->x, pos->z) + 1;
+
+		gx3dSphere* bounds = (gx3dSphere*)Ecs_Get_Component(e, COMP_BOUNDS);
+		bounds->center = *pos;
+		bounds->radius = 1;
+	}
+	for (int i = 0; i < num_trees; i++) {
+		EcsEntity e = Ecs_Create_Entity(ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS) | ECS_MASK(COMP_TREE) | tree_components);
+		if (e == ECS_INVALID_ENTITY)
+			break;
+		gx3dVector* pos = (gx3dVector*)Ecs_Get_Component(e, COMP_POSITION);
+		pos->x = (rand() % (2 * spawn_range + 1)) - spawn_range;
+		pos->z = (rand() % (2 * spawn_range + 1)) - spawn_range;
+		if (pos->x == 0)
+			pos->x += 2;
+		else if (pos->z == 0)
+			pos->z += 2;
+		pos->y = Terrain_Get_Height(pos->x, pos->z);
+
+		gx3dSphere* bounds = (gx3dSphere*)Ecs_Get_Component(e, COMP_BOUNDS);
+		bounds->center = *pos;
+		bounds->radius = shapes->tree_radius * WORLD_MODEL_SCALE;
+	}
+
+	return (World_Build(level_arena, shapes));
+}
+
+/*____________________________________________________________________
+|
+| Function: World_Build
+|
+| Input: Called from Build_World(), World_Spawn()
+| Output: Builds the trunk colliders and scene BVH for the entities in
+|   the level arena and starts the Slenders' clock.  Returns the scene
+|   BVH.
+|___________________________________________________________________*/
+
+Bvh World_Build(Arena level_arena, WorldShapes* shapes)
+{
+	EcsQuery query;
+
+	// Build the trunk colliders
+	Collide_Init(level_arena);
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_TREE) | ECS_MASK(COMP_POSITION));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		for (int i = 0; i < query.count; i++)
+			Collide_Add_Capsule(&pos[i], shapes->tree_height, TREE_TRUNK_RADIUS);
+	}
+	Collide_Build();
+
+	// Build the scene BVH for raycasts (page picking, etc.), user value = entity
+	Bvh scene_bvh = Bvh_Create(level_arena);
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_TREE) | ECS_MASK(COMP_POSITION));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		for (int i = 0; i < query.count; i++)
+			Bvh_Add_Capsule(scene_bvh, &pos[i], shapes->tree_height, TREE_TRUNK_RADIUS, ENTITY_TREE, query.entities[i]);
+	}
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_PAGE) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BVH_ENTRY));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		BvhEntry* entry = ECS_COLUMN(&query, BvhEntry, COMP_BVH_ENTRY);
+		for (int i = 0; i < query.count; i++)
+			entry[i] = Bvh_Add_Sphere(scene_bvh, &pos[i], shapes->paper_radius * WORLD_MODEL_SCALE, ENTITY_PAPER, query.entities[i]);
+	}
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_SLENDER) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BVH_ENTRY));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		BvhEntry* entry = ECS_COLUMN(&query, BvhEntry, COMP_BVH_ENTRY);
+		for (int i = 0; i < query.count; i++)
+			entry[i] = Bvh_Add_Sphere(scene_bvh, &pos[i], shapes->slender_radius * WORLD_MODEL_SCALE, ENTITY_SLENDER, query.entities[i]);
+	}
+	Bvh_Build(scene_bvh);
+
+	// Spread the Slenders' steps over the ticks
+	SimLod_Init(&slender_clock);
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_SLENDER) | ECS_MASK(COMP_SIM_LOD));
+	while (Ecs_Query_Next(&query)) {
+		SimLod* lod = ECS_COLUMN(&query, SimLod, COMP_SIM_LOD);
+		for (int i = 0; i < query.count; i++)
+			SimLod_Add(&slender_clock, &lod[i]);
+	}
+
+	return (scene_bvh);
+}
+
+/*____________________________________________________________________
+|
+| Function: World_Pick_Page
+|
+| Input: Called from Program_Run(), Apply_Input()
+| Output: Casts a ray from position along heading, so trees in the way
+|   block the pickup.  Returns true if it reaches a page within
+|   PICK_DISTANCE, with the page's entity in hit->user.
+|___________________________________________________________________*/
+
+int World_Pick_Page(Bvh bvh, gx3dVector* position, gx3dVector* heading, BvhHit* hit)
+{
+	gx3dRay ray;
+
+	ray.origin = *position;
+	ray.direction = *heading;
+
+	return (Bvh_Raycast(bvh, &ray, PICK_DISTANCE, BVH_MASK(ENTITY_TREE) | BVH_MASK(ENTITY_PAPER), hit) && hit->type == ENTITY_PAPER);
+}
+
+/*____________________________________________________________________
+|
+| Function: World_Take_Page
+|
+| Input: Called from Program_Run(), Apply_Input()
+| Output: Removes the page picked by World_Pick_Page() from the game
+|   and counts it in num_pages, which stops at WORLD_PAGES_TO_WIN.
+|   Returns WORLD_PAGE_WON if that's enough to win, WORLD_PAGE_FIRST
+|   for the first page, else WORLD_PAGE_TAKEN.
+|___________________________________________________________________*/
+
+int World_Take_Page(Bvh bvh, BvhHit* hit, int* num_pages)
+{
+	Bvh_Enable_Entry(bvh, hit->entry, FALSE);
+	Ecs_Destroy_Entity(hit->user);
+
+	(*num_pages)++;
+	if (*num_pages >= WORLD_PAGES_TO_WIN) {
+		*num_pages = WORLD_PAGES_TO_WIN;
+		return (WORLD_PAGE_WON);
+	}
+	else if (*num_pages == 1)
+		return (WORLD_PAGE_FIRST);
+	else
+		return (WORLD_PAGE_TAKEN);
+}
+
+/*____________________________________________________________________
+|
+| Function: World_Steer_Slenders
+|
+| Input: Called from Program_Run(), Server_Tick()
+| Output: Moves each Slender a step towards the nearest player not yet
+|   caught and refits the scene BVH around them.  Slenders far from
+|   every player are only moved every few steps, by the steps they
+|   missed (see simlod.cpp).  Sets caught for each
+|   player now within SLENDER_CATCH_DISTANCE of one (players already
+|   caught are left alone).  Returns true if anyone was caught.
+|___________________________________________________________________*/
+
+int World_Steer_Slenders(Bvh bvh, gx3dVector* players, int num_players, int* caught)
+{
+	int i, j, nearest, any_caught = FALSE;
+	unsigned steps;
+	float dx, dz, d, nearest_d;
+	EcsQuery query;
+
+	SimLod_Tick(&slender_clock, 1);
+
+	Ecs_Query_Begin(&query, ECS_MASK(COMP_SLENDER) | ECS_MASK(COMP_POSITION) | ECS_MASK(COMP_BOUNDS) | ECS_MASK(COMP_BVH_ENTRY) | ECS_MASK(COMP_SIM_LOD));
+	while (Ecs_Query_Next(&query)) {
+		gx3dVector* pos = ECS_COLUMN(&query, gx3dVector, COMP_POSITION);
+		gx3dSphere* bounds = ECS_COLUMN(&query, gx3dSphere, COMP_BOUNDS);
+		BvhEntry* entry = ECS_COLUMN(&query, BvhEntry, COMP_BVH_ENTRY);
+		SimLod* lod = ECS_COLUMN(&query, SimLod, COMP_SIM_LOD);
+		for (i = 0; i < query.count; i++) {
+			if (NOT SimLod_Due(&slender_clock, &lod[i], SimLod_Tier(&pos[i], players, num_players), &steps))
+				continue;
+			nearest = -1;
+			nearest_d = 0;
+			for (j = 0; j < num_players; j++)
+				if (NOT caught[j]) {
+					dx = players[j].x - pos[i].x;
+					dz = players[j].z - pos[i].z;
+					d = dx * dx + dz * dz;
+					if (nearest == -1 || d < nearest_d) {
+						nearest = j;
+						nearest_d = d;
+					}
+				}
+			if (nearest == -1)
+				continue;
+			Slender_Steer(&pos[i], 1, &players[nearest], (float)steps);
+
+			// Close enough to catch anyone?
+			for (j = 0; j < num_players; j++)
+				if (NOT caught[j]) {
+					gx3dVector diff;
+					gx3d_SubtractVector(&players[j], &pos[i], &diff);
+					if (gx3d_VectorMagnitude(&diff) <= SLENDER_CATCH_DISTANCE) {
+						caught[j] = TRUE;
+						any_caught = TRUE;
+					}
+				}
+			bounds[i].center = pos[i];
+			Bvh_Move_Entry(bvh, entry[i], &pos[i]);
+		}
+	}
+	// Refit the BVH around everything that moved
+	Bvh_Refit(bvh);
+
+	return (any_caught);
+}
+
+/*____________________________________________________________________
+|
+| Function: World_Get_Sim_Stats
+|
+| Input: Called from Program_Run()
+| Output: Returns the Slenders' clock, with how many steps each tier
+|   was given and skipped.
+|___________________________________________________________________*/
+
+void World_Get_Sim_Stats(SimLodClock* clock)
+{
+	*clock = slender_clock;
+}
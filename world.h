@@ -0,0 +1,92 @@
+/*____________________________________________________________________
+|
+| File: world.h
+|
+| Description: The forest of a round and its rules, without any
+|   drawing, shared by the game and the multiplayer server.
+|___________________________________________________________________*/
+
+#ifndef _WORLD_H_
+#define _WORLD_H_
+
+#include "arena.h"
+#include "ecs.h"
+#include "bvh.h"
+#include "simlod.h"
+
+/*___________________
+|
+| Constants
+|__________________*/
+
+// Collision sizes (world units)
+#define PLAYER_RADIUS      1.0f
+#define TREE_TRUNK_RADIUS  0.5f
+
+// Entity types in the scene BVH
+#define ENTITY_TREE     0
+#define ENTITY_PAPER    1
+#define ENTITY_SLENDER  2
+
+// Entity components of the world (3, 7 and 9 up are free for the caller's own)
+#define COMP_POSITION   0  // gx3dVector
+#define COMP_BOUNDS     1  // gx3dSphere
+#define COMP_BVH_ENTRY  2  // BvhEntry
+#define COMP_TREE       4  // tags
+#define COMP_PAGE       5
+#define COMP_SLENDER    6
+#define COMP_SIM_LOD    8  // SimLod, Slenders only
+
+// # of entities spawned per round, by default (see World_Set_Size())
+#define NUM_TREES    100
+#define NUM_PAPER    8
+#define NUM_SLENDER  1
+
+// Entities spawn within this of the origin on x and z, by default
+#define WORLD_SPAWN_RANGE  75
+
+// Ground heightfield, centered on the origin
+#define TERRAIN_SIZE        1024.0f
+#define TERRAIN_RESOLUTION  512      // quads per side
+#define TERRAIN_MAX_HEIGHT  2.0f
+#define TERRAIN_SEED        1
+
+// Max distance (world units) at which a page can be picked up
+#define PICK_DISTANCE 2.5f
+
+// Pages a player has to pick up to win
+#define WORLD_PAGES_TO_WIN  5
+
+// World_Take_Page() results
+#define WORLD_PAGE_TAKEN  0
+#define WORLD_PAGE_FIRST  1  // the player's first page
+#define WORLD_PAGE_WON    2  // the player has enough pages to win
+
+/*___________________
+|
+| Type definitions
+|__________________*/
+
+// Sizes of the models, before the world scales them up
+typedef struct {
+	float tree_height;     // top of the trunk
+	float tree_radius;     // bounding sphere
+	float paper_radius;
+	float slender_radius;
+} WorldShapes;
+
+/*___________________
+|
+| Functions
+|__________________*/
+
+void World_Define_Components ();
+void World_Set_Size (int trees, int slenders, int range);
+Bvh  World_Spawn (Arena level_arena, unsigned seed, WorldShapes *shapes, EcsMask tree_components, EcsMask page_components);
+Bvh  World_Build (Arena level_arena, WorldShapes *shapes);
+int  World_Pick_Page (Bvh bvh, gx3dVector *position, gx3dVector *heading, BvhHit *hit);
+int  World_Take_Page (Bvh bvh, BvhHit *hit, int *num_pages);
+int  World_Steer_Slenders (Bvh bvh, gx3dVector *players, int num_players, int *caught);
+void World_Get_Sim_Stats (SimLodClock *clock);
+
+#endif